@@ -0,0 +1,266 @@
+/***********************************************************************************************//**
+ * \file   ad_parser.c
+ * \brief  Single-pass advertising data parser and service UUID target matching
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Own header */
+#include "ad_parser.h"
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int hexValue(char c);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int adParse(const uint8_t* data, uint8_t len, struct adInfo* info)
+{
+  uint16_t i = 0;
+
+  /* The list arrays are only valid up to their counts, so leave them alone: clearing the whole
+   * structure would cost more than parsing a typical payload. */
+  info->hasFlags = false;
+  info->hasTxPower = false;
+  info->nameComplete = false;
+  info->nameLen = 0;
+  info->name = NULL;
+  info->manufacturerLen = 0;
+  info->manufacturerData = NULL;
+  info->uuidListCount = 0;
+  info->serviceDataCount = 0;
+  info->malformed = false;
+
+  while (i < len) {
+    uint8_t adLen = data[i];
+    const uint8_t* field = data + i + 2;
+    uint8_t fieldLen;
+    uint8_t width = 0;
+
+    /* A zero length marks the end of the significant part. */
+    if (adLen == 0) {
+      break;
+    }
+    if (i + 1 + adLen > len) {
+      info->malformed = true;
+      return -1;
+    }
+    fieldLen = adLen - 1;
+
+    switch (data[i + 1]) {
+      case AD_TYPE_FLAGS:
+        if (fieldLen >= 1) {
+          info->hasFlags = true;
+          info->flags = field[0];
+        }
+        break;
+
+      case AD_TYPE_UUID16_MORE:
+      case AD_TYPE_UUID16_COMPLETE:
+        width = 2;
+        break;
+
+      case AD_TYPE_UUID32_MORE:
+      case AD_TYPE_UUID32_COMPLETE:
+        width = 4;
+        break;
+
+      case AD_TYPE_UUID128_MORE:
+      case AD_TYPE_UUID128_COMPLETE:
+        width = 16;
+        break;
+
+      case AD_TYPE_NAME_SHORT:
+      case AD_TYPE_NAME_COMPLETE:
+        info->name = field;
+        info->nameLen = fieldLen;
+        info->nameComplete = (data[i + 1] == AD_TYPE_NAME_COMPLETE);
+        break;
+
+      case AD_TYPE_TX_POWER:
+        if (fieldLen >= 1) {
+          info->hasTxPower = true;
+          info->txPower = (int8_t)field[0];
+        }
+        break;
+
+      case AD_TYPE_SERVICE_DATA16:
+      case AD_TYPE_SERVICE_DATA32:
+      case AD_TYPE_SERVICE_DATA128: {
+        uint8_t uuidLen = (data[i + 1] == AD_TYPE_SERVICE_DATA16) ? 2
+                          : (data[i + 1] == AD_TYPE_SERVICE_DATA32) ? 4 : 16;
+
+        if (fieldLen >= uuidLen && info->serviceDataCount < AD_MAX_SERVICE_DATA) {
+          struct adServiceData* sd = &info->serviceData[info->serviceDataCount++];
+
+          sd->uuid = field;
+          sd->uuidLen = uuidLen;
+          sd->data = field + uuidLen;
+          sd->len = fieldLen - uuidLen;
+        }
+        break;
+      }
+
+      case AD_TYPE_MANUFACTURER_DATA:
+        if (fieldLen >= 2) {
+          info->manufacturerData = field;
+          info->manufacturerLen = fieldLen;
+        }
+        break;
+
+      default:
+        break;
+    }
+
+    if (width != 0 && fieldLen >= width && info->uuidListCount < AD_MAX_UUID_LISTS) {
+      struct adUuidList* list = &info->uuidLists[info->uuidListCount++];
+
+      list->data = field;
+      list->count = fieldLen / width;
+      list->width = width;
+    }
+
+    //jump to next AD record
+    i += adLen + 1;
+  }
+  return 0;
+}
+
+void adTargetInit(struct adTargetSet* set)
+{
+  memset(set, 0, sizeof(*set));
+}
+
+int adTargetAdd(struct adTargetSet* set, const uint8_t* uuid, uint8_t len)
+{
+  switch (len) {
+    case 2:
+      if (set->count16 >= AD_MAX_TARGETS) {
+        return -1;
+      }
+      memcpy(&set->uuid16[set->count16++], uuid, 2);
+      return 0;
+
+    case 4:
+      if (set->count32 >= AD_MAX_TARGETS) {
+        return -1;
+      }
+      memcpy(&set->uuid32[set->count32++], uuid, 4);
+      return 0;
+
+    case 16:
+      if (set->count128 >= AD_MAX_TARGETS) {
+        return -1;
+      }
+      memcpy(set->uuid128[set->count128++], uuid, 16);
+      return 0;
+
+    default:
+      return -1;
+  }
+}
+
+uint8_t adTargetCount(const struct adTargetSet* set)
+{
+  return set->count16 + set->count32 + set->count128;
+}
+
+int adMatch(const struct adInfo* info, const struct adTargetSet* set)
+{
+  for (uint8_t l = 0; l < info->uuidListCount; l++) {
+    const struct adUuidList* list = &info->uuidLists[l];
+    const uint8_t* p = list->data;
+
+    /* Targets are stored in the same byte order as the payload, so a memcpy'd load of either
+     * side compares equal regardless of host endianness. */
+    for (uint8_t n = 0; n < list->count; n++, p += list->width) {
+      if (list->width == 2) {
+        uint16_t v;
+
+        memcpy(&v, p, 2);
+        for (uint8_t t = 0; t < set->count16; t++) {
+          if (v == set->uuid16[t]) {
+            return t;
+          }
+        }
+      } else if (list->width == 4) {
+        uint32_t v;
+
+        memcpy(&v, p, 4);
+        for (uint8_t t = 0; t < set->count32; t++) {
+          if (v == set->uuid32[t]) {
+            return set->count16 + t;
+          }
+        }
+      } else {
+        uint64_t v[2];
+
+        memcpy(v, p, 16);
+        for (uint8_t t = 0; t < set->count128; t++) {
+          if (v[0] == set->uuid128[t][0] && v[1] == set->uuid128[t][1]) {
+            return set->count16 + set->count32 + t;
+          }
+        }
+      }
+    }
+  }
+  return AD_NO_MATCH;
+}
+
+int adParseUuidString(const char* text, uint8_t* uuid, uint8_t* len)
+{
+  uint8_t bytes[16];
+  uint8_t count = 0;
+  int hi = -1;
+
+  for (; *text != '\0'; text++) {
+    int v;
+
+    if (*text == '-') {
+      continue;
+    }
+    v = hexValue(*text);
+    if (v < 0 || (hi < 0 && count >= sizeof(bytes))) {
+      return -1;
+    }
+    if (hi < 0) {
+      hi = v;
+    } else {
+      bytes[count++] = (uint8_t)((hi << 4) | v);
+      hi = -1;
+    }
+  }
+  if (hi >= 0 || (count != 2 && count != 4 && count != 16)) {
+    return -1;
+  }
+  /* The string is written most significant byte first. */
+  for (uint8_t i = 0; i < count; i++) {
+    uuid[i] = bytes[count - 1 - i];
+  }
+  *len = count;
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Value of a hexadecimal digit.
+ *  \param[in] c Character.
+ *  \return  0 to 15, -1 if c is not a hexadecimal digit.
+ **************************************************************************************************/
+static int hexValue(char c)
+{
+  if (!isxdigit((unsigned char)c)) {
+    return -1;
+  }
+  return isdigit((unsigned char)c) ? c - '0' : tolower((unsigned char)c) - 'a' + 10;
+}
@@ -0,0 +1,150 @@
+/***********************************************************************************************//**
+ * \file   ad_parser.h
+ * \brief  Single-pass advertising data parser and service UUID target matching
+ ***************************************************************************************************
+ * The parser walks the AD structures of a report once and records where every field of interest
+ * sits; nothing is copied. UUIDs stay in the little-endian over-the-air byte order throughout.
+ **************************************************************************************************/
+
+#ifndef AD_PARSER_H
+#define AD_PARSER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/* AD types, see the Generic Access Profile assigned numbers */
+#define AD_TYPE_FLAGS                 0x01
+#define AD_TYPE_UUID16_MORE           0x02
+#define AD_TYPE_UUID16_COMPLETE       0x03
+#define AD_TYPE_UUID32_MORE           0x04
+#define AD_TYPE_UUID32_COMPLETE       0x05
+#define AD_TYPE_UUID128_MORE          0x06
+#define AD_TYPE_UUID128_COMPLETE      0x07
+#define AD_TYPE_NAME_SHORT            0x08
+#define AD_TYPE_NAME_COMPLETE         0x09
+#define AD_TYPE_TX_POWER              0x0A
+#define AD_TYPE_SERVICE_DATA16        0x16
+#define AD_TYPE_SERVICE_DATA32        0x20
+#define AD_TYPE_SERVICE_DATA128       0x21
+#define AD_TYPE_MANUFACTURER_DATA     0xFF
+
+/** UUID list and service data structures remembered per report; further ones are ignored. */
+#define AD_MAX_UUID_LISTS             8
+#define AD_MAX_SERVICE_DATA           4
+
+/** Target UUIDs per width. */
+#define AD_MAX_TARGETS                8
+
+/** adMatch() result when no target UUID is advertised. */
+#define AD_NO_MATCH                   (-1)
+
+/** One UUID list AD structure: count UUIDs of width bytes each. */
+struct adUuidList {
+  const uint8_t* data;
+  uint8_t count;
+  uint8_t width;                /**< 2, 4 or 16 */
+};
+
+/** One service data AD structure. */
+struct adServiceData {
+  const uint8_t* uuid;
+  uint8_t uuidLen;              /**< 2, 4 or 16 */
+  const uint8_t* data;
+  uint8_t len;
+};
+
+/** Fields found in one advertising or scan response payload. Pointers refer to the payload. */
+struct adInfo {
+  bool hasFlags;
+  uint8_t flags;
+  bool hasTxPower;
+  int8_t txPower;
+  bool nameComplete;
+  uint8_t nameLen;              /**< 0 if no name */
+  const uint8_t* name;          /**< not zero terminated */
+  uint8_t manufacturerLen;      /**< 0 if none, otherwise includes the 2-byte company identifier */
+  const uint8_t* manufacturerData;
+  uint8_t uuidListCount;
+  struct adUuidList uuidLists[AD_MAX_UUID_LISTS];
+  uint8_t serviceDataCount;
+  struct adServiceData serviceData[AD_MAX_SERVICE_DATA];
+  bool malformed;               /**< a structure ran past the end of the payload */
+};
+
+/** Service UUIDs to look for, kept per width so that each compare is one or two word loads. */
+struct adTargetSet {
+  uint8_t count16;
+  uint8_t count32;
+  uint8_t count128;
+  uint16_t uuid16[AD_MAX_TARGETS];
+  uint32_t uuid32[AD_MAX_TARGETS];
+  uint64_t uuid128[AD_MAX_TARGETS][2];
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Parse an advertising or scan response payload in a single pass.
+ *  \param[in] data Payload.
+ *  \param[in] len Payload length.
+ *  \param[out] info Fields found.
+ *  \return  0 on success, -1 if the payload is malformed; fields before the fault are still set.
+ **************************************************************************************************/
+int adParse(const uint8_t* data, uint8_t len, struct adInfo* info);
+
+/***********************************************************************************************//**
+ *  \brief  Empty a target set.
+ *  \param[out] set Target set.
+ **************************************************************************************************/
+void adTargetInit(struct adTargetSet* set);
+
+/***********************************************************************************************//**
+ *  \brief  Add a target UUID.
+ *  \param[in,out] set Target set.
+ *  \param[in] uuid UUID in little-endian order.
+ *  \param[in] len 2, 4 or 16.
+ *  \return  0 on success, -1 if the width is invalid or the set is full.
+ **************************************************************************************************/
+int adTargetAdd(struct adTargetSet* set, const uint8_t* uuid, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Number of UUIDs in a target set.
+ *  \param[in] set Target set.
+ *  \return  Target count.
+ **************************************************************************************************/
+uint8_t adTargetCount(const struct adTargetSet* set);
+
+/***********************************************************************************************//**
+ *  \brief  Look for any target UUID in the service UUID lists of a parsed payload.
+ *  \param[in] info Parsed payload.
+ *  \param[in] set Target set.
+ *  \return  Index of the first matching target (16-bit, then 32-bit, then 128-bit targets),
+ *           AD_NO_MATCH if none.
+ **************************************************************************************************/
+int adMatch(const struct adInfo* info, const struct adTargetSet* set);
+
+/***********************************************************************************************//**
+ *  \brief  Convert a UUID string to little-endian bytes. Accepts "180d", "0000180d" or the
+ *          dashed 128-bit form "dfd6...-...".
+ *  \param[in] text UUID string, most significant byte first.
+ *  \param[out] uuid UUID bytes, 16 bytes of room.
+ *  \param[out] len Number of bytes written: 2, 4 or 16.
+ *  \return  0 on success, -1 if the string is not a UUID.
+ **************************************************************************************************/
+int adParseUuidString(const char* text, uint8_t* uuid, uint8_t* len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* AD_PARSER_H */
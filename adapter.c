@@ -0,0 +1,224 @@
+/***********************************************************************************************//**
+ * \file   adapter.c
+ * \brief  Several NCPs driven by one process, each adapter served by a thread of its own
+ ***************************************************************************************************
+ * Adapter threads are stopped through a pipe that every adapter loop watches and that is never
+ * read, so a single byte wakes all of them. A second pipe tells the starting thread when an
+ * adapter thread has returned.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "infrastructure.h"
+
+#include "event_loop.h"
+
+/* Own header */
+#include "adapter.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+static struct adapter adapters[ADAPTER_MAX];
+static uint8_t count = 0;
+
+/** Adapter threads that have not returned yet; only touched by the starting thread. */
+static uint8_t running = 0;
+
+static adapterRunFn runFn = NULL;
+static int stopPipe[2] = { -1, -1 };
+static int donePipe[2] = { -1, -1 };
+
+static pthread_mutex_t bglibLock = PTHREAD_MUTEX_INITIALIZER;
+
+static ADAPTER_LOCAL struct adapter* current = NULL;
+
+/** Events BGLIB queued during the adapter's blocking commands. */
+static ADAPTER_LOCAL struct gecko_cmd_packet queued[BGLIB_QUEUE_LEN];
+static ADAPTER_LOCAL uint32_t queuedRead = 0;
+static ADAPTER_LOCAL uint32_t queuedWrite = 0;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void* adapterThread(void* arg);
+static void onStop(int fd, short revents, void* ctx);
+static void onDone(int fd, short revents, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int adapterAdd(const char* port, uint32_t baudRate, uint32_t flowControl)
+{
+  struct adapter* adapter;
+
+  if (count == ADAPTER_MAX) {
+    return -1;
+  }
+  adapter = &adapters[count];
+  memset(adapter, 0, sizeof(*adapter));
+  adapter->index = count;
+  adapter->port = port;
+  adapter->baudRate = baudRate;
+  adapter->flowControl = flowControl;
+  count++;
+  return 0;
+}
+
+uint8_t adapterCount(void)
+{
+  return count;
+}
+
+struct adapter* adapterAt(uint8_t index)
+{
+  return &adapters[index];
+}
+
+struct adapter* adapterCurrent(void)
+{
+  return current;
+}
+
+int adapterStartAll(adapterRunFn run)
+{
+  sigset_t all, saved;
+  int ret = 0;
+
+  if (pipe(stopPipe) < 0 || pipe(donePipe) < 0 || evloopAddFd(donePipe[0], POLLIN, onDone, NULL) < 0) {
+    return -1;
+  }
+  runFn = run;
+  /* Signals are for the starting thread's loop, so start the adapters with all blocked. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &saved);
+  for (uint8_t i = 0; i < count && ret == 0; i++) {
+    if (pthread_create(&adapters[i].thread, NULL, adapterThread, &adapters[i]) != 0) {
+      ret = -1;
+      break;
+    }
+    adapters[i].started = true;
+    running++;
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  return ret;
+}
+
+void adapterStopAll(void)
+{
+  uint8_t byte = 0;
+
+  if (stopPipe[1] < 0) {
+    return;
+  }
+  if (write(stopPipe[1], &byte, 1) < 0) {
+    /* The threads would never return. */
+    return;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (adapters[i].started) {
+      pthread_join(adapters[i].thread, NULL);
+      adapters[i].started = false;
+    }
+  }
+  evloopRemoveFd(donePipe[0]);
+  close(stopPipe[0]);
+  close(stopPipe[1]);
+  close(donePipe[0]);
+  close(donePipe[1]);
+  stopPipe[0] = stopPipe[1] = -1;
+  donePipe[0] = donePipe[1] = -1;
+}
+
+void adapterBglibLock(void)
+{
+  pthread_mutex_lock(&bglibLock);
+}
+
+void adapterBglibUnlock(void)
+{
+  struct gecko_cmd_packet* evt;
+
+  /* Only the BGLIB queue is left behind; take it along before another adapter can add to it. */
+  while ((evt = gecko_peek_event()) != NULL) {
+    if (queuedWrite - queuedRead < BGLIB_QUEUE_LEN) {
+      queued[queuedWrite++ % BGLIB_QUEUE_LEN] = *evt;
+    }
+  }
+  pthread_mutex_unlock(&bglibLock);
+}
+
+struct gecko_cmd_packet* adapterPeekEvent(void)
+{
+  if (queuedRead == queuedWrite) {
+    return NULL;
+  }
+  return &queued[queuedRead++ % BGLIB_QUEUE_LEN];
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Adapter thread: an event loop of its own, stopped through the stop pipe.
+ *  \param[in] arg The adapter.
+ *  \return  NULL.
+ **************************************************************************************************/
+static void* adapterThread(void* arg)
+{
+  struct adapter* adapter = arg;
+  uint8_t index = adapter->index;
+
+  current = adapter;
+  if (evloopInit() < 0 || evloopAddFd(stopPipe[0], POLLIN, onStop, NULL) < 0) {
+    adapter->result = -1;
+  } else {
+    adapter->result = runFn(adapter);
+  }
+  if (write(donePipe[1], &index, 1) < 0) {
+    adapter->result = -1;
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Stop pipe readable: leave the adapter's event loop. The byte stays for the others.
+ *  \param[in] fd Read end of the stop pipe.
+ *  \param[in] revents Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStop(int fd, short revents, void* ctx)
+{
+  evloopRemoveFd(fd);
+  evloopStop();
+}
+
+/***********************************************************************************************//**
+ *  \brief  An adapter thread returned: stop the starting thread's loop after the last one.
+ *  \param[in] fd Read end of the done pipe.
+ *  \param[in] revents Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onDone(int fd, short revents, void* ctx)
+{
+  uint8_t index[ADAPTER_MAX];
+  ssize_t n = read(fd, index, sizeof(index));
+
+  if (n > 0) {
+    running -= MIN(running, (uint8_t)n);
+    if (running == 0) {
+      evloopStop();
+    }
+  }
+}
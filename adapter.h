@@ -0,0 +1,127 @@
+/***********************************************************************************************//**
+ * \file   adapter.h
+ * \brief  Several NCPs driven by one process, each adapter served by a thread of its own
+ ***************************************************************************************************
+ * An adapter is one NCP behind one serial port. Its thread runs an event loop of its own, and
+ * the state of the serial port, the BGAPI receive and command paths, the connections and the
+ * application lives in ADAPTER_LOCAL variables, so every thread works on its adapter's copy.
+ * What adapters share, the peer registry, the GATT cache, the metrics, the event log and the
+ * notification pipeline, is safe to use from any of them.
+ *
+ * BGLIB itself keeps one set of globals. Blocking BGLIB commands are made between
+ * adapterBglibLock() and adapterBglibUnlock(), and events BGLIB queued meanwhile are handed back
+ * to the adapter that made the command through adapterPeekEvent().
+ **************************************************************************************************/
+
+#ifndef ADAPTER_H
+#define ADAPTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Adapters driven at once. */
+#define ADAPTER_MAX                   4
+
+/** Storage class of per-adapter state: each adapter thread has its own copy. */
+#define ADAPTER_LOCAL                 __thread
+
+/** Connection identifier unique over all adapters: the NCP handle, the adapter in the top bits. */
+#define ADAPTER_LINK_ID(index, handle) ((uint8_t)(((index) << 5) | (handle)))
+
+/** An NCP and its serial port. */
+struct adapter {
+  uint8_t index;
+  const char* port;
+  uint32_t baudRate;
+  uint32_t flowControl;
+  pthread_t thread;
+  bool started;
+  uint8_t links;                /**< ready links at the last stress report */
+  int result;                   /**< return value of the adapter's run function */
+};
+
+/***********************************************************************************************//**
+ *  \brief  Body of an adapter thread, called with the thread's event loop initialised.
+ *  \param[in] adapter The adapter.
+ *  \return  0 on a clean stop, -1 on failure.
+ **************************************************************************************************/
+typedef int (*adapterRunFn)(struct adapter* adapter);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Add an adapter, before adapterStartAll().
+ *  \param[in] port Serial port of the NCP.
+ *  \param[in] baudRate Baud rate.
+ *  \param[in] flowControl 1 for RTS/CTS, 0 for none.
+ *  \return  0 on success, -1 if ADAPTER_MAX adapters are already added.
+ **************************************************************************************************/
+int adapterAdd(const char* port, uint32_t baudRate, uint32_t flowControl);
+
+/***********************************************************************************************//**
+ *  \brief  Number of adapters added.
+ *  \return  Adapter count.
+ **************************************************************************************************/
+uint8_t adapterCount(void);
+
+/***********************************************************************************************//**
+ *  \brief  Access an adapter.
+ *  \param[in] index 0 to adapterCount() - 1.
+ *  \return  The adapter.
+ **************************************************************************************************/
+struct adapter* adapterAt(uint8_t index);
+
+/***********************************************************************************************//**
+ *  \brief  The adapter served by the calling thread.
+ *  \return  The adapter, NULL outside adapter threads.
+ **************************************************************************************************/
+struct adapter* adapterCurrent(void);
+
+/***********************************************************************************************//**
+ *  \brief  Start a thread per adapter. The event loop of the calling thread is stopped once
+ *          every adapter thread has returned.
+ *  \param[in] run Body of the adapter threads.
+ *  \return  0 on success, -1 if a thread could not be started; those started keep running.
+ **************************************************************************************************/
+int adapterStartAll(adapterRunFn run);
+
+/***********************************************************************************************//**
+ *  \brief  Stop the event loop of every adapter thread and wait for them to return.
+ **************************************************************************************************/
+void adapterStopAll(void);
+
+/***********************************************************************************************//**
+ *  \brief  Take BGLIB for a blocking command.
+ **************************************************************************************************/
+void adapterBglibLock(void);
+
+/***********************************************************************************************//**
+ *  \brief  Release BGLIB, keeping the events it queued for the calling adapter.
+ **************************************************************************************************/
+void adapterBglibUnlock(void);
+
+/***********************************************************************************************//**
+ *  \brief  Next event BGLIB queued during a blocking command of the calling adapter.
+ *  \return  The event, valid until the next call; NULL if none is left.
+ **************************************************************************************************/
+struct gecko_cmd_packet* adapterPeekEvent(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* ADAPTER_H */
@@ -0,0 +1,781 @@
+/***********************************************************************************************//**
+ * \file   adv_db.c
+ * \brief  Advertiser database: every device heard while scanning, queried over a Unix socket
+ ***************************************************************************************************
+ * Entries live in a fixed array and are linked by 16-bit indices: chained into hash buckets by
+ * address, and into a list ordered by when they were last heard. A report finds its entry
+ * through its bucket, moves it to the front of the list and updates it in place; a new
+ * advertiser takes a free entry or the one at the back of the list. No report walks more than
+ * one bucket chain, whatever the number of advertisers.
+ *
+ * The adapters record under one lock. A query copies what it needs under the lock and sorts and
+ * formats it after, so reports are held up for no longer than the copy. Query clients are
+ * served from the event loop of the thread that started the server, without blocking it.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+#include "event_loop.h"
+
+/* Own header */
+#include "adv_db.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Hash buckets, a power of two: two per entry keeps the chains about one entry long. */
+#define ADV_DB_BUCKET_BITS            13
+#define ADV_DB_BUCKETS                (1u << ADV_DB_BUCKET_BITS)
+
+/** End of a chain or list. */
+#define ADV_DB_NIL                    0xffff
+
+/** RSSI average: dBm in 1/16 steps, each report weighing 1/8. */
+#define ADV_DB_RSSI_SCALE             16
+#define ADV_DB_RSSI_WEIGHT            8
+
+/** Reports of an advertisement closer than this to the last one are the same advertising event,
+ *  heard again by another adapter; the shortest advertising interval is 20 ms. */
+#define ADV_DB_SAME_EVENT_NS          (10 * NSEC_PER_MSEC)
+
+/** Payload kinds, each with fields of its own. */
+#define ADV_DB_ADVERTISEMENT          0
+#define ADV_DB_SCAN_RESPONSE          1
+
+/** Query clients served at once, and how long one may take before it is dropped. */
+#define ADV_DB_CLIENTS                4
+#define ADV_DB_CLIENT_TIMEOUT_MS      5000
+
+/** Longest request line, and room for an answer: the whole table takes about 800 kB. */
+#define ADV_DB_REQUEST_MAX            128
+#define ADV_DB_TEXT_SIZE              (1024 * 1024)
+
+/** Room for one formatted advertiser. */
+#define ADV_DB_LINE_MAX               512
+
+struct advDbEntry {
+  uint64_t key;                   /**< address and address type */
+  uint16_t hashNext;
+  uint16_t lruPrev;
+  uint16_t lruNext;               /**< also links the free entries */
+  bd_addr address;
+  uint8_t addressType;
+  int8_t lastRssi;
+  int16_t rssiAvg;                /**< dBm * ADV_DB_RSSI_SCALE */
+  uint32_t reports;
+  uint64_t firstSeenNs;
+  uint64_t lastSeenNs;
+  uint64_t lastEventNs;           /**< last advertising event, scan responses left out */
+  uint64_t intervalNs;            /**< moving average between advertising events, 0 until known */
+  bool hasFlags;
+  uint8_t flags;
+  bool hasTxPower;
+  int8_t txPower;
+  bool hasCompany;
+  uint16_t company;
+  bool nameComplete;
+  uint8_t nameLen;
+  char name[ADV_DB_NAME_MAX];
+  int8_t match[2];                /**< adMatch() result per payload kind */
+  uint8_t uuidCount[2];
+  uint8_t uuids[2][ADV_DB_MAX_UUIDS][16];   /**< expanded to 128 bits, little-endian */
+};
+
+struct advDbClient {
+  int fd;                         /**< -1 when the slot is free */
+  int timer;
+  char request[ADV_DB_REQUEST_MAX];
+  size_t requestLen;
+  char* answer;                   /**< NULL while the request is read */
+  size_t answerLen;
+  size_t sent;
+};
+
+struct advDbWriter {
+  char* buf;
+  size_t size;
+  size_t len;
+  bool full;
+};
+
+/* Bluetooth Base UUID 00000000-0000-1000-8000-00805F9B34FB, little-endian */
+static const uint8_t baseUuid[16] = { 0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
+                                      0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static struct advDbEntry entries[ADV_DB_CAPACITY];
+static uint16_t buckets[ADV_DB_BUCKETS];
+static uint16_t lruHead = ADV_DB_NIL;   /**< heard most recently */
+static uint16_t lruTail = ADV_DB_NIL;
+static uint16_t freeHead = ADV_DB_NIL;
+static struct advDbStats stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Entries copied out by a query; only touched by the querying thread. */
+static struct advDbEntry results[ADV_DB_CAPACITY];
+
+static bool enabled = false;
+static int listenFd = -1;
+static char socketPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static struct advDbClient clients[ADV_DB_CLIENTS];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static uint64_t entryKey(const bd_addr* address, uint8_t addressType);
+static uint32_t bucketIndex(uint64_t key);
+static uint16_t entryFind(uint64_t key, uint32_t bucket);
+static uint16_t entryAllocate(uint64_t key, uint32_t bucket);
+static void lruUnlink(uint16_t index);
+static void lruPushFront(uint16_t index);
+static void storeFields(struct advDbEntry* e, uint8_t kind, const struct adInfo* info, int8_t match);
+static void storeUuid(struct advDbEntry* e, uint8_t kind, const uint8_t* uuid, uint8_t len);
+static void expandUuid(const uint8_t* uuid, uint8_t len, uint8_t* out);
+static bool entryAdvertises(const struct advDbEntry* e, const uint8_t* uuid);
+static int compareRssi(const void* a, const void* b);
+static void writerLine(struct advDbWriter* w, const char* fmt, ...);
+static void writeEntry(struct advDbWriter* w, const struct advDbEntry* e, uint64_t nowNs);
+static int formatUuid(char* buf, size_t size, const uint8_t* uuid);
+static void onQueryClient(int fd, short revents, void* ctx);
+static void onClientEvent(int fd, short revents, void* ctx);
+static void onClientTimeout(int timerId, void* ctx);
+static void clientClose(struct advDbClient* client);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void advDbInit(void)
+{
+  pthread_mutex_lock(&lock);
+  memset(entries, 0, sizeof(entries));
+  for (uint32_t i = 0; i < ADV_DB_BUCKETS; i++) {
+    buckets[i] = ADV_DB_NIL;
+  }
+  for (uint16_t i = 0; i < ADV_DB_CAPACITY; i++) {
+    entries[i].lruNext = i + 1 < ADV_DB_CAPACITY ? i + 1 : ADV_DB_NIL;
+  }
+  freeHead = 0;
+  lruHead = lruTail = ADV_DB_NIL;
+  memset(&stats, 0, sizeof(stats));
+  pthread_mutex_unlock(&lock);
+}
+
+int advDbStart(const char* path)
+{
+  struct sockaddr_un addr;
+
+  for (uint8_t i = 0; i < ADV_DB_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  strcpy(socketPath, path);
+  unlink(addr.sun_path);
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0
+      || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(listenFd, ADV_DB_CLIENTS) < 0
+      || fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK) < 0
+      || evloopAddFd(listenFd, POLLIN, onQueryClient, NULL) < 0) {
+    if (listenFd >= 0) {
+      close(listenFd);
+      listenFd = -1;
+    }
+    return -1;
+  }
+  advDbInit();
+  enabled = true;
+  return 0;
+}
+
+void advDbStop(void)
+{
+  enabled = false;
+  if (listenFd < 0) {
+    return;
+  }
+  for (uint8_t i = 0; i < ADV_DB_CLIENTS; i++) {
+    if (clients[i].fd >= 0) {
+      clientClose(&clients[i]);
+    }
+  }
+  evloopRemoveFd(listenFd);
+  close(listenFd);
+  listenFd = -1;
+  unlink(socketPath);
+}
+
+bool advDbEnabled(void)
+{
+  return enabled;
+}
+
+void advDbRecord(const bd_addr* address, uint8_t addressType, uint8_t packetType, int8_t rssi,
+                 uint64_t nowNs, const struct adInfo* info, int8_t match)
+{
+  uint64_t key = entryKey(address, addressType);
+  uint32_t bucket = bucketIndex(key);
+  /* Scan responses carry packet type bit 2, as in adv_dedup.c. */
+  uint8_t kind = (packetType & 0x04) ? ADV_DB_SCAN_RESPONSE : ADV_DB_ADVERTISEMENT;
+  struct advDbEntry* e;
+  uint16_t index;
+
+  pthread_mutex_lock(&lock);
+  stats.reports++;
+  index = entryFind(key, bucket);
+  if (index == ADV_DB_NIL) {
+    index = entryAllocate(key, bucket);
+    e = &entries[index];
+    e->address = *address;
+    e->addressType = addressType;
+    e->rssiAvg = rssi * ADV_DB_RSSI_SCALE;
+    e->firstSeenNs = nowNs;
+  } else {
+    e = &entries[index];
+    lruUnlink(index);
+    e->rssiAvg += (rssi * ADV_DB_RSSI_SCALE - e->rssiAvg) / ADV_DB_RSSI_WEIGHT;
+  }
+  lruPushFront(index);
+  e->lastRssi = rssi;
+  e->lastSeenNs = nowNs;
+  e->reports++;
+  if (kind == ADV_DB_ADVERTISEMENT && (e->lastEventNs == 0 || nowNs - e->lastEventNs >= ADV_DB_SAME_EVENT_NS)) {
+    if (e->lastEventNs != 0) {
+      int64_t interval = (int64_t)(nowNs - e->lastEventNs);
+
+      e->intervalNs = e->intervalNs == 0
+                      ? (uint64_t)interval
+                      : (uint64_t)((int64_t)e->intervalNs + (interval - (int64_t)e->intervalNs) / ADV_DB_RSSI_WEIGHT);
+    }
+    e->lastEventNs = nowNs;
+  }
+  if (info != NULL) {
+    storeFields(e, kind, info, match);
+    stats.parsed++;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+size_t advDbQuery(const char* request, uint64_t nowNs, char* buf, size_t size)
+{
+  struct advDbWriter w = { buf, size, 0, false };
+  char command[16] = "";
+  char argument[64] = "";
+  uint32_t count = 0;
+
+  buf[0] = '\0';
+  if (sscanf(request, "%15s %63s", command, argument) < 1) {
+    writerLine(&w, "error: empty request\n");
+    return w.len;
+  }
+
+  if (!strcmp(command, "top")) {
+    uint32_t n = argument[0] != '\0' ? (uint32_t)strtoul(argument, NULL, 10) : 10;
+
+    pthread_mutex_lock(&lock);
+    for (uint16_t i = lruHead; i != ADV_DB_NIL; i = entries[i].lruNext) {
+      results[count++] = entries[i];
+    }
+    pthread_mutex_unlock(&lock);
+    qsort(results, count, sizeof(results[0]), compareRssi);
+    count = MIN(count, n);
+  } else if (!strcmp(command, "uuid")) {
+    uint8_t uuid[16];
+    uint8_t expanded[16];
+    uint8_t len;
+
+    if (adParseUuidString(argument, uuid, &len) < 0) {
+      writerLine(&w, "error: not a UUID: %s\n", argument);
+      return w.len;
+    }
+    expandUuid(uuid, len, expanded);
+    pthread_mutex_lock(&lock);
+    for (uint16_t i = lruHead; i != ADV_DB_NIL; i = entries[i].lruNext) {
+      if (entryAdvertises(&entries[i], expanded)) {
+        results[count++] = entries[i];
+      }
+    }
+    pthread_mutex_unlock(&lock);
+    qsort(results, count, sizeof(results[0]), compareRssi);
+  } else if (!strcmp(command, "seen")) {
+    double seconds = strtod(argument, NULL);
+    uint64_t windowNs = seconds > 0 ? (uint64_t)(seconds * NSEC_PER_SEC) : 0;
+    uint64_t sinceNs = nowNs > windowNs ? nowNs - windowNs : 0;
+
+    /* The list is in the order the reports came in, so the walk stops at the first older one. */
+    pthread_mutex_lock(&lock);
+    for (uint16_t i = lruHead; i != ADV_DB_NIL && entries[i].lastSeenNs >= sinceNs; i = entries[i].lruNext) {
+      results[count++] = entries[i];
+    }
+    pthread_mutex_unlock(&lock);
+  } else if (!strcmp(command, "stats")) {
+    struct advDbStats s;
+
+    advDbGetStats(&s);
+    writerLine(&w, "entries=%u capacity=%u reports=%llu parsed=%llu inserts=%llu evictions=%llu\n",
+               s.entries, ADV_DB_CAPACITY, (unsigned long long)s.reports, (unsigned long long)s.parsed,
+               (unsigned long long)s.inserts, (unsigned long long)s.evictions);
+    return w.len;
+  } else {
+    writerLine(&w, "error: unknown request %s; use top N, uuid UUID, seen SECONDS or stats\n", command);
+    return w.len;
+  }
+
+  for (uint32_t i = 0; i < count && !w.full; i++) {
+    writeEntry(&w, &results[i], nowNs);
+  }
+  return w.len;
+}
+
+void advDbGetStats(struct advDbStats* s)
+{
+  pthread_mutex_lock(&lock);
+  *s = stats;
+  pthread_mutex_unlock(&lock);
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Table key of an advertiser.
+ *  \param[in] address Advertiser address.
+ *  \param[in] addressType Advertiser address type.
+ *  \return  64-bit key.
+ **************************************************************************************************/
+static uint64_t entryKey(const bd_addr* address, uint8_t addressType)
+{
+  uint64_t key = 0;
+
+  for (int i = 5; i >= 0; i--) {
+    key = (key << 8) | address->addr[i];
+  }
+  return key | ((uint64_t)addressType << 48);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Bucket of a key, from the top bits of a multiplicative hash.
+ *  \param[in] key Table key.
+ *  \return  Bucket index.
+ **************************************************************************************************/
+static uint32_t bucketIndex(uint64_t key)
+{
+  return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - ADV_DB_BUCKET_BITS));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find an advertiser, under the lock.
+ *  \param[in] key Table key.
+ *  \param[in] bucket Its bucket.
+ *  \return  Entry index, ADV_DB_NIL if unknown.
+ **************************************************************************************************/
+static uint16_t entryFind(uint64_t key, uint32_t bucket)
+{
+  uint16_t i;
+
+  for (i = buckets[bucket]; i != ADV_DB_NIL && entries[i].key != key; i = entries[i].hashNext) {
+  }
+  return i;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Take a cleared entry for a new advertiser, evicting the one heard least recently if
+ *          none is free, and chain it into its bucket. Under the lock.
+ *  \param[in] key Table key.
+ *  \param[in] bucket Its bucket.
+ *  \return  Entry index, not yet in the list.
+ **************************************************************************************************/
+static uint16_t entryAllocate(uint64_t key, uint32_t bucket)
+{
+  uint16_t index;
+
+  if (freeHead != ADV_DB_NIL) {
+    index = freeHead;
+    freeHead = entries[index].lruNext;
+    stats.entries++;
+  } else {
+    uint16_t* link;
+
+    index = lruTail;
+    lruUnlink(index);
+    for (link = &buckets[bucketIndex(entries[index].key)]; *link != index; link = &entries[*link].hashNext) {
+    }
+    *link = entries[index].hashNext;
+    stats.evictions++;
+  }
+  memset(&entries[index], 0, sizeof(entries[index]));
+  entries[index].key = key;
+  entries[index].match[ADV_DB_ADVERTISEMENT] = AD_NO_MATCH;
+  entries[index].match[ADV_DB_SCAN_RESPONSE] = AD_NO_MATCH;
+  entries[index].hashNext = buckets[bucket];
+  buckets[bucket] = index;
+  stats.inserts++;
+  return index;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Take an entry out of the list, under the lock.
+ *  \param[in] index Entry index.
+ **************************************************************************************************/
+static void lruUnlink(uint16_t index)
+{
+  struct advDbEntry* e = &entries[index];
+
+  if (e->lruPrev != ADV_DB_NIL) {
+    entries[e->lruPrev].lruNext = e->lruNext;
+  } else {
+    lruHead = e->lruNext;
+  }
+  if (e->lruNext != ADV_DB_NIL) {
+    entries[e->lruNext].lruPrev = e->lruPrev;
+  } else {
+    lruTail = e->lruPrev;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Put an entry at the front of the list, under the lock.
+ *  \param[in] index Entry index.
+ **************************************************************************************************/
+static void lruPushFront(uint16_t index)
+{
+  entries[index].lruPrev = ADV_DB_NIL;
+  entries[index].lruNext = lruHead;
+  if (lruHead != ADV_DB_NIL) {
+    entries[lruHead].lruPrev = index;
+  } else {
+    lruTail = index;
+  }
+  lruHead = index;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Keep the fields of a parsed payload. Fields it lacks keep the values the other kind
+ *          of payload gave them; a short name does not replace a complete one.
+ *  \param[in,out] e Entry.
+ *  \param[in] kind ADV_DB_ADVERTISEMENT or ADV_DB_SCAN_RESPONSE.
+ *  \param[in] info Parsed payload.
+ *  \param[in] match adMatch() result for the payload.
+ **************************************************************************************************/
+static void storeFields(struct advDbEntry* e, uint8_t kind, const struct adInfo* info, int8_t match)
+{
+  if (info->hasFlags) {
+    e->hasFlags = true;
+    e->flags = info->flags;
+  }
+  if (info->hasTxPower) {
+    e->hasTxPower = true;
+    e->txPower = info->txPower;
+  }
+  if (info->manufacturerLen >= 2) {
+    e->hasCompany = true;
+    e->company = info->manufacturerData[0] | (info->manufacturerData[1] << 8);
+  }
+  if (info->nameLen > 0 && (info->nameComplete || !e->nameComplete)) {
+    e->nameComplete = info->nameComplete;
+    e->nameLen = MIN(info->nameLen, ADV_DB_NAME_MAX);
+    memcpy(e->name, info->name, e->nameLen);
+  }
+  e->match[kind] = match;
+  e->uuidCount[kind] = 0;
+  for (uint8_t l = 0; l < info->uuidListCount; l++) {
+    for (uint8_t u = 0; u < info->uuidLists[l].count; u++) {
+      storeUuid(e, kind, info->uuidLists[l].data + u * info->uuidLists[l].width, info->uuidLists[l].width);
+    }
+  }
+  for (uint8_t s = 0; s < info->serviceDataCount; s++) {
+    storeUuid(e, kind, info->serviceData[s].uuid, info->serviceData[s].uuidLen);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Add a service UUID to the ones of a payload, unless it is there already or there is
+ *          no room.
+ *  \param[in,out] e Entry.
+ *  \param[in] kind ADV_DB_ADVERTISEMENT or ADV_DB_SCAN_RESPONSE.
+ *  \param[in] uuid UUID in little-endian order.
+ *  \param[in] len 2, 4 or 16.
+ **************************************************************************************************/
+static void storeUuid(struct advDbEntry* e, uint8_t kind, const uint8_t* uuid, uint8_t len)
+{
+  uint8_t expanded[16];
+
+  if (e->uuidCount[kind] == ADV_DB_MAX_UUIDS) {
+    return;
+  }
+  expandUuid(uuid, len, expanded);
+  for (uint8_t i = 0; i < e->uuidCount[kind]; i++) {
+    if (!memcmp(e->uuids[kind][i], expanded, 16)) {
+      return;
+    }
+  }
+  memcpy(e->uuids[kind][e->uuidCount[kind]++], expanded, 16);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Expand a 16 or 32-bit UUID onto the Bluetooth Base UUID, so that every width
+ *          compares alike.
+ *  \param[in] uuid UUID in little-endian order.
+ *  \param[in] len 2, 4 or 16.
+ *  \param[out] out 128-bit UUID in little-endian order.
+ **************************************************************************************************/
+static void expandUuid(const uint8_t* uuid, uint8_t len, uint8_t* out)
+{
+  if (len == 16) {
+    memcpy(out, uuid, 16);
+    return;
+  }
+  memcpy(out, baseUuid, 16);
+  memcpy(out + 12, uuid, len);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Whether either payload of an advertiser lists a service UUID.
+ *  \param[in] e Entry.
+ *  \param[in] uuid 128-bit UUID in little-endian order.
+ *  \return  true if it does.
+ **************************************************************************************************/
+static bool entryAdvertises(const struct advDbEntry* e, const uint8_t* uuid)
+{
+  for (uint8_t kind = 0; kind < 2; kind++) {
+    for (uint8_t i = 0; i < e->uuidCount[kind]; i++) {
+      if (!memcmp(e->uuids[kind][i], uuid, 16)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/***********************************************************************************************//**
+ *  \brief  qsort() order: strongest average RSSI first.
+ *  \param[in] a Entry.
+ *  \param[in] b Entry.
+ *  \return  Comparison result.
+ **************************************************************************************************/
+static int compareRssi(const void* a, const void* b)
+{
+  return ((const struct advDbEntry*)b)->rssiAvg - ((const struct advDbEntry*)a)->rssiAvg;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Append a line to the answer, or nothing more once one did not fit.
+ *  \param[in,out] w Answer writer.
+ *  \param[in] fmt printf format.
+ **************************************************************************************************/
+static void writerLine(struct advDbWriter* w, const char* fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  if (w->full) {
+    return;
+  }
+  va_start(ap, fmt);
+  n = vsnprintf(w->buf + w->len, w->size - w->len, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= w->size - w->len) {
+    w->buf[w->len] = '\0';
+    w->full = true;
+    return;
+  }
+  w->len += n;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Append one advertiser as a line of key=value fields; fields never advertised are left
+ *          out. Times are in seconds before nowNs.
+ *  \param[in,out] w Answer writer.
+ *  \param[in] e Entry.
+ *  \param[in] nowNs Monotonic time of the query.
+ **************************************************************************************************/
+static void writeEntry(struct advDbWriter* w, const struct advDbEntry* e, uint64_t nowNs)
+{
+  char line[ADV_DB_LINE_MAX];
+  size_t len;
+  uint8_t uuids = 0;
+  int8_t match = e->match[ADV_DB_ADVERTISEMENT] != AD_NO_MATCH ? e->match[ADV_DB_ADVERTISEMENT] : e->match[ADV_DB_SCAN_RESPONSE];
+
+  len = snprintf(line, sizeof(line),
+                 "%02x:%02x:%02x:%02x:%02x:%02x type=%u rssi=%.1f last_rssi=%d rate=%.1f first=%.3f last=%.3f reports=%u",
+                 e->address.addr[5], e->address.addr[4], e->address.addr[3],
+                 e->address.addr[2], e->address.addr[1], e->address.addr[0], e->addressType,
+                 (double)e->rssiAvg / ADV_DB_RSSI_SCALE, e->lastRssi,
+                 e->intervalNs != 0 ? (double)NSEC_PER_SEC / e->intervalNs : 0.0,
+                 (double)(nowNs - MIN(nowNs, e->firstSeenNs)) / NSEC_PER_SEC,
+                 (double)(nowNs - MIN(nowNs, e->lastSeenNs)) / NSEC_PER_SEC, e->reports);
+  if (e->hasFlags) {
+    len += snprintf(line + len, sizeof(line) - len, " flags=0x%02x", e->flags);
+  }
+  if (e->hasTxPower) {
+    len += snprintf(line + len, sizeof(line) - len, " tx=%d", e->txPower);
+  }
+  if (e->hasCompany) {
+    len += snprintf(line + len, sizeof(line) - len, " company=0x%04x", e->company);
+  }
+  if (match != AD_NO_MATCH) {
+    len += snprintf(line + len, sizeof(line) - len, " match=%d", match);
+  }
+  if (e->nameLen > 0) {
+    len += snprintf(line + len, sizeof(line) - len, " name=\"");
+    /* Anything that would break the line or the quoting shows as a dot. */
+    for (uint8_t i = 0; i < e->nameLen; i++) {
+      line[len++] = (e->name[i] >= 0x20 && e->name[i] < 0x7f && e->name[i] != '"') ? e->name[i] : '.';
+    }
+    line[len++] = '"';
+    line[len] = '\0';
+  }
+  for (uint8_t kind = 0; kind < 2; kind++) {
+    for (uint8_t i = 0; i < e->uuidCount[kind]; i++) {
+      len += snprintf(line + len, sizeof(line) - len, uuids++ == 0 ? " uuids=" : ",");
+      len += formatUuid(line + len, sizeof(line) - len, e->uuids[kind][i]);
+    }
+  }
+  writerLine(w, "%s\n", line);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Format a UUID the short way when it is on the Bluetooth Base UUID.
+ *  \param[out] buf Destination.
+ *  \param[in] size Size of buf.
+ *  \param[in] uuid 128-bit UUID in little-endian order.
+ *  \return  Characters written.
+ **************************************************************************************************/
+static int formatUuid(char* buf, size_t size, const uint8_t* uuid)
+{
+  if (!memcmp(uuid, baseUuid, 12)) {
+    if (uuid[14] == 0 && uuid[15] == 0) {
+      return snprintf(buf, size, "%02x%02x", uuid[13], uuid[12]);
+    }
+    return snprintf(buf, size, "%02x%02x%02x%02x", uuid[15], uuid[14], uuid[13], uuid[12]);
+  }
+  return snprintf(buf, size, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                  uuid[15], uuid[14], uuid[13], uuid[12], uuid[11], uuid[10], uuid[9], uuid[8],
+                  uuid[7], uuid[6], uuid[5], uuid[4], uuid[3], uuid[2], uuid[1], uuid[0]);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Clients connected to the query socket: take them on while there is a free slot.
+ *  \param[in] fd Listening socket.
+ *  \param[in] revents Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onQueryClient(int fd, short revents, void* ctx)
+{
+  int client;
+
+  while ((client = accept(fd, NULL, NULL)) >= 0) {
+    struct advDbClient* slot = NULL;
+
+    for (uint8_t i = 0; i < ADV_DB_CLIENTS && slot == NULL; i++) {
+      if (clients[i].fd < 0) {
+        slot = &clients[i];
+      }
+    }
+    if (slot == NULL
+        || fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK) < 0
+        || evloopAddFd(client, POLLIN, onClientEvent, slot) < 0) {
+      close(client);
+      continue;
+    }
+    memset(slot, 0, sizeof(*slot));
+    slot->fd = client;
+    slot->timer = evloopAddTimer(ADV_DB_CLIENT_TIMEOUT_MS, false, onClientTimeout, slot);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  A query client is readable or writable: read its request until the line end or its
+ *          end of stream, then send the answer as the socket takes it.
+ *  \param[in] fd Client socket.
+ *  \param[in] revents Unused.
+ *  \param[in] ctx The client.
+ **************************************************************************************************/
+static void onClientEvent(int fd, short revents, void* ctx)
+{
+  struct advDbClient* client = ctx;
+  ssize_t n;
+
+  if (client->answer == NULL) {
+    char* end;
+
+    n = read(fd, client->request + client->requestLen, sizeof(client->request) - 1 - client->requestLen);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+      return;
+    }
+    client->requestLen += MAX(n, 0);
+    client->request[client->requestLen] = '\0';
+    end = strpbrk(client->request, "\r\n");
+    if (end == NULL && n > 0 && client->requestLen < sizeof(client->request) - 1) {
+      return;
+    }
+    if (end != NULL) {
+      *end = '\0';
+    }
+    client->answer = malloc(ADV_DB_TEXT_SIZE);
+    if (client->answer == NULL || evloopModifyFd(fd, POLLOUT) < 0) {
+      clientClose(client);
+      return;
+    }
+    client->answerLen = advDbQuery(client->request, timeNowNs(), client->answer, ADV_DB_TEXT_SIZE);
+  }
+
+  n = write(fd, client->answer + client->sent, client->answerLen - client->sent);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  client->sent += MAX(n, 0);
+  if (n <= 0 || client->sent == client->answerLen) {
+    clientClose(client);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  A query client took too long: drop it.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx The client.
+ **************************************************************************************************/
+static void onClientTimeout(int timerId, void* ctx)
+{
+  struct advDbClient* client = ctx;
+
+  client->timer = -1;
+  clientClose(client);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Hang up on a query client and free its slot.
+ *  \param[in,out] client The client.
+ **************************************************************************************************/
+static void clientClose(struct advDbClient* client)
+{
+  evloopRemoveTimer(client->timer);
+  evloopRemoveFd(client->fd);
+  close(client->fd);
+  free(client->answer);
+  client->answer = NULL;
+  client->fd = -1;
+}
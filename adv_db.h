@@ -0,0 +1,117 @@
+/***********************************************************************************************//**
+ * \file   adv_db.h
+ * \brief  Advertiser database: every device heard while scanning, queried over a Unix socket
+ ***************************************************************************************************
+ * One table, shared by the adapters, of at most ADV_DB_CAPACITY advertisers keyed by address.
+ * When it is full the advertiser heard least recently makes room. Each entry keeps an RSSI
+ * moving average, when the device was first and last heard, its advertising rate, and the
+ * fields of its last advertising and scan response payloads, service UUIDs included.
+ *
+ * Clients of the query socket send one request line and read the answer until the server hangs
+ * up, one advertiser per line:
+ *
+ *   top N          the N advertisers with the strongest average RSSI
+ *   uuid UUID      advertisers of a 16, 32 or 128-bit service UUID, strongest first
+ *   seen T         advertisers heard in the last T seconds, most recent first
+ *   stats          table counters
+ **************************************************************************************************/
+
+#ifndef ADV_DB_H
+#define ADV_DB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bg_types.h"
+#include "ad_parser.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Advertisers kept at once; about 1 MB of table. */
+#define ADV_DB_CAPACITY               4096
+
+/** Service UUIDs kept per payload, from UUID lists and service data; further ones are ignored. */
+#define ADV_DB_MAX_UUIDS              4
+
+/** Longest advertised name: a whole legacy payload less the AD header. */
+#define ADV_DB_NAME_MAX               29
+
+/** Table counters. */
+struct advDbStats {
+  uint32_t entries;         /**< advertisers in the table */
+  uint64_t reports;         /**< scan reports recorded */
+  uint64_t parsed;          /**< reports whose payload fields were stored */
+  uint64_t inserts;         /**< advertisers added */
+  uint64_t evictions;       /**< advertisers dropped to make room */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Empty the table and clear the counters.
+ **************************************************************************************************/
+void advDbInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Serve queries on a Unix stream socket from the calling thread's event loop, and
+ *          start recording scan reports.
+ *  \param[in] path Socket path, replaced if it exists.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int advDbStart(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Stop serving queries and remove the socket.
+ **************************************************************************************************/
+void advDbStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Whether scan reports are to be recorded.
+ *  \return  true between advDbStart() and advDbStop().
+ **************************************************************************************************/
+bool advDbEnabled(void);
+
+/***********************************************************************************************//**
+ *  \brief  Record a scan report. Constant time, from any adapter thread.
+ *  \param[in] address Advertiser address.
+ *  \param[in] addressType Advertiser address type.
+ *  \param[in] packetType packet_type of the scan response event.
+ *  \param[in] rssi Signal strength in dBm.
+ *  \param[in] nowNs Monotonic time of the report.
+ *  \param[in] info The parsed payload, or NULL if it is unchanged since the advertiser's last
+ *             report of this packet type.
+ *  \param[in] match adMatch() result for the payload; ignored when info is NULL.
+ **************************************************************************************************/
+void advDbRecord(const bd_addr* address, uint8_t addressType, uint8_t packetType, int8_t rssi,
+                 uint64_t nowNs, const struct adInfo* info, int8_t match);
+
+/***********************************************************************************************//**
+ *  \brief  Answer a request line, as the query socket does.
+ *  \param[in] request Request, without the line end.
+ *  \param[in] nowNs Monotonic time the answer refers to.
+ *  \param[out] buf Answer text, zero terminated; truncated to whole lines if it does not fit.
+ *  \param[in] size Size of buf.
+ *  \return  Length of the answer.
+ **************************************************************************************************/
+size_t advDbQuery(const char* request, uint64_t nowNs, char* buf, size_t size);
+
+/***********************************************************************************************//**
+ *  \brief  Read the counters.
+ *  \param[out] stats Copy of the counters.
+ **************************************************************************************************/
+void advDbGetStats(struct advDbStats* stats);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* ADV_DB_H */
@@ -0,0 +1,149 @@
+/***********************************************************************************************//**
+ * \file   adv_dedup.c
+ * \brief  Scan report deduplication, keyed by advertiser address
+ ***************************************************************************************************
+ * Open addressing with linear probing. Key 0 marks a free slot; real keys always have bit 63
+ * set. There is no deletion: stale advertisers are overwritten when a probe sequence is full.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+
+#include "adapter.h"
+
+/* Own header */
+#include "adv_dedup.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define ADV_DEDUP_MASK                (ADV_DEDUP_SLOTS - 1)
+#define ADV_DEDUP_KEY_USED            (1ULL << 63)
+
+struct advDedupSlot {
+  uint64_t key;
+  uint32_t hash;
+  uint32_t lastSeen;
+  int8_t result;
+};
+
+static ADAPTER_LOCAL struct advDedupSlot slots[ADV_DEDUP_SLOTS];
+static ADAPTER_LOCAL uint32_t seenClock = 0;
+static ADAPTER_LOCAL struct advDedupStats stats;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static uint32_t slotIndex(uint64_t key);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void advDedupInit(void)
+{
+  memset(slots, 0, sizeof(slots));
+  memset(&stats, 0, sizeof(stats));
+  seenClock = 0;
+}
+
+uint64_t advDedupKey(const bd_addr* address, uint8_t addressType, uint8_t packetType)
+{
+  uint64_t key = 0;
+
+  for (int i = 5; i >= 0; i--) {
+    key = (key << 8) | address->addr[i];
+  }
+  /* Scan responses carry packet type bit 2; the other packet types share the advertising slot. */
+  return key | ((uint64_t)(addressType & 0x7f) << 48) | ((uint64_t)(packetType & 0x04) << 54)
+         | ADV_DEDUP_KEY_USED;
+}
+
+uint32_t advDedupHash(const uint8_t* data, uint8_t len)
+{
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+  uint64_t w;
+
+  for (; len >= 8; data += 8, len -= 8) {
+    memcpy(&w, data, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 29;
+  }
+  w = 0;
+  memcpy(&w, data, len);
+  h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+int8_t advDedupLookup(uint64_t key, uint32_t hash)
+{
+  uint32_t idx = slotIndex(key);
+
+  for (uint8_t n = 0; n < ADV_DEDUP_MAX_PROBE; n++, idx = (idx + 1) & ADV_DEDUP_MASK) {
+    struct advDedupSlot* s = &slots[idx];
+
+    if (s->key == 0) {
+      break;
+    }
+    if (s->key == key) {
+      s->lastSeen = ++seenClock;
+      if (s->hash == hash) {
+        stats.hits++;
+        return s->result;
+      }
+      break;
+    }
+  }
+  stats.misses++;
+  return ADV_DEDUP_MISS;
+}
+
+void advDedupStore(uint64_t key, uint32_t hash, int8_t result)
+{
+  uint32_t idx = slotIndex(key);
+  struct advDedupSlot* victim = &slots[idx];
+
+  for (uint8_t n = 0; n < ADV_DEDUP_MAX_PROBE; n++, idx = (idx + 1) & ADV_DEDUP_MASK) {
+    struct advDedupSlot* s = &slots[idx];
+
+    if (s->key == 0 || s->key == key) {
+      victim = s;
+      break;
+    }
+    if (s->lastSeen < victim->lastSeen) {
+      victim = s;
+    }
+  }
+  if (victim->key != 0 && victim->key != key) {
+    stats.evictions++;
+  }
+  victim->key = key;
+  victim->hash = hash;
+  victim->result = result;
+  victim->lastSeen = ++seenClock;
+}
+
+const struct advDedupStats* advDedupGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Home slot of a key. Addresses share prefixes, so mix all bits before masking.
+ *  \param[in] key Table key.
+ *  \return  Slot index.
+ **************************************************************************************************/
+static uint32_t slotIndex(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return (uint32_t)key & ADV_DEDUP_MASK;
+}
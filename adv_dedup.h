@@ -0,0 +1,93 @@
+/***********************************************************************************************//**
+ * \file   adv_dedup.h
+ * \brief  Scan report deduplication, keyed by advertiser address
+ ***************************************************************************************************
+ * Remembers, per advertiser, a hash of the last payload and the result of matching it against
+ * the target UUIDs, so that repeated unchanged advertisements are not parsed again.
+ **************************************************************************************************/
+
+#ifndef ADV_DEDUP_H
+#define ADV_DEDUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "bg_types.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Table size, a power of two. Sized for a few hundred advertisers with short probe chains. */
+#define ADV_DEDUP_SLOTS               2048
+
+/** Longest probe sequence; when it is exhausted the stalest slot in it is replaced. */
+#define ADV_DEDUP_MAX_PROBE           8
+
+/** advDedupLookup() result for an unknown advertiser or a changed payload. */
+#define ADV_DEDUP_MISS                (-2)
+
+/** Deduplication counters. */
+struct advDedupStats {
+  uint64_t hits;            /**< reports skipped, payload unchanged */
+  uint64_t misses;          /**< reports parsed */
+  uint64_t evictions;       /**< advertisers dropped to make room */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Forget every advertiser and clear the counters.
+ **************************************************************************************************/
+void advDedupInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Build the table key of a report. Advertising and scan response payloads of the same
+ *          device are kept apart.
+ *  \param[in] address Advertiser address.
+ *  \param[in] addressType Advertiser address type.
+ *  \param[in] packetType packet_type of the scan response event.
+ *  \return  64-bit key.
+ **************************************************************************************************/
+uint64_t advDedupKey(const bd_addr* address, uint8_t addressType, uint8_t packetType);
+
+/***********************************************************************************************//**
+ *  \brief  Hash a payload, eight bytes at a time.
+ *  \param[in] data Payload.
+ *  \param[in] len Payload length.
+ *  \return  32-bit hash.
+ **************************************************************************************************/
+uint32_t advDedupHash(const uint8_t* data, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Look up the result stored for an unchanged payload.
+ *  \param[in] key Key from advDedupKey().
+ *  \param[in] hash Payload hash from advDedupHash().
+ *  \return  The stored result, ADV_DEDUP_MISS if the advertiser is unknown or its payload changed.
+ **************************************************************************************************/
+int8_t advDedupLookup(uint64_t key, uint32_t hash);
+
+/***********************************************************************************************//**
+ *  \brief  Remember the result of processing a payload.
+ *  \param[in] key Key from advDedupKey().
+ *  \param[in] hash Payload hash from advDedupHash().
+ *  \param[in] result Value returned by later lookups of the same payload.
+ **************************************************************************************************/
+void advDedupStore(uint64_t key, uint32_t hash, int8_t result);
+
+/***********************************************************************************************//**
+ *  \brief  Access the counters.
+ *  \return  Pointer to the live statistics.
+ **************************************************************************************************/
+const struct advDedupStats* advDedupGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* ADV_DEDUP_H */
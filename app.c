@@ -14,12 +14,37 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
-#include <unistd.h>
+
+#include "infrastructure.h"
 
 /* BG stack headers */
 #include "bg_types.h"
 #include "gecko_bglib.h"
 
+#include "adapter.h"
+#include "ad_parser.h"
+#include "adv_dedup.h"
+#include "adv_db.h"
+#include "bgapi_cmd.h"
+#include "binlog.h"
+#include "bond_store.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "gatt_cache.h"
+#include "gatt_client.h"
+#include "gatt_profile.h"
+#include "metrics.h"
+#include "notify_pipe.h"
+#include "peer_registry.h"
+#include "reconnect.h"
+#include "rtt.h"
+#include "scan_sched.h"
+#include "shm_export.h"
+#include "stream.h"
+#include "timer_wheel.h"
+#include "timeutil.h"
+#include "uart_speed.h"
+
 /* Own header */
 #include "app.h"
 
@@ -28,23 +53,22 @@
  **************************************************************************************************/
 #define PRINT_ADV_INFO								1
 
-#define NO_CONNECTION									0xFF
-#define NO_HANDLE											0xFFFF
+/** Time allowed for a connection attempt before it is cancelled. */
+#define CONNECT_TIMEOUT_MS            5000
+
+/** An NCP that answers hello within this time is reused instead of reset. */
+#define STARTUP_HELLO_MS              100
 
-#define DISCONNECTED									0
-#define SCANNING											1
-#define CONNECTED											2
-#define SERVICE_FOUND									3
-#define CHARACTERISTICS_DISCOVERING 	4
-#define CHARACTERISTICS_FOUND					5
-#define ENABLING_NOTIFY   						6
-#define NOTIFY_ENABLED								7
-#define ENABLING_WRITE   						  8
-#define WRITE_ENABLED									9
+/** Time allowed to boot after a reset, or to close the links an earlier run left open. */
+#define STARTUP_DEADLINE_MS           3000
 
-#define NOTIFY_CHAR_ITEM							1
-#define RW_CHAR_ITEM									2
-#define ALL_CHARS											(NOTIFY_CHAR_ITEM | RW_CHAR_ITEM)
+/** Command callback context of a link: its handle, since the link may close before the response. */
+#define CONN_CTX(conn)                ((void *)(uintptr_t)(conn)->handle)
+
+/* 16-bit UUIDs of the Generic Attribute service, Database Hash and CCC descriptor */
+static const uint8_t gattServiceUUID[] = { 0x01, 0x18 };
+static const uint8_t dbHashCharUUID[] = { 0x2a, 0x2b };
+static const uint8_t cccDescriptorUUID[] = { 0x02, 0x29 };
 
 /* UUIDs for the demo service and characteristics */
 const uint8_t serviceUUID[] = {
@@ -100,256 +124,1606 @@ const uint8_t rwCharUUID[] = {
 		0x89,
 		0x95,
 		0xfb };
-// App booted flag
-static bool appBooted = false;
+/** Startup stages, up to the NCP being ready for this run. */
+enum startupStage {
+  STARTUP_PROBE,                /**< hello sent */
+  STARTUP_TIDY,                 /**< NCP running: closing what an earlier run left open */
+  STARTUP_BOOT,                 /**< reset sent, waiting for the boot event */
+  STARTUP_SPEED,                /**< raising the UART baud rate */
+  STARTUP_DONE
+};
+
+/** Startup of the adapter's NCP. */
+static ADAPTER_LOCAL struct {
+  enum startupStage stage;
+  int timer;                    /**< deadline of the current stage */
+  uint8_t closesPending;        /**< le_connection_close responses still to come */
+  uint8_t staleLinks;           /**< links of an earlier run being closed ... */
+  uint8_t staleClosed;          /**< ... and those whose closed event came */
+  bool warm;                    /**< the NCP was reused */
+  uint64_t stageNs;             /**< start of the current stage */
+  uint64_t probeNs;             /**< hello round trip, or the time waited for it */
+  uint64_t readyNs;             /**< tidy or boot time */
+  uint64_t speedNs;             /**< baud rate negotiation time */
+  bool reported;                /**< time to scanning printed */
+} startup;
+
+/** Start of the process, near enough: appInit() runs once the command line is parsed. */
+static uint64_t processStartNs = 0;
+
+/** Characteristics a link needs before notifications are enabled: NOTIFY_CHAR_ITEM, and
+ *  RW_CHAR_ITEM if the GATT profile has a characteristic to write. */
+static uint8_t profileChars = ALL_CHARS;
+
+/** The GATT profile fits the handle cache: one service, one characteristic to subscribe to, at
+ *  most one to write and none to poll. Other profiles discover on every link. */
+static bool profileCached = true;
 
 int8                rssi;
 uint8               packet_type;
 bd_addr             address;
 uint8               address_type;
-uint8               bonding;
 uint8array          data;
 
-static uint8_t connHandle = NO_CONNECTION;
-static uint8_t currentState = DISCONNECTED;
-static uint8_t characteristicsState = 0;
-static uint32_t serviceHandle = NO_HANDLE;
-static uint16_t notifyHandle = NO_HANDLE;
-static uint16_t rwHandle = NO_HANDLE;
-static uint8_t pb0PressTimes = 0;
-
-  static void Reset_variables() {
-	connHandle = NO_CONNECTION;
-	currentState = DISCONNECTED;
-	characteristicsState = 0;
-	serviceHandle = NO_HANDLE;
-	notifyHandle = NO_HANDLE;
-	rwHandle = NO_HANDLE;
-	pb0PressTimes = 0;
-}
-
-static uint8_t Process_scan_response(struct gecko_msg_le_gap_scan_response_evt_t *pResp) {
-	// decoding advertising packets is done here. The list of AD types can be found
-	// at: https://www.bluetooth.com/specifications/assigned-numbers/Generic-Access-Profile
-
-	uint8_t i = 0;
-	uint8_t ad_match_found = 0;
-	uint8_t ad_len;
-	uint8_t ad_type;
-
-	while (i < (pResp->data.len - 1)) {
-
-		ad_len = pResp->data.data[i];
-		ad_type = pResp->data.data[i + 1];
-
-		if (ad_type == 0x07 || ad_type == 0x06) {
-			// type 0x06 = More 128-bit UUIDs available
-			// type 0x07 = Complete list of 128-bit UUIDs available
-
-			// note: this check assumes that the service we are looking for is first
-			// in the list. To be fixed so that there is no such limitation...
-			if (!memcmp(pResp->data.data + i + 2, serviceUUID, 16)) {
-				ad_match_found = 1;
-				break;
+struct appConfig appCfg = {
+  .maxConnections = MAX_CONNECTIONS,
+  .stressMode = false,
+  .cachePath = GATT_CACHE_DEFAULT_PATH,
+  .directReconnect = true,
+  .adaptiveScan = true,
+  .rttPayload = RTT_DEFAULT_PAYLOAD,
+  .writePeriodMs = WRITE_PERIOD_MS,
+};
+
+/** Discovery is running on the NCP. */
+static ADAPTER_LOCAL bool scanning = false;
+
+/** Time discovery was last started. */
+static ADAPTER_LOCAL uint64_t scanStartNs = 0;
+
+/** Scan parameters last sent to the NCP, all 0 until the first are sent. */
+static ADAPTER_LOCAL struct scanParams scanApplied;
+
+/** Handle of the connection attempt in progress, only one may be pending at a time. */
+static ADAPTER_LOCAL uint8_t connectingHandle = NO_CONNECTION;
+
+/** Peer of the le_gap_open command awaiting its response, which carries the handle. */
+static ADAPTER_LOCAL struct {
+  bool pending;
+  bd_addr address;
+  uint8_t addressType;
+  bool direct;                  /**< reconnection to a lost peer, not a scan match */
+  uint64_t foundNs;
+} opening;
+
+/** Messages printed on the response to a command that starts a GATT procedure. */
+struct startReport {
+  const char *ok;               /**< printed on success, NULL for none */
+  const char *error;            /**< printed with the error code on failure */
+};
+
+static const struct startReport discoverServiceReport = {
+  "OK --- >Start discovering services.", "Error!!! Start Discovery error" };
+static const struct startReport discoverCharacteristicsReport = {
+  "OK --- >Start discovering characteristics.", "Error!!! Start Discovery characteristics error" };
+static const struct startReport discoverDescriptorsReport = {
+  NULL, "Error!!! Start Discovery descriptors error" };
+static const struct startReport enableNotifyReport = {
+  "OK --- >Set notification CCC to 0x0001.", "Error!!! Enable notification error" };
+static const struct startReport subscribeReport = {
+  "OK --- >Subscribing to a profile characteristic.", "Error!!! Profile subscription error" };
+static const struct startReport setParametersReport = {
+  NULL, "Error!!! Set connection parameters error" };
+
+/** Aggregate notification counters for the stress report window. */
+static ADAPTER_LOCAL uint64_t stressWindowNs = 0;
+static ADAPTER_LOCAL uint64_t stressNotifications = 0;
+static ADAPTER_LOCAL uint64_t stressBytes = 0;
+static ADAPTER_LOCAL uint64_t stressWrites = 0;
+static ADAPTER_LOCAL uint64_t stressWriteNs = 0;
+
+static void onDiscoverResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onOpenResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onStartResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onCachedCccWriteResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onHashReadResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onPeriodicWriteResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onHelloResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onStaleCloseResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onIncreaseSecurityResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx);
+static void onStartupTimeout(int timerId, void *ctx);
+static void startupReset(void);
+static void startupTidy(void);
+static void startupReady(bool warm);
+static void onSpeedDone(bool ok);
+static void startupDone(bool warm);
+static void onStressTimer(int timerId, void *ctx);
+static void onConnectTimeout(int jobId, void *ctx);
+static void onWriteJob(int jobId, void *ctx);
+static void onScanTimer(int timerId, void *ctx);
+static bool scanParamsPending(uint8_t level, struct scanParams *params);
+static void scanParamsSend(const struct scanParams *params);
+static void reportLinkProfile(uint8_t links);
+static void connectNext(void);
+static void profileValue(struct connection *conn, uint16_t characteristic, const uint8_t *data, uint8_t len);
+static void gattSetup(struct connection *conn);
+static void secureLink(struct connection *conn);
+static void linkEncrypted(struct connection *conn);
+
+static void Reset_variables() {
+	/* A boot drops every link without a closed event: the established ones are lost now. */
+	uint64_t lostNs = timeNowNs();
+	struct { bd_addr address; uint8_t addressType; } lost[MAX_CONNECTIONS];
+	uint8_t lostCount = 0;
+
+	/* The jobs, streams, probes and peer claims of the links dropped with the NCP go with them. */
+	for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+		struct connection *conn = connAt(i);
+		if (conn != NULL) {
+			if (conn->state != CONNECTING) {
+				lost[lostCount].address = conn->address;
+				lost[lostCount].addressType = conn->addressType;
+				lostCount++;
 			}
+			timerWheelCancel(conn->connectTimer);
+			timerWheelCancel(conn->writeJob);
+			streamStop(conn);
+			rttStop(conn);
+			peerRegistryRelease(&conn->address, adapterCurrent()->index);
 		}
-
-		//jump to next AD record
-		i = i + ad_len + 1;
 	}
-	return (ad_match_found);
+	if (opening.pending) {
+		peerRegistryRelease(&opening.address, adapterCurrent()->index);
+	}
+	connInit();
+	advDedupInit();
+	scanning = false;
+	memset(&scanApplied, 0, sizeof(scanApplied));
+	scanSchedInit(appCfg.adaptiveScan, timeNowNs());
+	connectingHandle = NO_CONNECTION;
+	opening.pending = false;
+	reconnectInit(connectNext);
+	/* Their peers take the direct reconnection path, as after a closed event. */
+	for (uint8_t i = 0; i < lostCount; i++) {
+		reconnectAdd(&lost[i].address, lost[i].addressType, lostNs);
+	}
+}
+
+/***********************************************************************************************//**
+ *  \brief  Decide whether a scan report advertises one of the target service UUIDs. Unchanged
+ *          repeats of a payload reuse the earlier decision instead of being parsed again.
+ *  \param[in] pResp Scan report.
+ *  \return  true if a target UUID is advertised.
+ **************************************************************************************************/
+static bool Process_scan_response(struct gecko_msg_le_gap_scan_response_evt_t *pResp)
+{
+  uint64_t key = advDedupKey(&pResp->address, pResp->address_type, pResp->packet_type);
+  uint32_t hash = advDedupHash(pResp->data.data, pResp->data.len);
+  int8_t match = advDedupLookup(key, hash);
+
+  if (match == ADV_DEDUP_MISS) {
+    struct adInfo info;
+
+    // decoding advertising packets is done here. The list of AD types can be found
+    // at: https://www.bluetooth.com/specifications/assigned-numbers/Generic-Access-Profile
+    adParse(pResp->data.data, pResp->data.len, &info);
+    match = adMatch(&info, &appCfg.targets);
+    advDedupStore(key, hash, match);
+    if (advDbEnabled()) {
+      advDbRecord(&pResp->address, pResp->address_type, pResp->packet_type, pResp->rssi, timeNowNs(), &info, match);
+    }
+  } else if (advDbEnabled()) {
+    advDbRecord(&pResp->address, pResp->address_type, pResp->packet_type, pResp->rssi, timeNowNs(), NULL, match);
+  }
+  return match != AD_NO_MATCH;
+}
+
+/***********************************************************************************************//**
+ *  \brief  (Re)start discovery if it is stopped and there is room for another link.
+ **************************************************************************************************/
+static void startScanning(void)
+{
+  struct scanParams params;
+
+  if (scanning || opening.pending || connectingHandle != NO_CONNECTION || connCount() >= appCfg.maxConnections) {
+    return;
+  }
+  /* Scanning until the response says otherwise, so that it is not started twice. */
+  scanning = true;
+  scanStartNs = timeNowNs();
+  if (scanParamsPending(scanSchedUpdate(scanStartNs, false, connCount(), appCfg.maxConnections), &params)) {
+    scanParamsSend(&params);
+  }
+  bgapiCmdLeGapDiscover(le_gap_discover_generic, onDiscoverResponse, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Whether the NCP has to be given the scan parameters of a level.
+ *  \param[in] level Level from scanSchedUpdate().
+ *  \param[out] params Its parameters.
+ *  \return  true if they differ from those last sent, false if they are the same or scanning
+ *           stays on the stack defaults.
+ **************************************************************************************************/
+static bool scanParamsPending(uint8_t level, struct scanParams *params)
+{
+  if (level == SCAN_LEVELS) {
+    return false;
+  }
+  scanSchedParams(level, params);
+  return params->interval != scanApplied.interval || params->window != scanApplied.window
+         || params->active != scanApplied.active;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send scan parameters; they take effect when discovery next starts.
+ *  \param[in] params Parameters.
+ **************************************************************************************************/
+static void scanParamsSend(const struct scanParams *params)
+{
+  printf("SCAN --- > %s: interval %.1f ms, window %.1f ms, %s\r\n", params->name,
+         params->interval * SCAN_SCHED_UNIT_US / 1e3, params->window * SCAN_SCHED_UNIT_US / 1e3,
+         params->active ? "active" : "passive");
+  bgapiCmdLeGapSetScanParameters(params->interval, params->window, params->active, NULL, NULL);
+  scanApplied = *params;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Open the next link: reconnect directly to a lost peer whose backoff has expired,
+ *          pausing discovery for it, otherwise (re)start discovery.
+ **************************************************************************************************/
+static void connectNext(void)
+{
+  struct reconnectPeer *peer;
+
+  if (opening.pending || connectingHandle != NO_CONNECTION || connCount() >= appCfg.maxConnections) {
+    return;
+  }
+  peer = appCfg.directReconnect ? reconnectNextDue() : NULL;
+  /* Another adapter may have found the peer by scanning meanwhile; it keeps it. */
+  while (peer != NULL && !peerRegistryClaim(&peer->address, adapterCurrent()->index)) {
+    reconnectRemove(peer);
+    peer = reconnectNextDue();
+  }
+  if (peer == NULL) {
+    startScanning();
+    return;
+  }
+  if (scanning) {
+    bgapiCmdLeGapEndProcedure(NULL, NULL);
+    scanning = false;
+  }
+  reconnectStarted(peer);
+  printf("OK --- >Reconnecting to a lost peer, attempt %d.\r\n", peer->attempts + 1);
+  metricsInc(METRICS_CONNECT_ATTEMPTS);
+  opening.pending = true;
+  opening.address = peer->address;
+  opening.addressType = peer->addressType;
+  opening.direct = true;
+  opening.foundNs = timeNowNs();
+  bgapiCmdLeGapOpen(opening.address, opening.addressType, onOpenResponse, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  A direct reconnection attempt failed: back off before the next one.
+ *  \param[in] address Peer address.
+ **************************************************************************************************/
+static void reconnectAttemptFailed(const bd_addr *address)
+{
+  struct reconnectPeer *peer = reconnectFind(address);
+
+  if (peer != NULL) {
+    reconnectFailed(peer);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to le_gap_discover.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onDiscoverResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  if (result == 0) {
+    printf("OK --- >Scanning Started.\r\n");
+    if (!startup.reported) {
+      startup.reported = true;
+      printf("STARTUP --- > %s start: scanning %.1f ms after process start (probe %.1f ms, %s %.1f ms, "
+             "%u baud after %.1f ms)\r\n",
+             startup.warm ? "warm" : "cold", (timeNowNs() - processStartNs) / 1e6, startup.probeNs / 1e6,
+             startup.warm ? "tidy" : "boot", startup.readyNs / 1e6, uartSpeedCurrent(), startup.speedNs / 1e6);
+    }
+  } else {
+    scanning = false;
+    printf("Error!!! Start Scanning error, error code = %d\r\n", result);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to le_gap_open: the handle of the new connection.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Response.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onOpenResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  struct connection *conn;
+
+  opening.pending = false;
+  conn = (result == 0) ? connAlloc(rsp->data.rsp_le_gap_open.connection) : NULL;
+  if (conn == NULL) {
+    if (result == 0) {
+      /* The NCP is connecting on a handle this host has no room for: call it off. The NCP
+       * reported no error, so none is counted. */
+      printf("Error!!! No room for connection %u, closing it\r\n", rsp->data.rsp_le_gap_open.connection);
+      bgapiCmdLeConnectionClose(rsp->data.rsp_le_gap_open.connection, NULL, NULL);
+    } else {
+      metricsError(METRICS_CONNECT_FAILURE, result);
+      printf("Error!!! Connect error, error code = %d\r\n", result);
+    }
+    peerRegistryRelease(&opening.address, adapterCurrent()->index);
+    if (opening.direct) {
+      reconnectAttemptFailed(&opening.address);
+    }
+    connectNext();
+    return;
+  }
+  connectingHandle = conn->handle;
+  conn->address = opening.address;
+  conn->addressType = opening.addressType;
+  conn->direct = opening.direct;
+  conn->foundNs = opening.foundNs;
+  conn->bonding = BOND_NONE;
+  /* A direct attempt gives up sooner: the peer may be gone, and scanning waits meanwhile. */
+  conn->connectTimer = timerWheelAdd(opening.direct ? RECONNECT_TIMEOUT_MS : CONNECT_TIMEOUT_MS, 0,
+                                     onConnectTimeout, CONN_CTX(conn));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to a command that starts a GATT procedure: report the outcome.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx The struct startReport to print.
+ **************************************************************************************************/
+static void onStartResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  const struct startReport *report = ctx;
+
+  if (result != 0) {
+    printf("%s, error code = %d\r\n", report->error, result);
+  } else if (report->ok != NULL) {
+    printf("%s\r\n", report->ok);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to the startup hello: reuse the NCP if it answered in time.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onHelloResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  if (startup.stage != STARTUP_PROBE) {
+    return;
+  }
+  evloopRemoveTimer(startup.timer);
+  startup.timer = -1;
+  startup.probeNs = timeNowNs() - startup.stageNs;
+  if (result == 0) {
+    startupTidy();
+  } else {
+    startupReset();
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to closing a handle at startup: count the links an earlier run left open.
+ *  \param[in] result BGAPI result code, an error if the handle had no link.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStaleCloseResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  if (startup.stage != STARTUP_TIDY) {
+    return;
+  }
+  startup.closesPending--;
+  if (result == 0) {
+    startup.staleLinks++;
+  }
+  if (startup.closesPending == 0 && startup.staleClosed >= startup.staleLinks) {
+    startupReady(true);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  A startup stage ran out of time: reset an NCP that does not answer or does not
+ *          settle, give up on one that does not boot.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStartupTimeout(int timerId, void *ctx)
+{
+  startup.timer = -1;
+  if (startup.stage == STARTUP_PROBE) {
+    /* An earlier run may have left the NCP at a raised baud rate. */
+    if (uartSpeedProbeNext(&appCfg.baudRates)) {
+      bgapiCmdSystemHello(onHelloResponse, NULL);
+      startup.timer = evloopAddTimer(STARTUP_HELLO_MS, false, onStartupTimeout, NULL);
+      return;
+    }
+    startup.probeNs = timeNowNs() - startup.stageNs;
+    startupReset();
+  } else if (startup.stage == STARTUP_TIDY) {
+    printf("Error!!! NCP did not close the links of an earlier run, resetting it.\r\n");
+    startupReset();
+  } else if (startup.stage == STARTUP_SPEED) {
+    printf("Error!!! Baud rate negotiation with the NCP on %s did not end, resetting it.\r\n",
+           adapterCurrent()->port);
+    startupReset();
+  } else if (startup.stage == STARTUP_BOOT) {
+    printf("Error!!! NCP on %s did not boot within %u ms.\r\n", adapterCurrent()->port, STARTUP_DEADLINE_MS);
+    evloopStop();
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Reset the NCP and wait for it to boot, up to STARTUP_DEADLINE_MS.
+ **************************************************************************************************/
+static void startupReset(void)
+{
+  printf("Resetting NCP target on %s...\r\n", adapterCurrent()->port);
+  startup.stage = STARTUP_BOOT;
+  startup.stageNs = timeNowNs();
+  /* Reset NCP to ensure it gets into a defined state.
+   * Once the chip successfully boots, gecko_evt_system_boot_id event should be received. */
+  adapterBglibLock();
+  gecko_cmd_system_reset(0);
+  adapterBglibUnlock();
+  /* It boots at the rate of the command line. */
+  uartSpeedFallback();
+  startup.timer = evloopAddTimer(STARTUP_DEADLINE_MS, false, onStartupTimeout, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Put a running NCP in the state a reset would leave it in, as far as this host is
+ *          concerned: no discovery, no soft timer (older hosts drove their writes with it) and no
+ *          links. Handles without a link refuse the close; the others are waited for, up to
+ *          STARTUP_DEADLINE_MS.
+ **************************************************************************************************/
+static void startupTidy(void)
+{
+  startup.stage = STARTUP_TIDY;
+  startup.stageNs = timeNowNs();
+  startup.closesPending = MAX_CONNECTIONS;
+  startup.staleLinks = 0;
+  startup.staleClosed = 0;
+  bgapiCmdLeGapEndProcedure(NULL, NULL);
+  bgapiCmdHardwareSetSoftTimer(0, 0, 0, NULL, NULL);
+  for (uint8_t handle = 1; handle <= MAX_CONNECTIONS; handle++) {
+    bgapiCmdLeConnectionClose(handle, onStaleCloseResponse, NULL);
+  }
+  startup.timer = evloopAddTimer(STARTUP_DEADLINE_MS, false, onStartupTimeout, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  The NCP booted or was tidied up: raise the baud rate, if candidates were given, the
+ *          first time it comes up, and then get on with startupDone().
+ *  \param[in] warm true if the running NCP was reused, false after a boot.
+ **************************************************************************************************/
+static void startupReady(bool warm)
+{
+  if (startup.stage == STARTUP_DONE) {
+    startupDone(warm);
+    return;
+  }
+  startup.readyNs = timeNowNs() - startup.stageNs;
+  if (appCfg.baudRates.count == 0) {
+    startupDone(warm);
+    return;
+  }
+  evloopRemoveTimer(startup.timer);
+  startup.timer = -1;
+  if (!warm) {
+    /* Commands sent before the reset are never answered. */
+    bgapiCmdReset();
+  }
+  startup.warm = warm;
+  startup.stage = STARTUP_SPEED;
+  startup.speedNs = timeNowNs();
+  /* Every step has its own deadline: this one only guards against a negotiation that never ends. */
+  startup.timer = evloopAddTimer(appCfg.baudRates.count * UART_SPEED_STEP_MAX_MS + STARTUP_DEADLINE_MS,
+                                 false, onStartupTimeout, NULL);
+  uartSpeedRaise(&appCfg.baudRates, onSpeedDone);
+}
+
+/***********************************************************************************************//**
+ *  \brief  End of the baud rate negotiation: carry on, or wait for the NCP that it reset.
+ *  \param[in] ok false if the line was lost and the NCP reset.
+ **************************************************************************************************/
+static void onSpeedDone(bool ok)
+{
+  evloopRemoveTimer(startup.timer);
+  startup.timer = -1;
+  startup.speedNs = timeNowNs() - startup.speedNs;
+  if (!ok) {
+    startup.stage = STARTUP_BOOT;
+    startup.stageNs = timeNowNs();
+    startup.timer = evloopAddTimer(STARTUP_DEADLINE_MS, false, onStartupTimeout, NULL);
+    return;
+  }
+  startupDone(startup.warm);
+}
+
+/***********************************************************************************************//**
+ *  \brief  The NCP is up for this run: set it up and start discovery.
+ *  \param[in] warm true if the running NCP was reused, false after a boot.
+ **************************************************************************************************/
+static void startupDone(bool warm)
+{
+  bool first = startup.stage != STARTUP_DONE;
+  uint16_t maxMtu;
+
+  evloopRemoveTimer(startup.timer);
+  startup.timer = -1;
+  startup.warm = warm;
+  startup.stage = STARTUP_DONE;
+  if (!warm) {
+    /* Commands sent before the reset are never answered. */
+    bgapiCmdReset();
+  }
+  Reset_variables();
+  maxMtu = appCfg.profile->maxMtu;
+  if (appCfg.streamBytes > 0 || appCfg.rttPayload > RTT_DEFAULT_PAYLOAD) {
+    maxMtu = MAX(maxMtu, STREAM_MAX_MTU);
+  }
+  if (gattProfileCount(GATT_PROFILE_POLL) > 1) {
+    /* Room for several polled values in one read multiple response. */
+    maxMtu = MAX(maxMtu, GATT_CLIENT_BATCH_MTU);
+  }
+  if (maxMtu > 0) {
+    /* Large packets for streaming, probes, batched polls or the profile; the MTU exchange then runs on
+     * every new link. */
+    bgapiCmdGattSetMaxMtu(maxMtu, NULL, NULL);
+  }
+  if (appCfg.stressMode && first) {
+    stressWindowNs = timeNowNs();
+    evloopAddTimer(STRESS_REPORT_MS, true, onStressTimer, NULL);
+  }
+  if (appCfg.rttRate > 0 && first) {
+    rttInit(appCfg.rttRate, appCfg.rttPayload, appCfg.profile->name);
+  }
+  if (first) {
+    evloopAddTimer(SCAN_SCHED_PERIOD_MS, true, onScanTimer, NULL);
+    gattClientInit();
+  }
+  if (appCfg.bondPath != NULL) {
+    /* Just Works bonding; the bonds the NCP holds are checked against the store. */
+    bgapiCmdSmConfigure(0, sm_io_capability_noinputnooutput, NULL, NULL);
+    bgapiCmdSmSetBondableMode(1, NULL, NULL);
+    bondStoreListBegin(adapterCurrent()->index);
+    bgapiCmdSmListAllBondings(NULL, NULL);
+  }
+  /* Start discovery after system booted */
+  connectNext();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Give up on a connection attempt that did not complete in time.
+ *  \param[in] jobId Expired job.
+ *  \param[in] ctx Connection handle of the pending attempt.
+ **************************************************************************************************/
+static void onConnectTimeout(int jobId, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (conn == NULL || conn->connectTimer != jobId) {
+    return;
+  }
+  conn->connectTimer = -1;
+  if (conn->state == CONNECTING) {
+    printf("Error!!! Connection attempt to handle %d timed out, cancelling.\r\n", conn->handle);
+    /* Closing a pending connection cancels it; the closed event moves on to the next attempt. */
+    bgapiCmdLeConnectionClose(conn->handle, NULL, NULL);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move scanning to the level that fits how discovery is going.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onScanTimer(int timerId, void *ctx)
+{
+  uint8_t level = scanSchedUpdate(timeNowNs(), scanning, connCount(), appCfg.maxConnections);
+  struct scanParams params;
+
+  /* New parameters only apply when discovery starts: restart it, keeping its start time. */
+  if (scanning && scanParamsPending(level, &params)) {
+    bgapiCmdLeGapEndProcedure(NULL, NULL);
+    scanParamsSend(&params);
+    bgapiCmdLeGapDiscover(le_gap_discover_generic, onDiscoverResponse, NULL);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Periodic stress report: link count and aggregate notification throughput.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStressTimer(int timerId, void *ctx)
+{
+  uint64_t now = timeNowNs();
+  double seconds = (now - stressWindowNs) / 1e9;
+  uint8_t links = 0;
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection *conn = connAt(i);
+    if (conn != NULL && conn->state == ENABLING_WRITE) {
+      links++;
+    }
+  }
+  printf("STRESS --- > %u links: %.1f notifications/s, %.1f bytes/s aggregate\r\n",
+         links, stressNotifications / seconds, stressBytes / seconds);
+  __atomic_store_n(&adapterCurrent()->links, links, __ATOMIC_RELAXED);
+  reportLinkProfile(links);
+  stressWindowNs = now;
+  stressNotifications = 0;
+  stressBytes = 0;
+  stressWrites = 0;
+  stressWriteNs = 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Stress report of the link profile: parameters negotiated on the ready links, and the
+ *          round trip of the periodic writes, which waits for the peripheral's next connection
+ *          event the way a notification does.
+ *  \param[in] links Ready links.
+ **************************************************************************************************/
+static void reportLinkProfile(uint8_t links)
+{
+  uint32_t intervalSum = 0;
+  uint32_t latencySum = 0;
+  uint32_t txsizeSum = 0;
+  uint8_t known = 0;
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection *conn = connAt(i);
+    if (conn != NULL && conn->state == ENABLING_WRITE && conn->interval != 0) {
+      intervalSum += conn->interval;
+      latencySum += conn->latency;
+      txsizeSum += conn->txsize;
+      known++;
+    }
+  }
+  printf("PROFILE --- > %s on %u links: interval avg %.2f ms, slave latency avg %.1f, %.0f-byte packets; "
+         "write round trip avg %.2f ms (%llu writes)\r\n", appCfg.profile->name, links,
+         known ? intervalSum * (LINK_PROFILE_INTERVAL_US / 1000.0) / known : 0, known ? (double)latencySum / known : 0,
+         known ? (double)txsizeSum / known : 0, stressWrites ? stressWriteNs / 1e6 / stressWrites : 0,
+         (unsigned long long)stressWrites);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to a periodic write: a refused write never completes, so stop timing it.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onPeriodicWriteResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (conn != NULL && result != 0) {
+    conn->writeNs = 0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Write job of a link: write the next counter value to its RW characteristic.
+ *  \param[in] jobId Job that fell due.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onWriteJob(int jobId, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (conn == NULL || conn->writeJob != jobId) {
+    /* The link went, or the handle was reused by another. */
+    timerWheelCancel(jobId);
+    return;
+  }
+  /* One GATT procedure at a time per link: on a long interval the previous write may still be in flight. */
+  if (conn->state != ENABLING_WRITE || conn->writeNs != 0 || conn->pollPending != 0) {
+    return;
+  }
+  conn->writeCounter++;
+  conn->writeNs = timeNowNs();
+
+  //It sends the notifications
+  bgapiCmdGattWriteCharacteristicValue(conn->handle, conn->rwHandle, 1, &conn->writeCounter,
+                                       onPeriodicWriteResponse, CONN_CTX(conn));
+
+  printf("OK --- > Writing to Server %d (handle %d)\r\n", conn->writeCounter, conn->handle);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Ask for the connection parameters of the link profile, unless it keeps the defaults.
+ *  \param[in] conn Connection.
+ **************************************************************************************************/
+static void requestLinkParameters(struct connection *conn)
+{
+  const struct linkProfile *profile = appCfg.profile;
+
+  if (profile->minInterval == 0) {
+    return;
+  }
+  conn->profileRequests++;
+  bgapiCmdLeConnectionSetParameters(conn->handle, profile->minInterval, profile->maxInterval, profile->latency,
+                                    profile->timeout, onStartResponse, (void *)&setParametersReport);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Per-link setup is complete: start periodic writes and report setup time.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void connectionReady(struct connection *conn)
+{
+  uint8_t links = 0;
+  const struct gattLinkChar *subscription = gattClientNextSubscription(conn);
+
+  /* Further characteristics of the profile to subscribe to, one at a time: back here on completion. */
+  if (subscription != NULL) {
+    connSetState(conn, SUBSCRIBING);
+    bgapiCmdGattSetCharacteristicNotification(conn->handle, subscription->handle, gatt_notification, onStartResponse,
+                                              (void *)&subscribeReport);
+    return;
+  }
+  conn->readyNs = timeNowNs();
+  metricsInc(METRICS_LINKS_READY);
+  metricsObserve(METRICS_SETUP_TIME, conn->readyNs - conn->foundNs);
+  if (appCfg.streamBytes > 0) {
+    if (appCfg.stressMode) {
+      printf("STRESS --- > handle %d set up in %.1f ms (connect %.1f ms, GATT %.1f ms)\r\n", conn->handle,
+             (conn->readyNs - conn->foundNs) / 1e6, (conn->openedNs - conn->foundNs) / 1e6,
+             (conn->readyNs - conn->openedNs) / 1e6);
+    }
+    streamStart(conn, appCfg.streamBytes, appCfg.streamPayload);
+    return;
+  }
+  connSetState(conn, ENABLING_WRITE);
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection *other = connAt(i);
+    if (other != NULL && other->state == ENABLING_WRITE) {
+      links++;
+    }
+  }
+  if (appCfg.rttRate > 0) {
+    /* Round-trip probes replace the periodic writes. */
+    rttStart(conn);
+  } else if (conn->rwHandle != NO_HANDLE) {
+    /* Every link has its own job, on a common phase: the writes of all links fall due in the same
+     * tick and leave in one UART write. */
+    conn->writeJob = timerWheelAdd(timerWheelAlign(appCfg.writePeriodMs), appCfg.writePeriodMs, onWriteJob,
+                                   CONN_CTX(conn));
+    printf("OK --- > Central will Write to Server every %ums \r\n", appCfg.writePeriodMs);
+  }
+
+  if (appCfg.stressMode) {
+    printf("STRESS --- > link %u (handle %d) set up in %.1f ms (connect %.1f ms, GATT %.1f ms), %u links ready\r\n",
+           links, conn->handle, (conn->readyNs - conn->foundNs) / 1e6, (conn->openedNs - conn->foundNs) / 1e6,
+           (conn->readyNs - conn->openedNs) / 1e6, links);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Start the full discovery chain: the services of the GATT profile, their characteristics,
+ *          the CCC descriptor of the notify characteristic.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void discoverServices(struct connection *conn)
+{
+  connSetState(conn, CONNECTED);
+  conn->fromCache = false;
+  conn->characteristicsState = 0;
+  conn->serviceHandle = NO_HANDLE;
+  conn->notifyHandle = NO_HANDLE;
+  conn->rwHandle = NO_HANDLE;
+  conn->cccHandle = NO_HANDLE;
+  conn->gattServiceHandle = 0;
+  gattClientReset(conn);
+  if (gattProfileCount(GATT_PROFILE_SERVICE) == 1) {
+    /* The first entry is a service: search for it alone, as written in the profile. */
+    const struct gattProfileAttr *service = gattProfileAt(0);
+
+    bgapiCmdGattDiscoverPrimaryServicesByUuid(conn->handle, service->len,
+                                              service->uuid + (service->len == 16 ? 0 : 12), onStartResponse,
+                                              (void *)&discoverServiceReport);
+  } else {
+    bgapiCmdGattDiscoverPrimaryServices(conn->handle, onStartResponse, (void *)&discoverServiceReport);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Discover the characteristics of the next service of the profile found on the link.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void discoverCharacteristics(struct connection *conn)
+{
+  connSetState(conn, CHARACTERISTICS_DISCOVERING);
+  bgapiCmdGattDiscoverCharacteristics(conn->handle, conn->services[conn->serviceNext], onStartResponse,
+                                      (void *)&discoverCharacteristicsReport);
 }
 
+/***********************************************************************************************//**
+ *  \brief  Skip discovery: take the handles from the cache and write the CCC descriptor directly.
+ *  \param[in] conn Connection context.
+ *  \param[in] cached Cache entry of the peer.
+ **************************************************************************************************/
+static void enableNotifyFromCache(struct connection *conn, const struct gattCacheEntry *cached)
+{
+  uint8_t buf[2] = {
+    0x01,
+    0x00 };
+
+  conn->fromCache = true;
+  conn->serviceHandle = cached->serviceHandle;
+  conn->gattServiceHandle = cached->gattServiceHandle;
+  conn->notifyHandle = cached->notifyHandle;
+  conn->rwHandle = cached->rwHandle;
+  conn->cccHandle = cached->cccHandle;
+  conn->characteristicsState = profileChars;
+  connSetState(conn, ENABLING_NOTIFY);
+
+  bgapiCmdGattWriteDescriptorValue(conn->handle, conn->cccHandle, 2, buf, onCachedCccWriteResponse, CONN_CTX(conn));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to the CCC write with cached handles: rediscover if it was refused.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onCachedCccWriteResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (conn == NULL || conn->state != ENABLING_NOTIFY) {
+    return;
+  }
+  if (result == 0) {
+    printf("OK --- >Handles cached, set notification CCC 0x%04x to 0x0001.\r\n", conn->cccHandle);
+  } else {
+    printf("Error!!! Cached CCC write error, error code = %d, rediscovering.\r\n", result);
+    gattCacheInvalidate(&conn->address);
+    discoverServices(conn);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Set up the GATT side of a new or newly encrypted link.
+ *  \param[in] conn Connection.
+ **************************************************************************************************/
+static void gattSetup(struct connection *conn)
+{
+  struct gattCacheEntry cached;
+
+  /* Known peer: go straight to enabling notifications, otherwise discover. */
+  if (profileCached && gattCacheFind(&conn->address, &cached)) {
+    enableNotifyFromCache(conn, &cached);
+  } else {
+    discoverServices(conn);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Encrypt a new link: with the stored bond of a known peer, otherwise by pairing.
+ *  \param[in] conn Connection.
+ **************************************************************************************************/
+static void secureLink(struct connection *conn)
+{
+  conn->pairing = conn->bonding == BOND_NONE;
+  connSetState(conn, ENCRYPTING);
+  bgapiCmdSmIncreaseSecurity(conn->handle, onIncreaseSecurityResponse, CONN_CTX(conn));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to sm_increase_security: close a link that cannot be encrypted.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onIncreaseSecurityResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (result == 0 || conn == NULL) {
+    return;
+  }
+  printf("Error!!! Increase security error on handle %d, error code = %d\r\n", conn->handle, result);
+  metricsError(METRICS_BONDING_FAILURE, result);
+  bondStoreRecordFailure();
+  bgapiCmdLeConnectionClose(conn->handle, NULL, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  The link is encrypted: record how long it took, then set up GATT.
+ *  \param[in] conn Connection.
+ **************************************************************************************************/
+static void linkEncrypted(struct connection *conn)
+{
+  uint64_t setupNs = timeNowNs() - conn->openedNs;
+
+  metricsObserve(conn->pairing ? METRICS_PAIR_TIME : METRICS_ENCRYPT_TIME, setupNs);
+  if (conn->bonding != BOND_NONE) {
+    bondStoreRecordSetup(adapterCurrent()->index, conn->bonding, !conn->pairing, setupNs);
+  }
+  printf("BOND --- > handle %d %s in %.1f ms\r\n", conn->handle,
+         conn->pairing ? "paired and bonded" : "encrypted with the stored bond", setupNs / 1e6);
+  conn->pairing = false;
+  gattSetup(conn);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Save the handles discovered on this link.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void storeInCache(struct connection *conn)
+{
+  struct gattCacheEntry entry;
+
+  if (!profileCached) {
+    return;
+  }
+  memset(&entry, 0, sizeof(entry));
+  entry.address = conn->address;
+  entry.addressType = conn->addressType;
+  entry.serviceHandle = conn->serviceHandle;
+  entry.gattServiceHandle = conn->gattServiceHandle;
+  entry.notifyHandle = conn->notifyHandle;
+  entry.rwHandle = conn->rwHandle;
+  entry.cccHandle = conn->cccHandle;
+  entry.hashValid = conn->hashRead;
+  memcpy(entry.dbHash, conn->dbHash, sizeof(entry.dbHash));
+  gattCacheStore(&entry);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Finish setup without the Database Hash: cache a cold link's handles as they are, trust
+ *          the cache on a warm one.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void readyWithoutHash(struct connection *conn)
+{
+  if (!conn->fromCache) {
+    storeInCache(conn);
+  }
+  connectionReady(conn);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Read the peer's Database Hash, to store it (cold link) or to validate the cache (warm).
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void readDatabaseHash(struct connection *conn)
+{
+  conn->hashRead = false;
+  connSetState(conn, READING_DB_HASH);
+  bgapiCmdGattReadCharacteristicValueByUuid(conn->handle, conn->gattServiceHandle, sizeof(dbHashCharUUID),
+                                            dbHashCharUUID, onHashReadResponse, CONN_CTX(conn));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to the Database Hash read, or to the discovery of the service holding it:
+ *          carry on without the hash if the procedure could not start.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onHashReadResponse(uint16_t result, const struct gecko_cmd_packet *rsp, void *ctx)
+{
+  struct connection *conn = connGet((uintptr_t)ctx);
+
+  if (result != 0 && conn != NULL && (conn->state == READING_DB_HASH || conn->state == GATT_SERVICE_DISCOVERING)) {
+    readyWithoutHash(conn);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Notifications are flowing; finish the cache bookkeeping before starting writes.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void notifyEnabled(struct connection *conn)
+{
+  struct gattCacheEntry cached;
+
+  connSetState(conn, NOTIFY_ENABLED);
+  if (conn->fromCache) {
+    /* Validate against the Database Hash where the peer has one; otherwise trust the cache. */
+    if (gattCachePeek(&conn->address, &cached) && cached.hashValid) {
+      readDatabaseHash(conn);
+      return;
+    }
+    connectionReady(conn);
+    return;
+  }
+
+  /* Cold link: look for the Generic Attribute service to pick up the Database Hash. */
+  connSetState(conn, GATT_SERVICE_DISCOVERING);
+  bgapiCmdGattDiscoverPrimaryServicesByUuid(conn->handle, sizeof(gattServiceUUID), gattServiceUUID,
+                                            onHashReadResponse, CONN_CTX(conn));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Hand a value of a GATT profile characteristic other than the notify one to the
+ *          notification pipeline and the shared memory export.
+ *  \param[in] conn Connection context.
+ *  \param[in] characteristic Characteristic handle.
+ *  \param[in] data Value.
+ *  \param[in] len Value length.
+ **************************************************************************************************/
+static void profileValue(struct connection *conn, uint16_t characteristic, const uint8_t *data, uint8_t len)
+{
+  uint64_t nowNs = timeNowNs();
+
+  if (notifyPipeActive()) {
+    notifyPipePush(ADAPTER_LINK_ID(adapterCurrent()->index, conn->handle), characteristic, nowNs, data, len);
+  }
+  if (shmExportActive()) {
+    shmExportNotify(ADAPTER_LINK_ID(adapterCurrent()->index, conn->handle), characteristic, &conn->address, nowNs,
+                    data, len);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Option defaults and the GATT cache, shared by all adapters.
+ **************************************************************************************************/
+void appInit(void)
+{
+  processStartNs = timeNowNs();
+  gattCacheLoad(appCfg.cachePath);
+  if (appCfg.bondPath != NULL) {
+    bondStoreLoad(appCfg.bondPath);
+  }
+  if (appCfg.profile == NULL) {
+    appCfg.profile = linkProfileDefault();
+  }
+  if (gattProfileSize() == 0) {
+    /* No profile file: the Demo Service, notify characteristic and RW characteristic. */
+    gattProfileAdd(GATT_PROFILE_SERVICE, serviceUUID, sizeof(serviceUUID), 0, 0);
+    gattProfileAdd(GATT_PROFILE_SUBSCRIBE, notifyCharUUID, sizeof(notifyCharUUID), 0, 0);
+    gattProfileAdd(GATT_PROFILE_WRITE, rwCharUUID, sizeof(rwCharUUID), 0, 0);
+  }
+  profileChars = NOTIFY_CHAR_ITEM | (gattProfileCount(GATT_PROFILE_WRITE) > 0 ? RW_CHAR_ITEM : 0);
+  profileCached = gattProfileCount(GATT_PROFILE_SERVICE) == 1 && gattProfileCount(GATT_PROFILE_SUBSCRIBE) == 1
+                  && gattProfileCount(GATT_PROFILE_WRITE) <= 1 && gattProfileCount(GATT_PROFILE_POLL) == 0;
+  if (adTargetCount(&appCfg.targets) == 0) {
+    /* Connect to peers advertising the first service of the profile. */
+    const struct gattProfileAttr *service = gattProfileAt(0);
+
+    adTargetAdd(&appCfg.targets, service->uuid + (service->len == 16 ? 0 : 12), service->len);
+  }
+}
+
+void appStart(void)
+{
+  /* Reset_variables() looks at the links of the table: it has to start out empty. */
+  connInit();
+  uartSpeedInit(adapterCurrent()->baudRate);
+  startup.stage = STARTUP_PROBE;
+  startup.timer = -1;
+  startup.reported = false;
+  startup.probeNs = 0;
+  if (appCfg.coldStart) {
+    startupReset();
+    return;
+  }
+  startup.stageNs = timeNowNs();
+  bgapiCmdSystemHello(onHelloResponse, NULL);
+  startup.timer = evloopAddTimer(STARTUP_HELLO_MS, false, onStartupTimeout, NULL);
+}
+
+bool appStarted(void)
+{
+  return startup.stage == STARTUP_DONE;
+}
 
-uint8_t writeCounter = 0;
 /***********************************************************************************************//**
  *  \brief  Event handler function.
  *  \param[in] evt Event pointer.
  **************************************************************************************************/
 void appHandleEvents(struct gecko_cmd_packet *evt)
 {
+  struct connection *conn;
+  const struct gattProfileAttr *attr;
+  bool found;
 
   if (NULL == evt) {
     return;
   }
 
-  // Do not handle any events until system is booted up properly.
+  /* Until the NCP is up for this run, events belong to an earlier run or to the reset: only
+   * the closing of stale links is waited for. */
   if ((BGLIB_MSG_ID(evt->header) != gecko_evt_system_boot_id)
-      && !appBooted) {
+      && startup.stage != STARTUP_DONE) {
 #if defined(DEBUG)
     printf("Event: 0x%04x\n", BGLIB_MSG_ID(evt->header));
 #endif
-    usleep(50000);
+    if (startup.stage == STARTUP_TIDY && BGLIB_MSG_ID(evt->header) == gecko_evt_le_connection_closed_id) {
+      startup.staleClosed++;
+      if (startup.closesPending == 0 && startup.staleClosed >= startup.staleLinks) {
+        startupReady(true);
+      }
+    }
     return;
   }
 
-
-
-
   /* Handle events */
   switch (BGLIB_MSG_ID(evt->header)) {
+    /* After a reset, or when the NCP restarted on its own. */
     case gecko_evt_system_boot_id:
+      startupReady(false);
+      break;
+
+    /* Check for scan response results */
+    case gecko_evt_le_gap_scan_response_id:
+#if (PRINT_ADV_INFO == 1)
+      if (BINLOG_ENABLED(BINLOG_DEBUG)) {
+        binlogEvent(evt);
+      }
+#endif
+      metricsInc(METRICS_SCAN_RESPONSES);
+      // process scan responses: this function returns true if we found a service we are looking for.
+      // Every report goes through it, so that the advertiser database sees the busy times too.
+      found = Process_scan_response(&(evt->data.evt_le_gap_scan_response));
+      scanSchedHeard(found, evt->data.evt_le_gap_scan_response.packet_type, timeNowNs());
+      if (found && shmExportActive()) {
+        shmExportScan(&evt->data.evt_le_gap_scan_response, timeNowNs());
+      }
+      /* A bonded peer is known by the bond the NCP resolved its private address with, whatever it
+       * advertises, and by its identity address from then on. */
+      struct bondEntry bond;
+      bool bonded = appCfg.bondPath != NULL
+                    && bondStoreFind(adapterCurrent()->index, evt->data.evt_le_gap_scan_response.bonding, &bond);
+      if (bonded) {
+        bondStoreRecordResolved();
+        found = true;
+      } else {
+        bond.identity = evt->data.evt_le_gap_scan_response.address;
+        bond.identityType = evt->data.evt_le_gap_scan_response.address_type;
+      }
+      /* Only one connection attempt may be pending, and never two links to the same peer. */
+      if (opening.pending || connectingHandle != NO_CONNECTION || connCount() >= appCfg.maxConnections
+          || connFindByAddress(&bond.identity) != NULL) {
+        break;
+      }
+      // connect unless the peer is held by another adapter
+      if (found && peerRegistryClaim(&bond.identity, adapterCurrent()->index)) {
+        opening.foundNs = timeNowNs();
+        metricsInc(METRICS_SCAN_MATCHES);
+        metricsObserve(METRICS_SCAN_TIME, opening.foundNs - scanStartNs);
+        scanSchedFound(opening.foundNs - scanStartNs);
+        // match found -> pause discovery while the connection is being opened
+        bgapiCmdLeGapEndProcedure(NULL, NULL);
+        scanning = false;
+        printf("OK --- >Device found, connecting.\r\n");
+        metricsInc(METRICS_CONNECT_ATTEMPTS);
+        /* The connection context is allocated when the response brings its handle. */
+        opening.pending = true;
+        opening.address = bond.identity;
+        opening.addressType = bonded ? bond.identityType + le_gap_address_type_public_identity : bond.identityType;
+        opening.direct = false;
+        bgapiCmdLeGapOpen(opening.address, opening.addressType, onOpenResponse, NULL);
+      }
+      break;
 
-        appBooted = true;
-        Reset_variables();
-  			currentState = SCANNING;
-  			/* Start discovery after system booted */
-  			struct gecko_msg_le_gap_discover_rsp_t *retDiscover = gecko_cmd_le_gap_discover(le_gap_discover_generic);
-  			if (retDiscover->result == 0) {
-  				printf("OK --- >Scanning Started.\r\n");
-  			} else {
-  				printf("Error!!! Start Scanning error, error code = %d\r\n", retDiscover->result);
-  			}
+    /* Connection opened event */
+    case gecko_evt_le_connection_opened_id:
+      printf("OK --- >Connected.\r\n");
+      metricsInc(METRICS_LINKS_OPENED);
+      conn = connGet(evt->data.evt_le_connection_opened.connection);
+      if (conn == NULL) {
+        conn = connAlloc(evt->data.evt_le_connection_opened.connection);
+        if (conn == NULL) {
+          bgapiCmdLeConnectionClose(evt->data.evt_le_connection_opened.connection, NULL, NULL);
+          break;
+        }
+        conn->address = evt->data.evt_le_connection_opened.address;
+        conn->addressType = evt->data.evt_le_connection_opened.address_type;
+        conn->foundNs = timeNowNs();
+        struct bondEntry bond;
+        if (appCfg.bondPath != NULL
+            && bondStoreFind(adapterCurrent()->index, evt->data.evt_le_connection_opened.bonding, &bond)) {
+          conn->address = bond.identity;
+          conn->addressType = bond.identityType + le_gap_address_type_public_identity;
+        }
+        peerRegistryClaim(&conn->address, adapterCurrent()->index);
+      }
+      conn->bonding = evt->data.evt_le_connection_opened.bonding;
+      if (conn->handle == connectingHandle) {
+        connectingHandle = NO_CONNECTION;
+      }
+      timerWheelCancel(conn->connectTimer);
+      conn->connectTimer = -1;
+      conn->openedNs = timeNowNs();
+      /* Back after a link loss, whichever way it was found: time until data flows again. */
+      struct reconnectPeer *lost = reconnectFind(&conn->address);
+      if (lost != NULL) {
+        conn->lostNs = lost->lostNs;
+        reconnectRemove(lost);
+      }
+      /* The connection parameters follow the parameters event that comes with every new link. */
+      if (appCfg.profile->phy != 0 || appCfg.streamBytes > 0) {
+        bgapiCmdLeConnectionSetPhy(conn->handle, appCfg.profile->phy != 0 ? appCfg.profile->phy : le_gap_phy_2m,
+                                   NULL, NULL);
+      }
+      if (appCfg.bondPath != NULL) {
+        secureLink(conn);
+      } else {
+        gattSetup(conn);
+      }
+      /* Keep looking for further peripherals while this link is being set up. */
+      connectNext();
+      break;
 
+    case gecko_evt_gatt_service_id:
+      conn = connGet(evt->data.evt_gatt_service.connection);
+      if (conn == NULL) {
+        break;
+      }
+      if ((conn->state == CONNECTED || conn->state == SERVICE_FOUND)
+          && gattClientAddService(conn, evt->data.evt_gatt_service.service, evt->data.evt_gatt_service.uuid.data,
+                                  evt->data.evt_gatt_service.uuid.len)) {
+        printf("OK --- >Service Found\r\n");
+        if (conn->state == CONNECTED) {
+          connSetState(conn, SERVICE_FOUND);
+          conn->serviceHandle = evt->data.evt_gatt_service.service;
+        }
+        /* Profile service found, will start discovering characteristics in gap complete event since there might be more services causing current GATT operation not done yet */
+      }
+      if (evt->data.evt_gatt_service.uuid.len == 2 && !memcmp(evt->data.evt_gatt_service.uuid.data, gattServiceUUID, 2)) {
+        conn->gattServiceHandle = evt->data.evt_gatt_service.service;
+      }
+      break;
 
+    case gecko_evt_gatt_descriptor_id:
+      conn = connGet(evt->data.evt_gatt_descriptor.connection);
+      if (conn != NULL && evt->data.evt_gatt_descriptor.uuid.len == 2
+          && !memcmp(evt->data.evt_gatt_descriptor.uuid.data, cccDescriptorUUID, 2)) {
+        printf("OK --- >CCC descriptor Found\r\n");
+        conn->cccHandle = evt->data.evt_gatt_descriptor.descriptor;
+      }
       break;
 
+    case gecko_evt_gatt_characteristic_id:
+      conn = connGet(evt->data.evt_gatt_characteristic.connection);
+      if (conn == NULL) {
+        break;
+      }
+      /* The rest of the last service still counts once the required characteristics are found. */
+      if (conn->state != CHARACTERISTICS_DISCOVERING && conn->state != CHARACTERISTICS_FOUND) {
+        break;
+      }
+      attr = gattClientAddCharacteristic(conn, evt->data.evt_gatt_characteristic.characteristic,
+                                         evt->data.evt_gatt_characteristic.uuid.data,
+                                         evt->data.evt_gatt_characteristic.uuid.len);
+      if (attr == NULL) {
+        break;
+      }
+      /* The first characteristic to subscribe to carries the link's data, the first to write its writes. */
+      if (attr->action == GATT_PROFILE_SUBSCRIBE && conn->notifyHandle == NO_HANDLE) {
+        printf("OK --- >Notify Char Found\r\n");
+        conn->characteristicsState |= NOTIFY_CHAR_ITEM;
+        conn->notifyHandle = evt->data.evt_gatt_characteristic.characteristic;
+        conn->serviceHandle = conn->services[conn->serviceNext];
+      } else if (attr->action == GATT_PROFILE_WRITE && conn->rwHandle == NO_HANDLE) {
+        printf("OK --- >RW Char Found\r\n");
+        conn->characteristicsState |= RW_CHAR_ITEM;
+        conn->rwHandle = evt->data.evt_gatt_characteristic.characteristic;
+      }
+      if (conn->characteristicsState == profileChars && conn->serviceNext + 1 == conn->serviceCount) {
+        printf("OK --- >All characteristics found.\r\n");
+        connSetState(conn, CHARACTERISTICS_FOUND);
+        /* Profile characteristics found, will enable notification in gap complete event */
+      }
+      break;
 
-		        /* Check for scan response results */
-        case gecko_evt_le_gap_scan_response_id:
-
-        #if (PRINT_ADV_INFO == 1)
-        				printf("address ---> ");
-        				for(uint8_t i=0; i< 6; i++) {
-        					printf("0x%02x ", evt->data.evt_le_gap_scan_response.address.addr[i]);
-        				}
-        				printf(" ---- ");
-        				printf("advertisement packet --> ");
-        				for(uint8_t i=0; i< evt->data.evt_le_gap_scan_response.data.len; i++) {
-        					printf("0x%02x ", evt->data.evt_le_gap_scan_response.data.data[i]);
-        				}
-        				printf("\r\n");
-        #endif
-        				// process scan responses: this function returns 1 if we found the service we are looking for
-        				if (Process_scan_response(&(evt->data.evt_le_gap_scan_response)) > 0) {
-        					struct gecko_msg_le_gap_open_rsp_t *pResp;
-        					// match found -> stop discovery and try to connect
-        					gecko_cmd_le_gap_end_procedure();
-        					printf("OK --- >Device found, connecting.\r\n");
-        					pResp = gecko_cmd_le_gap_open(evt->data.evt_le_gap_scan_response.address, evt->data.evt_le_gap_scan_response.address_type);
-        					// make copy of connection handle for later use (for example, to cancel the connection attempt)
-        					connHandle = pResp->connection;
-        				}
-            break;
-
-            /* Connection opened event */
-    			case gecko_evt_le_connection_opened_id:
-      				printf("OK --- >Connected.\r\n");
-      				currentState = CONNECTED;
-      				connHandle = evt->data.evt_le_connection_opened.connection;
-      				/* Search for specified Demo service after connection opened */
-      				struct gecko_msg_gatt_discover_primary_services_by_uuid_rsp_t *retDisService = gecko_cmd_gatt_discover_primary_services_by_uuid(connHandle, 16, serviceUUID);
-      				if (retDisService->result == 0) {
-      					printf("OK --- >Start discovering demo service.\r\n");
-      				} else {
-      					printf("Error!!! Start Discovery error, error code = %d\r\n", retDisService->result);
-      				}
-    			break;
-
-          case gecko_evt_gatt_service_id:
-      				if (!memcmp(evt->data.evt_gatt_service.uuid.data, serviceUUID, 16)) {
-      					printf("OK --- >Service Found\r\n");
-      					currentState = SERVICE_FOUND;
-      					serviceHandle = evt->data.evt_gatt_service.service;
-      					/* Specified Demo service found, will start discovering characteristics in gap complete event since there might be more services causing current GATT operation not done yet */
-      				}
-      	 break;
-
-         case gecko_evt_gatt_characteristic_id:
-               if (!memcmp(evt->data.evt_gatt_characteristic.uuid.data, notifyCharUUID, 16)) {
-                 printf("OK --- >Notify Char Found\r\n");
-                 characteristicsState |= NOTIFY_CHAR_ITEM;
-                 notifyHandle = evt->data.evt_gatt_characteristic.characteristic;
-               }
-               if (!memcmp(evt->data.evt_gatt_characteristic.uuid.data, rwCharUUID, 16)) {
-                 printf("OK --- >RW Char Found\r\n");
-                 characteristicsState |= RW_CHAR_ITEM;
-                 rwHandle = evt->data.evt_gatt_characteristic.characteristic;
-               }
-               if (characteristicsState == ALL_CHARS) {
-                 printf("OK --- >All characteristics found.\r\n");
-                 currentState = CHARACTERISTICS_FOUND;
-                 /* Specified characteristics in Demo service found, will enable notification in gap complete event */
-               }
-         break;
-
-         /* Received data from notification or read operations */
-        case gecko_evt_gatt_characteristic_value_id:
-               if (evt->data.evt_gatt_characteristic_value.characteristic == notifyHandle) {
-                 printf("OK --- >Received notification data --> ");
-                 for (uint8_t i = 0; i < evt->data.evt_gatt_characteristic_value.value.len; i++) {
-                   printf("0x%02x ", evt->data.evt_gatt_characteristic_value.value.data[i]);
-                 }
-                 printf("\r\n");
-               } else if (evt->data.evt_gatt_characteristic_value.characteristic == rwHandle) {
-                 printf("OK --- >Received read data --> ");
-                 for (uint8_t i = 0; i < evt->data.evt_gatt_characteristic_value.value.len; i++) {
-                   printf("0x%02x ", evt->data.evt_gatt_characteristic_value.value.data[i]);
-                 }
-                 printf("\r\n");
-               }
+    /* Received data from notification or read operations */
+    case gecko_evt_gatt_characteristic_value_id:
+      conn = connGet(evt->data.evt_gatt_characteristic_value.connection);
+      if (conn == NULL) {
         break;
+      }
+      if (evt->data.evt_gatt_characteristic_value.characteristic == conn->notifyHandle) {
+        if (conn->firstNotifyNs == 0) {
+          conn->firstNotifyNs = timeNowNs();
+          gattCacheRecordTtfn(conn->fromCache, conn->firstNotifyNs - conn->openedNs);
+          printf("CACHE --- > first notification (handle %d) %.1f ms after connect, %s\r\n", conn->handle,
+                 (conn->firstNotifyNs - conn->openedNs) / 1e6, conn->fromCache ? "warm" : "cold");
+          gattCacheReport();
+          if (conn->lostNs != 0) {
+            metricsObserve(conn->direct ? METRICS_RESUME_DIRECT_TIME : METRICS_RESUME_SCAN_TIME,
+                           conn->firstNotifyNs - conn->lostNs);
+            printf("RECONNECT --- > data resumed on handle %d %.1f ms after the link loss, %s\r\n", conn->handle,
+                   (conn->firstNotifyNs - conn->lostNs) / 1e6, conn->direct ? "direct" : "scanned");
+          }
+        }
+        if (appCfg.rttRate > 0) {
+          rttReceive(conn, evt->data.evt_gatt_characteristic_value.value.data,
+                     evt->data.evt_gatt_characteristic_value.value.len);
+        }
+        conn->notifications++;
+        conn->notifyBytes += evt->data.evt_gatt_characteristic_value.value.len;
+        metricsInc(METRICS_NOTIFICATIONS);
+        metricsAdd(METRICS_NOTIFY_BYTES, evt->data.evt_gatt_characteristic_value.value.len);
+        stressNotifications++;
+        stressBytes += evt->data.evt_gatt_characteristic_value.value.len;
+        if (notifyPipeActive()) {
+          notifyPipePush(ADAPTER_LINK_ID(adapterCurrent()->index, conn->handle), evt->data.evt_gatt_characteristic_value.characteristic, timeNowNs(),
+                         evt->data.evt_gatt_characteristic_value.value.data,
+                         evt->data.evt_gatt_characteristic_value.value.len);
+        }
+        if (shmExportActive()) {
+          shmExportNotify(ADAPTER_LINK_ID(adapterCurrent()->index, conn->handle),
+                          evt->data.evt_gatt_characteristic_value.characteristic, &conn->address, timeNowNs(),
+                          evt->data.evt_gatt_characteristic_value.value.data,
+                          evt->data.evt_gatt_characteristic_value.value.len);
+        }
+        if (BINLOG_ENABLED(BINLOG_INFO)) {
+          binlogEvent(evt);
+        }
+      } else if (evt->data.evt_gatt_characteristic_value.characteristic == conn->rwHandle) {
+        if (BINLOG_ENABLED(BINLOG_INFO)) {
+          binlogEvent(evt);
+        }
+      } else if (conn->state == READING_DB_HASH && evt->data.evt_gatt_characteristic_value.value.len == sizeof(conn->dbHash)) {
+        memcpy(conn->dbHash, evt->data.evt_gatt_characteristic_value.value.data, sizeof(conn->dbHash));
+        conn->hashRead = true;
+      } else if (gattClientValue(conn, evt->data.evt_gatt_characteristic_value.characteristic,
+                                 evt->data.evt_gatt_characteristic_value.att_opcode,
+                                 evt->data.evt_gatt_characteristic_value.offset,
+                                 evt->data.evt_gatt_characteristic_value.value.data,
+                                 evt->data.evt_gatt_characteristic_value.value.len, profileValue)) {
+        /* Polled values, split out of a read multiple response. */
+        if (BINLOG_ENABLED(BINLOG_INFO)) {
+          binlogEvent(evt);
+        }
+      } else if (gattClientFind(conn, evt->data.evt_gatt_characteristic_value.characteristic) != NULL) {
+        /* Further profile characteristics subscribed to. */
+        if (evt->data.evt_gatt_characteristic_value.att_opcode == gatt_handle_value_notification) {
+          metricsInc(METRICS_NOTIFICATIONS);
+        }
+        profileValue(conn, evt->data.evt_gatt_characteristic_value.characteristic,
+                     evt->data.evt_gatt_characteristic_value.value.data,
+                     evt->data.evt_gatt_characteristic_value.value.len);
+        if (BINLOG_ENABLED(BINLOG_INFO)) {
+          binlogEvent(evt);
+        }
+      }
+      break;
 
-        case gecko_evt_gatt_procedure_completed_id:
-      				if (currentState == SERVICE_FOUND) {
-      					currentState = CHARACTERISTICS_DISCOVERING;
-      					struct gecko_msg_gatt_discover_characteristics_rsp_t *ret = gecko_cmd_gatt_discover_characteristics(connHandle, serviceHandle);
-      					if (ret->result == 0) {
-      						printf("OK --- >Start discovering demo characteristics.\r\n");
-      					} else {
-      						printf("Error!!! Start Discovery characteristics error, error code = %d\r\n", ret->result);
-      					}
-      				} else if (currentState == CHARACTERISTICS_FOUND) {
-      					currentState = ENABLING_NOTIFY;
-      					struct gecko_msg_gatt_set_characteristic_notification_rsp_t *ret1 = gecko_cmd_gatt_set_characteristic_notification(connHandle, notifyHandle, gatt_notification);
-      					if (ret1->result == 0) {
-      						printf("OK --- >Set notification CCC to 0x0001.\r\n");
-      					} else {
-      						printf("Error!!! Enable notification error, error code = %d\r\n", ret1->result);
-      					}
-      				} else if (currentState == ENABLING_NOTIFY) {
-      //		printf("gatt complete result --> %d\r\n", evt->data.evt_gatt_procedure_completed.result);
-      					if (evt->data.evt_gatt_procedure_completed.result == 0) {
-      						printf("OK --- >Notification enabled.\r\n");
-      						currentState = NOTIFY_ENABLED;
-									//Start SoftTimer for Write operations every 100ms
-									gecko_cmd_hardware_set_soft_timer(3277, 0, 0);
-									printf("OK --- > Central will Write to Server every 100ms \r\n");
-									currentState = ENABLING_WRITE;
-
-      					} else {
-      						printf("Enable notification failed, error code = %d, try the handle next to characteristic.\r\n", evt->data.evt_gatt_procedure_completed.result);
-      						uint8_t buf[2] = {
-      								0x01,
-      								0x00 };
-      						gecko_cmd_gatt_write_characteristic_value(connHandle, notifyHandle + 1, 2, buf);
-
-      					}
-      				}
-			break;
-
-      case gecko_evt_gatt_mtu_exchanged_id:
-	           printf("Exchanged MTU = %d\r\n", evt->data.evt_gatt_mtu_exchanged.mtu);
-			break;
-
-    	case gecko_evt_le_connection_closed_id:
-    					Reset_variables();
-    					printf("Disconnected. Scanning Restarted.\r\n");
-    					/* Restart advertising after client has disconnected */
-    					currentState = SCANNING;
-    					gecko_cmd_le_gap_discover(le_gap_discover_generic);
-			break;
-
-			case gecko_evt_hardware_soft_timer_id:
-
-     	  writeCounter++;
-
-     	  //It sends the notifications
-				gecko_cmd_gatt_write_characteristic_value(connHandle, rwHandle, 1, &writeCounter);
-
-     	  printf("OK --- > Writing to Server %d \r\n", writeCounter);
-
-         break;
+    case gecko_evt_gatt_procedure_completed_id:
+      conn = connGet(evt->data.evt_gatt_procedure_completed.connection);
+      if (conn == NULL) {
+        break;
+      }
+      if (evt->data.evt_gatt_procedure_completed.result != 0) {
+        metricsError(METRICS_GATT_FAILURE, evt->data.evt_gatt_procedure_completed.result);
+      }
+      if (gattClientCompleted(conn, evt->data.evt_gatt_procedure_completed.result)) {
+        break;
+      }
+      if (conn->state == SERVICE_FOUND) {
+        conn->serviceNext = 0;
+        discoverCharacteristics(conn);
+      } else if (conn->state == CHARACTERISTICS_DISCOVERING && conn->serviceNext + 1 < conn->serviceCount) {
+        /* Characteristics of the profile may still be in the services not searched yet. */
+        conn->serviceNext++;
+        discoverCharacteristics(conn);
+      } else if (conn->state == CHARACTERISTICS_DISCOVERING && conn->characteristicsState != profileChars) {
+        printf("Error!!! Characteristics of the GATT profile missing on handle %d, closing.\r\n", conn->handle);
+        bgapiCmdLeConnectionClose(conn->handle, NULL, NULL);
+      } else if (conn->state == CHARACTERISTICS_FOUND || conn->state == CHARACTERISTICS_DISCOVERING) {
+        /* All found: on the last service, or already in an earlier one. */
+        connSetState(conn, DESCRIPTORS_DISCOVERING);
+        bgapiCmdGattDiscoverDescriptors(conn->handle, conn->notifyHandle, onStartResponse,
+                                        (void *)&discoverDescriptorsReport);
+      } else if (conn->state == DESCRIPTORS_DISCOVERING) {
+        if (conn->cccHandle == NO_HANDLE) {
+          /* Same assumption as the fallback below: the CCC follows the characteristic value. */
+          conn->cccHandle = conn->notifyHandle + 1;
+        }
+        connSetState(conn, ENABLING_NOTIFY);
+        bgapiCmdGattSetCharacteristicNotification(conn->handle, conn->notifyHandle, gatt_notification, onStartResponse,
+                                                  (void *)&enableNotifyReport);
+      } else if (conn->state == ENABLING_NOTIFY) {
+        if (evt->data.evt_gatt_procedure_completed.result == 0) {
+          printf("OK --- >Notification enabled.\r\n");
+          notifyEnabled(conn);
+        } else if (conn->fromCache) {
+          printf("Error!!! Cached CCC write failed, error code = %d, rediscovering.\r\n", evt->data.evt_gatt_procedure_completed.result);
+          gattCacheInvalidate(&conn->address);
+          discoverServices(conn);
+        } else {
+          printf("Enable notification failed, error code = %d, try the handle next to characteristic.\r\n", evt->data.evt_gatt_procedure_completed.result);
+          uint8_t buf[2] = {
+            0x01,
+            0x00 };
+          bgapiCmdGattWriteCharacteristicValue(conn->handle, conn->notifyHandle + 1, 2, buf, NULL, NULL);
+        }
+      } else if (conn->state == SUBSCRIBING) {
+        if (evt->data.evt_gatt_procedure_completed.result != 0) {
+          printf("Error!!! Profile subscription failed on handle %d, error code = %d\r\n", conn->handle,
+                 evt->data.evt_gatt_procedure_completed.result);
+        }
+        connectionReady(conn);
+      } else if (conn->state == GATT_SERVICE_DISCOVERING) {
+        if (conn->gattServiceHandle == 0) {
+          readyWithoutHash(conn);
+        } else {
+          readDatabaseHash(conn);
+        }
+      } else if (conn->state == ENABLING_WRITE && conn->writeNs != 0) {
+        uint64_t writeNs = timeNowNs() - conn->writeNs;
+
+        conn->writeNs = 0;
+        metricsObserve(METRICS_WRITE_TIME, writeNs);
+        stressWrites++;
+        stressWriteNs += writeNs;
+      } else if (conn->state == STREAM_DRAINING) {
+        streamCompleted(conn, evt->data.evt_gatt_procedure_completed.result);
+      } else if (conn->state == READING_DB_HASH) {
+        if (!conn->fromCache) {
+          storeInCache(conn);
+          connectionReady(conn);
+          break;
+        }
+        struct gattCacheEntry cached;
+        if (gattCachePeek(&conn->address, &cached) && conn->hashRead
+            && !memcmp(cached.dbHash, conn->dbHash, sizeof(conn->dbHash))) {
+          connectionReady(conn);
+        } else {
+          printf("CACHE --- > Database Hash changed on handle %d, rediscovering.\r\n", conn->handle);
+          gattCacheInvalidate(&conn->address);
+          discoverServices(conn);
+        }
+      }
+      break;
+
+    case gecko_evt_gatt_mtu_exchanged_id:
+      printf("Exchanged MTU = %d\r\n", evt->data.evt_gatt_mtu_exchanged.mtu);
+      conn = connGet(evt->data.evt_gatt_mtu_exchanged.connection);
+      if (conn != NULL) {
+        conn->mtu = evt->data.evt_gatt_mtu_exchanged.mtu;
+      }
+      break;
+
+    case gecko_evt_le_connection_phy_status_id:
+      printf("OK --- >PHY %d on handle %d\r\n", evt->data.evt_le_connection_phy_status.phy,
+             evt->data.evt_le_connection_phy_status.connection);
+      conn = connGet(evt->data.evt_le_connection_phy_status.connection);
+      if (conn != NULL) {
+        conn->phy = evt->data.evt_le_connection_phy_status.phy;
+      }
+      break;
+
+    case gecko_evt_le_connection_parameters_id:
+      conn = connGet(evt->data.evt_le_connection_parameters.connection);
+      if (conn == NULL) {
+        break;
+      }
+      conn->interval = evt->data.evt_le_connection_parameters.interval;
+      conn->latency = evt->data.evt_le_connection_parameters.latency;
+      conn->timeout = evt->data.evt_le_connection_parameters.timeout;
+      conn->txsize = evt->data.evt_le_connection_parameters.txsize;
+      printf("PROFILE --- > handle %d: interval %.2f ms, slave latency %d, supervision timeout %d ms, %d-byte packets\r\n",
+             conn->handle, conn->interval * (LINK_PROFILE_INTERVAL_US / 1000.0), conn->latency,
+             conn->timeout * LINK_PROFILE_TIMEOUT_MS, conn->txsize);
+      /* Encryption with a stored bond shows only here; a new bond also ends with sm_bonded. */
+      if (conn->state == ENCRYPTING && !conn->pairing
+          && evt->data.evt_le_connection_parameters.security_mode > le_connection_mode1_level1) {
+        linkEncrypted(conn);
+      }
+      /* First the parameters the link opened with, later any the peripheral asked for: hold to the profile. */
+      if (!linkProfileAccepts(appCfg.profile, conn->interval, conn->latency, conn->timeout)
+          && conn->profileRequests < LINK_PROFILE_MAX_REQUESTS) {
+        requestLinkParameters(conn);
+      }
+      break;
+
+    case gecko_evt_sm_list_bonding_entry_id:
+      bondStoreListEntry(adapterCurrent()->index, evt->data.evt_sm_list_bonding_entry.bonding,
+                         &evt->data.evt_sm_list_bonding_entry.address,
+                         evt->data.evt_sm_list_bonding_entry.address_type);
+      break;
+
+    case gecko_evt_sm_list_all_bondings_complete_id:
+      bondStoreListEnd(adapterCurrent()->index);
+      /* Links that just bonded go by the identity address from now on: it is the one a direct
+       * reconnection and the handle cache can rely on, unlike the private address they opened with. */
+      for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+        struct bondEntry bond;
+
+        conn = connAt(i);
+        if (conn == NULL || !bondStoreFind(adapterCurrent()->index, conn->bonding, &bond)
+            || !memcmp(&conn->address, &bond.identity, sizeof(bd_addr))) {
+          continue;
+        }
+        peerRegistryRelease(&conn->address, adapterCurrent()->index);
+        conn->address = bond.identity;
+        conn->addressType = bond.identityType + le_gap_address_type_public_identity;
+        peerRegistryClaim(&conn->address, adapterCurrent()->index);
+      }
+      break;
+
+    case gecko_evt_sm_bonded_id:
+      conn = connGet(evt->data.evt_sm_bonded.connection);
+      if (conn == NULL) {
+        break;
+      }
+      if (conn->pairing && evt->data.evt_sm_bonded.bonding != BOND_NONE) {
+        conn->bonding = evt->data.evt_sm_bonded.bonding;
+        bondStoreBonded(adapterCurrent()->index, conn->bonding, &conn->address, conn->addressType);
+        /* The list brings the identity address the peer distributed while bonding. */
+        bondStoreListBegin(adapterCurrent()->index);
+        bgapiCmdSmListAllBondings(NULL, NULL);
+      }
+      if (conn->state == ENCRYPTING) {
+        linkEncrypted(conn);
+      }
+      break;
+
+    case gecko_evt_sm_bonding_failed_id:
+      conn = connGet(evt->data.evt_sm_bonding_failed.connection);
+      metricsError(METRICS_BONDING_FAILURE, evt->data.evt_sm_bonding_failed.reason);
+      bondStoreRecordFailure();
+      if (conn == NULL || conn->state != ENCRYPTING) {
+        break;
+      }
+      printf("Error!!! %s failed on handle %d, reason 0x%04x\r\n", conn->pairing ? "Pairing" : "Encryption",
+             conn->handle, evt->data.evt_sm_bonding_failed.reason);
+      if (!conn->pairing && evt->data.evt_sm_bonding_failed.reason == bg_err_bt_pin_or_key_missing) {
+        /* The peer lost its side of the bond: drop ours and pair again. */
+        bgapiCmdSmDeleteBonding(conn->bonding, NULL, NULL);
+        bondStoreForget(adapterCurrent()->index, conn->bonding);
+        conn->bonding = BOND_NONE;
+        secureLink(conn);
+      } else {
+        bgapiCmdLeConnectionClose(conn->handle, NULL, NULL);
+      }
+      break;
+
+    case gecko_evt_le_connection_closed_id:
+      conn = connGet(evt->data.evt_le_connection_closed.connection);
+      if (conn != NULL) {
+        timerWheelCancel(conn->connectTimer);
+        timerWheelCancel(conn->writeJob);
+        streamStop(conn);
+        rttStop(conn);
+        if (conn->handle == connectingHandle) {
+          connectingHandle = NO_CONNECTION;
+        }
+        /* A link closed before it opened is a failed attempt, a timeout included. */
+        metricsError(conn->state == CONNECTING ? METRICS_CONNECT_FAILURE : METRICS_DISCONNECT,
+                     evt->data.evt_le_connection_closed.reason);
+        if (conn->state != CONNECTING) {
+          reconnectAdd(&conn->address, conn->addressType, timeNowNs());
+          /* Back to full duty at once if discovery is running slow for the other slots. */
+          scanSchedLost(timeNowNs());
+          onScanTimer(-1, NULL);
+        } else if (conn->direct) {
+          reconnectAttemptFailed(&conn->address);
+        }
+        peerRegistryRelease(&conn->address, adapterCurrent()->index);
+        connFree(conn);
+      }
+      printf("Disconnected (handle %d, reason 0x%04x), %u links left.\r\n",
+             evt->data.evt_le_connection_closed.connection,
+             evt->data.evt_le_connection_closed.reason, connCount());
+      /* Reconnect to the lost peer, or restart discovery to replace the link */
+      connectNext();
+      break;
 
     default:
       break;
@@ -16,6 +16,13 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad_parser.h"
+#include "link_profile.h"
+#include "uart_speed.h"
+
 /***********************************************************************************************//**
  * \defgroup app Application Code
  * \brief Sample Application Implementation
@@ -35,10 +42,58 @@ extern "C" {
  * Type Definitions
  **************************************************************************************************/
 
+/** Interval between stress mode throughput reports. */
+#define STRESS_REPORT_MS              5000
+
+/** Default interval between the periodic 1-byte writes to every peer, and its bounds. */
+#define WRITE_PERIOD_MS               100
+#define WRITE_PERIOD_MIN_MS           10
+#define WRITE_PERIOD_MAX_MS           60000
+
+/** Run-time options, filled in from the command line before the first event. */
+struct appConfig {
+  uint8_t maxConnections;   /**< number of peripherals to hold at once, 1 to MAX_CONNECTIONS */
+  bool stressMode;          /**< report per-link setup time and aggregate throughput */
+  const char *cachePath;    /**< GATT handle cache file */
+  struct adTargetSet targets; /**< service UUIDs to connect to, the Demo Service if empty */
+  uint32_t streamBytes;     /**< bytes to stream to every peer, 0 for the periodic 1-byte writes */
+  uint16_t streamPayload;   /**< bytes per streamed write, 0 for ATT MTU - 3 */
+  uint32_t rttRate;         /**< round-trip probes per second per link, 0 for the periodic 1-byte writes */
+  uint16_t rttPayload;      /**< bytes per round-trip probe */
+  bool directReconnect;     /**< reopen lost links by address instead of waiting for a scan match */
+  bool adaptiveScan;        /**< tune the scan parameters to how discovery goes, see scan_sched.h */
+  const struct linkProfile *profile; /**< link-layer parameters requested on every link */
+  bool coldStart;           /**< always reset the NCP at startup instead of reusing a running one */
+  struct uartSpeedRates baudRates; /**< baud rates to raise the UART to, see uart_speed.h; none to stay */
+  const char *bondPath;     /**< bond store file, see bond_store.h; NULL to leave links unencrypted */
+  uint16_t writePeriodMs;   /**< interval between the periodic 1-byte writes to every peer */
+};
+
+extern struct appConfig appCfg;
+
 /***************************************************************************************************
  * Function Declarations
  **************************************************************************************************/
 
+/***********************************************************************************************//**
+ *  \brief  Fill in the defaults of the options not given and load the GATT cache. Called once,
+ *          before any adapter starts.
+ **************************************************************************************************/
+void appInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Bring up the NCP of the calling adapter, once its UART is in the event loop. An NCP
+ *          that answers hello is reused, after closing what an earlier run left open; one that
+ *          does not, or every NCP with appCfg.coldStart, is reset.
+ **************************************************************************************************/
+void appStart(void);
+
+/***********************************************************************************************//**
+ *  \brief  Whether the NCP of the calling adapter came up.
+ *  \return  true once it was reused or booted.
+ **************************************************************************************************/
+bool appStarted(void);
+
 /***********************************************************************************************//**
  *  \brief  Handle application events.
  *  \param[in]  evt  incoming event ID
@@ -0,0 +1,267 @@
+/***********************************************************************************************//**
+ * \file   bgapi_cmd.c
+ * \brief  Non-blocking BGAPI commands: a pending-response queue with completion callbacks
+ ***************************************************************************************************
+ * The queue is a ring of complete command frames. Entries from queueHead to queueSent have
+ * been copied to the transmit buffer and await their response; entries from queueSent to
+ * queueTail wait for the in-flight limit. The transmit buffer is written when the UART is
+ * writable, so the commands queued during one loop pass share a single write().
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+#include "adapter.h"
+#include "bgapi_rx.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "serial.h"
+
+/* Own header */
+#include "bgapi_cmd.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Header word of a command: identifier and payload length, as BGLIB builds it. */
+#define BGAPI_CMD_HEADER(id, len)     ((id) + (((len) & 0xff) << 8) + (((len) & 0x700) >> 8))
+
+/** Result code of a response: its first field, whatever the command. */
+#define BGAPI_CMD_RESULT(packet)      ((uint16_t)((packet)->data.payload[0] | ((packet)->data.payload[1] << 8)))
+
+/** A queued command. */
+struct bgapiCmdEntry {
+  struct gecko_cmd_packet packet;
+  bgapiCmdCallback callback;
+  void* ctx;
+  uint64_t queuedNs;
+};
+
+static ADAPTER_LOCAL struct bgapiCmdEntry queue[BGAPI_CMD_QUEUE_SIZE];
+static ADAPTER_LOCAL uint32_t queueHead = 0;
+static ADAPTER_LOCAL uint32_t queueSent = 0;
+static ADAPTER_LOCAL uint32_t queueTail = 0;
+
+/** Filled in when the queue is full, so that bgapiCmdPrepare() never fails, and handed to the
+ *  callbacks of failed commands. */
+static ADAPTER_LOCAL struct gecko_cmd_packet overflowPacket;
+
+static ADAPTER_LOCAL uint8_t txBuf[BGAPI_CMD_TX_SIZE];
+static ADAPTER_LOCAL uint32_t txLen = 0;
+
+/** Commands awaiting a response at the same time. */
+static ADAPTER_LOCAL uint8_t cmdDepth = BGAPI_CMD_DEFAULT_DEPTH;
+
+/** The UART is watched for POLLOUT. */
+static ADAPTER_LOCAL bool txArmed = false;
+
+static ADAPTER_LOCAL struct bgapiCmdStats stats;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void bgapiCmdRelease(uint32_t limit);
+static void bgapiCmdArm(void);
+static void bgapiCmdFail(uint32_t id, bgapiCmdCallback callback, void* ctx, uint16_t result);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void bgapiCmdInit(uint8_t depth)
+{
+  queueHead = 0;
+  queueSent = 0;
+  queueTail = 0;
+  txLen = 0;
+  txArmed = false;
+  cmdDepth = MAX(1, MIN(depth, BGAPI_CMD_MAX_DEPTH));
+  memset(&stats, 0, sizeof(stats));
+}
+
+void bgapiCmdReset(void)
+{
+  queueHead = queueTail;
+  queueSent = queueTail;
+  txLen = 0;
+  bgapiCmdArm();
+}
+
+struct gecko_cmd_packet* bgapiCmdPrepare(void)
+{
+  if (queueTail - queueHead == BGAPI_CMD_QUEUE_SIZE) {
+    return &overflowPacket;
+  }
+  return &queue[queueTail % BGAPI_CMD_QUEUE_SIZE].packet;
+}
+
+int bgapiCmdSubmit(uint32_t id, uint32_t len, bgapiCmdCallback callback, void* ctx)
+{
+  struct bgapiCmdEntry* entry;
+
+  if (queueTail - queueHead == BGAPI_CMD_QUEUE_SIZE) {
+    stats.rejected++;
+    bgapiCmdFail(id, callback, ctx, bg_err_out_of_memory);
+    return -1;
+  }
+  entry = &queue[queueTail % BGAPI_CMD_QUEUE_SIZE];
+  entry->packet.header = BGAPI_CMD_HEADER(id, len);
+  entry->callback = callback;
+  entry->ctx = ctx;
+  entry->queuedNs = timeNowNs();
+  queueTail++;
+  stats.commands++;
+  stats.maxPending = MAX(stats.maxPending, queueTail - queueHead);
+  bgapiCmdArm();
+  return 0;
+}
+
+int32_t bgapiCmdFlush(void)
+{
+  int32_t ret;
+
+  bgapiCmdRelease(queueHead + cmdDepth);
+  if (txLen > 0) {
+    ret = serialWrite(txBuf, txLen);
+    if (ret < 0) {
+      return -1;
+    }
+    if (ret > 0) {
+      stats.writes++;
+      txLen -= ret;
+      memmove(txBuf, txBuf + ret, txLen);
+    }
+  }
+  bgapiCmdArm();
+  return 0;
+}
+
+void bgapiCmdComplete(const struct gecko_cmd_packet* rsp)
+{
+  struct bgapiCmdEntry* entry;
+  bgapiCmdCallback callback;
+  void* ctx;
+  uint64_t latencyNs;
+  uint32_t match = queueHead;
+
+  /* Responses come in command order: one to a later command means that the NCP never answered
+   * the commands before it. One to no command awaiting a response, e.g. after BGLIB read the
+   * raw stream, is stray. Either way a callback never gets a response of another type. */
+  while (match != queueSent
+         && BGLIB_MSG_ID(queue[match % BGAPI_CMD_QUEUE_SIZE].packet.header) != BGLIB_MSG_ID(rsp->header)) {
+    match++;
+  }
+  if (match == queueSent) {
+    stats.stray++;
+    return;
+  }
+  while (queueHead != match) {
+    entry = &queue[queueHead % BGAPI_CMD_QUEUE_SIZE];
+    queueHead++;
+    stats.lost++;
+    bgapiCmdFail(BGLIB_MSG_ID(entry->packet.header), entry->callback, entry->ctx, bg_err_timeout);
+    if ((int32_t)(queueHead - match) > 0) {
+      /* The callback reset the queue: the response is owed to nothing left. */
+      stats.stray++;
+      bgapiCmdArm();
+      return;
+    }
+  }
+  entry = &queue[queueHead % BGAPI_CMD_QUEUE_SIZE];
+  /* Retire the entry before the callback, which may queue or send further commands. */
+  callback = entry->callback;
+  ctx = entry->ctx;
+  latencyNs = timeNowNs() - entry->queuedNs;
+  queueHead++;
+  stats.completed++;
+  stats.latencySumNs += latencyNs;
+  stats.latencyMaxNs = MAX(stats.latencyMaxNs, latencyNs);
+  metricsObserve(METRICS_COMMAND_TIME, latencyNs);
+  if (callback != NULL) {
+    callback(BGAPI_CMD_RESULT(rsp), rsp, ctx);
+  }
+  bgapiCmdArm();
+}
+
+int32_t bgapiCmdSendBlocking(uint32_t len, const uint8_t* data)
+{
+  /* Keep the order of the commands: everything queued goes first, past the in-flight limit. */
+  while (txLen > 0 || queueSent != queueTail) {
+    bgapiCmdRelease(queueTail);
+    if (serialTx(txLen, txBuf) < 0) {
+      return -1;
+    }
+    stats.writes++;
+    txLen = 0;
+  }
+  bgapiCmdArm();
+  bgapiRxSkipResponses(queueSent - queueHead);
+  return serialTx(len, data);
+}
+
+const struct bgapiCmdStats* bgapiCmdGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Copy waiting commands to the transmit buffer.
+ *  \param[in] limit Queue position not to reach.
+ **************************************************************************************************/
+static void bgapiCmdRelease(uint32_t limit)
+{
+  while (queueSent != queueTail && (int32_t)(limit - queueSent) > 0) {
+    struct gecko_cmd_packet* packet = &queue[queueSent % BGAPI_CMD_QUEUE_SIZE].packet;
+    uint32_t len = BGLIB_MSG_HEADER_LEN + BGLIB_MSG_LEN(packet->header);
+
+    if (txLen + len > sizeof(txBuf)) {
+      break;
+    }
+    memcpy(txBuf + txLen, packet, len);
+    txLen += len;
+    queueSent++;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Watch the UART for POLLOUT exactly while there is something to write.
+ **************************************************************************************************/
+static void bgapiCmdArm(void)
+{
+  bool pending = txLen > 0 || (queueSent != queueTail && queueSent - queueHead < cmdDepth);
+
+  if (pending != txArmed && evloopModifyFd(serialGetFd(), pending ? POLLIN | POLLOUT : POLLIN) == 0) {
+    txArmed = pending;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Call back for a command that gets no response, with one made up from the result.
+ *  \param[in] id Message identifier of the command.
+ *  \param[in] callback Its callback, may be NULL.
+ *  \param[in] ctx Its context pointer.
+ *  \param[in] result Result code to report.
+ **************************************************************************************************/
+static void bgapiCmdFail(uint32_t id, bgapiCmdCallback callback, void* ctx, uint16_t result)
+{
+  if (callback == NULL) {
+    return;
+  }
+  overflowPacket.header = id;
+  memset(&overflowPacket.data, 0, sizeof(overflowPacket.data));
+  overflowPacket.data.payload[0] = UINT16_TO_BYTE0(result);
+  overflowPacket.data.payload[1] = UINT16_TO_BYTE1(result);
+  callback(result, &overflowPacket, ctx);
+}
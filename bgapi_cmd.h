@@ -0,0 +1,410 @@
+/***********************************************************************************************//**
+ * \file   bgapi_cmd.h
+ * \brief  Non-blocking BGAPI commands: a pending-response queue with completion callbacks
+ ***************************************************************************************************
+ * A command is queued with the callback to run on its response and returns at once; the event
+ * loop keeps dispatching events while it is in flight. Commands are written in order, up to a
+ * configurable number awaiting a response, and everything queued during one loop pass goes out
+ * in a single write(). The NCP answers commands in the order it receives them, so responses
+ * are matched to the queue by position.
+ *
+ * The blocking gecko_cmd_*() calls of BGLIB still work next to the queue: their message is
+ * written after every queued command, and their response is picked out from behind the
+ * responses still owed to the queue.
+ **************************************************************************************************/
+
+#ifndef BGAPI_CMD_H
+#define BGAPI_CMD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Commands queued at most, awaiting a response or not yet written. */
+#define BGAPI_CMD_QUEUE_SIZE          64
+
+/** Commands awaiting a response at the same time, by default and at most. Each one occupies
+ *  NCP receive buffer space until the NCP has handled it. */
+#define BGAPI_CMD_DEFAULT_DEPTH       4
+#define BGAPI_CMD_MAX_DEPTH           16
+
+/** Transmit buffer size, enough for BGAPI_CMD_MAX_DEPTH maximum length commands. */
+#define BGAPI_CMD_TX_SIZE             (BGAPI_CMD_MAX_DEPTH * (BGLIB_MSG_HEADER_LEN + BGLIB_MSG_MAX_PAYLOAD))
+
+/***********************************************************************************************//**
+ *  \brief  Called with the response to a queued command.
+ *  \param[in] result BGAPI result code, the first field of every response.
+ *  \param[in] rsp Full response, in place; only valid during the call. Synthesised with result
+ *             bg_err_out_of_memory if the command could not be queued, and with bg_err_timeout
+ *             if the NCP answered a later command instead.
+ *  \param[in] ctx Context pointer given with the command.
+ **************************************************************************************************/
+typedef void (*bgapiCmdCallback)(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+
+/** Command queue counters. */
+struct bgapiCmdStats {
+  uint64_t commands;        /**< commands queued */
+  uint64_t completed;       /**< responses matched to a queued command */
+  uint64_t rejected;        /**< commands refused because the queue was full */
+  uint64_t stray;           /**< responses matching no queued command */
+  uint64_t lost;            /**< commands failed because the NCP answered a later one */
+  uint64_t writes;          /**< write() calls that sent queued commands */
+  uint64_t latencySumNs;    /**< sum of queued to response times */
+  uint64_t latencyMaxNs;    /**< worst queued to response time */
+  uint32_t maxPending;      /**< most commands queued at the same time */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Empty the queue and clear the counters.
+ *  \param[in] depth Commands awaiting a response at the same time, 1 to BGAPI_CMD_MAX_DEPTH.
+ **************************************************************************************************/
+void bgapiCmdInit(uint8_t depth);
+
+/***********************************************************************************************//**
+ *  \brief  Forget every queued command, without calling back: after an NCP reset none of them
+ *          will be answered.
+ **************************************************************************************************/
+void bgapiCmdReset(void);
+
+/***********************************************************************************************//**
+ *  \brief  Packet for the next command. Fill in its data.cmd_* member, then bgapiCmdSubmit().
+ *  \return  The packet, never NULL.
+ **************************************************************************************************/
+struct gecko_cmd_packet* bgapiCmdPrepare(void);
+
+/***********************************************************************************************//**
+ *  \brief  Queue the command in the packet from bgapiCmdPrepare(). The callback runs at once,
+ *          with bg_err_out_of_memory, if the queue is full.
+ *  \param[in] id Command identifier, gecko_cmd_*_id.
+ *  \param[in] len Payload length.
+ *  \param[in] callback Function called with the response, NULL to ignore it.
+ *  \param[in] ctx Passed back to the callback.
+ *  \return  0 if queued, -1 if the queue is full.
+ **************************************************************************************************/
+int bgapiCmdSubmit(uint32_t id, uint32_t len, bgapiCmdCallback callback, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Write queued commands, as far as the in-flight limit and the driver allow, without
+ *          blocking. The UART is watched for POLLOUT while commands remain to be written.
+ *  \return  0 on success, -1 on a write failure.
+ **************************************************************************************************/
+int32_t bgapiCmdFlush(void);
+
+/***********************************************************************************************//**
+ *  \brief  Run the callback of the oldest command awaiting a response.
+ *  \param[in] rsp Response packet.
+ **************************************************************************************************/
+void bgapiCmdComplete(const struct gecko_cmd_packet* rsp);
+
+/***********************************************************************************************//**
+ *  \brief  BGLIB output function: write a blocking command after every queued one.
+ *  \param[in] len Message length, header included.
+ *  \param[in] data Message.
+ *  \return  len on success, -1 on a write failure.
+ **************************************************************************************************/
+int32_t bgapiCmdSendBlocking(uint32_t len, const uint8_t* data);
+
+/***********************************************************************************************//**
+ *  \brief  Access the counters.
+ *  \return  Counters since bgapiCmdInit().
+ **************************************************************************************************/
+const struct bgapiCmdStats* bgapiCmdGetStats(void);
+
+/***************************************************************************************************
+ * Commands used by the application, with the parameters of their gecko_cmd_*() counterparts
+ **************************************************************************************************/
+
+static inline int bgapiCmdSystemHello(bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare();
+  return bgapiCmdSubmit(gecko_cmd_system_hello_id, 0, callback, ctx);
+}
+
+static inline int bgapiCmdLeGapDiscover(uint8 mode, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_le_gap_discover.mode = mode;
+  return bgapiCmdSubmit(gecko_cmd_le_gap_discover_id, sizeof(struct gecko_msg_le_gap_discover_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdLeGapSetScanParameters(uint16 interval, uint16 window, uint8 active,
+                                                 bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_le_gap_set_scan_parameters.scan_interval = interval;
+  cmd->data.cmd_le_gap_set_scan_parameters.scan_window = window;
+  cmd->data.cmd_le_gap_set_scan_parameters.active = active;
+  return bgapiCmdSubmit(gecko_cmd_le_gap_set_scan_parameters_id,
+                        sizeof(struct gecko_msg_le_gap_set_scan_parameters_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdLeGapEndProcedure(bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare();
+  return bgapiCmdSubmit(gecko_cmd_le_gap_end_procedure_id, 0, callback, ctx);
+}
+
+static inline int bgapiCmdLeGapOpen(bd_addr address, uint8 addressType, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_le_gap_open.address = address;
+  cmd->data.cmd_le_gap_open.address_type = addressType;
+  return bgapiCmdSubmit(gecko_cmd_le_gap_open_id, sizeof(struct gecko_msg_le_gap_open_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdLeConnectionClose(uint8 connection, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_le_connection_close.connection = connection;
+  return bgapiCmdSubmit(gecko_cmd_le_connection_close_id, sizeof(struct gecko_msg_le_connection_close_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdLeConnectionSetParameters(uint8 connection, uint16 minInterval, uint16 maxInterval,
+                                                    uint16 latency, uint16 timeout, bgapiCmdCallback callback,
+                                                    void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_le_connection_set_parameters.connection = connection;
+  cmd->data.cmd_le_connection_set_parameters.min_interval = minInterval;
+  cmd->data.cmd_le_connection_set_parameters.max_interval = maxInterval;
+  cmd->data.cmd_le_connection_set_parameters.latency = latency;
+  cmd->data.cmd_le_connection_set_parameters.timeout = timeout;
+  return bgapiCmdSubmit(gecko_cmd_le_connection_set_parameters_id,
+                        sizeof(struct gecko_msg_le_connection_set_parameters_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdLeConnectionSetPhy(uint8 connection, uint8 phy, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_le_connection_set_phy.connection = connection;
+  cmd->data.cmd_le_connection_set_phy.phy = phy;
+  return bgapiCmdSubmit(gecko_cmd_le_connection_set_phy_id, sizeof(struct gecko_msg_le_connection_set_phy_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdHardwareSetSoftTimer(uint32 time, uint8 handle, uint8 singleShot,
+                                               bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_hardware_set_soft_timer.time = time;
+  cmd->data.cmd_hardware_set_soft_timer.handle = handle;
+  cmd->data.cmd_hardware_set_soft_timer.single_shot = singleShot;
+  return bgapiCmdSubmit(gecko_cmd_hardware_set_soft_timer_id, sizeof(struct gecko_msg_hardware_set_soft_timer_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdGattSetMaxMtu(uint16 maxMtu, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_gatt_set_max_mtu.max_mtu = maxMtu;
+  return bgapiCmdSubmit(gecko_cmd_gatt_set_max_mtu_id, sizeof(struct gecko_msg_gatt_set_max_mtu_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdGattDiscoverPrimaryServices(uint8 connection, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_gatt_discover_primary_services.connection = connection;
+  return bgapiCmdSubmit(gecko_cmd_gatt_discover_primary_services_id,
+                        sizeof(struct gecko_msg_gatt_discover_primary_services_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdGattDiscoverPrimaryServicesByUuid(uint8 connection, uint8 uuidLen, const uint8* uuid,
+                                                            bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_discover_primary_services_by_uuid.connection = connection;
+  cmd->data.cmd_gatt_discover_primary_services_by_uuid.uuid.len = uuidLen;
+  memcpy(cmd->data.cmd_gatt_discover_primary_services_by_uuid.uuid.data, uuid, uuidLen);
+  return bgapiCmdSubmit(gecko_cmd_gatt_discover_primary_services_by_uuid_id,
+                        sizeof(struct gecko_msg_gatt_discover_primary_services_by_uuid_cmd_t) + uuidLen,
+                        callback, ctx);
+}
+
+static inline int bgapiCmdGattDiscoverCharacteristics(uint8 connection, uint32 service,
+                                                      bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_discover_characteristics.connection = connection;
+  cmd->data.cmd_gatt_discover_characteristics.service = service;
+  return bgapiCmdSubmit(gecko_cmd_gatt_discover_characteristics_id,
+                        sizeof(struct gecko_msg_gatt_discover_characteristics_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdGattDiscoverDescriptors(uint8 connection, uint16 characteristic,
+                                                  bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_discover_descriptors.connection = connection;
+  cmd->data.cmd_gatt_discover_descriptors.characteristic = characteristic;
+  return bgapiCmdSubmit(gecko_cmd_gatt_discover_descriptors_id,
+                        sizeof(struct gecko_msg_gatt_discover_descriptors_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdGattSetCharacteristicNotification(uint8 connection, uint16 characteristic, uint8 flags,
+                                                            bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_set_characteristic_notification.connection = connection;
+  cmd->data.cmd_gatt_set_characteristic_notification.characteristic = characteristic;
+  cmd->data.cmd_gatt_set_characteristic_notification.flags = flags;
+  return bgapiCmdSubmit(gecko_cmd_gatt_set_characteristic_notification_id,
+                        sizeof(struct gecko_msg_gatt_set_characteristic_notification_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdGattReadCharacteristicValue(uint8 connection, uint16 characteristic,
+                                                      bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_read_characteristic_value.connection = connection;
+  cmd->data.cmd_gatt_read_characteristic_value.characteristic = characteristic;
+  return bgapiCmdSubmit(gecko_cmd_gatt_read_characteristic_value_id,
+                        sizeof(struct gecko_msg_gatt_read_characteristic_value_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdGattReadCharacteristicValueByUuid(uint8 connection, uint32 service, uint8 uuidLen,
+                                                            const uint8* uuid, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_read_characteristic_value_by_uuid.connection = connection;
+  cmd->data.cmd_gatt_read_characteristic_value_by_uuid.service = service;
+  cmd->data.cmd_gatt_read_characteristic_value_by_uuid.uuid.len = uuidLen;
+  memcpy(cmd->data.cmd_gatt_read_characteristic_value_by_uuid.uuid.data, uuid, uuidLen);
+  return bgapiCmdSubmit(gecko_cmd_gatt_read_characteristic_value_by_uuid_id,
+                        sizeof(struct gecko_msg_gatt_read_characteristic_value_by_uuid_cmd_t) + uuidLen,
+                        callback, ctx);
+}
+
+static inline int bgapiCmdGattReadMultipleCharacteristicValues(uint8 connection, uint8 count,
+                                                               const uint16* characteristics,
+                                                               bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+  uint8* list = cmd->data.cmd_gatt_read_multiple_characteristic_values.characteristic_list.data;
+
+  cmd->data.cmd_gatt_read_multiple_characteristic_values.connection = connection;
+  cmd->data.cmd_gatt_read_multiple_characteristic_values.characteristic_list.len = count * 2;
+  /* Handles go out little-endian, two bytes each. */
+  for (uint8 i = 0; i < count; i++) {
+    list[2 * i] = (uint8)characteristics[i];
+    list[2 * i + 1] = (uint8)(characteristics[i] >> 8);
+  }
+  return bgapiCmdSubmit(gecko_cmd_gatt_read_multiple_characteristic_values_id,
+                        sizeof(struct gecko_msg_gatt_read_multiple_characteristic_values_cmd_t) + count * 2,
+                        callback, ctx);
+}
+
+static inline int bgapiCmdGattWriteDescriptorValue(uint8 connection, uint16 descriptor, uint8 valueLen,
+                                                   const uint8* value, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_write_descriptor_value.connection = connection;
+  cmd->data.cmd_gatt_write_descriptor_value.descriptor = descriptor;
+  cmd->data.cmd_gatt_write_descriptor_value.value.len = valueLen;
+  memcpy(cmd->data.cmd_gatt_write_descriptor_value.value.data, value, valueLen);
+  return bgapiCmdSubmit(gecko_cmd_gatt_write_descriptor_value_id,
+                        sizeof(struct gecko_msg_gatt_write_descriptor_value_cmd_t) + valueLen, callback, ctx);
+}
+
+static inline int bgapiCmdGattWriteCharacteristicValue(uint8 connection, uint16 characteristic, uint8 valueLen,
+                                                       const uint8* value, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_write_characteristic_value.connection = connection;
+  cmd->data.cmd_gatt_write_characteristic_value.characteristic = characteristic;
+  cmd->data.cmd_gatt_write_characteristic_value.value.len = valueLen;
+  memcpy(cmd->data.cmd_gatt_write_characteristic_value.value.data, value, valueLen);
+  return bgapiCmdSubmit(gecko_cmd_gatt_write_characteristic_value_id,
+                        sizeof(struct gecko_msg_gatt_write_characteristic_value_cmd_t) + valueLen, callback, ctx);
+}
+
+static inline int bgapiCmdGattWriteCharacteristicValueWithoutResponse(uint8 connection, uint16 characteristic,
+                                                                      uint8 valueLen, const uint8* value,
+                                                                      bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_gatt_write_characteristic_value_without_response.connection = connection;
+  cmd->data.cmd_gatt_write_characteristic_value_without_response.characteristic = characteristic;
+  cmd->data.cmd_gatt_write_characteristic_value_without_response.value.len = valueLen;
+  memcpy(cmd->data.cmd_gatt_write_characteristic_value_without_response.value.data, value, valueLen);
+  return bgapiCmdSubmit(gecko_cmd_gatt_write_characteristic_value_without_response_id,
+                        sizeof(struct gecko_msg_gatt_write_characteristic_value_without_response_cmd_t) + valueLen,
+                        callback, ctx);
+}
+
+static inline int bgapiCmdSmConfigure(uint8 flags, uint8 ioCapabilities, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_sm_configure.flags = flags;
+  cmd->data.cmd_sm_configure.io_capabilities = ioCapabilities;
+  return bgapiCmdSubmit(gecko_cmd_sm_configure_id, sizeof(struct gecko_msg_sm_configure_cmd_t), callback, ctx);
+}
+
+static inline int bgapiCmdSmSetBondableMode(uint8 bondable, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_sm_set_bondable_mode.bondable = bondable;
+  return bgapiCmdSubmit(gecko_cmd_sm_set_bondable_mode_id, sizeof(struct gecko_msg_sm_set_bondable_mode_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdSmIncreaseSecurity(uint8 connection, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_sm_increase_security.connection = connection;
+  return bgapiCmdSubmit(gecko_cmd_sm_increase_security_id, sizeof(struct gecko_msg_sm_increase_security_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdSmDeleteBonding(uint8 bonding, bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare()->data.cmd_sm_delete_bonding.bonding = bonding;
+  return bgapiCmdSubmit(gecko_cmd_sm_delete_bonding_id, sizeof(struct gecko_msg_sm_delete_bonding_cmd_t),
+                        callback, ctx);
+}
+
+static inline int bgapiCmdSmListAllBondings(bgapiCmdCallback callback, void* ctx)
+{
+  bgapiCmdPrepare();
+  return bgapiCmdSubmit(gecko_cmd_sm_list_all_bondings_id, 0, callback, ctx);
+}
+
+static inline int bgapiCmdUserMessageToTarget(uint8 dataLen, const uint8* data, bgapiCmdCallback callback, void* ctx)
+{
+  struct gecko_cmd_packet* cmd = bgapiCmdPrepare();
+
+  cmd->data.cmd_user_message_to_target.data.len = dataLen;
+  memcpy(cmd->data.cmd_user_message_to_target.data.data, data, dataLen);
+  return bgapiCmdSubmit(gecko_cmd_user_message_to_target_id,
+                        sizeof(struct gecko_msg_user_message_to_target_cmd_t) + dataLen, callback, ctx);
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BGAPI_CMD_H */
@@ -0,0 +1,272 @@
+/***********************************************************************************************//**
+ * \file   bgapi_rx.c
+ * \brief  Buffered BGAPI receive path: bulk UART reads, frames parsed in place
+ ***************************************************************************************************
+ * The buffer is linear: bytes are appended at rxWrite and parsed from rxRead. Data is only
+ * moved to the front in bgapiRxFill(), when no handed-out frame can be in use; at that point
+ * at most one partial frame is left to move.
+ *
+ * BGLIB reads only while it waits for the response to a blocking command. Frames that arrive
+ * ahead of it stay in the buffer, responses owed to queued commands included: the response is
+ * moved in front of them and served alone, and the rest is handed out in place afterwards, in
+ * the order BGLIB would have queued the events.
+ * Only if the stream cannot be parsed, or the buffer fills up during the wait, does BGLIB get
+ * the raw bytes and queue the events itself, until the next bgapiRxFill().
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "infrastructure.h"
+
+#include "adapter.h"
+#include "serial.h"
+
+/* Own header */
+#include "bgapi_rx.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Header byte 0: device type bits, and the event flag. */
+#define BGAPI_DEV_TYPE_MASK           0x78
+#define BGAPI_TYPE_MASK               0xf8
+
+/* The slack after the buffer keeps handlers that read a short frame through the full packet
+ * structure inside the array. */
+static ADAPTER_LOCAL uint8_t rxBuf[BGAPI_RX_SIZE + sizeof(struct gecko_cmd_packet)];
+static ADAPTER_LOCAL uint32_t rxRead = 0;
+static ADAPTER_LOCAL uint32_t rxWrite = 0;
+
+/** Bytes of the response being served to BGLIB. */
+static ADAPTER_LOCAL uint32_t rxResponseLeft = 0;
+
+/** Responses to leave in place before the one BGLIB waits for. */
+static ADAPTER_LOCAL uint32_t rxSkipResponses = 0;
+
+/** BGLIB reads the raw stream until the next bgapiRxFill(). */
+static ADAPTER_LOCAL bool rxRaw = false;
+
+/** The frame last returned by bgapiRxNext() may be in use: what lies before rxRead stays put. */
+static ADAPTER_LOCAL bool rxFrameLive = false;
+
+static ADAPTER_LOCAL struct bgapiRxStats stats;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int32_t frameLength(const uint8_t* frame);
+static void bgapiRxCompact(void);
+static int bgapiRxTakeResponse(void);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void bgapiRxInit(void)
+{
+  rxRead = 0;
+  rxWrite = 0;
+  rxResponseLeft = 0;
+  rxSkipResponses = 0;
+  rxRaw = false;
+  rxFrameLive = false;
+  memset(&stats, 0, sizeof(stats));
+}
+
+void bgapiRxDiscard(void)
+{
+  stats.discarded += rxWrite - rxRead;
+  rxRead = rxWrite;
+  rxResponseLeft = 0;
+  rxSkipResponses = 0;
+}
+
+int32_t bgapiRxFill(void)
+{
+  int32_t ret;
+
+  /* No command is waiting: BGLIB is at a message boundary. */
+  rxRaw = false;
+  rxResponseLeft = 0;
+  rxSkipResponses = 0;
+  rxFrameLive = false;
+  bgapiRxCompact();
+  if (rxWrite == BGAPI_RX_SIZE) {
+    return 0;
+  }
+  ret = serialRead(rxBuf + rxWrite, BGAPI_RX_SIZE - rxWrite);
+  if (ret > 0) {
+    rxWrite += ret;
+    stats.reads++;
+    stats.bytes += ret;
+  }
+  return ret;
+}
+
+struct gecko_cmd_packet* bgapiRxNext(void)
+{
+  while (rxWrite - rxRead >= BGLIB_MSG_HEADER_LEN) {
+    uint8_t* frame = rxBuf + rxRead;
+    int32_t len = frameLength(frame);
+
+    /* Skip a byte at a time until a plausible header appears, as BGLIB does. */
+    if (len < 0) {
+      rxRead++;
+      stats.discarded++;
+      continue;
+    }
+    if (rxWrite - rxRead < (uint32_t)len) {
+      return NULL;
+    }
+    rxRead += len;
+    stats.frames++;
+    rxFrameLive = true;
+    return (struct gecko_cmd_packet*)frame;
+  }
+  rxFrameLive = false;
+  return NULL;
+}
+
+int32_t bgapiRxInput(uint32_t len, uint8_t* data)
+{
+  uint32_t done = 0;
+  int32_t ret;
+
+  while (done < len) {
+    /* Several blocking commands in a row, e.g. from a timer, fill the buffer without a
+     * bgapiRxFill() in between. Unless a frame handler is running, the space before rxRead is
+     * free; without it the response would be looked for in the raw stream, where it cannot be
+     * told apart from those owed to queued commands. */
+    if (rxWrite == BGAPI_RX_SIZE && !rxFrameLive) {
+      bgapiRxCompact();
+    }
+    if (!rxRaw && rxResponseLeft == 0 && bgapiRxTakeResponse() < 0) {
+      rxRaw = true;
+    }
+    if ((rxRaw || rxResponseLeft > 0) && rxRead < rxWrite) {
+      uint32_t n = MIN(rxWrite - rxRead, len - done);
+
+      if (!rxRaw) {
+        n = MIN(n, rxResponseLeft);
+        rxResponseLeft -= n;
+      }
+      memcpy(data + done, rxBuf + rxRead, n);
+      rxRead += n;
+      done += n;
+      continue;
+    }
+    /* Append only, the frame being handled may lie before rxRead. With no room left, read
+     * straight into the destination. */
+    if (rxWrite < BGAPI_RX_SIZE) {
+      ret = serialRead(rxBuf + rxWrite, BGAPI_RX_SIZE - rxWrite);
+      if (ret > 0) {
+        rxWrite += ret;
+      }
+    } else {
+      ret = serialRead(data + done, len - done);
+      if (ret > 0) {
+        done += ret;
+      }
+    }
+    if (ret > 0) {
+      stats.reads++;
+      stats.bytes += ret;
+    } else if (ret < 0) {
+      return -1;
+    } else if ((ret = serialWaitReadable()) <= 0) {
+      if (ret == 0) {
+        errno = ETIMEDOUT;
+      }
+      return -1;
+    }
+  }
+  return len;
+}
+
+void bgapiRxSkipResponses(uint32_t count)
+{
+  rxSkipResponses = count;
+}
+
+int32_t bgapiRxPeek(void)
+{
+  return 0;
+}
+
+const struct bgapiRxStats* bgapiRxGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Check a frame header, with the same tests as BGLIB.
+ *  \param[in] frame Header, BGLIB_MSG_HEADER_LEN bytes.
+ *  \return  Frame length, header included; -1 if this is not a plausible header.
+ **************************************************************************************************/
+static int32_t frameLength(const uint8_t* frame)
+{
+  uint32_t len = ((frame[0] & 0x07) << 8) | frame[1];
+
+  if ((frame[0] & BGAPI_DEV_TYPE_MASK) != gecko_dev_type_gecko || len > BGLIB_MSG_MAX_PAYLOAD) {
+    return -1;
+  }
+  return BGLIB_MSG_HEADER_LEN + len;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move the unread data to the start of the buffer. Invalidates every frame handed out.
+ **************************************************************************************************/
+static void bgapiRxCompact(void)
+{
+  if (rxRead > 0) {
+    memmove(rxBuf, rxBuf + rxRead, rxWrite - rxRead);
+    rxWrite -= rxRead;
+    rxRead = 0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find the first complete response not owed to a queued command and move it in front
+ *          of the frames that arrived before it.
+ *  \return  1 if rxRead now starts the response, 0 if none is complete yet, -1 if the buffered
+ *           data does not parse or the buffer is full without one.
+ **************************************************************************************************/
+static int bgapiRxTakeResponse(void)
+{
+  uint8_t response[BGLIB_MSG_HEADER_LEN + BGLIB_MSG_MAX_PAYLOAD];
+  uint32_t pos = rxRead;
+  uint32_t skip = rxSkipResponses;
+  int32_t len;
+
+  while (rxWrite - pos >= BGLIB_MSG_HEADER_LEN) {
+    len = frameLength(rxBuf + pos);
+    if (len < 0) {
+      return -1;
+    }
+    if (rxWrite - pos < (uint32_t)len) {
+      break;
+    }
+    if ((rxBuf[pos] & BGAPI_TYPE_MASK) == gecko_dev_type_gecko && skip-- == 0) {
+      if (pos > rxRead) {
+        memcpy(response, rxBuf + pos, len);
+        memmove(rxBuf + rxRead + len, rxBuf + rxRead, pos - rxRead);
+        memcpy(rxBuf + rxRead, response, len);
+      }
+      rxResponseLeft = len;
+      rxSkipResponses = 0;
+      return 1;
+    }
+    pos += len;
+  }
+  return rxWrite == BGAPI_RX_SIZE ? -1 : 0;
+}
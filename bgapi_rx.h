@@ -0,0 +1,106 @@
+/***********************************************************************************************//**
+ * \file   bgapi_rx.h
+ * \brief  Buffered BGAPI receive path: bulk UART reads, frames parsed in place
+ ***************************************************************************************************
+ * One read() takes everything the driver holds into a linear buffer, and every complete frame
+ * in it, event or response to a queued command, is handed to the application where it lies,
+ * without copying it into BGLIB. BGLIB itself only reads while it waits for the response to a
+ * blocking command; it is served that response from the same buffer, and the frames that
+ * arrived ahead of it stay there for bgapiRxNext().
+ **************************************************************************************************/
+
+#ifndef BGAPI_RX_H
+#define BGAPI_RX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Receive buffer size. A read never asks for more than the free space at its end. */
+#define BGAPI_RX_SIZE                 16384
+
+/** A frame returned by bgapiRxNext() is a command response rather than an event. */
+#define BGAPI_RX_IS_RESPONSE(packet)  (((packet)->header & gecko_msg_type_evt) == 0)
+
+/** Receive counters. */
+struct bgapiRxStats {
+  uint64_t reads;           /**< read() calls that returned data */
+  uint64_t bytes;           /**< bytes received */
+  uint64_t frames;          /**< frames handed out in place */
+  uint64_t discarded;       /**< bytes skipped to resynchronise */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Empty the buffer and clear the counters.
+ **************************************************************************************************/
+void bgapiRxInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Drop the buffered bytes, counted as discarded: after a baud rate change they are
+ *          garbled or belong to the line as it was. The frame last returned by bgapiRxNext()
+ *          stays valid.
+ **************************************************************************************************/
+void bgapiRxDiscard(void);
+
+/***********************************************************************************************//**
+ *  \brief  Read everything pending on the serial port into the buffer, with a single read().
+ *          Invalidates the frame last returned by bgapiRxNext().
+ *  \return  Number of bytes read, 0 if nothing was pending, -1 on failure or hangup.
+ **************************************************************************************************/
+int32_t bgapiRxFill(void);
+
+/***********************************************************************************************//**
+ *  \brief  Take the next complete frame, event or response, from the buffer.
+ *  \return  The frame, in place; valid until the next bgapiRxNext() or bgapiRxFill() call.
+ *           NULL if no complete frame is buffered.
+ **************************************************************************************************/
+struct gecko_cmd_packet* bgapiRxNext(void);
+
+/***********************************************************************************************//**
+ *  \brief  BGLIB input function: read exactly len bytes, from the buffer first, blocking for the
+ *          rest. Never moves buffered frames while the frame last returned by bgapiRxNext() may
+ *          be in use, i.e. until bgapiRxNext() has returned NULL.
+ *  \param[in] len Number of bytes.
+ *  \param[out] data Destination.
+ *  \return  len on success, -1 on failure or timeout; errno is ETIMEDOUT after a timeout.
+ **************************************************************************************************/
+int32_t bgapiRxInput(uint32_t len, uint8_t* data);
+
+/***********************************************************************************************//**
+ *  \brief  Leave the given number of responses in the buffer when serving BGLIB the response to
+ *          the blocking command just sent: they belong to commands queued before it. Cleared by
+ *          bgapiRxFill().
+ *  \param[in] count Responses owed to earlier commands.
+ **************************************************************************************************/
+void bgapiRxSkipResponses(uint32_t count);
+
+/***********************************************************************************************//**
+ *  \brief  BGLIB peek function. Always 0: events are read by bgapiRxNext(), so that
+ *          gecko_peek_event() only returns those BGLIB queued while waiting for a response.
+ *  \return  0.
+ **************************************************************************************************/
+int32_t bgapiRxPeek(void);
+
+/***********************************************************************************************//**
+ *  \brief  Access the counters.
+ *  \return  Counters since bgapiRxInit().
+ **************************************************************************************************/
+const struct bgapiRxStats* bgapiRxGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BGAPI_RX_H */
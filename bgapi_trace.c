@@ -0,0 +1,335 @@
+/***********************************************************************************************//**
+ * \file   bgapi_trace.c
+ * \brief  Capture of the raw BGAPI traffic on the UART, and its replay without an NCP
+ ***************************************************************************************************
+ * Capture goes through a buffered stream under a lock, as every adapter thread appends to the
+ * same file. Replay hands every adapter a pipe in place of its serial port. The pipe holds one
+ * byte while a record is due; with the original pacing, the byte is taken out once the due
+ * records are read and put back by a one-shot event loop timer when the next one falls due.
+ * After the adapter's last record the write end is closed, which shows as a hangup.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+#include "adapter.h"
+#include "event_loop.h"
+
+/* Own header */
+#include "bgapi_trace.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Stream buffer of the capture file. */
+#define BGAPI_TRACE_BUFFER_SIZE       65536
+
+static FILE* captureFile = NULL;
+static pthread_mutex_t captureLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** The mapped trace, shared by the adapters. */
+static const uint8_t* replayMap = NULL;
+static size_t replaySize = 0;
+static bool replayRealTime = true;
+static uint64_t replayFirstNs = 0;
+
+/** Replay state of each adapter. */
+static ADAPTER_LOCAL size_t replayCursor = 0;     /**< offset of the current record */
+static ADAPTER_LOCAL uint32_t replayConsumed = 0;  /**< bytes of it already read */
+static ADAPTER_LOCAL uint64_t replayStartNs = 0;
+static ADAPTER_LOCAL int wakePipe[2] = { -1, -1 };
+static ADAPTER_LOCAL bool wakeSet = false;
+static ADAPTER_LOCAL int wakeTimer = -1;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static const struct bgapiTraceRecord* replayCurrent(void);
+static uint64_t replayDueNs(const struct bgapiTraceRecord* record);
+static void replayArm(void);
+static void replayWake(bool set);
+static void onWakeTimer(int timerId, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int bgapiTraceCaptureOpen(const char* path)
+{
+  static const uint8_t header[BGAPI_TRACE_HEADER_LEN] = BGAPI_TRACE_MAGIC;
+
+  captureFile = fopen(path, "wb");
+  if (captureFile == NULL) {
+    return -1;
+  }
+  setvbuf(captureFile, NULL, _IOFBF, BGAPI_TRACE_BUFFER_SIZE);
+  if (fwrite(header, 1, sizeof(header), captureFile) != sizeof(header)) {
+    fclose(captureFile);
+    captureFile = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void bgapiTraceCaptureClose(void)
+{
+  if (captureFile != NULL) {
+    if (fclose(captureFile) != 0) {
+      printf("Error!!! The BGAPI trace is incomplete\n");
+    }
+    captureFile = NULL;
+  }
+}
+
+void bgapiTraceCapture(uint8_t direction, const uint8_t* data, uint32_t length)
+{
+  static const uint8_t padding[8] = { 0 };
+  struct bgapiTraceRecord record;
+  struct adapter* adapter = adapterCurrent();
+
+  if (captureFile == NULL) {
+    return;
+  }
+  memset(&record, 0, sizeof(record));
+  record.timestampNs = timeNowNs();
+  record.length = length;
+  record.direction = direction;
+  record.adapter = adapter != NULL ? adapter->index : 0;
+
+  pthread_mutex_lock(&captureLock);
+  fwrite(&record, sizeof(record), 1, captureFile);
+  fwrite(data, 1, length, captureFile);
+  fwrite(padding, 1, BGAPI_TRACE_RECORD_SIZE(length) - sizeof(record) - length, captureFile);
+  pthread_mutex_unlock(&captureLock);
+}
+
+int bgapiTraceReplayOpen(const char* path, bool realTime)
+{
+  const struct bgapiTraceRecord* record;
+  struct stat st;
+  uint8_t adapters = 0;
+  size_t pos;
+  void* map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < BGAPI_TRACE_HEADER_LEN) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  if (memcmp(map, BGAPI_TRACE_MAGIC, 4)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+  replayMap = map;
+  replaySize = st.st_size;
+  replayRealTime = realTime;
+
+  /* A record cut short by a crash during capture ends the trace. */
+  for (pos = BGAPI_TRACE_HEADER_LEN; pos + sizeof(*record) <= replaySize; pos += BGAPI_TRACE_RECORD_SIZE(record->length)) {
+    record = (const struct bgapiTraceRecord*)(replayMap + pos);
+    if (record->length > replaySize - pos - sizeof(*record)) {
+      break;
+    }
+    if (pos == BGAPI_TRACE_HEADER_LEN) {
+      replayFirstNs = record->timestampNs;
+    }
+    adapters = MAX(adapters, record->adapter + 1);
+  }
+  replaySize = pos;
+  return MAX(adapters, 1);
+}
+
+void bgapiTraceReplayClose(void)
+{
+  if (replayMap != NULL) {
+    munmap((void*)replayMap, replaySize);
+    replayMap = NULL;
+  }
+}
+
+bool bgapiTraceReplaying(void)
+{
+  return replayMap != NULL;
+}
+
+int bgapiTraceReplayStart(void)
+{
+  if (pipe(wakePipe) < 0) {
+    return -1;
+  }
+  replayCursor = BGAPI_TRACE_HEADER_LEN;
+  replayConsumed = 0;
+  replayStartNs = timeNowNs();
+  wakeSet = false;
+  wakeTimer = -1;
+  replayArm();
+  return wakePipe[0];
+}
+
+void bgapiTraceReplayStop(void)
+{
+  if (wakeTimer >= 0) {
+    evloopRemoveTimer(wakeTimer);
+    wakeTimer = -1;
+  }
+  for (uint8_t i = 0; i < 2; i++) {
+    if (wakePipe[i] >= 0) {
+      close(wakePipe[i]);
+      wakePipe[i] = -1;
+    }
+  }
+}
+
+int32_t bgapiTraceReplayRead(uint8_t* data, uint32_t maxLength)
+{
+  const struct bgapiTraceRecord* record = replayCurrent();
+  uint32_t n;
+
+  if (record == NULL) {
+    return -1;
+  }
+  if (replayRealTime && timeNowNs() < replayDueNs(record)) {
+    replayArm();
+    return 0;
+  }
+  n = MIN(record->length - replayConsumed, maxLength);
+  memcpy(data, (const uint8_t*)(record + 1) + replayConsumed, n);
+  replayConsumed += n;
+  if (replayConsumed == record->length) {
+    replayCursor += BGAPI_TRACE_RECORD_SIZE(record->length);
+    replayConsumed = 0;
+  }
+  replayArm();
+  return n;
+}
+
+int32_t bgapiTraceReplayWait(void)
+{
+  const struct bgapiTraceRecord* record = replayCurrent();
+  uint64_t nowNs = timeNowNs();
+  uint64_t dueNs;
+  struct timespec ts;
+
+  if (record == NULL) {
+    return -1;
+  }
+  dueNs = replayDueNs(record);
+  if (replayRealTime && nowNs < dueNs) {
+    ts.tv_sec = (dueNs - nowNs) / NSEC_PER_SEC;
+    ts.tv_nsec = (dueNs - nowNs) % NSEC_PER_SEC;
+    nanosleep(&ts, NULL);
+  }
+  return 1;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Move the cursor to the next record the calling adapter received.
+ *  \return  The record, NULL after the last one.
+ **************************************************************************************************/
+static const struct bgapiTraceRecord* replayCurrent(void)
+{
+  uint8_t index = adapterCurrent()->index;
+  const struct bgapiTraceRecord* record;
+
+  while (replayCursor < replaySize) {
+    record = (const struct bgapiTraceRecord*)(replayMap + replayCursor);
+    if (record->direction == BGAPI_TRACE_RX && record->adapter == index && record->length > 0) {
+      return record;
+    }
+    replayCursor += BGAPI_TRACE_RECORD_SIZE(record->length);
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Time a record is due, at its original distance from the start of the capture.
+ *  \param[in] record The record.
+ *  \return  Monotonic time in nanoseconds.
+ **************************************************************************************************/
+static uint64_t replayDueNs(const struct bgapiTraceRecord* record)
+{
+  return replayStartNs + (record->timestampNs - replayFirstNs);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Make the pipe readable if a record is due, otherwise wake up when one is, and hang
+ *          up after the last record.
+ **************************************************************************************************/
+static void replayArm(void)
+{
+  const struct bgapiTraceRecord* record = replayCurrent();
+  uint64_t nowNs;
+  uint64_t dueNs;
+
+  if (record == NULL) {
+    if (wakePipe[1] >= 0) {
+      close(wakePipe[1]);
+      wakePipe[1] = -1;
+    }
+    return;
+  }
+  nowNs = timeNowNs();
+  dueNs = replayDueNs(record);
+  if (!replayRealTime || nowNs >= dueNs) {
+    replayWake(true);
+    return;
+  }
+  replayWake(false);
+  if (wakeTimer < 0) {
+    wakeTimer = evloopAddTimer((dueNs - nowNs + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC, false, onWakeTimer, NULL);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Put the wake byte into the pipe or take it out, if not done already.
+ *  \param[in] set true to make the pipe readable.
+ **************************************************************************************************/
+static void replayWake(bool set)
+{
+  uint8_t byte = 0;
+
+  if (set == wakeSet) {
+    return;
+  }
+  if ((set ? write(wakePipe[1], &byte, 1) : read(wakePipe[0], &byte, 1)) == 1) {
+    wakeSet = set;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  The next record fell due.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onWakeTimer(int timerId, void* ctx)
+{
+  wakeTimer = -1;
+  replayArm();
+}
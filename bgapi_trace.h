@@ -0,0 +1,128 @@
+/***********************************************************************************************//**
+ * \file   bgapi_trace.h
+ * \brief  Capture of the raw BGAPI traffic on the UART, and its replay without an NCP
+ ***************************************************************************************************
+ * Capture appends the bytes of every read() and write() on the serial ports to a trace file,
+ * stamped with the monotonic clock. A record holds what one call moved, so frames may span
+ * records, exactly as the receive path saw them.
+ *
+ * Replay maps a trace and stands in for the serial ports: reads return the received records,
+ * at their original pace or as fast as the host takes them, and writes are dropped. Each
+ * adapter of the capture is replayed by an adapter of its own. The host answers the replayed
+ * events as it did live; the recorded responses answer its commands in order.
+ *
+ * The file is append-only and laid out for mmap(): a header, then records of a struct
+ * bgapiTraceRecord and its bytes, padded to 8 bytes, in host byte order.
+ **************************************************************************************************/
+
+#ifndef BGAPI_TRACE_H
+#define BGAPI_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** File header: the magic, then 4 reserved bytes. */
+#define BGAPI_TRACE_MAGIC             "BGT1"
+#define BGAPI_TRACE_HEADER_LEN        8
+
+/* Record directions */
+#define BGAPI_TRACE_RX                0   /**< read from the NCP */
+#define BGAPI_TRACE_TX                1   /**< written to the NCP */
+
+/** Record header, followed by length bytes. */
+struct bgapiTraceRecord {
+  uint64_t timestampNs;     /**< monotonic clock when the call returned */
+  uint32_t length;          /**< bytes that follow */
+  uint8_t direction;        /**< BGAPI_TRACE_RX or BGAPI_TRACE_TX */
+  uint8_t adapter;          /**< index of the adapter */
+  uint16_t reserved;
+};
+
+/** Size of a record in the file, header and padding included. */
+#define BGAPI_TRACE_RECORD_SIZE(length) \
+  (sizeof(struct bgapiTraceRecord) + (((length) + 7u) & ~7u))
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start capturing to a trace file, before the adapters start.
+ *  \param[in] path Trace file, created or truncated.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int bgapiTraceCaptureOpen(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Flush and close the trace file, after the adapters stopped.
+ **************************************************************************************************/
+void bgapiTraceCaptureClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Append the bytes moved by a serial read or write of the calling adapter. Does
+ *          nothing when not capturing.
+ *  \param[in] direction BGAPI_TRACE_RX or BGAPI_TRACE_TX.
+ *  \param[in] data Bytes.
+ *  \param[in] length Number of bytes, at least 1.
+ **************************************************************************************************/
+void bgapiTraceCapture(uint8_t direction, const uint8_t* data, uint32_t length);
+
+/***********************************************************************************************//**
+ *  \brief  Map a trace for replay, before the adapters start.
+ *  \param[in] path Trace file.
+ *  \param[in] realTime true to hand out the records at their original pace, false for as fast
+ *             as they are read.
+ *  \return  Number of adapters in the trace, -1 if it cannot be read or is not a trace.
+ **************************************************************************************************/
+int bgapiTraceReplayOpen(const char* path, bool realTime);
+
+/***********************************************************************************************//**
+ *  \brief  Unmap the trace, after the adapters stopped.
+ **************************************************************************************************/
+void bgapiTraceReplayClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Whether the serial ports are replayed from a trace.
+ *  \return  true between bgapiTraceReplayOpen() and bgapiTraceReplayClose().
+ **************************************************************************************************/
+bool bgapiTraceReplaying(void);
+
+/***********************************************************************************************//**
+ *  \brief  Start replaying the records of the calling adapter, from its event loop thread.
+ *  \return  Descriptor to watch for POLLIN like a serial port: readable while a record is due,
+ *           hung up after the last one. -1 on failure.
+ **************************************************************************************************/
+int bgapiTraceReplayStart(void);
+
+/***********************************************************************************************//**
+ *  \brief  Stop the replay of the calling adapter and close its descriptor.
+ **************************************************************************************************/
+void bgapiTraceReplayStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Serial read from the trace: the next due record, or as much of it as fits.
+ *  \param[out] data Destination buffer.
+ *  \param[in] maxLength Size of data.
+ *  \return  Number of bytes read, 0 if no record is due yet, -1 after the last record.
+ **************************************************************************************************/
+int32_t bgapiTraceReplayRead(uint8_t* data, uint32_t maxLength);
+
+/***********************************************************************************************//**
+ *  \brief  Blocking wait for the next record, for BGLIB waiting on a response.
+ *  \return  1 once a record is due, -1 after the last record.
+ **************************************************************************************************/
+int32_t bgapiTraceReplayWait(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BGAPI_TRACE_H */
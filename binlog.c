@@ -0,0 +1,326 @@
+/***********************************************************************************************//**
+ * \file   binlog.c
+ * \brief  Asynchronous binary event logger
+ ***************************************************************************************************
+ * The ring holds records in their on-disk format, so the writer thread copies bytes straight
+ * from the ring to the file, or renders them one by one when the output is stdout. head is only written by the adapter thread holding the producer
+ * lock and tail only by the writer thread; both run freely over 64 bits and are masked on access.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+/* Own header */
+#include "binlog.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Ring size in bytes, a power of two. Holds several seconds of a saturated scan. */
+#define BINLOG_RING_SIZE              (1u << 20)
+#define BINLOG_RING_MASK              (BINLOG_RING_SIZE - 1)
+
+/** The writer flushes at least this often ... */
+#define BINLOG_FLUSH_MS               100
+
+/** ... and is woken early when the producer pushes the ring past this fill level. */
+#define BINLOG_KICK_LEVEL             (BINLOG_RING_SIZE / 4)
+
+volatile uint8_t binlogLevel = BINLOG_DEBUG;
+
+static uint8_t ring[BINLOG_RING_SIZE];
+static uint64_t ringHead = 0;
+static uint64_t ringTail = 0;
+
+static FILE* logFile = NULL;
+/** logFile is stdout: records are rendered as text. */
+static bool logText = false;
+static pthread_t writerThread;
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+/** The ring has one producer at a time, whichever adapter thread logs. */
+static pthread_mutex_t producerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writerKick = PTHREAD_COND_INITIALIZER;
+static volatile bool writerStop = false;
+static struct binlogStats stats;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void* binlogWriter(void* arg);
+static uint64_t binlogWriteText(uint64_t tail, uint64_t head);
+static void ringCopyIn(uint64_t pos, const void* data, size_t len);
+static void ringCopyOut(uint64_t pos, void* data, size_t len);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int binlogOpen(const char* path)
+{
+  sigset_t all, saved;
+  int ret;
+
+  logText = path == NULL;
+  logFile = logText ? stdout : fopen(path, "wb");
+  if (logFile == NULL) {
+    return -1;
+  }
+  if (!logText && fwrite(BINLOG_MAGIC, 1, 4, logFile) != 4) {
+    fclose(logFile);
+    logFile = NULL;
+    return -1;
+  }
+  /* The writer must not take signals meant for the event loop, so start it with all blocked. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &saved);
+  writerStop = false;
+  ret = pthread_create(&writerThread, NULL, binlogWriter, NULL);
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  if (ret != 0) {
+    if (!logText) {
+      fclose(logFile);
+    }
+    logFile = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+void binlogClose(void)
+{
+  if (logFile == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&writerLock);
+  writerStop = true;
+  pthread_cond_signal(&writerKick);
+  pthread_mutex_unlock(&writerLock);
+  pthread_join(writerThread, NULL);
+  if (!logText) {
+    fclose(logFile);
+  }
+  logFile = NULL;
+}
+
+void binlogEvent(const struct gecko_cmd_packet* evt)
+{
+  uint64_t startNs = timeNowNs();
+  uint16_t len = BGLIB_MSG_LEN(evt->header) + BGLIB_MSG_HEADER_LEN;
+
+  pthread_mutex_lock(&producerLock);
+  if (logFile != NULL) {
+    uint8_t header[BINLOG_RECORD_HEADER_LEN];
+    uint8_t* p = header;
+    uint64_t head = ringHead;
+    uint64_t tail = __atomic_load_n(&ringTail, __ATOMIC_ACQUIRE);
+
+    if (BINLOG_RING_SIZE - (head - tail) < sizeof(header) + len) {
+      stats.dropped++;
+      pthread_mutex_unlock(&producerLock);
+      return;
+    }
+    UINT32_TO_BITSTREAM(p, (uint32_t)startNs);
+    UINT32_TO_BITSTREAM(p, (uint32_t)(startNs >> 32));
+    UINT16_TO_BITSTREAM(p, len);
+    ringCopyIn(head, header, sizeof(header));
+    ringCopyIn(head + sizeof(header), evt, len);
+    __atomic_store_n(&ringHead, head + sizeof(header) + len, __ATOMIC_RELEASE);
+    /* Only a threshold crossing costs a syscall; a missed wakeup is covered by the timeout. */
+    if (head - tail < BINLOG_KICK_LEVEL && head + sizeof(header) + len - tail >= BINLOG_KICK_LEVEL) {
+      pthread_cond_signal(&writerKick);
+    }
+    stats.records++;
+    stats.costNs += timeNowNs() - startNs;
+    pthread_mutex_unlock(&producerLock);
+  } else {
+    char line[1024];
+
+    /* No writer thread: print in place, but without holding up the other adapters. */
+    pthread_mutex_unlock(&producerLock);
+    binlogFormatEvent(line, sizeof(line), evt);
+    fputs(line, stdout);
+    pthread_mutex_lock(&producerLock);
+    stats.records++;
+    stats.costNs += timeNowNs() - startNs;
+    pthread_mutex_unlock(&producerLock);
+  }
+}
+
+size_t binlogFormatEvent(char* out, size_t size, const struct gecko_cmd_packet* evt)
+{
+  const uint8_t* data = NULL;
+  uint8_t dataLen = 0;
+  size_t n;
+
+  switch (BGLIB_MSG_ID(evt->header)) {
+    case gecko_evt_le_gap_scan_response_id:
+      n = snprintf(out, size, "address ---> ");
+      for (uint8_t i = 0; i < 6 && n < size; i++) {
+        n += snprintf(out + n, size - n, "0x%02x ", evt->data.evt_le_gap_scan_response.address.addr[i]);
+      }
+      if (n < size) {
+        n += snprintf(out + n, size - n, " ---- rssi %d ---- advertisement packet --> ",
+                      evt->data.evt_le_gap_scan_response.rssi);
+      }
+      data = evt->data.evt_le_gap_scan_response.data.data;
+      dataLen = evt->data.evt_le_gap_scan_response.data.len;
+      break;
+
+    case gecko_evt_gatt_characteristic_value_id:
+      n = snprintf(out, size, "OK --- >Received %s data (handle %d, characteristic 0x%04x) --> ",
+                   evt->data.evt_gatt_characteristic_value.att_opcode == gatt_handle_value_notification
+                   ? "notification" : "read",
+                   evt->data.evt_gatt_characteristic_value.connection,
+                   evt->data.evt_gatt_characteristic_value.characteristic);
+      data = evt->data.evt_gatt_characteristic_value.value.data;
+      dataLen = evt->data.evt_gatt_characteristic_value.value.len;
+      break;
+
+    case gecko_evt_le_connection_opened_id:
+      n = snprintf(out, size, "Connection opened (handle %d)",
+                   evt->data.evt_le_connection_opened.connection);
+      break;
+
+    case gecko_evt_le_connection_closed_id:
+      n = snprintf(out, size, "Connection closed (handle %d, reason 0x%04x)",
+                   evt->data.evt_le_connection_closed.connection,
+                   evt->data.evt_le_connection_closed.reason);
+      break;
+
+    default:
+      n = snprintf(out, size, "Event: 0x%08x, %u bytes",
+                   (unsigned)BGLIB_MSG_ID(evt->header), (unsigned)BGLIB_MSG_LEN(evt->header));
+      break;
+  }
+  for (uint8_t i = 0; i < dataLen && n < size; i++) {
+    n += snprintf(out + n, size - n, "0x%02x ", data[i]);
+  }
+  if (n < size) {
+    n += snprintf(out + n, size - n, "\r\n");
+  }
+  return MIN(n, size - 1);
+}
+
+const struct binlogStats* binlogGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Writer thread: move whatever the ring holds to the file, then wait for the next
+ *          flush period or a kick from the producer.
+ *  \param[in] arg Unused.
+ *  \return  NULL.
+ **************************************************************************************************/
+static void* binlogWriter(void* arg)
+{
+  for (;; ) {
+    /* Sample the stop flag first so that a final pass drains everything logged before it. */
+    bool stop = writerStop;
+    uint64_t head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+    uint64_t tail = ringTail;
+
+    if (head == tail) {
+      struct timespec deadline;
+
+      if (stop) {
+        break;
+      }
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += BINLOG_FLUSH_MS * NSEC_PER_MSEC;
+      if (deadline.tv_nsec >= NSEC_PER_SEC) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= NSEC_PER_SEC;
+      }
+      pthread_mutex_lock(&writerLock);
+      if (!writerStop) {
+        pthread_cond_timedwait(&writerKick, &writerLock, &deadline);
+      }
+      pthread_mutex_unlock(&writerLock);
+      continue;
+    }
+    if (logText) {
+      tail = binlogWriteText(tail, head);
+    }
+    while (tail != head) {
+      size_t offset = tail & BINLOG_RING_MASK;
+      size_t chunk = MIN(head - tail, BINLOG_RING_SIZE - offset);
+
+      stats.bytes += fwrite(ring + offset, 1, chunk, logFile);
+      tail += chunk;
+    }
+    __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+    fflush(logFile);
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Print the records of the ring as text, freeing their space as they go.
+ *  \param[in] tail Free-running position of the first record.
+ *  \param[in] head Free-running position past the last record.
+ *  \return  head.
+ **************************************************************************************************/
+static uint64_t binlogWriteText(uint64_t tail, uint64_t head)
+{
+  struct gecko_cmd_packet evt;
+  char line[1024];
+
+  while (tail != head) {
+    uint8_t header[BINLOG_RECORD_HEADER_LEN];
+    uint16_t len;
+
+    ringCopyOut(tail, header, sizeof(header));
+    len = header[8] | (header[9] << 8);
+    ringCopyOut(tail + sizeof(header), &evt, MIN(len, sizeof(evt)));
+    tail += sizeof(header) + len;
+    __atomic_store_n(&ringTail, tail, __ATOMIC_RELEASE);
+    stats.bytes += fwrite(line, 1, binlogFormatEvent(line, sizeof(line), &evt), logFile);
+  }
+  return tail;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Copy bytes into the ring at a free-running position, wrapping at the end.
+ *  \param[in] pos Free-running write position.
+ *  \param[in] data Bytes to copy.
+ *  \param[in] len Number of bytes.
+ **************************************************************************************************/
+static void ringCopyIn(uint64_t pos, const void* data, size_t len)
+{
+  size_t offset = pos & BINLOG_RING_MASK;
+  size_t first = MIN(len, BINLOG_RING_SIZE - offset);
+
+  memcpy(ring + offset, data, first);
+  memcpy(ring, (const uint8_t*)data + first, len - first);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Copy bytes out of the ring at a free-running position, wrapping at the end.
+ *  \param[in] pos Free-running read position.
+ *  \param[out] data Destination.
+ *  \param[in] len Number of bytes.
+ **************************************************************************************************/
+static void ringCopyOut(uint64_t pos, void* data, size_t len)
+{
+  size_t offset = pos & BINLOG_RING_MASK;
+  size_t first = MIN(len, BINLOG_RING_SIZE - offset);
+
+  memcpy(data, ring + offset, first);
+  memcpy((uint8_t*)data + first, ring, len - first);
+}
@@ -0,0 +1,90 @@
+/***********************************************************************************************//**
+ * \file   binlog.h
+ * \brief  Asynchronous binary event logger
+ ***************************************************************************************************
+ * The BGAPI thread copies raw events into a lock-free single-producer/single-consumer ring,
+ * stamped with the monotonic clock. A background thread drains the ring to a binary log file
+ * that tools/binlog_decode.c renders as text. Without a log file, the same thread renders them
+ * as one text line each on stdout, so that a slow terminal never holds up the BGAPI thread.
+ **************************************************************************************************/
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/* Verbosity levels */
+#define BINLOG_OFF                    0
+#define BINLOG_INFO                   1   /**< link events, notification and read payloads */
+#define BINLOG_DEBUG                  2   /**< plus every scan report */
+
+/** Current verbosity; a single byte load, cheap enough to test on every event. */
+extern volatile uint8_t binlogLevel;
+
+#define BINLOG_ENABLED(level)         (binlogLevel >= (level))
+
+/** File header, followed by records of: uint64 timestamp (ns), uint16 length, raw BGAPI packet. */
+#define BINLOG_MAGIC                  "BLG1"
+#define BINLOG_RECORD_HEADER_LEN      10
+
+/** Logger counters. */
+struct binlogStats {
+  uint64_t records;         /**< events accepted */
+  uint64_t dropped;         /**< events lost because the ring was full */
+  uint64_t bytes;           /**< bytes written to the log file or stdout */
+  uint64_t costNs;          /**< time spent in binlogEvent() by the calling thread */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start logging through the background writer thread.
+ *  \param[in] path Binary log file, created or truncated; NULL to print the events on stdout.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int binlogOpen(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Drain the ring, stop the writer thread and close the file.
+ **************************************************************************************************/
+void binlogClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Log one BGAPI event. Never blocks; drops the event if the ring is full.
+ *  \param[in] evt Event as returned by gecko_peek_event().
+ **************************************************************************************************/
+void binlogEvent(const struct gecko_cmd_packet* evt);
+
+/***********************************************************************************************//**
+ *  \brief  Render an event as one line of text.
+ *  \param[out] out Destination buffer.
+ *  \param[in] size Size of the destination buffer.
+ *  \param[in] evt Event to render.
+ *  \return  Length of the text, excluding the terminating zero.
+ **************************************************************************************************/
+size_t binlogFormatEvent(char* out, size_t size, const struct gecko_cmd_packet* evt);
+
+/***********************************************************************************************//**
+ *  \brief  Access the logger counters.
+ *  \return  Pointer to the live statistics.
+ **************************************************************************************************/
+const struct binlogStats* binlogGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BINLOG_H */
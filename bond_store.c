@@ -0,0 +1,380 @@
+/***********************************************************************************************//**
+ * \file   bond_store.c
+ * \brief  Persistent store of the bonds held by the NCPs, keyed by peer identity address
+ ***************************************************************************************************
+ * File layout, little-endian:
+ *   "BND1" | uint16 count | count x 19-byte records
+ *   record: identity[6] identityType bonding[4] pairings(4) resumes(4)
+ *
+ * One store serves every adapter: all access is under a lock, and lookups hand out copies.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "infrastructure.h"
+
+/* Own header */
+#include "bond_store.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BOND_STORE_MAGIC              "BND1"
+#define BOND_STORE_RECORD_LEN         19
+
+#define BITSTREAM_TO_UINT16(p)        ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define BITSTREAM_TO_UINT32(p)        ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) \
+                                       | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+static struct bondEntry entries[BOND_STORE_ENTRIES];
+static uint16_t entryCount = 0;
+static uint32_t useClock = 0;
+static char storePath[256] = BOND_STORE_DEFAULT_PATH;
+static struct bondStoreStats stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Entries each adapter's NCP listed since bondStoreListBegin(), one bit per entry. */
+static uint32_t listed[ADAPTER_MAX];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int bondStoreWrite(void);
+static struct bondEntry* bondStoreByIdentity(const bd_addr* identity);
+static struct bondEntry* bondStoreByHandle(uint8_t adapter, uint8_t bonding);
+static struct bondEntry* bondStoreInsert(const bd_addr* identity, uint8_t identityType);
+static void bondStoreDropUnused(void);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int bondStoreLoad(const char* path)
+{
+  uint8_t record[BOND_STORE_RECORD_LEN];
+  uint8_t header[6];
+  uint16_t count;
+  FILE* fp;
+
+  pthread_mutex_lock(&lock);
+  snprintf(storePath, sizeof(storePath), "%s", path);
+  entryCount = 0;
+
+  fp = fopen(storePath, "rb");
+  if (fp == NULL) {
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, BOND_STORE_MAGIC, 4)) {
+    fclose(fp);
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+  count = MIN(BITSTREAM_TO_UINT16(header + 4), BOND_STORE_ENTRIES);
+
+  while (entryCount < count && fread(record, 1, sizeof(record), fp) == sizeof(record)) {
+    struct bondEntry* e = &entries[entryCount++];
+    uint8_t* p = record;
+
+    memcpy(e->identity.addr, p, 6);
+    p += 6;
+    e->identityType = *p++;
+    memcpy(e->bonding, p, ADAPTER_MAX);
+    p += ADAPTER_MAX;
+    e->pairings = BITSTREAM_TO_UINT32(p);
+    p += 4;
+    e->resumes = BITSTREAM_TO_UINT32(p);
+    e->lastUsed = 0;
+  }
+  fclose(fp);
+  count = entryCount;
+  pthread_mutex_unlock(&lock);
+  return count;
+}
+
+void bondStoreListBegin(uint8_t adapter)
+{
+  pthread_mutex_lock(&lock);
+  listed[adapter] = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+void bondStoreListEntry(uint8_t adapter, uint8_t bonding, const bd_addr* identity, uint8_t identityType)
+{
+  struct bondEntry* held;
+  struct bondEntry* e;
+
+  pthread_mutex_lock(&lock);
+  held = bondStoreByHandle(adapter, bonding);
+  e = bondStoreByIdentity(identity);
+  if (held != NULL && held != e) {
+    if (e == NULL) {
+      /* A bond recorded under the address of its link: now the identity is known. */
+      e = held;
+      e->identity = *identity;
+    } else {
+      /* The handle was reused for another peer. */
+      held->bonding[adapter] = BOND_NONE;
+    }
+  }
+  if (e == NULL) {
+    e = bondStoreInsert(identity, identityType);
+  }
+  e->identityType = identityType;
+  e->bonding[adapter] = bonding;
+  listed[adapter] |= 1u << (e - entries);
+  pthread_mutex_unlock(&lock);
+}
+
+void bondStoreListEnd(uint8_t adapter)
+{
+  pthread_mutex_lock(&lock);
+  for (uint16_t i = 0; i < entryCount; i++) {
+    if (entries[i].bonding[adapter] != BOND_NONE && !(listed[adapter] & (1u << i))) {
+      entries[i].bonding[adapter] = BOND_NONE;
+      stats.dropped++;
+    }
+  }
+  bondStoreDropUnused();
+  if (bondStoreWrite() < 0) {
+    printf("Error!!! Could not write bond store %s\r\n", storePath);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void bondStoreBonded(uint8_t adapter, uint8_t bonding, const bd_addr* address, uint8_t addressType)
+{
+  struct bondEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = bondStoreByHandle(adapter, bonding);
+  if (e == NULL) {
+    e = bondStoreByIdentity(address);
+  }
+  if (e == NULL) {
+    e = bondStoreInsert(address, addressType & 1);
+  }
+  e->bonding[adapter] = bonding;
+  e->pairings++;
+  e->lastUsed = ++useClock;
+  if (bondStoreWrite() < 0) {
+    printf("Error!!! Could not write bond store %s\r\n", storePath);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+bool bondStoreFind(uint8_t adapter, uint8_t bonding, struct bondEntry* entry)
+{
+  struct bondEntry* e = NULL;
+
+  pthread_mutex_lock(&lock);
+  if (bonding != BOND_NONE) {
+    e = bondStoreByHandle(adapter, bonding);
+  }
+  if (e != NULL) {
+    e->lastUsed = ++useClock;
+    *entry = *e;
+  }
+  pthread_mutex_unlock(&lock);
+  return e != NULL;
+}
+
+void bondStoreForget(uint8_t adapter, uint8_t bonding)
+{
+  struct bondEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = bondStoreByHandle(adapter, bonding);
+  if (e != NULL) {
+    e->bonding[adapter] = BOND_NONE;
+    stats.dropped++;
+    bondStoreDropUnused();
+    if (bondStoreWrite() < 0) {
+      printf("Error!!! Could not write bond store %s\r\n", storePath);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void bondStoreRecordSetup(uint8_t adapter, uint8_t bonding, bool resumed, uint64_t setupNs)
+{
+  struct bondEntry* e;
+
+  pthread_mutex_lock(&lock);
+  if (resumed) {
+    stats.resumedCount++;
+    stats.resumeNs += setupNs;
+    e = bondStoreByHandle(adapter, bonding);
+    if (e != NULL) {
+      /* Counted in memory; written with the next change to the bonds. */
+      e->resumes++;
+    }
+  } else {
+    stats.pairedCount++;
+    stats.pairNs += setupNs;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void bondStoreRecordFailure(void)
+{
+  __atomic_add_fetch(&stats.failures, 1, __ATOMIC_RELAXED);
+}
+
+void bondStoreRecordResolved(void)
+{
+  __atomic_add_fetch(&stats.resolved, 1, __ATOMIC_RELAXED);
+}
+
+void bondStoreReport(void)
+{
+  pthread_mutex_lock(&lock);
+  printf("BOND --- > %u bonded peers, %llu scan reports from them, %u bonds dropped, %u failures; "
+         "encryption: paired %.1f ms (%u links), stored bond %.1f ms (%u links)\r\n",
+         entryCount, (unsigned long long)stats.resolved, stats.dropped, stats.failures,
+         stats.pairedCount ? stats.pairNs / 1e6 / stats.pairedCount : 0.0, stats.pairedCount,
+         stats.resumedCount ? stats.resumeNs / 1e6 / stats.resumedCount : 0.0, stats.resumedCount);
+  pthread_mutex_unlock(&lock);
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Write the store to disk atomically, with the lock held.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int bondStoreWrite(void)
+{
+  uint8_t record[BOND_STORE_RECORD_LEN];
+  uint8_t header[6];
+  char tmpPath[sizeof(storePath) + 4];
+  uint8_t* p;
+  FILE* fp;
+  bool ok;
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", storePath);
+  fp = fopen(tmpPath, "wb");
+  if (fp == NULL) {
+    return -1;
+  }
+  memcpy(header, BOND_STORE_MAGIC, 4);
+  p = header + 4;
+  UINT16_TO_BITSTREAM(p, entryCount);
+  ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+
+  for (uint16_t i = 0; ok && i < entryCount; i++) {
+    const struct bondEntry* e = &entries[i];
+
+    p = record;
+    memcpy(p, e->identity.addr, 6);
+    p += 6;
+    UINT8_TO_BITSTREAM(p, e->identityType);
+    memcpy(p, e->bonding, ADAPTER_MAX);
+    p += ADAPTER_MAX;
+    UINT32_TO_BITSTREAM(p, e->pairings);
+    UINT32_TO_BITSTREAM(p, e->resumes);
+    ok = fwrite(record, 1, sizeof(record), fp) == sizeof(record);
+  }
+  if (fclose(fp) != 0 || !ok || rename(tmpPath, storePath) != 0) {
+    remove(tmpPath);
+    return -1;
+  }
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find the entry of an identity address.
+ *  \param[in] identity Identity address.
+ *  \return  The entry, NULL if unknown.
+ **************************************************************************************************/
+static struct bondEntry* bondStoreByIdentity(const bd_addr* identity)
+{
+  for (uint16_t i = 0; i < entryCount; i++) {
+    if (!memcmp(&entries[i].identity, identity, sizeof(bd_addr))) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find the entry holding a bonding handle of an adapter.
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle.
+ *  \return  The entry, NULL if unknown.
+ **************************************************************************************************/
+static struct bondEntry* bondStoreByHandle(uint8_t adapter, uint8_t bonding)
+{
+  for (uint16_t i = 0; i < entryCount; i++) {
+    if (entries[i].bonding[adapter] == bonding) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Add an entry without bonds, replacing the least recently used peer when full.
+ *  \param[in] identity Identity address.
+ *  \param[in] identityType Its type.
+ *  \return  The entry.
+ **************************************************************************************************/
+static struct bondEntry* bondStoreInsert(const bd_addr* identity, uint8_t identityType)
+{
+  struct bondEntry* e;
+
+  if (entryCount < BOND_STORE_ENTRIES) {
+    e = &entries[entryCount++];
+  } else {
+    e = &entries[0];
+    for (uint16_t i = 1; i < entryCount; i++) {
+      if (entries[i].lastUsed < e->lastUsed) {
+        e = &entries[i];
+      }
+    }
+  }
+  for (uint8_t a = 0; a < ADAPTER_MAX; a++) {
+    listed[a] &= ~(1u << (e - entries));
+  }
+  memset(e, 0, sizeof(*e));
+  memset(e->bonding, BOND_NONE, sizeof(e->bonding));
+  e->identity = *identity;
+  e->identityType = identityType;
+  e->lastUsed = ++useClock;
+  return e;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Remove the peers no NCP holds a bond with any more, keeping the order of the others
+ *          and the adapters' list marks in step.
+ **************************************************************************************************/
+static void bondStoreDropUnused(void)
+{
+  uint16_t kept = 0;
+
+  for (uint16_t i = 0; i < entryCount; i++) {
+    bool held = false;
+
+    for (uint8_t a = 0; a < ADAPTER_MAX; a++) {
+      held |= entries[i].bonding[a] != BOND_NONE;
+    }
+    if (!held) {
+      continue;
+    }
+    for (uint8_t a = 0; a < ADAPTER_MAX; a++) {
+      uint32_t bit = (listed[a] >> i) & 1;
+
+      listed[a] = (listed[a] & ~(1u << kept)) | (bit << kept);
+    }
+    entries[kept++] = entries[i];
+  }
+  entryCount = kept;
+}
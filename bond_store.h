@@ -0,0 +1,149 @@
+/***********************************************************************************************//**
+ * \file   bond_store.h
+ * \brief  Persistent store of the bonds held by the NCPs, keyed by peer identity address
+ ***************************************************************************************************
+ * The keys of a bond (LTK, IRK, CSRK) never leave the NCP: the 2.x stack keeps them in its own
+ * persistent store, uses them to encrypt links and to resolve private addresses, and tells the
+ * host about them only through a bonding handle. This store is the host's side of that: for every
+ * peer identity address, the bonding handle it has on each adapter's NCP and what the bond was
+ * used for. It lets the host recognize a bonded peer from the handle of a scan report or a new
+ * link, whatever private address it used, and is checked against the NCP's own list of bonds
+ * (sm_list_all_bondings) every time an NCP is set up.
+ **************************************************************************************************/
+
+#ifndef BOND_STORE_H
+#define BOND_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+#include "adapter.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Peers remembered, the most an NCP can be configured to bond with. */
+#define BOND_STORE_ENTRIES            32
+
+/** Default location of the store file. */
+#define BOND_STORE_DEFAULT_PATH       "bonds.bin"
+
+/** Bonding handle of a peer the NCP has no bond with, as the stack reports it. */
+#define BOND_NONE                     0xff
+
+/** One bonded peer. */
+struct bondEntry {
+  bd_addr identity;             /**< identity address, as the NCP lists the bond */
+  uint8_t identityType;         /**< 0 public, 1 static random */
+  uint8_t bonding[ADAPTER_MAX]; /**< handle of the bond on each adapter's NCP, BOND_NONE if none */
+  uint32_t pairings;            /**< bonds made with the peer */
+  uint32_t resumes;             /**< links encrypted with a stored bond */
+  uint32_t lastUsed;            /**< LRU stamp, not persisted */
+};
+
+/** Counters of this run. */
+struct bondStoreStats {
+  uint32_t pairedCount;         /**< links that paired and bonded */
+  uint32_t resumedCount;        /**< links encrypted with a stored bond */
+  uint32_t failures;            /**< pairing or encryption failures */
+  uint32_t dropped;             /**< bonds the NCP no longer had, or lost by the peer */
+  uint64_t pairNs;              /**< sum of opened-to-bonded times */
+  uint64_t resumeNs;            /**< sum of opened-to-encrypted times with a stored bond */
+  uint64_t resolved;            /**< scan reports from bonded peers, private addresses included */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Load the store from disk. A missing or malformed file yields an empty store.
+ *  \param[in] path Store file location.
+ *  \return  Number of peers loaded.
+ **************************************************************************************************/
+int bondStoreLoad(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Start checking an adapter's bonds against the list its NCP is about to send.
+ *  \param[in] adapter Adapter index.
+ **************************************************************************************************/
+void bondStoreListBegin(uint8_t adapter);
+
+/***********************************************************************************************//**
+ *  \brief  Record a bond listed by the NCP (sm_list_bonding_entry).
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle.
+ *  \param[in] identity Identity address of the peer.
+ *  \param[in] identityType Its type, 0 public, 1 static random.
+ **************************************************************************************************/
+void bondStoreListEntry(uint8_t adapter, uint8_t bonding, const bd_addr* identity, uint8_t identityType);
+
+/***********************************************************************************************//**
+ *  \brief  End of the NCP's list: forget the adapter's bonds that were not in it, and persist the
+ *          store.
+ *  \param[in] adapter Adapter index.
+ **************************************************************************************************/
+void bondStoreListEnd(uint8_t adapter);
+
+/***********************************************************************************************//**
+ *  \brief  Record a new bond (sm_bonded), under the address the link was opened with until the
+ *          NCP lists its identity address, and persist the store.
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle.
+ *  \param[in] address Address of the link.
+ *  \param[in] addressType Its type.
+ **************************************************************************************************/
+void bondStoreBonded(uint8_t adapter, uint8_t bonding, const bd_addr* address, uint8_t addressType);
+
+/***********************************************************************************************//**
+ *  \brief  Look up the peer of a bonding handle.
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle, BOND_NONE for none.
+ *  \param[out] entry Copy of the entry, if the handle is known.
+ *  \return  true if the handle is known.
+ **************************************************************************************************/
+bool bondStoreFind(uint8_t adapter, uint8_t bonding, struct bondEntry* entry);
+
+/***********************************************************************************************//**
+ *  \brief  Forget a bond the adapter's NCP deleted, and persist the store.
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle.
+ **************************************************************************************************/
+void bondStoreForget(uint8_t adapter, uint8_t bonding);
+
+/***********************************************************************************************//**
+ *  \brief  Record the time a link took from opening to encryption.
+ *  \param[in] adapter Adapter index.
+ *  \param[in] bonding Bonding handle of the link.
+ *  \param[in] resumed true if a stored bond was used, false if the link paired.
+ *  \param[in] setupNs Opened to encrypted, or to bonded after pairing, in nanoseconds.
+ **************************************************************************************************/
+void bondStoreRecordSetup(uint8_t adapter, uint8_t bonding, bool resumed, uint64_t setupNs);
+
+/***********************************************************************************************//**
+ *  \brief  Count a pairing or encryption failure.
+ **************************************************************************************************/
+void bondStoreRecordFailure(void);
+
+/***********************************************************************************************//**
+ *  \brief  Count a scan report from a bonded peer.
+ **************************************************************************************************/
+void bondStoreRecordResolved(void);
+
+/***********************************************************************************************//**
+ *  \brief  Print the bonds and the pairing vs. stored bond encryption times.
+ **************************************************************************************************/
+void bondStoreReport(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BOND_STORE_H */
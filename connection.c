@@ -0,0 +1,159 @@
+/***********************************************************************************************//**
+ * \file   connection.c
+ * \brief  Per-connection context table, indexed by the BGAPI connection handle
+ ***************************************************************************************************
+ * Entries live in a fixed array of MAX_CONNECTIONS slots. A 256-entry byte index maps any
+ * connection handle to its slot, so event handlers find their context with a single load.
+ * Every state transition is timestamped and the time spent in the state left is recorded.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <string.h>
+
+#include "timeutil.h"
+
+#include "adapter.h"
+#include "metrics.h"
+
+/* Own header */
+#include "connection.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define NO_SLOT                       0xFF
+
+static ADAPTER_LOCAL struct connection connections[MAX_CONNECTIONS];
+
+/** Connection handle to slot index, NO_SLOT if unused. */
+static ADAPTER_LOCAL uint8_t slotByHandle[256];
+
+static ADAPTER_LOCAL uint8_t usedCount = 0;
+
+static const char* stateNames[] = {
+  [DISCONNECTED] = "DISCONNECTED",
+  [SCANNING] = "SCANNING",
+  [CONNECTED] = "CONNECTED",
+  [SERVICE_FOUND] = "SERVICE_FOUND",
+  [CHARACTERISTICS_DISCOVERING] = "CHARACTERISTICS_DISCOVERING",
+  [CHARACTERISTICS_FOUND] = "CHARACTERISTICS_FOUND",
+  [ENABLING_NOTIFY] = "ENABLING_NOTIFY",
+  [NOTIFY_ENABLED] = "NOTIFY_ENABLED",
+  [ENABLING_WRITE] = "ENABLING_WRITE",
+  [WRITE_ENABLED] = "WRITE_ENABLED",
+  [CONNECTING] = "CONNECTING",
+  [DESCRIPTORS_DISCOVERING] = "DESCRIPTORS_DISCOVERING",
+  [GATT_SERVICE_DISCOVERING] = "GATT_SERVICE_DISCOVERING",
+  [READING_DB_HASH] = "READING_DB_HASH",
+  [STREAMING] = "STREAMING",
+  [STREAM_DRAINING] = "STREAM_DRAINING",
+  [SUBSCRIBING] = "SUBSCRIBING",
+  [ENCRYPTING] = "ENCRYPTING",
+};
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void connInit(void)
+{
+  memset(slotByHandle, NO_SLOT, sizeof(slotByHandle));
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    memset(&connections[i], 0, sizeof(connections[i]));
+    connections[i].handle = NO_CONNECTION;
+    connections[i].connectTimer = -1;
+    connections[i].writeJob = -1;
+    connections[i].streamTimer = -1;
+  }
+  usedCount = 0;
+}
+
+struct connection* connAlloc(uint8_t handle)
+{
+  if (handle == NO_CONNECTION || slotByHandle[handle] != NO_SLOT) {
+    return NULL;
+  }
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection* conn = &connections[i];
+
+    if (conn->handle == NO_CONNECTION) {
+      memset(conn, 0, sizeof(*conn));
+      conn->handle = handle;
+      conn->state = CONNECTING;
+      conn->stateNs = timeNowNs();
+      conn->serviceHandle = NO_HANDLE;
+      conn->notifyHandle = NO_HANDLE;
+      conn->rwHandle = NO_HANDLE;
+      conn->cccHandle = NO_HANDLE;
+      conn->connectTimer = -1;
+      conn->writeJob = -1;
+      conn->streamTimer = -1;
+      conn->mtu = ATT_DEFAULT_MTU;
+      slotByHandle[handle] = i;
+      usedCount++;
+      return conn;
+    }
+  }
+  return NULL;
+}
+
+struct connection* connGet(uint8_t handle)
+{
+  uint8_t slot = slotByHandle[handle];
+
+  return (slot == NO_SLOT) ? NULL : &connections[slot];
+}
+
+struct connection* connFindByAddress(const bd_addr* address)
+{
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    if (connections[i].handle != NO_CONNECTION
+        && !memcmp(&connections[i].address, address, sizeof(bd_addr))) {
+      return &connections[i];
+    }
+  }
+  return NULL;
+}
+
+void connFree(struct connection* conn)
+{
+  if (conn == NULL || conn->handle == NO_CONNECTION) {
+    return;
+  }
+  slotByHandle[conn->handle] = NO_SLOT;
+  conn->handle = NO_CONNECTION;
+  connSetState(conn, DISCONNECTED);
+  usedCount--;
+}
+
+void connSetState(struct connection* conn, uint8_t state)
+{
+  uint64_t now = timeNowNs();
+
+  metricsObserve(METRICS_STATE_TIME(conn->state), now - conn->stateNs);
+  conn->state = state;
+  conn->stateNs = now;
+}
+
+const char* connStateName(uint8_t state)
+{
+  if (state >= sizeof(stateNames) / sizeof(stateNames[0])) {
+    return "UNKNOWN";
+  }
+  return stateNames[state];
+}
+
+uint8_t connCount(void)
+{
+  return usedCount;
+}
+
+struct connection* connAt(uint8_t slot)
+{
+  if (slot >= MAX_CONNECTIONS || connections[slot].handle == NO_CONNECTION) {
+    return NULL;
+  }
+  return &connections[slot];
+}
@@ -0,0 +1,206 @@
+/***********************************************************************************************//**
+ * \file   connection.h
+ * \brief  Per-connection context table, indexed by the BGAPI connection handle
+ **************************************************************************************************/
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Number of simultaneous connections supported by the MG13 NCP image. */
+#define MAX_CONNECTIONS               8
+
+#define NO_CONNECTION                 0xFF
+#define NO_HANDLE                     0xFFFF
+
+/** ATT MTU before the exchange. */
+#define ATT_DEFAULT_MTU               23
+
+/* Per-connection states */
+#define DISCONNECTED                  0
+#define SCANNING                      1
+#define CONNECTED                     2
+#define SERVICE_FOUND                 3
+#define CHARACTERISTICS_DISCOVERING   4
+#define CHARACTERISTICS_FOUND         5
+#define ENABLING_NOTIFY               6
+#define NOTIFY_ENABLED                7
+#define ENABLING_WRITE                8
+#define WRITE_ENABLED                 9
+#define CONNECTING                    10
+#define DESCRIPTORS_DISCOVERING       11
+#define GATT_SERVICE_DISCOVERING      12
+#define READING_DB_HASH               13
+#define STREAMING                     14
+#define STREAM_DRAINING               15
+#define SUBSCRIBING                   16
+#define ENCRYPTING                    17
+
+/** Profile services and characteristics a link keeps the handles of; further ones are ignored. */
+#define GATT_LINK_SERVICES            8
+#define GATT_LINK_CHARS               32
+
+/** Value length of a characteristic not read yet. */
+#define GATT_LINK_LEN_UNKNOWN         0xFFFF
+
+/** Round-trip probes tracked per link for loss and reordering, a multiple of 64. */
+#define RTT_WINDOW                    256
+
+#define NOTIFY_CHAR_ITEM              1
+#define RW_CHAR_ITEM                  2
+#define ALL_CHARS                     (NOTIFY_CHAR_ITEM | RW_CHAR_ITEM)
+
+/** A characteristic of the GATT profile found on a link. */
+struct gattLinkChar {
+  uint16_t handle;
+  uint16_t entry;               /**< GATT profile entry */
+  uint16_t valueLen;            /**< length of the last value read, GATT_LINK_LEN_UNKNOWN before */
+  uint16_t readLen;             /**< bytes of the read in progress */
+  uint64_t dueNs;               /**< next poll read, 0 until the link is polled */
+};
+
+/** State of one link to a Demo Service peripheral. */
+struct connection {
+  uint8_t handle;               /**< BGAPI connection handle, NO_CONNECTION when free */
+  uint8_t state;                /**< one of the per-connection states above, set by connSetState() */
+  uint8_t characteristicsState; /**< NOTIFY_CHAR_ITEM / RW_CHAR_ITEM found so far */
+  uint8_t writeCounter;         /**< value written on every run of the write job */
+  uint32_t serviceHandle;
+  uint32_t gattServiceHandle;   /**< Generic Attribute service, 0 if not found */
+  uint16_t notifyHandle;
+  uint16_t rwHandle;
+  uint16_t cccHandle;           /**< CCC descriptor of notifyHandle */
+  uint8_t serviceCount;         /**< GATT profile services found */
+  uint8_t serviceNext;          /**< service whose characteristics are being discovered */
+  uint32_t services[GATT_LINK_SERVICES];
+  uint16_t serviceEntries[GATT_LINK_SERVICES]; /**< GATT profile entries of services[] */
+  uint8_t charCount;            /**< GATT profile characteristics found */
+  uint8_t subscribeNext;        /**< chars[] index to look for further subscriptions from */
+  uint32_t pollPending;         /**< chars[] of the poll read in flight, one bit each, 0 if none */
+  uint64_t pollNs;              /**< send time of that read */
+  uint8_t pollResponses;        /**< ATT responses to it so far */
+  bool noReadMultiple;          /**< the peer refused a read multiple request */
+  struct gattLinkChar chars[GATT_LINK_CHARS];
+  bd_addr address;
+  uint8_t addressType;
+  bool fromCache;               /**< handles were taken from the GATT cache */
+  bool hashRead;                /**< dbHash holds the value read on this link */
+  bool direct;                  /**< opened by a direct reconnection rather than a scan match */
+  uint8_t bonding;              /**< bonding handle on the NCP, 0xff while not bonded */
+  bool pairing;                 /**< encryption needs pairing: there is no stored bond */
+  uint8_t dbHash[16];
+  int connectTimer;             /**< timer wheel job guarding the open, -1 if none */
+  int writeJob;                 /**< timer wheel job of the periodic writes, -1 if none */
+  uint64_t stateNs;             /**< time of the last state transition */
+  uint64_t foundNs;             /**< scan match time */
+  uint64_t lostNs;              /**< loss of the previous link to this peer, 0 if none */
+  uint64_t openedNs;            /**< connection opened time */
+  uint64_t readyNs;             /**< notifications enabled time */
+  uint64_t firstNotifyNs;       /**< first notification time, 0 until then */
+  uint64_t notifications;       /**< notifications received */
+  uint64_t notifyBytes;         /**< notification payload bytes received */
+  uint16_t mtu;                 /**< ATT MTU of the link */
+  uint16_t interval;            /**< negotiated connection interval, 1.25 ms units, 0 until known */
+  uint16_t latency;             /**< negotiated slave latency */
+  uint16_t timeout;             /**< negotiated supervision timeout, 10 ms units */
+  uint16_t txsize;              /**< negotiated link-layer payload size */
+  uint8_t phy;                  /**< current PHY, 0 until reported */
+  uint8_t profileRequests;      /**< link profile parameter requests sent */
+  uint64_t writeNs;             /**< send time of the periodic write in flight, 0 if none */
+  uint16_t streamPayload;       /**< bytes per streamed write */
+  uint32_t streamLeft;          /**< bytes still to stream */
+  uint8_t streamBackoffMs;      /**< current wait after a full NCP buffer */
+  int streamTimer;              /**< event loop timer pacing the stream, -1 if none */
+  uint64_t streamStartNs;
+  uint64_t streamBytes;         /**< bytes accepted by the NCP */
+  uint64_t streamWrites;        /**< writes accepted by the NCP */
+  uint64_t streamRetries;       /**< writes refused because the NCP buffers were full */
+  uint64_t streamErrors;        /**< writes refused for any other reason */
+  bool rttActive;               /**< round-trip probes are sent on this link */
+  uint32_t rttSent;             /**< probes sent, the sequence number of the next one */
+  uint32_t rttNext;             /**< one past the highest sequence number echoed */
+  uint32_t rttBase;             /**< oldest sequence number of the window */
+  uint64_t rttEchoed[RTT_WINDOW / 64]; /**< window bits of the probes echoed or refused */
+  uint64_t rttDueNs;            /**< time the next probe is due */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Mark every entry free.
+ **************************************************************************************************/
+void connInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Claim an entry for a new connection handle.
+ *  \param[in] handle Connection handle returned by the stack.
+ *  \return  The zeroed entry, NULL if the table is full or the handle is already in use.
+ **************************************************************************************************/
+struct connection* connAlloc(uint8_t handle);
+
+/***********************************************************************************************//**
+ *  \brief  Look up a connection by handle in O(1).
+ *  \param[in] handle Connection handle.
+ *  \return  The entry, NULL if the handle is unknown.
+ **************************************************************************************************/
+struct connection* connGet(uint8_t handle);
+
+/***********************************************************************************************//**
+ *  \brief  Look up a connection by peer address.
+ *  \param[in] address Peer Bluetooth address.
+ *  \return  The entry, NULL if there is no link or pending link to that peer.
+ **************************************************************************************************/
+struct connection* connFindByAddress(const bd_addr* address);
+
+/***********************************************************************************************//**
+ *  \brief  Release an entry.
+ *  \param[in] conn Entry returned by connAlloc() or connGet().
+ **************************************************************************************************/
+void connFree(struct connection* conn);
+
+/***********************************************************************************************//**
+ *  \brief  Change state, recording the time spent in the previous one.
+ *  \param[in] conn Entry.
+ *  \param[in] state New per-connection state.
+ **************************************************************************************************/
+void connSetState(struct connection* conn, uint8_t state);
+
+/***********************************************************************************************//**
+ *  \brief  Name of a per-connection state.
+ *  \param[in] state Per-connection state.
+ *  \return  Upper-case name, "UNKNOWN" if out of range.
+ **************************************************************************************************/
+const char* connStateName(uint8_t state);
+
+/***********************************************************************************************//**
+ *  \brief  Number of entries in use, pending connection attempts included.
+ *  \return  Entry count.
+ **************************************************************************************************/
+uint8_t connCount(void);
+
+/***********************************************************************************************//**
+ *  \brief  Access an entry by slot, for iterating over all connections.
+ *  \param[in] slot Slot index, 0 to MAX_CONNECTIONS - 1.
+ *  \return  The entry if the slot is in use, NULL otherwise.
+ **************************************************************************************************/
+struct connection* connAt(uint8_t slot);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* CONNECTION_H */
@@ -0,0 +1,361 @@
+/***********************************************************************************************//**
+ * \file   event_loop.c
+ * \brief  poll() based event loop over file descriptors and timers
+ ***************************************************************************************************
+ * All sources live in one small table that is turned into a pollfd array on every iteration,
+ * so handlers may add or remove sources freely. On Linux every timer is a timerfd sitting in
+ * the same poll set; elsewhere timers are kept as deadlines and folded into the poll timeout.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#endif
+
+#include "timeutil.h"
+
+#include "adapter.h"
+
+/* Own header */
+#include "event_loop.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define SOURCE_ID(index, gen)     ((int)(((gen) << 8) | (index)))
+#define SOURCE_INDEX(id)          ((id) & 0xFF)
+
+struct evloopSource {
+  bool used;
+  bool isTimer;
+  bool periodic;
+  uint16_t gen;
+  int fd;
+  short events;
+  evloopFdHandler fdHandler;
+  evloopTimerHandler timerHandler;
+  void* ctx;
+  uint64_t periodNs;
+  uint64_t nextNs;          /**< next expiry, used when timerfd is not available */
+};
+
+static ADAPTER_LOCAL struct evloopSource sources[EVLOOP_MAX_SOURCES];
+static ADAPTER_LOCAL struct evloopStats stats;
+static ADAPTER_LOCAL volatile sig_atomic_t stopRequested = 0;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int evloopAllocSource(void);
+static void evloopFreeSource(int index);
+static int evloopTimerTimeout(uint64_t now);
+static void evloopFireTimer(int index, uint64_t now);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int evloopInit(void)
+{
+  for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].used) {
+      evloopFreeSource(i);
+    }
+  }
+  memset(&stats, 0, sizeof(stats));
+  stopRequested = 0;
+  return 0;
+}
+
+int evloopAddFd(int fd, short events, evloopFdHandler handler, void* ctx)
+{
+  int index = evloopAllocSource();
+
+  if (index < 0) {
+    return -1;
+  }
+  sources[index].fd = fd;
+  sources[index].events = events;
+  sources[index].fdHandler = handler;
+  sources[index].ctx = ctx;
+  return 0;
+}
+
+int evloopModifyFd(int fd, short events)
+{
+  for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].used && !sources[i].isTimer && sources[i].fd == fd) {
+      sources[i].events = events;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int evloopRemoveFd(int fd)
+{
+  for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].used && !sources[i].isTimer && sources[i].fd == fd) {
+      evloopFreeSource(i);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int evloopAddTimer(uint32_t intervalMs, bool periodic, evloopTimerHandler handler, void* ctx)
+{
+  struct evloopSource* src;
+  int index = evloopAllocSource();
+
+  if (index < 0) {
+    return -1;
+  }
+  src = &sources[index];
+  src->isTimer = true;
+  src->periodic = periodic;
+  src->timerHandler = handler;
+  src->ctx = ctx;
+  src->periodNs = (uint64_t)intervalMs * NSEC_PER_MSEC;
+  src->nextNs = timeNowNs() + src->periodNs;
+  src->fd = -1;
+
+#if defined(__linux__)
+  struct itimerspec its;
+
+  src->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (src->fd < 0) {
+    evloopFreeSource(index);
+    return -1;
+  }
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = intervalMs / 1000;
+  its.it_value.tv_nsec = (intervalMs % 1000) * NSEC_PER_MSEC;
+  if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+    its.it_value.tv_nsec = 1;
+  }
+  if (periodic) {
+    its.it_interval = its.it_value;
+  }
+  timerfd_settime(src->fd, 0, &its, NULL);
+  src->events = POLLIN;
+#endif
+
+  return SOURCE_ID(index, src->gen);
+}
+
+void evloopSetTimer(int timerId, uint64_t dueNs)
+{
+  struct evloopSource* src;
+  int index;
+
+  if (timerId < 0) {
+    return;
+  }
+  index = SOURCE_INDEX(timerId);
+  if (index >= EVLOOP_MAX_SOURCES || !sources[index].used || !sources[index].isTimer
+      || SOURCE_ID(index, sources[index].gen) != timerId) {
+    return;
+  }
+  src = &sources[index];
+  src->periodNs = 0;
+  src->nextNs = dueNs == 0 ? UINT64_MAX : dueNs;
+
+#if defined(__linux__)
+  struct itimerspec its;
+
+  /* An absolute time already past expires at once; zero disarms. */
+  if (src->fd >= 0) {
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = dueNs / NSEC_PER_SEC;
+    its.it_value.tv_nsec = dueNs % NSEC_PER_SEC;
+    timerfd_settime(src->fd, TFD_TIMER_ABSTIME, &its, NULL);
+  }
+#endif
+}
+
+void evloopRemoveTimer(int timerId)
+{
+  int index;
+
+  if (timerId < 0) {
+    return;
+  }
+  index = SOURCE_INDEX(timerId);
+  if (index < EVLOOP_MAX_SOURCES && sources[index].used && sources[index].isTimer
+      && SOURCE_ID(index, sources[index].gen) == timerId) {
+    evloopFreeSource(index);
+  }
+}
+
+int evloopRun(void)
+{
+  struct pollfd pfds[EVLOOP_MAX_SOURCES];
+  int owner[EVLOOP_MAX_SOURCES];
+  uint16_t ownerGen[EVLOOP_MAX_SOURCES];
+  int count;
+  int ret;
+  uint64_t now;
+
+  while (!stopRequested) {
+    count = 0;
+    for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+      if (!sources[i].used) {
+        continue;
+      }
+      /* Deadline-only timers carry fd -1, which poll() ignores. */
+      pfds[count].fd = sources[i].fd;
+      pfds[count].events = sources[i].events;
+      pfds[count].revents = 0;
+      owner[count] = i;
+      ownerGen[count] = sources[i].gen;
+      count++;
+    }
+
+    ret = poll(pfds, count, evloopTimerTimeout(timeNowNs()));
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    now = timeNowNs();
+    stats.lastWakeNs = now;
+    if (ret > 0) {
+      stats.wakeups++;
+    }
+
+    for (int j = 0; j < count; j++) {
+      struct evloopSource* src = &sources[owner[j]];
+
+      /* The source may have been removed or replaced by an earlier handler. */
+      if (!src->used || src->gen != ownerGen[j]) {
+        continue;
+      }
+      if (src->isTimer) {
+        if (src->fd >= 0 ? (pfds[j].revents != 0) : (now >= src->nextNs)) {
+          evloopFireTimer(owner[j], now);
+        }
+      } else if (pfds[j].revents) {
+        src->fdHandler(src->fd, pfds[j].revents, src->ctx);
+      }
+    }
+  }
+  stopRequested = 0;
+  return 0;
+}
+
+void evloopStop(void)
+{
+  stopRequested = 1;
+}
+
+const struct evloopStats* evloopGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Claim a free slot in the source table.
+ *  \return  Slot index, -1 if the table is full.
+ **************************************************************************************************/
+static int evloopAllocSource(void)
+{
+  for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (!sources[i].used) {
+      uint16_t gen = (uint16_t)((sources[i].gen + 1) & 0x7FFF);
+
+      memset(&sources[i], 0, sizeof(sources[i]));
+      sources[i].used = true;
+      sources[i].gen = gen;
+      sources[i].fd = -1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Release a slot, closing the timerfd owned by timer slots.
+ *  \param[in] index Slot index.
+ **************************************************************************************************/
+static void evloopFreeSource(int index)
+{
+  if (sources[index].isTimer && sources[index].fd >= 0) {
+    close(sources[index].fd);
+  }
+  sources[index].used = false;
+  sources[index].fd = -1;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Compute the poll() timeout from the nearest deadline-only timer.
+ *  \param[in] now Current monotonic time.
+ *  \return  Timeout in milliseconds, -1 to wait indefinitely.
+ **************************************************************************************************/
+static int evloopTimerTimeout(uint64_t now)
+{
+  uint64_t nearest = UINT64_MAX;
+
+  for (int i = 0; i < EVLOOP_MAX_SOURCES; i++) {
+    if (sources[i].used && sources[i].isTimer && sources[i].fd < 0 && sources[i].nextNs < nearest) {
+      nearest = sources[i].nextNs;
+    }
+  }
+  if (nearest == UINT64_MAX) {
+    return -1;
+  }
+  if (nearest <= now) {
+    return 0;
+  }
+  /* Round up so that we never wake before the deadline. */
+  return (int)((nearest - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Acknowledge a timer expiry, re-arm or release it, then run its handler.
+ *  \param[in] index Slot index of the timer.
+ *  \param[in] now Current monotonic time.
+ **************************************************************************************************/
+static void evloopFireTimer(int index, uint64_t now)
+{
+  struct evloopSource* src = &sources[index];
+  int id = SOURCE_ID(index, src->gen);
+  evloopTimerHandler handler = src->timerHandler;
+  void* ctx = src->ctx;
+
+  if (src->fd >= 0) {
+    uint64_t expirations;
+
+    if (read(src->fd, &expirations, sizeof(expirations)) < 0) {
+      return;
+    }
+  } else if (src->periodNs == 0) {
+    /* Set with evloopSetTimer(): idle until set again. */
+    src->nextNs = UINT64_MAX;
+  } else {
+    src->nextNs += src->periodNs;
+    if (src->nextNs <= now) {
+      src->nextNs = now + src->periodNs;
+    }
+  }
+  if (!src->periodic) {
+    evloopFreeSource(index);
+  }
+  stats.timerExpiries++;
+  handler(id, ctx);
+}
@@ -0,0 +1,125 @@
+/***********************************************************************************************//**
+ * \file   event_loop.h
+ * \brief  poll() based event loop over file descriptors and timers
+ **************************************************************************************************/
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Maximum number of descriptors (timers included) watched at the same time. */
+#define EVLOOP_MAX_SOURCES        32
+
+/***********************************************************************************************//**
+ *  \brief  Called when a watched descriptor becomes ready.
+ *  \param[in] fd The descriptor.
+ *  \param[in] revents poll() revents bits.
+ *  \param[in] ctx Context pointer given at registration.
+ **************************************************************************************************/
+typedef void (*evloopFdHandler)(int fd, short revents, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Called when a timer expires.
+ *  \param[in] timerId Identifier returned by evloopAddTimer().
+ *  \param[in] ctx Context pointer given at registration.
+ **************************************************************************************************/
+typedef void (*evloopTimerHandler)(int timerId, void* ctx);
+
+/** Counters kept by the loop, used by the measurement mode. */
+struct evloopStats {
+  uint64_t wakeups;         /**< poll() returns with at least one ready source */
+  uint64_t timerExpiries;   /**< timer handler invocations */
+  uint64_t lastWakeNs;      /**< monotonic time of the latest poll() return */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Reset the loop to an empty set of sources.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int evloopInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Watch a descriptor, for example the UART, a control socket or a signalfd.
+ *  \param[in] fd Descriptor to watch.
+ *  \param[in] events poll() events of interest (POLLIN, POLLOUT).
+ *  \param[in] handler Function called when the descriptor is ready.
+ *  \param[in] ctx Passed back to the handler.
+ *  \return  0 on success, -1 if the table is full.
+ **************************************************************************************************/
+int evloopAddFd(int fd, short events, evloopFdHandler handler, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Change the poll() events a registered descriptor is watched for.
+ *  \param[in] fd Registered descriptor.
+ *  \param[in] events New poll() events of interest.
+ *  \return  0 on success, -1 if the descriptor is not registered.
+ **************************************************************************************************/
+int evloopModifyFd(int fd, short events);
+
+/***********************************************************************************************//**
+ *  \brief  Stop watching a descriptor. Safe to call from inside a handler.
+ *  \param[in] fd Registered descriptor.
+ *  \return  0 on success, -1 if the descriptor is not registered.
+ **************************************************************************************************/
+int evloopRemoveFd(int fd);
+
+/***********************************************************************************************//**
+ *  \brief  Start a timer. On Linux it is backed by a timerfd in the same poll set.
+ *  \param[in] intervalMs Time until the first expiry, and the period if periodic.
+ *  \param[in] periodic true to re-arm after each expiry, false for a one-shot timer.
+ *  \param[in] handler Function called on expiry.
+ *  \param[in] ctx Passed back to the handler.
+ *  \return  Timer identifier (>= 0), -1 on failure.
+ **************************************************************************************************/
+int evloopAddTimer(uint32_t intervalMs, bool periodic, evloopTimerHandler handler, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Set the next expiry of a periodic timer to a given time, once: it then stays idle
+ *          until set again, keeping its slot.
+ *  \param[in] timerId Identifier returned by evloopAddTimer() for a periodic timer.
+ *  \param[in] dueNs Monotonic time of the expiry, 0 to leave the timer idle.
+ **************************************************************************************************/
+void evloopSetTimer(int timerId, uint64_t dueNs);
+
+/***********************************************************************************************//**
+ *  \brief  Cancel a timer. One-shot timers are removed automatically once they fire.
+ *  \param[in] timerId Identifier returned by evloopAddTimer().
+ **************************************************************************************************/
+void evloopRemoveTimer(int timerId);
+
+/***********************************************************************************************//**
+ *  \brief  Dispatch events until evloopStop() is called.
+ *  \return  0 when stopped, -1 on a poll() failure.
+ **************************************************************************************************/
+int evloopRun(void);
+
+/***********************************************************************************************//**
+ *  \brief  Ask evloopRun() to return. Async-signal-safe.
+ **************************************************************************************************/
+void evloopStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Access the loop counters.
+ *  \return  Pointer to the live statistics.
+ **************************************************************************************************/
+const struct evloopStats* evloopGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* EVENT_LOOP_H */
@@ -0,0 +1,279 @@
+/***********************************************************************************************//**
+ * \file   gatt_cache.c
+ * \brief  Persistent cache of discovered GATT handles, keyed by peer address
+ ***************************************************************************************************
+ * File layout, little-endian:
+ *   "GHC1" | uint16 count | count x 38-byte records
+ *   record: address[6] addressType flags serviceHandle(4) gattServiceHandle(4)
+ *           notifyHandle(2) rwHandle(2) cccHandle(2) dbHash[16]
+ *
+ * One cache serves every adapter: all access is under a lock, and lookups hand out copies.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "infrastructure.h"
+
+/* Own header */
+#include "gatt_cache.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define GATT_CACHE_MAGIC              "GHC1"
+#define GATT_CACHE_RECORD_LEN         38
+#define GATT_CACHE_FLAG_HASH          0x01
+
+#define BITSTREAM_TO_UINT16(p)        ((uint16_t)((p)[0] | ((p)[1] << 8)))
+#define BITSTREAM_TO_UINT32(p)        ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) \
+                                       | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+static struct gattCacheEntry entries[GATT_CACHE_ENTRIES];
+static uint16_t entryCount = 0;
+static uint32_t useClock = 0;
+static char cachePath[256] = GATT_CACHE_DEFAULT_PATH;
+static struct gattCacheStats stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int gattCacheWrite(void);
+static struct gattCacheEntry* gattCacheLookup(const bd_addr* address);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int gattCacheLoad(const char* path)
+{
+  uint8_t record[GATT_CACHE_RECORD_LEN];
+  uint8_t header[6];
+  uint16_t count;
+  FILE* fp;
+
+  pthread_mutex_lock(&lock);
+  snprintf(cachePath, sizeof(cachePath), "%s", path);
+  entryCount = 0;
+
+  fp = fopen(cachePath, "rb");
+  if (fp == NULL) {
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, GATT_CACHE_MAGIC, 4)) {
+    fclose(fp);
+    pthread_mutex_unlock(&lock);
+    return 0;
+  }
+  count = MIN(BITSTREAM_TO_UINT16(header + 4), GATT_CACHE_ENTRIES);
+
+  while (entryCount < count && fread(record, 1, sizeof(record), fp) == sizeof(record)) {
+    struct gattCacheEntry* e = &entries[entryCount++];
+    uint8_t* p = record;
+
+    memcpy(e->address.addr, p, 6);
+    p += 6;
+    e->addressType = *p++;
+    e->hashValid = (*p++ & GATT_CACHE_FLAG_HASH) != 0;
+    e->serviceHandle = BITSTREAM_TO_UINT32(p);
+    p += 4;
+    e->gattServiceHandle = BITSTREAM_TO_UINT32(p);
+    p += 4;
+    e->notifyHandle = BITSTREAM_TO_UINT16(p);
+    p += 2;
+    e->rwHandle = BITSTREAM_TO_UINT16(p);
+    p += 2;
+    e->cccHandle = BITSTREAM_TO_UINT16(p);
+    p += 2;
+    memcpy(e->dbHash, p, 16);
+    e->lastUsed = 0;
+  }
+  fclose(fp);
+  count = entryCount;
+  pthread_mutex_unlock(&lock);
+  return count;
+}
+
+int gattCacheSave(void)
+{
+  int ret;
+
+  pthread_mutex_lock(&lock);
+  ret = gattCacheWrite();
+  pthread_mutex_unlock(&lock);
+  return ret;
+}
+
+bool gattCacheFind(const bd_addr* address, struct gattCacheEntry* entry)
+{
+  struct gattCacheEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = gattCacheLookup(address);
+  if (e == NULL) {
+    stats.misses++;
+  } else {
+    stats.hits++;
+    e->lastUsed = ++useClock;
+    *entry = *e;
+  }
+  pthread_mutex_unlock(&lock);
+  return e != NULL;
+}
+
+bool gattCachePeek(const bd_addr* address, struct gattCacheEntry* entry)
+{
+  struct gattCacheEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = gattCacheLookup(address);
+  if (e != NULL) {
+    *entry = *e;
+  }
+  pthread_mutex_unlock(&lock);
+  return e != NULL;
+}
+
+void gattCacheStore(const struct gattCacheEntry* entry)
+{
+  struct gattCacheEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = gattCacheLookup(&entry->address);
+  if (e == NULL) {
+    if (entryCount < GATT_CACHE_ENTRIES) {
+      e = &entries[entryCount++];
+    } else {
+      /* Replace the least recently used peer. */
+      e = &entries[0];
+      for (uint16_t i = 1; i < entryCount; i++) {
+        if (entries[i].lastUsed < e->lastUsed) {
+          e = &entries[i];
+        }
+      }
+    }
+  }
+  *e = *entry;
+  e->lastUsed = ++useClock;
+  if (gattCacheWrite() < 0) {
+    printf("Error!!! Could not write GATT cache %s\r\n", cachePath);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void gattCacheInvalidate(const bd_addr* address)
+{
+  struct gattCacheEntry* e;
+
+  pthread_mutex_lock(&lock);
+  e = gattCacheLookup(address);
+  if (e != NULL) {
+    *e = entries[--entryCount];
+    stats.invalidations++;
+    if (gattCacheWrite() < 0) {
+      printf("Error!!! Could not write GATT cache %s\r\n", cachePath);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void gattCacheRecordTtfn(bool warm, uint64_t ttfnNs)
+{
+  pthread_mutex_lock(&lock);
+  if (warm) {
+    stats.warmCount++;
+    stats.warmTtfnNs += ttfnNs;
+  } else {
+    stats.coldCount++;
+    stats.coldTtfnNs += ttfnNs;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void gattCacheReport(void)
+{
+  pthread_mutex_lock(&lock);
+  printf("CACHE --- > hits %u, misses %u, invalidations %u; "
+         "time to first notification: cold %.1f ms (%u links), warm %.1f ms (%u links)\r\n",
+         stats.hits, stats.misses, stats.invalidations,
+         stats.coldCount ? stats.coldTtfnNs / 1e6 / stats.coldCount : 0.0, stats.coldCount,
+         stats.warmCount ? stats.warmTtfnNs / 1e6 / stats.warmCount : 0.0, stats.warmCount);
+  pthread_mutex_unlock(&lock);
+}
+
+const struct gattCacheStats* gattCacheGetStats(void)
+{
+  return &stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Write the cache to disk atomically, with the lock held.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int gattCacheWrite(void)
+{
+  uint8_t record[GATT_CACHE_RECORD_LEN];
+  uint8_t header[6];
+  char tmpPath[sizeof(cachePath) + 4];
+  uint8_t* p;
+  FILE* fp;
+  bool ok;
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", cachePath);
+  fp = fopen(tmpPath, "wb");
+  if (fp == NULL) {
+    return -1;
+  }
+  memcpy(header, GATT_CACHE_MAGIC, 4);
+  p = header + 4;
+  UINT16_TO_BITSTREAM(p, entryCount);
+  ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+
+  for (uint16_t i = 0; ok && i < entryCount; i++) {
+    const struct gattCacheEntry* e = &entries[i];
+
+    p = record;
+    memcpy(p, e->address.addr, 6);
+    p += 6;
+    UINT8_TO_BITSTREAM(p, e->addressType);
+    UINT8_TO_BITSTREAM(p, e->hashValid ? GATT_CACHE_FLAG_HASH : 0);
+    UINT32_TO_BITSTREAM(p, e->serviceHandle);
+    UINT32_TO_BITSTREAM(p, e->gattServiceHandle);
+    UINT16_TO_BITSTREAM(p, e->notifyHandle);
+    UINT16_TO_BITSTREAM(p, e->rwHandle);
+    UINT16_TO_BITSTREAM(p, e->cccHandle);
+    memcpy(p, e->dbHash, 16);
+    ok = fwrite(record, 1, sizeof(record), fp) == sizeof(record);
+  }
+  if (fclose(fp) != 0 || !ok || rename(tmpPath, cachePath) != 0) {
+    remove(tmpPath);
+    return -1;
+  }
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find the entry of a peer without touching the counters.
+ *  \param[in] address Peer address.
+ *  \return  The entry, NULL if not cached.
+ **************************************************************************************************/
+static struct gattCacheEntry* gattCacheLookup(const bd_addr* address)
+{
+  for (uint16_t i = 0; i < entryCount; i++) {
+    if (!memcmp(&entries[i].address, address, sizeof(bd_addr))) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
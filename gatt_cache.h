@@ -0,0 +1,120 @@
+/***********************************************************************************************//**
+ * \file   gatt_cache.h
+ * \brief  Persistent cache of discovered GATT handles, keyed by peer address
+ **************************************************************************************************/
+
+#ifndef GATT_CACHE_H
+#define GATT_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Number of peers remembered; the least recently used entry is replaced when full. */
+#define GATT_CACHE_ENTRIES            64
+
+/** Default location of the cache file. */
+#define GATT_CACHE_DEFAULT_PATH       "gattcache.bin"
+
+/** Handles of the Demo Service on one peer. */
+struct gattCacheEntry {
+  bd_addr address;
+  uint8_t addressType;
+  bool hashValid;               /**< dbHash holds the peer's Database Hash */
+  uint32_t serviceHandle;       /**< Demo Service */
+  uint32_t gattServiceHandle;   /**< Generic Attribute service, 0 if not found */
+  uint16_t notifyHandle;
+  uint16_t rwHandle;
+  uint16_t cccHandle;           /**< Client Characteristic Configuration of notifyHandle */
+  uint8_t dbHash[16];
+  uint32_t lastUsed;            /**< LRU stamp, not persisted */
+};
+
+/** Cache counters. */
+struct gattCacheStats {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t invalidations;       /**< entries dropped after a hash mismatch or a failed write */
+  uint32_t coldCount;           /**< links set up through full discovery */
+  uint32_t warmCount;           /**< links set up from the cache */
+  uint64_t coldTtfnNs;          /**< sum of opened-to-first-notification times, cold links */
+  uint64_t warmTtfnNs;          /**< sum of opened-to-first-notification times, warm links */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Load the cache from disk. A missing or malformed file yields an empty cache.
+ *  \param[in] path Cache file location.
+ *  \return  Number of entries loaded.
+ **************************************************************************************************/
+int gattCacheLoad(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Write the cache to disk atomically (temporary file and rename).
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int gattCacheSave(void);
+
+/***********************************************************************************************//**
+ *  \brief  Look up the handles of a peer and count the hit or miss.
+ *  \param[in] address Peer address.
+ *  \param[out] entry Copy of the entry, on a hit.
+ *  \return  true on a hit.
+ **************************************************************************************************/
+bool gattCacheFind(const bd_addr* address, struct gattCacheEntry* entry);
+
+/***********************************************************************************************//**
+ *  \brief  Look up the handles of a peer without counting a hit or miss.
+ *  \param[in] address Peer address.
+ *  \param[out] entry Copy of the entry, if the peer is cached.
+ *  \return  true if the peer is cached.
+ **************************************************************************************************/
+bool gattCachePeek(const bd_addr* address, struct gattCacheEntry* entry);
+
+/***********************************************************************************************//**
+ *  \brief  Insert or update the entry for entry->address and persist the cache.
+ *  \param[in] entry Discovered handles.
+ **************************************************************************************************/
+void gattCacheStore(const struct gattCacheEntry* entry);
+
+/***********************************************************************************************//**
+ *  \brief  Drop the entry of a peer whose database no longer matches, and persist the cache.
+ *  \param[in] address Peer address.
+ **************************************************************************************************/
+void gattCacheInvalidate(const bd_addr* address);
+
+/***********************************************************************************************//**
+ *  \brief  Record the opened-to-first-notification time of a link.
+ *  \param[in] warm true if the link was set up from the cache.
+ *  \param[in] ttfnNs Time to first notification in nanoseconds.
+ **************************************************************************************************/
+void gattCacheRecordTtfn(bool warm, uint64_t ttfnNs);
+
+/***********************************************************************************************//**
+ *  \brief  Print the counters and the cold vs. warm time-to-first-notification comparison.
+ **************************************************************************************************/
+void gattCacheReport(void);
+
+/***********************************************************************************************//**
+ *  \brief  Access the counters.
+ *  \return  Pointer to the live statistics.
+ **************************************************************************************************/
+const struct gattCacheStats* gattCacheGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* GATT_CACHE_H */
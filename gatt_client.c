@@ -0,0 +1,389 @@
+/***********************************************************************************************//**
+ * \file   gatt_client.c
+ * \brief  Per-link use of the GATT profile: attributes found on a link and periodic reads
+ ***************************************************************************************************
+ * A link keeps at most GATT_LINK_CHARS characteristics, searched linearly by handle: a link
+ * rarely uses more than a few, and a value event that is not the notify or RW characteristic
+ * is the only caller. The poll timer serves every link of the adapter: on each tick a free link
+ * reads its most overdue characteristic, and a period missed by more than a tick is not made
+ * up for. Other polls join that read if they are due within a quarter of their period and their
+ * values fit in one read multiple response together.
+ *
+ * A read multiple response is the values back to back, without lengths, so it can only be
+ * split with the lengths known: every characteristic is first read on its own, which gives its
+ * length, and only values shorter than ATT_MTU - 1, which cannot have been cut short, are read
+ * together afterwards. A response whose length is not the sum of those expected cannot be split
+ * and is dropped, and its characteristics are read on their own again. A value that changes
+ * length while another changes by the opposite amount goes unnoticed; fixed-length values, the
+ * usual case for polled readings, do not.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "adapter.h"
+#include "bgapi_cmd.h"
+#include "event_loop.h"
+#include "metrics.h"
+
+/* Own header */
+#include "gatt_client.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Command context of a poll read: the connection handle. */
+#define POLL_CTX(conn)                ((void*)(uintptr_t)(conn)->handle)
+
+/** Bit of chars[i] in pollPending. */
+#define POLL_BIT(i)                   (1UL << (i))
+
+/** Counters of the calling adapter since gattClientInit(). */
+struct pollCounters {
+  uint64_t values;          /**< characteristic values read */
+  uint64_t roundTrips;      /**< ATT read requests: one per read multiple, one or more per long value */
+  uint64_t batches;         /**< read multiple requests */
+  uint64_t batchValues;     /**< values they read */
+  uint64_t longReads;       /**< values too long for read multiple */
+  uint64_t unsplit;         /**< read multiple responses dropped: a value changed length */
+};
+
+static ADAPTER_LOCAL struct pollCounters counters;
+static ADAPTER_LOCAL uint64_t startNs = 0;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void onPollResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+static bool batchable(const struct connection* conn, const struct gattLinkChar* ch);
+static void pollSend(struct connection* conn, struct gattLinkChar* first, uint64_t nowNs);
+static void onPollTimer(int timerId, void* ctx);
+static void onReportTimer(int timerId, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void gattClientInit(void)
+{
+  if (gattProfileCount(GATT_PROFILE_POLL) > 0) {
+    memset(&counters, 0, sizeof(counters));
+    startNs = timeNowNs();
+    evloopAddTimer(GATT_CLIENT_POLL_TICK_MS, true, onPollTimer, NULL);
+    evloopAddTimer(GATT_CLIENT_REPORT_MS, true, onReportTimer, NULL);
+  }
+}
+
+void gattClientReset(struct connection* conn)
+{
+  conn->serviceCount = 0;
+  conn->serviceNext = 0;
+  conn->charCount = 0;
+  conn->subscribeNext = 0;
+  conn->pollPending = 0;
+}
+
+bool gattClientAddService(struct connection* conn, uint32_t service, const uint8_t* uuid, uint8_t len)
+{
+  const struct gattProfileAttr* attr = gattProfileLookup(uuid, len, GATT_PROFILE_NO_SERVICE);
+
+  if (attr == NULL || conn->serviceCount == GATT_LINK_SERVICES) {
+    return false;
+  }
+  conn->services[conn->serviceCount] = service;
+  conn->serviceEntries[conn->serviceCount] = attr->index;
+  conn->serviceCount++;
+  return true;
+}
+
+const struct gattProfileAttr* gattClientAddCharacteristic(struct connection* conn, uint16_t characteristic,
+                                                          const uint8_t* uuid, uint8_t len)
+{
+  const struct gattProfileAttr* attr;
+
+  if (conn->serviceNext >= conn->serviceCount || conn->charCount == GATT_LINK_CHARS) {
+    return NULL;
+  }
+  attr = gattProfileLookup(uuid, len, conn->serviceEntries[conn->serviceNext]);
+  if (attr == NULL) {
+    return NULL;
+  }
+  conn->chars[conn->charCount].handle = characteristic;
+  conn->chars[conn->charCount].entry = attr->index;
+  conn->chars[conn->charCount].valueLen = GATT_LINK_LEN_UNKNOWN;
+  conn->chars[conn->charCount].dueNs = 0;
+  conn->charCount++;
+  return attr;
+}
+
+const struct gattLinkChar* gattClientNextSubscription(struct connection* conn)
+{
+  while (conn->subscribeNext < conn->charCount) {
+    const struct gattLinkChar* c = &conn->chars[conn->subscribeNext++];
+
+    if (gattProfileAt(c->entry)->action == GATT_PROFILE_SUBSCRIBE && c->handle != conn->notifyHandle) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+const struct gattProfileAttr* gattClientFind(const struct connection* conn, uint16_t characteristic)
+{
+  for (uint8_t i = 0; i < conn->charCount; i++) {
+    if (conn->chars[i].handle == characteristic) {
+      return gattProfileAt(conn->chars[i].entry);
+    }
+  }
+  return NULL;
+}
+
+bool gattClientValue(struct connection* conn, uint16_t characteristic, uint8_t opcode, uint16_t offset,
+                     const uint8_t* data, uint8_t len, gattClientValueFn fn)
+{
+  uint32_t batch = conn->pollPending;
+  uint16_t expected = 0;
+  uint8_t count = 0;
+
+  if (batch == 0) {
+    return false;
+  }
+  if (opcode != gatt_read_multiple_response) {
+    struct gattLinkChar* ch = &conn->chars[__builtin_ctzl(batch)];
+
+    if ((batch & (batch - 1)) != 0 || characteristic != ch->handle) {
+      return false;
+    }
+    conn->pollResponses++;
+    ch->readLen = offset + len;
+    if (offset == 0) {
+      counters.values++;
+      metricsInc(METRICS_POLL_READS);
+    }
+    fn(conn, characteristic, data, len);
+    return true;
+  }
+
+  conn->pollResponses++;
+  for (uint8_t i = 0; i < conn->charCount; i++) {
+    if (batch & POLL_BIT(i)) {
+      expected += conn->chars[i].valueLen;
+    }
+  }
+  if (expected != len) {
+    counters.unsplit++;
+    for (uint8_t i = 0; i < conn->charCount; i++) {
+      if (batch & POLL_BIT(i)) {
+        conn->chars[i].valueLen = GATT_LINK_LEN_UNKNOWN;
+      }
+    }
+    return true;
+  }
+  for (uint8_t i = 0; i < conn->charCount; i++) {
+    struct gattLinkChar* ch = &conn->chars[i];
+
+    if (batch & POLL_BIT(i)) {
+      fn(conn, ch->handle, data, (uint8_t)ch->valueLen);
+      data += ch->valueLen;
+      count++;
+    }
+  }
+  counters.values += count;
+  counters.batchValues += count;
+  metricsAdd(METRICS_POLL_READS, count);
+  return true;
+}
+
+bool gattClientCompleted(struct connection* conn, uint16_t result)
+{
+  uint32_t batch = conn->pollPending;
+  uint8_t roundTrips = MAX(conn->pollResponses, 1);
+
+  if (batch == 0) {
+    return false;
+  }
+  conn->pollPending = 0;
+  counters.roundTrips += roundTrips;
+  metricsAdd(METRICS_POLL_ROUND_TRIPS, roundTrips);
+  if ((batch & (batch - 1)) != 0) {
+    counters.batches++;
+    if (result == bg_err_att_request_not_supported) {
+      printf("POLL --- > handle %d: no read multiple, reading one by one\r\n", conn->handle);
+      conn->noReadMultiple = true;
+    }
+  } else if (result == 0) {
+    struct gattLinkChar* ch = &conn->chars[__builtin_ctzl(batch)];
+
+    ch->valueLen = ch->readLen;
+    if (ch->valueLen >= conn->mtu - 1) {
+      counters.longReads++;
+    }
+  }
+  if (result == 0) {
+    metricsObserve(METRICS_POLL_TIME, timeNowNs() - conn->pollNs);
+  }
+  return true;
+}
+
+void gattClientReport(void)
+{
+  double seconds = (timeNowNs() - startNs) / 1e9;
+  uint64_t saved = counters.values > counters.roundTrips ? counters.values - counters.roundTrips : 0;
+  uint8_t links = 0;
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection* conn = connAt(i);
+    if (conn != NULL && conn->state == ENABLING_WRITE) {
+      links++;
+    }
+  }
+  printf("POLL --- > %u links: %llu values in %llu ATT round trips, %.1f values/s, %llu round trips "
+         "saved (%.0f%%); %llu read multiple of %.1f values, %llu long values, %llu responses dropped\r\n",
+         links, (unsigned long long)counters.values, (unsigned long long)counters.roundTrips,
+         seconds > 0 ? counters.values / seconds : 0.0, (unsigned long long)saved,
+         counters.values ? 100.0 * saved / counters.values : 0.0, (unsigned long long)counters.batches,
+         counters.batches ? (double)counters.batchValues / counters.batches : 0.0,
+         (unsigned long long)counters.longReads, (unsigned long long)counters.unsplit);
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Response to a poll read: the read is not in flight if it could not start.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Connection handle.
+ **************************************************************************************************/
+static void onPollResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx)
+{
+  struct connection* conn = connGet((uintptr_t)ctx);
+
+  if (result != 0 && conn != NULL) {
+    conn->pollPending = 0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Whether a characteristic may be read with others: its length is known and its value
+ *          could not have been cut short.
+ *  \param[in] conn Connection context.
+ *  \param[in] ch Characteristic.
+ *  \return  true if it can go in a read multiple request.
+ **************************************************************************************************/
+static bool batchable(const struct connection* conn, const struct gattLinkChar* ch)
+{
+  return !conn->noReadMultiple && ch->valueLen != GATT_LINK_LEN_UNKNOWN && ch->valueLen < conn->mtu - 1;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Read an overdue characteristic, together with the polls that may join it.
+ *  \param[in] conn Connection context.
+ *  \param[in] first Most overdue characteristic.
+ *  \param[in] nowNs Current time.
+ **************************************************************************************************/
+static void pollSend(struct connection* conn, struct gattLinkChar* first, uint64_t nowNs)
+{
+  uint16_t handles[GATT_CLIENT_BATCH_MAX];
+  uint32_t batch = POLL_BIT(first - conn->chars);
+  uint8_t count = 1;
+
+  /* The response holds ATT_MTU - 1 bytes of values. */
+  if (batchable(conn, first)) {
+    uint16_t room = conn->mtu - 1 - first->valueLen;
+
+    for (uint8_t i = 0; i < conn->charCount && count < GATT_CLIENT_BATCH_MAX; i++) {
+      struct gattLinkChar* ch = &conn->chars[i];
+      const struct gattProfileAttr* attr = gattProfileAt(ch->entry);
+
+      if (ch == first || attr->action != GATT_PROFILE_POLL || !batchable(conn, ch) || ch->valueLen > room
+          || ch->dueNs > nowNs + attr->periodMs * NSEC_PER_MSEC / GATT_CLIENT_EARLY_DIV) {
+        continue;
+      }
+      batch |= POLL_BIT(i);
+      room -= ch->valueLen;
+      count++;
+    }
+  }
+
+  count = 0;
+  for (uint8_t i = 0; i < conn->charCount; i++) {
+    struct gattLinkChar* ch = &conn->chars[i];
+
+    if (batch & POLL_BIT(i)) {
+      ch->dueNs = MAX(ch->dueNs, nowNs - GATT_CLIENT_POLL_TICK_MS * NSEC_PER_MSEC)
+                  + gattProfileAt(ch->entry)->periodMs * NSEC_PER_MSEC;
+      ch->readLen = 0;
+      handles[count++] = ch->handle;
+    }
+  }
+  conn->pollPending = batch;
+  conn->pollNs = nowNs;
+  conn->pollResponses = 0;
+  if (count == 1) {
+    bgapiCmdGattReadCharacteristicValue(conn->handle, handles[0], onPollResponse, POLL_CTX(conn));
+  } else {
+    bgapiCmdGattReadMultipleCharacteristicValues(conn->handle, count, handles, onPollResponse, POLL_CTX(conn));
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Start the most overdue poll read of every link that has none in flight.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onPollTimer(int timerId, void* ctx)
+{
+  uint64_t nowNs = timeNowNs();
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection* conn = connAt(i);
+    struct gattLinkChar* due = NULL;
+
+    /* One GATT procedure at a time per link: leave room for the periodic write. Streams end
+     * with an acknowledged write, so streaming links are not polled. */
+    if (conn == NULL || conn->state != ENABLING_WRITE || conn->pollPending != 0 || conn->writeNs != 0) {
+      continue;
+    }
+    for (uint8_t c = 0; c < conn->charCount; c++) {
+      struct gattLinkChar* ch = &conn->chars[c];
+      const struct gattProfileAttr* attr = gattProfileAt(ch->entry);
+
+      if (attr->action != GATT_PROFILE_POLL) {
+        continue;
+      }
+      if (ch->dueNs == 0) {
+        /* First time the link is polled: spread the reads by their phase. */
+        ch->dueNs = nowNs + attr->phaseMs * NSEC_PER_MSEC;
+      }
+      if (ch->dueNs <= nowNs && (due == NULL || ch->dueNs < due->dueNs)) {
+        due = ch;
+      }
+    }
+    if (due != NULL) {
+      pollSend(conn, due, nowNs);
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Print the poll report.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onReportTimer(int timerId, void* ctx)
+{
+  gattClientReport();
+}
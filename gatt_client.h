@@ -0,0 +1,136 @@
+/***********************************************************************************************//**
+ * \file   gatt_client.h
+ * \brief  Per-link use of the GATT profile: attributes found on a link and periodic reads
+ ***************************************************************************************************
+ * Discovery on a link is classified against the GATT profile as it arrives: each service and
+ * characteristic costs one profile lookup, and those of the profile are kept with their handles
+ * in the connection context. Characteristics to poll are then read at their period, one read
+ * at a time per link and never while a periodic write is in flight, on links that finished
+ * setup and are not streaming. Polls that fall due together go out as one read multiple
+ * request, one ATT round trip for all of them; values too long for it take a read of their own,
+ * which the stack continues with blob reads.
+ **************************************************************************************************/
+
+#ifndef GATT_CLIENT_H
+#define GATT_CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "connection.h"
+#include "gatt_profile.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Resolution of the poll periods. */
+#define GATT_CLIENT_POLL_TICK_MS      10
+
+/** Characteristics read by one read multiple request at most. */
+#define GATT_CLIENT_BATCH_MAX         8
+
+/** ATT MTU asked for when the profile polls several characteristics. */
+#define GATT_CLIENT_BATCH_MTU         247
+
+/** A poll joins the read of another one at most this fraction of its period early. */
+#define GATT_CLIENT_EARLY_DIV         4
+
+/** Interval between poll reports, in milliseconds. */
+#define GATT_CLIENT_REPORT_MS         5000
+
+/** Receiver of the characteristic values read by polls. */
+typedef void (*gattClientValueFn)(struct connection* conn, uint16_t characteristic, const uint8_t* data,
+                                  uint8_t len);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start the poll and report timers of the calling adapter if the profile has
+ *          characteristics to poll.
+ **************************************************************************************************/
+void gattClientInit(void);
+
+/***********************************************************************************************//**
+ *  \brief  Forget the services and characteristics found on a link, before discovering again.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+void gattClientReset(struct connection* conn);
+
+/***********************************************************************************************//**
+ *  \brief  Classify a discovered primary service and keep it if it is part of the profile.
+ *  \param[in] conn Connection context.
+ *  \param[in] service Service handle.
+ *  \param[in] uuid Service UUID, little-endian.
+ *  \param[in] len UUID length.
+ *  \return  true if it was kept.
+ **************************************************************************************************/
+bool gattClientAddService(struct connection* conn, uint32_t service, const uint8_t* uuid, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Classify a characteristic discovered in services[serviceNext] and keep it if it is
+ *          part of the profile.
+ *  \param[in] conn Connection context.
+ *  \param[in] characteristic Characteristic handle.
+ *  \param[in] uuid Characteristic UUID, little-endian.
+ *  \param[in] len UUID length.
+ *  \return  Its profile entry, NULL if it is not part of the profile or there is no room left.
+ **************************************************************************************************/
+const struct gattProfileAttr* gattClientAddCharacteristic(struct connection* conn, uint16_t characteristic,
+                                                          const uint8_t* uuid, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Next characteristic to subscribe to besides notifyHandle.
+ *  \param[in] conn Connection context.
+ *  \return  The characteristic, NULL when all are done.
+ **************************************************************************************************/
+const struct gattLinkChar* gattClientNextSubscription(struct connection* conn);
+
+/***********************************************************************************************//**
+ *  \brief  Profile entry of a characteristic found on a link.
+ *  \param[in] conn Connection context.
+ *  \param[in] characteristic Characteristic handle.
+ *  \return  The entry, NULL if the handle is not one of the profile.
+ **************************************************************************************************/
+const struct gattProfileAttr* gattClientFind(const struct connection* conn, uint16_t characteristic);
+
+/***********************************************************************************************//**
+ *  \brief  Take a characteristic value event of a poll read, splitting a read multiple response
+ *          into its values.
+ *  \param[in] conn Connection context.
+ *  \param[in] characteristic Characteristic handle, 0 for a read multiple response.
+ *  \param[in] opcode ATT opcode of the response.
+ *  \param[in] offset Offset of the value part, above 0 for the blob reads of a long value.
+ *  \param[in] data Value.
+ *  \param[in] len Value length.
+ *  \param[in] fn Receiver of every characteristic value, or part of one, it carries.
+ *  \return  true if it belonged to a poll read.
+ **************************************************************************************************/
+bool gattClientValue(struct connection* conn, uint16_t characteristic, uint8_t opcode, uint16_t offset,
+                     const uint8_t* data, uint8_t len, gattClientValueFn fn);
+
+/***********************************************************************************************//**
+ *  \brief  Take a procedure completed event that ends a poll read.
+ *  \param[in] conn Connection context.
+ *  \param[in] result Procedure result.
+ *  \return  true if it ended a poll read.
+ **************************************************************************************************/
+bool gattClientCompleted(struct connection* conn, uint16_t result);
+
+/***********************************************************************************************//**
+ *  \brief  Print the values read by polls on the calling adapter, the ATT round trips they took
+ *          and those that read multiple saved.
+ **************************************************************************************************/
+void gattClientReport(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* GATT_CLIENT_H */
@@ -0,0 +1,251 @@
+/***********************************************************************************************//**
+ * \file   gatt_profile.c
+ * \brief  GATT profile: the services and characteristics to use on a peer, and what to do with each
+ ***************************************************************************************************
+ * Entries live in one array in profile order; an open-addressing table of entry indices, twice
+ * the capacity and probed linearly, finds them by UUID and service. The hash mixes both halves
+ * of the UUID with two multiplications, so UUIDs that differ only in the 16 bits a Bluetooth
+ * SIG UUID fills in still spread over the whole table. The profile is built before the adapter
+ * threads start and only read afterwards, so lookups take no lock.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "infrastructure.h"
+#include "ad_parser.h"
+
+/* Own header */
+#include "gatt_profile.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Hash table slots, a power of two at least twice the capacity. */
+#define GATT_PROFILE_SLOTS            8192
+
+/** Slots hold the entry index plus one, so that a zeroed table is empty. */
+#define GATT_PROFILE_EMPTY            0
+
+/** Longest profile file line. */
+#define GATT_PROFILE_LINE_MAX         256
+
+/* Bluetooth Base UUID 00000000-0000-1000-8000-00805F9B34FB, little-endian */
+static const uint8_t baseUuid[16] = { 0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
+                                      0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static const char* const actionNames[GATT_PROFILE_ACTIONS] = {
+  [GATT_PROFILE_SERVICE] = "service",
+  [GATT_PROFILE_SUBSCRIBE] = "subscribe",
+  [GATT_PROFILE_POLL] = "poll",
+  [GATT_PROFILE_WRITE] = "write",
+};
+
+static struct gattProfileAttr entries[GATT_PROFILE_CAPACITY];
+static uint16_t slots[GATT_PROFILE_SLOTS];
+static uint16_t entryCount = 0;
+static uint16_t actionCounts[GATT_PROFILE_ACTIONS];
+static uint16_t lastService = GATT_PROFILE_NO_SERVICE;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void expandUuid(const uint8_t* uuid, uint8_t len, uint8_t* out);
+static uint32_t slotOf(const uint8_t* uuid, uint16_t service);
+static const struct gattProfileAttr* findExpanded(const uint8_t* uuid, uint16_t service);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void gattProfileClear(void)
+{
+  memset(slots, 0, sizeof(slots));
+  memset(actionCounts, 0, sizeof(actionCounts));
+  entryCount = 0;
+  lastService = GATT_PROFILE_NO_SERVICE;
+}
+
+int gattProfileAdd(uint8_t action, const uint8_t* uuid, uint8_t len, uint32_t periodMs, uint32_t phaseMs)
+{
+  uint16_t service = action == GATT_PROFILE_SERVICE ? GATT_PROFILE_NO_SERVICE : lastService;
+  struct gattProfileAttr* e;
+  uint32_t slot;
+
+  if (entryCount == GATT_PROFILE_CAPACITY || action >= GATT_PROFILE_ACTIONS
+      || (action != GATT_PROFILE_SERVICE && service == GATT_PROFILE_NO_SERVICE)) {
+    return -1;
+  }
+  e = &entries[entryCount];
+  expandUuid(uuid, len, e->uuid);
+  if (findExpanded(e->uuid, service) != NULL) {
+    return -1;
+  }
+  e->len = len;
+  e->action = action;
+  e->index = entryCount;
+  e->service = service;
+  e->periodMs = action == GATT_PROFILE_POLL ? periodMs : 0;
+  e->phaseMs = action == GATT_PROFILE_POLL ? phaseMs : 0;
+
+  for (slot = slotOf(e->uuid, service); slots[slot] != GATT_PROFILE_EMPTY; slot = (slot + 1) % GATT_PROFILE_SLOTS) {
+  }
+  slots[slot] = entryCount + 1;
+  if (action == GATT_PROFILE_SERVICE) {
+    lastService = entryCount;
+  }
+  actionCounts[action]++;
+  return entryCount++;
+}
+
+int gattProfileLoad(const char* path)
+{
+  char line[GATT_PROFILE_LINE_MAX];
+  uint32_t lineNo = 0;
+  bool ok = true;
+  FILE* f = fopen(path, "r");
+
+  if (f == NULL) {
+    printf("Error!!! Cannot open GATT profile %s\n", path);
+    return -1;
+  }
+  gattProfileClear();
+  while (ok && fgets(line, sizeof(line), f) != NULL) {
+    char* save = NULL;
+    char* word;
+    char* argument;
+    char* period;
+    char* phase;
+    uint8_t uuid[16];
+    uint8_t len;
+    uint8_t action;
+    long periodMs = 0;
+    long phaseMs = 0;
+
+    lineNo++;
+    line[strcspn(line, "#\r\n")] = '\0';
+    word = strtok_r(line, " \t", &save);
+    if (word == NULL) {
+      continue;
+    }
+    argument = strtok_r(NULL, " \t", &save);
+    period = strtok_r(NULL, " \t", &save);
+    phase = period != NULL ? strtok_r(NULL, " \t", &save) : NULL;
+    for (action = 0; action < GATT_PROFILE_ACTIONS && strcmp(word, actionNames[action]) != 0; action++) {
+    }
+    if (action == GATT_PROFILE_ACTIONS || argument == NULL || adParseUuidString(argument, uuid, &len) < 0) {
+      printf("Error!!! %s:%u: expected service, subscribe, poll or write and a UUID\n", path, lineNo);
+    } else if (action == GATT_PROFILE_POLL && (period == NULL || (periodMs = strtol(period, NULL, 0)) <= 0)) {
+      printf("Error!!! %s:%u: poll needs a period in milliseconds\n", path, lineNo);
+    } else if (phase != NULL && action == GATT_PROFILE_POLL && (phaseMs = strtol(phase, NULL, 0)) < 0) {
+      printf("Error!!! %s:%u: the phase of a poll is a delay in milliseconds\n", path, lineNo);
+    } else if ((action != GATT_PROFILE_POLL && period != NULL) || (phase != NULL && strtok_r(NULL, " \t", &save) != NULL)) {
+      printf("Error!!! %s:%u: too many fields\n", path, lineNo);
+    } else if (gattProfileAdd(action, uuid, len, (uint32_t)periodMs, (uint32_t)phaseMs) < 0) {
+      printf("Error!!! %s:%u: %s\n", path, lineNo,
+             entryCount == GATT_PROFILE_CAPACITY ? "too many entries"
+             : action != GATT_PROFILE_SERVICE && lastService == GATT_PROFILE_NO_SERVICE ? "characteristic outside a service"
+             : "duplicate entry");
+    } else {
+      continue;
+    }
+    ok = false;
+  }
+  ok = ok && !ferror(f);
+  fclose(f);
+  if (!ok) {
+    return -1;
+  }
+  if (actionCounts[GATT_PROFILE_SERVICE] == 0 || actionCounts[GATT_PROFILE_SUBSCRIBE] == 0) {
+    printf("Error!!! %s: a profile needs a service and a characteristic to subscribe to\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+const struct gattProfileAttr* gattProfileLookup(const uint8_t* uuid, uint8_t len, uint16_t service)
+{
+  uint8_t expanded[16];
+
+  if (len != 2 && len != 4 && len != 16) {
+    return NULL;
+  }
+  expandUuid(uuid, len, expanded);
+  return findExpanded(expanded, service);
+}
+
+const struct gattProfileAttr* gattProfileAt(uint16_t index)
+{
+  return &entries[index];
+}
+
+uint16_t gattProfileSize(void)
+{
+  return entryCount;
+}
+
+uint16_t gattProfileCount(uint8_t action)
+{
+  return action < GATT_PROFILE_ACTIONS ? actionCounts[action] : 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Expand a 16 or 32-bit UUID with the Bluetooth Base UUID.
+ *  \param[in] uuid UUID, little-endian.
+ *  \param[in] len 2, 4 or 16.
+ *  \param[out] out 128-bit UUID, little-endian.
+ **************************************************************************************************/
+static void expandUuid(const uint8_t* uuid, uint8_t len, uint8_t* out)
+{
+  if (len == 16) {
+    memcpy(out, uuid, 16);
+    return;
+  }
+  memcpy(out, baseUuid, 16);
+  memcpy(out + 12, uuid, len);
+}
+
+/***********************************************************************************************//**
+ *  \brief  First slot to probe for a key.
+ *  \param[in] uuid 128-bit UUID, little-endian.
+ *  \param[in] service Service entry index, GATT_PROFILE_NO_SERVICE for a service.
+ *  \return  Slot index.
+ **************************************************************************************************/
+static uint32_t slotOf(const uint8_t* uuid, uint16_t service)
+{
+  uint64_t lo;
+  uint64_t hi;
+
+  memcpy(&lo, uuid, sizeof(lo));
+  memcpy(&hi, uuid + 8, sizeof(hi));
+  /* The high half of a product depends on every bit of the multiplicand. */
+  return (uint32_t)(((lo ^ hi * 0x9e3779b97f4a7c15ULL ^ service) * 0xff51afd7ed558ccdULL) >> 32) % GATT_PROFILE_SLOTS;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find an entry by expanded UUID and service.
+ *  \param[in] uuid 128-bit UUID, little-endian.
+ *  \param[in] service Service entry index, GATT_PROFILE_NO_SERVICE for a service.
+ *  \return  The entry, NULL if there is none.
+ **************************************************************************************************/
+static const struct gattProfileAttr* findExpanded(const uint8_t* uuid, uint16_t service)
+{
+  for (uint32_t slot = slotOf(uuid, service); slots[slot] != GATT_PROFILE_EMPTY; slot = (slot + 1) % GATT_PROFILE_SLOTS) {
+    const struct gattProfileAttr* e = &entries[slots[slot] - 1];
+
+    if (e->service == service && !memcmp(e->uuid, uuid, 16)) {
+      return e;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,124 @@
+/***********************************************************************************************//**
+ * \file   gatt_profile.h
+ * \brief  GATT profile: the services and characteristics to use on a peer, and what to do with each
+ ***************************************************************************************************
+ * The profile is loaded once at startup, from a file or from the built-in Demo Service profile,
+ * into a hash table keyed by the 128-bit UUID and the service the attribute belongs to, so every
+ * service and characteristic discovered on a link is classified with one lookup.
+ *
+ * Profile file: one entry per line, '#' starts a comment. Characteristics belong to the service
+ * line above them; UUIDs are written as for -u.
+ *
+ *   service UUID        discover the characteristics of this primary service
+ *   subscribe UUID      enable notifications; the first one found is the link's data source
+ *   poll UUID MS [PH]   read the value every MS milliseconds, the first time PH milliseconds
+ *                       (default 0) after the link is ready
+ *   write UUID          target of the periodic writes, streaming and round-trip probes
+ *
+ * A profile needs a service and a characteristic to subscribe to.
+ **************************************************************************************************/
+
+#ifndef GATT_PROFILE_H
+#define GATT_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Profile entries at most, services and characteristics together. */
+#define GATT_PROFILE_CAPACITY         4096
+
+/** Parent of a service entry. */
+#define GATT_PROFILE_NO_SERVICE       0xFFFF
+
+/** What to do with an attribute of the profile. */
+enum gattProfileAction {
+  GATT_PROFILE_SERVICE,         /**< discover its characteristics */
+  GATT_PROFILE_SUBSCRIBE,       /**< enable notifications */
+  GATT_PROFILE_POLL,            /**< read periodically */
+  GATT_PROFILE_WRITE,           /**< write to */
+  GATT_PROFILE_ACTIONS
+};
+
+/** One service or characteristic of the profile. */
+struct gattProfileAttr {
+  uint8_t uuid[16];             /**< expanded to 128 bits, little-endian */
+  uint8_t len;                  /**< length as written: 2, 4 or 16 */
+  uint8_t action;               /**< enum gattProfileAction */
+  uint16_t index;               /**< entry index */
+  uint16_t service;             /**< entry index of its service, GATT_PROFILE_NO_SERVICE for a service */
+  uint32_t periodMs;            /**< read period of GATT_PROFILE_POLL */
+  uint32_t phaseMs;             /**< first read of GATT_PROFILE_POLL after the link is ready */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Empty the profile.
+ **************************************************************************************************/
+void gattProfileClear(void);
+
+/***********************************************************************************************//**
+ *  \brief  Add an entry. A characteristic belongs to the service added last.
+ *  \param[in] action enum gattProfileAction.
+ *  \param[in] uuid UUID, little-endian.
+ *  \param[in] len UUID length: 2, 4 or 16.
+ *  \param[in] periodMs Read period of GATT_PROFILE_POLL, ignored otherwise.
+ *  \param[in] phaseMs Delay of the first read of GATT_PROFILE_POLL, ignored otherwise.
+ *  \return  Entry index, -1 if the profile is full, the entry is a duplicate or a characteristic
+ *           comes before any service.
+ **************************************************************************************************/
+int gattProfileAdd(uint8_t action, const uint8_t* uuid, uint8_t len, uint32_t periodMs, uint32_t phaseMs);
+
+/***********************************************************************************************//**
+ *  \brief  Replace the profile with the contents of a profile file. Errors are printed with
+ *          their line number.
+ *  \param[in] path Profile file.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int gattProfileLoad(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Classify a discovered attribute.
+ *  \param[in] uuid UUID as discovered, little-endian.
+ *  \param[in] len UUID length: 2, 4 or 16.
+ *  \param[in] service Entry index of the service it was found in, GATT_PROFILE_NO_SERVICE to
+ *             look up a service.
+ *  \return  The profile entry, NULL if the attribute is not part of the profile.
+ **************************************************************************************************/
+const struct gattProfileAttr* gattProfileLookup(const uint8_t* uuid, uint8_t len, uint16_t service);
+
+/***********************************************************************************************//**
+ *  \brief  Entry by index.
+ *  \param[in] index Entry index, below gattProfileSize().
+ *  \return  The entry.
+ **************************************************************************************************/
+const struct gattProfileAttr* gattProfileAt(uint16_t index);
+
+/***********************************************************************************************//**
+ *  \brief  Number of entries.
+ *  \return  Services and characteristics.
+ **************************************************************************************************/
+uint16_t gattProfileSize(void);
+
+/***********************************************************************************************//**
+ *  \brief  Number of entries with an action.
+ *  \param[in] action enum gattProfileAction.
+ *  \return  Entry count.
+ **************************************************************************************************/
+uint16_t gattProfileCount(uint8_t action);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* GATT_PROFILE_H */
@@ -0,0 +1,62 @@
+/***********************************************************************************************//**
+ * \file   link_profile.c
+ * \brief  Named link-layer profiles: connection interval, slave latency, supervision timeout,
+ *         PHY and ATT MTU requested on every link
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "infrastructure.h"
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+/* Own header */
+#include "link_profile.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+static const struct linkProfile profiles[] = {
+  /* Stack defaults. */
+  { "default", 0, 0, 0, 0, 0, 0 },
+  /* Shortest interval, every event attended: a notification waits at most 7.5 ms for the air. */
+  { "low-latency", 6, 6, 0, 100, 0, 0 },
+  /* 2M PHY and full-size packets; a longer interval leaves room for more packets per event. */
+  { "throughput", 24, 40, 0, 200, le_gap_phy_2m, 250 },
+  /* 100-200 ms interval, and the peripheral may sleep through 4 events in 5 when it has nothing to send. */
+  { "low-power", 80, 160, 4, 600, le_gap_phy_1m, 0 },
+};
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+const struct linkProfile* linkProfileFind(const char* name)
+{
+  for (uint8_t i = 0; i < COUNTOF(profiles); i++) {
+    if (!strcmp(profiles[i].name, name)) {
+      return &profiles[i];
+    }
+  }
+  return NULL;
+}
+
+const struct linkProfile* linkProfileDefault(void)
+{
+  return &profiles[0];
+}
+
+bool linkProfileAccepts(const struct linkProfile* profile, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+  if (profile->minInterval == 0) {
+    return true;
+  }
+  return interval >= profile->minInterval && interval <= profile->maxInterval
+         && latency == profile->latency && timeout == profile->timeout;
+}
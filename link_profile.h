@@ -0,0 +1,77 @@
+/***********************************************************************************************//**
+ * \file   link_profile.h
+ * \brief  Named link-layer profiles: connection interval, slave latency, supervision timeout,
+ *         PHY and ATT MTU requested on every link
+ ***************************************************************************************************
+ * A profile trades latency, throughput and power against each other. It is requested when a
+ * link opens and again whenever the negotiated parameters drift outside it, for instance after
+ * the peripheral asked for an update of its own. The default profile requests nothing and leaves
+ * every link on the stack defaults.
+ **************************************************************************************************/
+
+#ifndef LINK_PROFILE_H
+#define LINK_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Requests of the profile parameters per link, the one on opening included. */
+#define LINK_PROFILE_MAX_REQUESTS     3
+
+/** Connection interval unit, in microseconds. */
+#define LINK_PROFILE_INTERVAL_US      1250
+
+/** Supervision timeout unit, in milliseconds. */
+#define LINK_PROFILE_TIMEOUT_MS       10
+
+/** Link-layer settings requested on every link. */
+struct linkProfile {
+  const char* name;
+  uint16_t minInterval;         /**< in 1.25 ms units, 0 to keep the stack defaults */
+  uint16_t maxInterval;         /**< in 1.25 ms units */
+  uint16_t latency;             /**< connection events the peripheral may skip */
+  uint16_t timeout;             /**< supervision timeout, in 10 ms units */
+  uint8_t phy;                  /**< le_gap_phy_1m or le_gap_phy_2m, 0 to keep the current one */
+  uint16_t maxMtu;              /**< ATT MTU offered, and with it the data length; 0 for the default */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Look up a profile by name.
+ *  \param[in] name default, low-latency, throughput or low-power.
+ *  \return  The profile, NULL if the name is unknown.
+ **************************************************************************************************/
+const struct linkProfile* linkProfileFind(const char* name);
+
+/***********************************************************************************************//**
+ *  \brief  The profile that requests nothing.
+ *  \return  The default profile.
+ **************************************************************************************************/
+const struct linkProfile* linkProfileDefault(void);
+
+/***********************************************************************************************//**
+ *  \brief  Decide whether negotiated connection parameters satisfy a profile.
+ *  \param[in] profile Profile.
+ *  \param[in] interval Connection interval, in 1.25 ms units.
+ *  \param[in] latency Slave latency.
+ *  \param[in] timeout Supervision timeout, in 10 ms units.
+ *  \return  true if the link needs no new request.
+ **************************************************************************************************/
+bool linkProfileAccepts(const struct linkProfile* profile, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* LINK_PROFILE_H */
@@ -11,20 +11,49 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#if defined(__linux__)
+#include <sys/signalfd.h>
+#endif
 
 #include "infrastructure.h"
+#include "timeutil.h"
 
 /* BG stack headers */
 #include "gecko_bglib.h"
 
 /* hardware specific headers */
-#include "uart.h"
+#include "serial.h"
 
 /* application specific files */
 #include "app.h"
+#include "adapter.h"
+#include "adv_dedup.h"
+#include "adv_db.h"
+#include "bgapi_cmd.h"
+#include "bgapi_rx.h"
+#include "bgapi_trace.h"
+#include "binlog.h"
+#include "bond_store.h"
+#include "connection.h"
+#include "event_loop.h"
+#include "gatt_cache.h"
+#include "gatt_client.h"
+#include "gatt_profile.h"
+#include "metrics.h"
+#include "notify_pipe.h"
+#include "reconnect.h"
+#include "rtt.h"
+#include "scan_sched.h"
+#include "shm_export.h"
+#include "stream.h"
+#include "timer_wheel.h"
+#include "uart_speed.h"
 
 /***************************************************************************************************
  * Local Macros and Definitions
@@ -46,21 +75,147 @@ static char* default_uart_port = "";
 /** The default baud rate to use. */
 static uint32_t default_baud_rate = 115200;
 
-/** The serial port to use for BGAPI communication. */
-static char* uart_port = NULL;
+/** Time in milliseconds a blocking read from the serial port waits for data. */
+#define SERIAL_TIMEOUT_MS         100
 
-/** The baud rate to use. */
-static uint32_t baud_rate = 0;
+/** Timer wheel jobs of an adapter: a connect timeout and the periodic writes of every link, and
+ *  the backoff of every lost peer. */
+#define TIMER_WHEEL_JOBS          (2 * MAX_CONNECTIONS + RECONNECT_MAX_PEERS)
 
 /** Usage string */
-#define USAGE "Usage: %s <serial port> <baud rate> [flow control: 1(on, default) or 0(off)]\n\n"
+#define USAGE "Usage: %s [-m] [-s] [-a serial port]... [-n connections] [-c cache file] [-l log file] [-v level] [-u uuid]... [-g profile] [-w bytes] [-b payload] [-e rate] [-E bytes] [-o file] [-U socket] [-j consumers] [-q policy] [-M target] [-A socket] [-x name] [-P depth] [-H baud rates] [-k bond file] [-W ms] [-D] [-S] [-C] [-T trace file] [-R trace file] [-F] <serial port> <baud rate> [flow control: 1(on, default) or 0(off)] [link profile]\n" \
+              "  -m  measurement mode: report CPU time per processed BGAPI event\n" \
+              "  -s  stress mode: report per-link setup time and aggregate notification throughput\n" \
+              "  -a  drive another NCP on this serial port, at the same baud rate and flow control;\n" \
+              "      repeat for several (up to 4 adapters)\n" \
+              "  -n  number of peripherals to connect at once (1-8, default 8)\n" \
+              "  -c  GATT handle cache file (default " GATT_CACHE_DEFAULT_PATH ")\n" \
+              "  -l  write events to a binary log file, decoded with exe/binlog_decode\n" \
+              "  -v  log verbosity: 0 off, 1 links and payloads, 2 also scan reports (default);\n" \
+              "      SIGUSR1 / SIGUSR2 raise / lower it at runtime\n" \
+              "  -u  connect to peripherals advertising this 16, 32 or 128-bit service UUID;\n" \
+              "      repeat for several (default: the first service of the GATT profile)\n" \
+              "  -g  GATT profile file: services and characteristics to subscribe to, poll and write\n" \
+              "      (default: the Demo Service, its notify and RW characteristics)\n" \
+              "  -w  stream this many bytes to every peer with write-without-response\n" \
+              "  -b  bytes per streamed write (default: ATT MTU - 3)\n" \
+              "  -e  send this many round-trip probes per second to every peer, which echoes them\n" \
+              "      as notifications, and report their latency instead of the periodic writes\n" \
+              "  -E  bytes per round-trip probe (16 up to ATT MTU - 3, default 20)\n" \
+              "  -o  hand notifications to consumer threads that append them to this file\n" \
+              "  -U  hand notifications to consumer threads that send them to this Unix datagram socket\n" \
+              "  -j  notification consumer threads (1-4, default 1)\n" \
+              "  -q  notification queue overflow policy: drop-newest (default), drop-oldest or block\n" \
+              "  -M  export Prometheus metrics to this file every 5 s, or serve them on unix:PATH\n" \
+              "  -A  keep a table of every advertiser heard and answer queries on this Unix socket\n" \
+              "  -x  publish notifications and matched scan reports to the shared memory ring\n" \
+              "      /dev/shm/name, and name.1, name.2, ... for the further adapters\n" \
+              "  -P  BGAPI commands awaiting a response at the same time (1-16, default 4)\n" \
+              "  -H  raise the UART to the highest of these comma-separated baud rates the NCP\n" \
+              "      confirms, e.g. 921600,460800; needs an NCP image with the baud rate user command\n" \
+              "  -k  bond with every peer and encrypt every link, with the stored bond once there is\n" \
+              "      one; the peers bonded with are kept in this file (e.g. " BOND_STORE_DEFAULT_PATH ")\n" \
+              "  -W  interval of the periodic 1-byte writes to every peer, in ms (10-60000, default 100)\n" \
+              "  -D  no direct reconnection: wait for lost peers to be found by scanning\n" \
+              "  -S  static scan: keep the stack's default scan interval, window and type instead of\n" \
+              "      scanning at full duty only while targets are missing\n" \
+              "  -C  cold start: reset the NCP even if it is running and answers\n" \
+              "  -T  capture the BGAPI traffic of every serial port to this trace file\n" \
+              "  -R  replay a trace file instead of driving NCPs, implies -m; the serial port and\n" \
+              "      baud rate may be left out\n" \
+              "  -F  replay as fast as possible instead of at the original pace\n" \
+              "  link profile: default (stack defaults), low-latency, throughput or low-power\n\n"
+
+/** Interval between measurement reports, in milliseconds. */
+#define MEASURE_REPORT_MS         5000
+
+/** Measurement mode enabled from the command line. */
+static bool measureMode = false;
+
+/** Binary event log file, NULL to print events on stdout. */
+static const char* logPath = NULL;
+
+/** Notification pipeline sinks, NULL when unused. */
+static const char* notifyFilePath = NULL;
+static const char* notifySocketPath = NULL;
+
+/** Notification pipeline consumer threads and overflow policy. */
+static uint8_t notifyConsumers = 1;
+static enum notifyOverflow notifyPolicy = NOTIFY_DROP_NEWEST;
+
+/** Metrics export target, NULL when not exported. */
+static const char* metricsTarget = NULL;
+
+/** Advertiser database query socket, NULL when the database is not kept. */
+static const char* advDbPath = NULL;
+
+/** Shared memory segment name of the live export, NULL when not exported. */
+static const char* shmExportName = NULL;
+
+/** BGAPI commands in flight at the same time. */
+static uint8_t commandDepth = BGAPI_CMD_DEFAULT_DEPTH;
+
+/** BGAPI trace to capture to, or to replay instead of the serial ports; NULL when unused. */
+static const char* tracePath = NULL;
+static const char* replayPath = NULL;
+
+/** Replay at the original pace, rather than as fast as possible. */
+static bool replayRealTime = true;
+
+/** Serial ports of the adapters after the first one. */
+static const char* extraPorts[ADAPTER_MAX - 1];
+static uint8_t extraPortCount = 0;
+
+/** Notification counters at the start of the aggregate stress report window. */
+static struct {
+  uint64_t wallNs;
+  uint64_t notifications;
+  uint64_t bytes;
+} aggregate;
+
+/** Counters for the measurement mode, reset after every report; each adapter has its own. */
+static ADAPTER_LOCAL struct {
+  uint64_t events;          /**< BGAPI events dispatched */
+  uint64_t wakeups;         /**< loop wakeups at the start of the window */
+  uint64_t latencySumNs;    /**< sum of loop-wakeup to handler-done times */
+  uint64_t latencyMaxNs;    /**< worst loop-wakeup to handler-done time */
+  uint64_t readSumNs;       /**< sum of times spent reading and framing an event */
+  uint64_t readMaxNs;
+  uint64_t handlerSumNs;    /**< sum of times spent in the event handler */
+  uint64_t handlerMaxNs;
+  uint64_t cpuNs;           /**< process CPU time at the start of the window */
+  uint64_t wallNs;          /**< monotonic time at the start of the window */
+  struct binlogStats log;   /**< logger counters at the start of the window */
+  struct advDedupStats scan;  /**< deduplication counters at the start of the window */
+  struct bgapiRxStats rx;   /**< receive counters at the start of the window */
+  struct bgapiCmdStats cmd; /**< command queue counters at the start of the window */
+  struct notifyPipeStats notify;  /**< notification pipeline counters at the start of the window */
+  struct timerWheelStats timers;  /**< timer wheel counters at the start of the window */
+} measure;
+
+/** Measurement totals over all windows, for the replay report. */
+static ADAPTER_LOCAL struct {
+  uint64_t events;
+  uint64_t readSumNs;
+  uint64_t handlerSumNs;
+  uint64_t cpuNs;
+  uint64_t wallNs;
+} total;
 
 /***************************************************************************************************
  * Static Function Declarations
  **************************************************************************************************/
 
-static int appSerialPortInit(int argc, char* argv[], int32_t timeout);
+static int appSerialPortInit(int argc, char* argv[]);
+static int appReplayInit(void);
+static int runAdapter(struct adapter* adapter);
 static void on_message_send(uint32_t msg_len, uint8_t* msg_data);
+static int32_t on_message_receive(uint32_t msg_len, uint8_t* msg_data);
+static void onUartReadable(int fd, short revents, void* ctx);
+static void onMeasureTimer(int timerId, void* ctx);
+static void onAggregateTimer(int timerId, void* ctx);
+static void onSignalNumber(int signum);
+static int appSignalInit(void);
 
 /***************************************************************************************************
  * Public Function Definitions
@@ -74,40 +229,173 @@ static void on_message_send(uint32_t msg_len, uint8_t* msg_data);
  **************************************************************************************************/
 int main(int argc, char* argv[])
 {
-  struct gecko_cmd_packet* evt;
+  int ret = 0;
 
-  /* Initialize BGLIB with our output function for sending messages. */
-  BGLIB_INITIALIZE_NONBLOCK(on_message_send, uartRx, uartRxPeek);
+  /* Initialize BGLIB with our output function for sending messages. Events and the responses
+   * to queued commands are parsed by the buffered receive path of each adapter; BGLIB reads
+   * through it only while waiting for the response to a blocking command. */
+  BGLIB_INITIALIZE_NONBLOCK(on_message_send, on_message_receive, bgapiRxPeek);
 
-  /* Initialise serial communication as non-blocking. */
-  if (appSerialPortInit(argc, argv, 100) < 0) {
+  /* One adapter per serial port on the command line. */
+  if (appSerialPortInit(argc, argv) < 0) {
     printf("Non-blocking serial port init failure\n");
     exit(EXIT_FAILURE);
   }
+  appInit();
 
   // Flush std output
   fflush(stdout);
 
-  printf("Starting up...\nResetting NCP target...\n");
+  if (binlogOpen(logPath) < 0) {
+    printf("Error!!! Could not open event log %s\n", logPath != NULL ? logPath : "on stdout");
+    exit(EXIT_FAILURE);
+  }
+  if (tracePath != NULL && bgapiTraceCaptureOpen(tracePath) < 0) {
+    printf("Error!!! Could not open BGAPI trace %s\n", tracePath);
+    exit(EXIT_FAILURE);
+  }
+  if (notifyFilePath != NULL || notifySocketPath != NULL) {
+    if ((notifyFilePath != NULL && notifyPipeAddFileSink(notifyFilePath) < 0)
+        || (notifySocketPath != NULL && notifyPipeAddSocketSink(notifySocketPath) < 0)
+        || notifyPipeStart(notifyConsumers, notifyPolicy) < 0) {
+      printf("Error!!! Could not start the notification pipeline\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("Starting up...\n");
 
-  /* Reset NCP to ensure it gets into a defined state.
-   * Once the chip successfully boots, gecko_evt_system_boot_id event should be received. */
-  gecko_cmd_system_reset(0);
+  /* This thread sleeps in poll() for signals, the metrics export and advertiser queries;
+   * every adapter has a thread and a loop of its own, and this loop stops when the last of them
+   * returns. */
+  evloopInit();
+  if (appSignalInit() < 0) {
+    printf("Event loop init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  if (metricsTarget != NULL && metricsStart(metricsTarget) < 0) {
+    printf("Error!!! Could not export metrics to %s\n", metricsTarget);
+    exit(EXIT_FAILURE);
+  }
+  if (advDbPath != NULL && advDbStart(advDbPath) < 0) {
+    printf("Error!!! Could not serve advertiser queries on %s\n", advDbPath);
+    exit(EXIT_FAILURE);
+  }
+  if (appCfg.stressMode) {
+    aggregate.wallNs = timeNowNs();
+    evloopAddTimer(STRESS_REPORT_MS, true, onAggregateTimer, NULL);
+  }
+  if (adapterStartAll(runAdapter) < 0) {
+    printf("Error!!! Could not start the adapter threads\n");
+    adapterStopAll();
+    exit(EXIT_FAILURE);
+  }
 
-  while (1) {
-    /* Check for stack event. */
-    evt = gecko_peek_event();
-    /* Run application and event handler. */
-    appHandleEvents(evt);
+  if (evloopRun() < 0) {
+    printf("Event loop failure, errno: %d\n", errno);
+    exit(EXIT_FAILURE);
   }
 
-  return -1;
+  adapterStopAll();
+  for (uint8_t i = 0; i < adapterCount(); i++) {
+    if (adapterAt(i)->result < 0) {
+      ret = EXIT_FAILURE;
+    }
+  }
+  if (appCfg.bondPath != NULL) {
+    bondStoreReport();
+  }
+  metricsStop();
+  advDbStop();
+  notifyPipeStop();
+  binlogClose();
+  bgapiTraceCaptureClose();
+  bgapiTraceReplayClose();
+  return ret;
 }
 
 /***************************************************************************************************
  * Static Function Definitions
  **************************************************************************************************/
 
+/***********************************************************************************************//**
+ *  \brief  Adapter thread: open the serial port, reset the NCP and serve it until stopped.
+ *  \param[in] adapter The adapter.
+ *  \return  0 when stopped or when the port closes, -1 on failure.
+ **************************************************************************************************/
+static int runAdapter(struct adapter* adapter)
+{
+  int ret;
+
+  bgapiRxInit();
+  if (serialOpen(adapter->port, adapter->baudRate, adapter->flowControl, SERIAL_TIMEOUT_MS) < 0) {
+    printf("Non-blocking serial port init failure on %s\n", adapter->port);
+    return -1;
+  }
+  bgapiCmdInit(commandDepth);
+  if (shmExportName != NULL && shmExportOpen(shmExportName) < 0) {
+    printf("Error!!! Could not create the shared memory export %s on %s\n", shmExportName, adapter->port);
+    serialClose();
+    return -1;
+  }
+
+  /* Sleep in poll() until the NCP sends something, a timer fires or the adapter is stopped. */
+  if (evloopAddFd(serialGetFd(), POLLIN, onUartReadable, adapter) < 0) {
+    printf("Event loop init failure\n");
+    shmExportClose();
+    serialClose();
+    return -1;
+  }
+  /* Per-connection jobs, behind a single event loop timer. */
+  if (timerWheelInit(TIMER_WHEEL_JOBS) < 0) {
+    printf("Timer wheel init failure\n");
+    shmExportClose();
+    serialClose();
+    return -1;
+  }
+  if (measureMode) {
+    measure.cpuNs = timeCpuNs();
+    measure.wallNs = timeNowNs();
+    evloopAddTimer(MEASURE_REPORT_MS, true, onMeasureTimer, adapter);
+  }
+
+  /* Reuse the NCP if it answers, otherwise reset it; the first events decide. */
+  appStart();
+
+  ret = evloopRun();
+  if (ret < 0) {
+    printf("Event loop failure on %s, errno: %d\n", adapter->port, errno);
+  } else if (!appStarted()) {
+    ret = -1;
+  }
+
+  if (measureMode) {
+    onMeasureTimer(-1, adapter);
+  }
+  if (appCfg.rttRate > 0 && appStarted()) {
+    rttReport();
+  }
+  if (gattProfileCount(GATT_PROFILE_POLL) > 0 && appStarted()) {
+    gattClientReport();
+  }
+  if (measureMode && appStarted() && !bgapiTraceReplaying()) {
+    scanSchedReport();
+  }
+  if (bgapiTraceReplaying()) {
+    printf("REPLAY --- > adapter %u: %llu events in %.3f s, %.0f events/s, read avg %.2f us, "
+           "handler avg %.2f us, cpu/event %.2f us\r\n",
+           adapter->index, (unsigned long long)total.events, total.wallNs / 1e9,
+           total.wallNs ? total.events * 1e9 / total.wallNs : 0.0,
+           total.events ? total.readSumNs / 1e3 / total.events : 0.0,
+           total.events ? total.handlerSumNs / 1e3 / total.events : 0.0,
+           total.events ? total.cpuNs / 1e3 / total.events : 0.0);
+  }
+  timerWheelClose();
+  shmExportClose();
+  serialClose();
+  return ret;
+}
+
 /***********************************************************************************************//**
  *  \brief  Function called when a message needs to be written to the serial port.
  *  \param[in] msg_len Length of the message.
@@ -118,28 +406,211 @@ static void on_message_send(uint32_t msg_len, uint8_t* msg_data)
   /** Variable for storing function return values. */
   int32_t ret;
 
-  ret = uartTx(msg_len, msg_data);
+  ret = bgapiCmdSendBlocking(msg_len, msg_data);
   if (ret < 0) {
-    printf("Failed to write to serial port %s, ret: %d, errno: %d\n", uart_port, ret, errno);
+    printf("Failed to write to serial port %s, ret: %d, errno: %d\n", adapterCurrent()->port, ret, errno);
     exit(EXIT_FAILURE);
   }
 }
 
 /***********************************************************************************************//**
- *  \brief  Serial Port initialisation routine.
+ *  \brief  Function called when BGLIB reads a command response from the serial port.
+ *  \param[in] msg_len Number of bytes to read.
+ *  \param[out] msg_data Destination.
+ *  \return  msg_len on success, -1 after a timeout, which BGLIB retries.
+ **************************************************************************************************/
+static int32_t on_message_receive(uint32_t msg_len, uint8_t* msg_data)
+{
+  int32_t ret;
+
+  ret = bgapiRxInput(msg_len, msg_data);
+  /* BGLIB would retry a port that is gone for ever. */
+  if (ret < 0 && errno != ETIMEDOUT) {
+    printf("Failed to read from serial port %s, ret: %d, errno: %d\n", adapterCurrent()->port, ret, errno);
+    exit(EXIT_FAILURE);
+  }
+  return ret;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Serial Port initialisation routine: parse the command line and add an adapter for
+ *          every serial port given. The ports are opened by the adapter threads.
  *  \param[in] argc Argument count.
  *  \param[in] argv Buffer contaning Serial Port data.
  *  \return  0 on success, -1 on failure.
  **************************************************************************************************/
-static int appSerialPortInit(int argc, char* argv[], int32_t timeout)
+static int appSerialPortInit(int argc, char* argv[])
 {
+  char* uart_port = NULL;
+  uint32_t baud_rate = 0;
   uint32_t flowcontrol = 1;
+  int opt;
 
   /**
-   * Handle the command-line arguments.
+   * Handle the command-line options, then the positional arguments.
    */
+  while ((opt = getopt(argc, argv, "msa:n:c:l:v:u:g:w:b:e:E:o:U:j:q:M:A:x:P:H:k:W:DSCT:R:F")) != -1) {
+    switch (opt) {
+      case 'm':
+        measureMode = true;
+        break;
+      case 's':
+        appCfg.stressMode = true;
+        break;
+      case 'D':
+        appCfg.directReconnect = false;
+        break;
+      case 'S':
+        appCfg.adaptiveScan = false;
+        break;
+      case 'C':
+        appCfg.coldStart = true;
+        break;
+      case 'T':
+        tracePath = optarg;
+        break;
+      case 'R':
+        replayPath = optarg;
+        measureMode = true;
+        break;
+      case 'F':
+        replayRealTime = false;
+        break;
+      case 'a':
+        if (extraPortCount == COUNTOF(extraPorts)) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        extraPorts[extraPortCount++] = optarg;
+        break;
+      case 'n':
+        appCfg.maxConnections = atoi(optarg);
+        if (appCfg.maxConnections < 1 || appCfg.maxConnections > MAX_CONNECTIONS) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'c':
+        appCfg.cachePath = optarg;
+        break;
+      case 'l':
+        logPath = optarg;
+        break;
+      case 'u': {
+        uint8_t uuid[16];
+        uint8_t len;
+
+        if (adParseUuidString(optarg, uuid, &len) < 0 || adTargetAdd(&appCfg.targets, uuid, len) < 0) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'g':
+        if (gattProfileLoad(optarg) < 0) {
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'w':
+        appCfg.streamBytes = strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        appCfg.streamPayload = atoi(optarg);
+        break;
+      case 'e':
+        appCfg.rttRate = strtoul(optarg, NULL, 0);
+        break;
+      case 'E':
+        appCfg.rttPayload = atoi(optarg);
+        if (appCfg.rttPayload < RTT_HEADER_LEN || appCfg.rttPayload > STREAM_MAX_MTU - 3) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'o':
+        notifyFilePath = optarg;
+        break;
+      case 'U':
+        notifySocketPath = optarg;
+        break;
+      case 'j':
+        notifyConsumers = atoi(optarg);
+        if (notifyConsumers < 1 || notifyConsumers > NOTIFY_MAX_CONSUMERS) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'q':
+        if (notifyParsePolicy(optarg, &notifyPolicy) < 0) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'M':
+        metricsTarget = optarg;
+        break;
+      case 'A':
+        advDbPath = optarg;
+        break;
+      case 'x':
+        shmExportName = optarg;
+        break;
+      case 'H':
+        if (uartSpeedParse(optarg, &appCfg.baudRates) < 0) {
+          printf("Error!!! -H takes up to %d baud rates this system supports\n", UART_SPEED_MAX_RATES);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'k':
+        appCfg.bondPath = optarg;
+        break;
+      case 'W': {
+        int periodMs = atoi(optarg);
+
+        if (periodMs < WRITE_PERIOD_MIN_MS || periodMs > WRITE_PERIOD_MAX_MS) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        appCfg.writePeriodMs = periodMs;
+        break;
+      }
+      case 'P':
+        commandDepth = atoi(optarg);
+        if (commandDepth < 1 || commandDepth > BGAPI_CMD_MAX_DEPTH) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'v':
+        binlogLevel = atoi(optarg);
+        if (binlogLevel > BINLOG_DEBUG) {
+          printf(USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default:
+        printf(USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  argv += optind - 1;
+  argc -= optind - 1;
+  /* Streams and round-trip probes go to the characteristic to write. */
+  if ((appCfg.streamBytes > 0 || appCfg.rttRate > 0) && gattProfileSize() > 0
+      && gattProfileCount(GATT_PROFILE_WRITE) == 0) {
+    printf("Error!!! -w and -e need a characteristic to write in the GATT profile\n");
+    exit(EXIT_FAILURE);
+  }
+
   baud_rate = default_baud_rate;
   switch (argc) {
+    case 5:
+      appCfg.profile = linkProfileFind(argv[4]);
+      if (appCfg.profile == NULL) {
+        printf(USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+      }
+    /** Falls through on purpose. */
     case 4:
       flowcontrol = atoi(argv[3]);
     /** Falls through on purpose. */
@@ -150,11 +621,318 @@ static int appSerialPortInit(int argc, char* argv[], int32_t timeout)
     default:
       break;
   }
+  if (replayPath != NULL) {
+    return appReplayInit();
+  }
   if (!uart_port || !baud_rate || (flowcontrol > 1)) {
     printf(USAGE, argv[0]);
     exit(EXIT_FAILURE);
   }
 
-  /* Initialise the serial port with RTS/CTS enabled. */
-  return uartOpen((int8_t*)uart_port, baud_rate, flowcontrol, timeout);
+  /* Every adapter with the same line settings, RTS/CTS enabled unless turned off. */
+  if (adapterAdd(uart_port, baud_rate, flowcontrol) < 0) {
+    return -1;
+  }
+  for (uint8_t i = 0; i < extraPortCount; i++) {
+    if (adapterAdd(extraPorts[i], baud_rate, flowcontrol) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Map the trace to replay and add an adapter for every adapter it was captured from.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int appReplayInit(void)
+{
+  int adapters;
+
+  if (extraPortCount > 0 || tracePath != NULL) {
+    printf("Error!!! A replay takes the place of the serial ports: -a and -T do not go with -R\n");
+    return -1;
+  }
+  adapters = bgapiTraceReplayOpen(replayPath, replayRealTime);
+  if (adapters < 0) {
+    printf("Error!!! Could not read BGAPI trace %s\n", replayPath);
+    return -1;
+  }
+  for (int i = 0; i < adapters; i++) {
+    if (adapterAdd(replayPath, default_baud_rate, 0) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Event loop handler for the UART: dispatch every BGAPI event and command response that
+ *          is available, then write the commands queued meanwhile.
+ *  \param[in] fd UART descriptor.
+ *  \param[in] revents poll() revents bits.
+ *  \param[in] ctx The adapter.
+ **************************************************************************************************/
+static void onUartReadable(int fd, short revents, void* ctx)
+{
+  const char* port = ((struct adapter*)ctx)->port;
+  struct gecko_cmd_packet* evt;
+  uint64_t stageNs = measureMode ? timeNowNs() : 0;
+  uint64_t nowNs;
+
+  if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+    printf("Serial port %s closed or failed\n", port);
+    evloopStop();
+    return;
+  }
+
+  /* One read for everything pending, then every complete frame in the buffer. Events BGLIB
+   * queued itself, if it ever had to read the raw stream, come before the rest of the buffer. */
+  if ((revents & POLLIN) && bgapiRxFill() < 0) {
+    printf("Serial port %s closed or failed\n", port);
+    evloopStop();
+    return;
+  }
+  while ((evt = adapterPeekEvent()) != NULL || (evt = bgapiRxNext()) != NULL) {
+    if (measureMode) {
+      nowNs = timeNowNs();
+      measure.readSumNs += nowNs - stageNs;
+      measure.readMaxNs = MAX(measure.readMaxNs, nowNs - stageNs);
+      stageNs = nowNs;
+    }
+    if (BGAPI_RX_IS_RESPONSE(evt)) {
+      bgapiCmdComplete(evt);
+    } else {
+      appHandleEvents(evt);
+    }
+    if (measureMode) {
+      nowNs = timeNowNs();
+      measure.events++;
+      measure.handlerSumNs += nowNs - stageNs;
+      measure.handlerMaxNs = MAX(measure.handlerMaxNs, nowNs - stageNs);
+      measure.latencySumNs += nowNs - evloopGetStats()->lastWakeNs;
+      measure.latencyMaxNs = MAX(measure.latencyMaxNs, nowNs - evloopGetStats()->lastWakeNs);
+      stageNs = nowNs;
+    }
+  }
+
+  /* Everything the handlers queued goes out in one write. */
+  if (bgapiCmdFlush() < 0) {
+    printf("Failed to write to serial port %s, errno: %d\n", port, errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Print the measurement report of an adapter for the window that just ended and start a
+ *          new one. CPU time is the whole process's.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx The adapter.
+ **************************************************************************************************/
+static void onMeasureTimer(int timerId, void* ctx)
+{
+  uint64_t cpuNs = timeCpuNs();
+  uint64_t wallNs = timeNowNs();
+  uint64_t wakeups = evloopGetStats()->wakeups;
+  uint64_t cpuDelta = cpuNs - measure.cpuNs;
+  uint64_t wallDelta = wallNs - measure.wallNs;
+  struct binlogStats log = *binlogGetStats();
+  uint64_t logRecords = log.records - measure.log.records;
+  struct advDedupStats scan = *advDedupGetStats();
+  struct bgapiRxStats rx = *bgapiRxGetStats();
+  struct bgapiCmdStats cmd = *bgapiCmdGetStats();
+  uint64_t completed = cmd.completed - measure.cmd.completed;
+  struct timerWheelStats timers = *timerWheelGetStats();
+  uint64_t fired = timers.fired - measure.timers.fired;
+  uint64_t passes = timers.passes - measure.timers.passes;
+  struct notifyPipeStats notify;
+
+  /* The lines of one report stay together when several adapters report at once. */
+  flockfile(stdout);
+  if (adapterCount() > 1) {
+    printf("MEASURE --- > adapter %u on %s\r\n", ((struct adapter*)ctx)->index, ((struct adapter*)ctx)->port);
+  }
+  printf("MEASURE --- > %.1f s: %llu events, %llu wakeups, cpu %.3f ms (%.2f%%), "
+         "cpu/event %.1f us, latency avg %.1f us max %.1f us\r\n",
+         wallDelta / 1e9,
+         (unsigned long long)measure.events,
+         (unsigned long long)(wakeups - measure.wakeups),
+         cpuDelta / 1e6,
+         wallDelta ? 100.0 * cpuDelta / wallDelta : 0.0,
+         measure.events ? cpuDelta / 1e3 / measure.events : 0.0,
+         measure.events ? measure.latencySumNs / 1e3 / measure.events : 0.0,
+         measure.latencyMaxNs / 1e3);
+  printf("MEASURE --- > stages: read avg %.1f us max %.1f us, handler avg %.1f us max %.1f us\r\n",
+         measure.events ? measure.readSumNs / 1e3 / measure.events : 0.0, measure.readMaxNs / 1e3,
+         measure.events ? measure.handlerSumNs / 1e3 / measure.events : 0.0, measure.handlerMaxNs / 1e3);
+  printf("MEASURE --- > uart: %llu reads, %llu bytes, %.2f reads/event, %llu bytes discarded\r\n",
+         (unsigned long long)(rx.reads - measure.rx.reads),
+         (unsigned long long)(rx.bytes - measure.rx.bytes),
+         measure.events ? (double)(rx.reads - measure.rx.reads) / measure.events : 0.0,
+         (unsigned long long)(rx.discarded - measure.rx.discarded));
+  /* The peaks are since start. */
+  printf("MEASURE --- > commands: %llu queued, %llu writes, response avg %.1f us, peak %.1f us, "
+         "peak queue %u, %llu rejected, %llu stray responses, %llu lost\r\n",
+         (unsigned long long)(cmd.commands - measure.cmd.commands),
+         (unsigned long long)(cmd.writes - measure.cmd.writes),
+         completed ? (cmd.latencySumNs - measure.cmd.latencySumNs) / 1e3 / completed : 0.0,
+         cmd.latencyMaxNs / 1e3, cmd.maxPending,
+         (unsigned long long)(cmd.rejected - measure.cmd.rejected),
+         (unsigned long long)(cmd.stray - measure.cmd.stray),
+         (unsigned long long)(cmd.lost - measure.cmd.lost));
+  printf("MEASURE --- > log: %llu records, %llu dropped, %.0f ns/record\r\n",
+         (unsigned long long)logRecords,
+         (unsigned long long)(log.dropped - measure.log.dropped),
+         logRecords ? (double)(log.costNs - measure.log.costNs) / logRecords : 0.0);
+  printf("MEASURE --- > scan: %llu reports parsed, %llu unchanged repeats skipped, %llu evictions\r\n",
+         (unsigned long long)(scan.misses - measure.scan.misses),
+         (unsigned long long)(scan.hits - measure.scan.hits),
+         (unsigned long long)(scan.evictions - measure.scan.evictions));
+  /* The late peak is since start. */
+  printf("MEASURE --- > timers: %u jobs, %llu runs in %llu passes (%.1f per pass), %llu wakeups, "
+         "late avg %.1f us, peak %.1f us\r\n",
+         timers.active, (unsigned long long)fired, (unsigned long long)passes,
+         passes ? (double)fired / passes : 0.0,
+         (unsigned long long)(timers.wakeups - measure.timers.wakeups),
+         fired ? (timers.lateNs - measure.timers.lateNs) / 1e3 / fired : 0.0, timers.lateMaxNs / 1e3);
+
+  if (notifyPipeActive()) {
+    notifyPipeGetStats(&notify);
+    printf("MEASURE --- > notify: %llu queued, %llu delivered, %llu dropped newest, %llu dropped oldest, "
+           "%llu producer waits\r\n",
+           (unsigned long long)(notify.pushed - measure.notify.pushed),
+           (unsigned long long)(notify.delivered - measure.notify.delivered),
+           (unsigned long long)(notify.droppedNewest - measure.notify.droppedNewest),
+           (unsigned long long)(notify.droppedOldest - measure.notify.droppedOldest),
+           (unsigned long long)(notify.blockedWaits - measure.notify.blockedWaits));
+  } else {
+    memset(&notify, 0, sizeof(notify));
+  }
+  funlockfile(stdout);
+
+  total.events += measure.events;
+  total.readSumNs += measure.readSumNs;
+  total.handlerSumNs += measure.handlerSumNs;
+  total.cpuNs += cpuDelta;
+  total.wallNs += wallDelta;
+  memset(&measure, 0, sizeof(measure));
+  measure.cpuNs = cpuNs;
+  measure.wallNs = wallNs;
+  measure.wakeups = wakeups;
+  measure.log = log;
+  measure.scan = scan;
+  measure.rx = rx;
+  measure.cmd = cmd;
+  measure.notify = notify;
+  measure.timers = timers;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Stress report over all adapters: the links each adapter had ready at its last report,
+ *          and the notification throughput since the previous aggregate report.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onAggregateTimer(int timerId, void* ctx)
+{
+  uint64_t wallNs = timeNowNs();
+  uint64_t notifications = __atomic_load_n(&metricsCounters[METRICS_NOTIFICATIONS], __ATOMIC_RELAXED);
+  uint64_t bytes = __atomic_load_n(&metricsCounters[METRICS_NOTIFY_BYTES], __ATOMIC_RELAXED);
+  double seconds = (wallNs - aggregate.wallNs) / 1e9;
+  uint32_t links = 0;
+
+  for (uint8_t i = 0; i < adapterCount(); i++) {
+    links += __atomic_load_n(&adapterAt(i)->links, __ATOMIC_RELAXED);
+  }
+  printf("STRESS --- > %u adapters, %u links: %.1f notifications/s, %.1f bytes/s over all adapters\r\n",
+         adapterCount(), links, (notifications - aggregate.notifications) / seconds,
+         (bytes - aggregate.bytes) / seconds);
+  aggregate.wallNs = wallNs;
+  aggregate.notifications = notifications;
+  aggregate.bytes = bytes;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Act on a signal. Only touches async-signal-safe state.
+ *  \param[in] signum Signal number.
+ **************************************************************************************************/
+static void onSignalNumber(int signum)
+{
+  if (signum == SIGUSR1) {
+    if (binlogLevel < BINLOG_DEBUG) {
+      binlogLevel++;
+    }
+  } else if (signum == SIGUSR2) {
+    if (binlogLevel > BINLOG_OFF) {
+      binlogLevel--;
+    }
+  } else {
+    evloopStop();
+  }
+}
+
+#if defined(__linux__)
+/***********************************************************************************************//**
+ *  \brief  signalfd handler: leave the event loop on SIGINT/SIGTERM, change the log verbosity
+ *          on SIGUSR1/SIGUSR2.
+ *  \param[in] fd signalfd descriptor.
+ *  \param[in] revents poll() revents bits.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onSignal(int fd, short revents, void* ctx)
+{
+  struct signalfd_siginfo info;
+
+  if (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    onSignalNumber(info.ssi_signo);
+  }
+}
+#else
+/***********************************************************************************************//**
+ *  \brief  Signal handler: leave the event loop on SIGINT/SIGTERM, change the log verbosity
+ *          on SIGUSR1/SIGUSR2.
+ *  \param[in] signum Signal number.
+ **************************************************************************************************/
+static void onSignal(int signum)
+{
+  onSignalNumber(signum);
+}
+#endif
+
+/***********************************************************************************************//**
+ *  \brief  Route SIGINT and SIGTERM into the event loop so that we shut down cleanly, and
+ *          SIGUSR1/SIGUSR2 to the log verbosity.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int appSignalInit(void)
+{
+#if defined(__linux__)
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+    return -1;
+  }
+  fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  return evloopAddFd(fd, POLLIN, onSignal, NULL);
+#else
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSignal;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGINT, &sa, NULL) < 0 || sigaction(SIGTERM, &sa, NULL) < 0
+      || sigaction(SIGUSR1, &sa, NULL) < 0 || sigaction(SIGUSR2, &sa, NULL) < 0) {
+    return -1;
+  }
+  return 0;
+#endif
 }
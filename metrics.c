@@ -0,0 +1,455 @@
+/***********************************************************************************************//**
+ * \file   metrics.c
+ * \brief  Always-on counters and latency histograms, exported in Prometheus text format
+ ***************************************************************************************************
+ * A value v >= 16 ns with highest set bit e falls into bucket (e - 3) * 16 + the four bits
+ * below the highest one, so every power of two is split into 16 equal sub-buckets. Exported
+ * histograms use fixed "le" bounds; each fine bucket is counted under the first bound not
+ * below its upper edge. Quantiles are read from the fine buckets.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "infrastructure.h"
+
+#include "connection.h"
+#include "event_loop.h"
+
+/* Own header */
+#include "metrics.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define METRICS_SUB_BITS              4
+#define METRICS_SUB_COUNT             (1 << METRICS_SUB_BITS)
+
+/** Distinct (kind, code) pairs tracked; further codes are exported as "other". */
+#define METRICS_MAX_ERRORS            32
+
+/** Room for the rendered text. */
+#define METRICS_TEXT_SIZE             (64 * 1024)
+
+#define METRICS_UNIX_PREFIX           "unix:"
+
+struct metricsErrorCount {
+  uint8_t kind;
+  uint16_t code;
+  uint64_t count;
+};
+
+/** Output buffer being rendered into. */
+struct metricsWriter {
+  char* buf;
+  size_t size;
+  size_t len;
+};
+
+uint64_t metricsCounters[METRICS_COUNTERS];
+
+static struct metricsHistogram histograms[METRICS_HISTOGRAMS];
+static struct metricsErrorCount errors[METRICS_MAX_ERRORS];
+static uint8_t errorCount = 0;
+static uint64_t otherErrors[METRICS_ERROR_KINDS];
+
+/** Histograms and error codes are recorded by every adapter thread. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* filePath = NULL;
+static int listenFd = -1;
+static int exportTimer = -1;
+static char text[METRICS_TEXT_SIZE];
+
+/** Exported histogram bounds, in seconds. */
+static const double bounds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+                                 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60 };
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1 };
+
+static const struct {
+  const char* name;
+  const char* help;
+} counterInfo[METRICS_COUNTERS] = {
+  [METRICS_SCAN_RESPONSES] = { "scan_responses", "Scan reports received." },
+  [METRICS_SCAN_MATCHES] = { "scan_matches", "Scan reports that matched a target service." },
+  [METRICS_CONNECT_ATTEMPTS] = { "connect_attempts", "Connection attempts started." },
+  [METRICS_LINKS_OPENED] = { "links_opened", "Connections opened." },
+  [METRICS_LINKS_READY] = { "links_ready", "Links that reached notifications enabled." },
+  [METRICS_NOTIFICATIONS] = { "notifications", "Notifications received." },
+  [METRICS_NOTIFY_BYTES] = { "notification_bytes", "Notification payload bytes received." },
+  [METRICS_POLL_READS] = { "poll_reads", "Characteristic values read by GATT profile polls." },
+  [METRICS_POLL_ROUND_TRIPS] = { "poll_round_trips", "ATT read requests of GATT profile polls, several values each with read multiple." },
+};
+
+static const struct {
+  const char* name;
+  const char* label;
+  const char* help;
+} errorInfo[METRICS_ERROR_KINDS] = {
+  [METRICS_CONNECT_FAILURE] = { "connect_failures", "code", "Failed connection attempts by BGAPI result code." },
+  [METRICS_GATT_FAILURE] = { "gatt_failures", "code", "Failed GATT procedures by BGAPI result code." },
+  [METRICS_DISCONNECT] = { "disconnects", "reason", "Established links closed, by reason code." },
+  [METRICS_BONDING_FAILURE] = { "bonding_failures", "reason", "Failed pairings and encryptions with a stored bond, by reason code." },
+};
+
+static const struct {
+  const char* name;
+  const char* help;
+} histogramInfo[METRICS_FIXED_HISTOGRAMS] = {
+  [METRICS_SCAN_TIME] = { "scan", "Time from starting discovery to a target match." },
+  [METRICS_SETUP_TIME] = { "setup", "Time from a target match to notifications enabled." },
+  [METRICS_COMMAND_TIME] = { "command", "Time from queueing a BGAPI command to its response." },
+  [METRICS_RESUME_DIRECT_TIME] = { "resume_direct", "Time from a link loss to the first notification, reconnected directly." },
+  [METRICS_RESUME_SCAN_TIME] = { "resume_scan", "Time from a link loss to the first notification, peer found by scanning." },
+  [METRICS_WRITE_TIME] = { "write", "Time from a periodic write request to its completion, one connection event or more." },
+  [METRICS_RTT_TIME] = { "rtt", "Time from a round-trip probe write to the notification echoing it." },
+  [METRICS_POLL_TIME] = { "poll", "Time from a GATT profile poll read request to its completion." },
+  [METRICS_PAIR_TIME] = { "pair", "Time from a link opened to a new bond with the peer." },
+  [METRICS_ENCRYPT_TIME] = { "encrypt", "Time from a link opened to its encryption with a stored bond." },
+};
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static uint32_t bucketIndex(uint64_t ns);
+static uint64_t bucketUpperNs(uint32_t index);
+static void writerAppend(struct metricsWriter* w, const char* format, ...);
+static void renderHistogram(struct metricsWriter* w, const char* name, const char* label,
+                            const struct metricsHistogram* h);
+static void writeFile(void);
+static void onExportTimer(int timerId, void* ctx);
+static void onMetricsClient(int fd, short revents, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void metricsError(enum metricsErrorKind kind, uint16_t code)
+{
+  uint8_t i;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < errorCount; i++) {
+    if (errors[i].kind == kind && errors[i].code == code) {
+      break;
+    }
+  }
+  if (i < errorCount) {
+    errors[i].count++;
+  } else if (errorCount == METRICS_MAX_ERRORS) {
+    otherErrors[kind]++;
+  } else {
+    errors[errorCount].kind = kind;
+    errors[errorCount].code = code;
+    errors[errorCount].count = 1;
+    errorCount++;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void metricsObserve(uint8_t histogram, uint64_t ns)
+{
+  pthread_mutex_lock(&lock);
+  metricsHistogramRecord(&histograms[histogram], ns);
+  pthread_mutex_unlock(&lock);
+}
+
+void metricsHistogramRecord(struct metricsHistogram* h, uint64_t ns)
+{
+  h->count++;
+  h->sumNs += ns;
+  h->maxNs = MAX(h->maxNs, ns);
+  h->buckets[bucketIndex(ns)]++;
+}
+
+uint64_t metricsHistogramQuantileNs(const struct metricsHistogram* h, double q)
+{
+  uint64_t rank = (uint64_t)(q * h->count + 0.5);
+  uint64_t cumulative = 0;
+
+  rank = MAX(rank, 1);
+  for (uint32_t i = 0; i < METRICS_BUCKETS; i++) {
+    cumulative += h->buckets[i];
+    if (cumulative >= rank) {
+      return MIN(bucketUpperNs(i), h->maxNs);
+    }
+  }
+  return h->maxNs;
+}
+
+int metricsStart(const char* target)
+{
+  size_t prefixLen = strlen(METRICS_UNIX_PREFIX);
+
+  if (strncmp(target, METRICS_UNIX_PREFIX, prefixLen) != 0) {
+    filePath = target;
+    writeFile();
+    exportTimer = evloopAddTimer(METRICS_EXPORT_MS, true, onExportTimer, NULL);
+    return exportTimer < 0 ? -1 : 0;
+  }
+
+  struct sockaddr_un addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(target + prefixLen) >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  strcpy(addr.sun_path, target + prefixLen);
+  unlink(addr.sun_path);
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0
+      || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+      || listen(listenFd, 4) < 0
+      || fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK) < 0
+      || evloopAddFd(listenFd, POLLIN, onMetricsClient, NULL) < 0) {
+    if (listenFd >= 0) {
+      close(listenFd);
+      listenFd = -1;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+void metricsStop(void)
+{
+  if (filePath != NULL) {
+    evloopRemoveTimer(exportTimer);
+    exportTimer = -1;
+    writeFile();
+    filePath = NULL;
+  }
+  if (listenFd >= 0) {
+    evloopRemoveFd(listenFd);
+    close(listenFd);
+    listenFd = -1;
+  }
+}
+
+size_t metricsRender(char* buf, size_t size)
+{
+  struct metricsWriter w = { buf, size, 0 };
+
+  buf[0] = '\0';
+  for (uint8_t c = 0; c < METRICS_COUNTERS; c++) {
+    writerAppend(&w, "# HELP blecentral_%s_total %s\n# TYPE blecentral_%s_total counter\n"
+                 "blecentral_%s_total %llu\n", counterInfo[c].name, counterInfo[c].help,
+                 counterInfo[c].name, counterInfo[c].name,
+                 (unsigned long long)__atomic_load_n(&metricsCounters[c], __ATOMIC_RELAXED));
+  }
+
+  pthread_mutex_lock(&lock);
+
+  for (uint8_t k = 0; k < METRICS_ERROR_KINDS; k++) {
+    writerAppend(&w, "# HELP blecentral_%s_total %s\n# TYPE blecentral_%s_total counter\n",
+                 errorInfo[k].name, errorInfo[k].help, errorInfo[k].name);
+    for (uint8_t i = 0; i < errorCount; i++) {
+      if (errors[i].kind == k) {
+        writerAppend(&w, "blecentral_%s_total{%s=\"0x%04x\"} %llu\n", errorInfo[k].name,
+                     errorInfo[k].label, errors[i].code, (unsigned long long)errors[i].count);
+      }
+    }
+    if (otherErrors[k] != 0) {
+      writerAppend(&w, "blecentral_%s_total{%s=\"other\"} %llu\n", errorInfo[k].name,
+                   errorInfo[k].label, (unsigned long long)otherErrors[k]);
+    }
+  }
+
+  for (uint8_t i = 0; i < METRICS_FIXED_HISTOGRAMS; i++) {
+    char name[48];
+
+    snprintf(name, sizeof(name), "blecentral_%s_seconds", histogramInfo[i].name);
+    writerAppend(&w, "# HELP %s %s\n# TYPE %s histogram\n", name, histogramInfo[i].help, name);
+    renderHistogram(&w, name, "", &histograms[i]);
+  }
+
+  writerAppend(&w, "# HELP blecentral_state_seconds Time spent in a per-connection state before leaving it.\n"
+               "# TYPE blecentral_state_seconds histogram\n");
+  for (uint8_t s = 0; s < METRICS_STATES; s++) {
+    char label[40];
+
+    if (histograms[METRICS_STATE_TIME(s)].count == 0) {
+      continue;
+    }
+    snprintf(label, sizeof(label), "state=\"%s\",", connStateName(s));
+    renderHistogram(&w, "blecentral_state_seconds", label, &histograms[METRICS_STATE_TIME(s)]);
+  }
+
+  /* Quantiles from the fine buckets, which the fixed export bounds cannot give. */
+  writerAppend(&w, "# HELP blecentral_latency_quantile_seconds Latency quantiles, 6%% precision.\n"
+               "# TYPE blecentral_latency_quantile_seconds gauge\n");
+  for (uint8_t i = 0; i < METRICS_HISTOGRAMS; i++) {
+    const char* name = i < METRICS_FIXED_HISTOGRAMS ? histogramInfo[i].name
+                       : connStateName(i - METRICS_FIXED_HISTOGRAMS);
+
+    if (histograms[i].count == 0) {
+      continue;
+    }
+    for (uint8_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+      writerAppend(&w, "blecentral_latency_quantile_seconds{histogram=\"%s\",quantile=\"%g\"} %.9f\n",
+                   name, quantiles[q], metricsHistogramQuantileNs(&histograms[i], quantiles[q]) / 1e9);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return w.len;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Fine bucket of a duration.
+ *  \param[in] ns Duration.
+ *  \return  Bucket index.
+ **************************************************************************************************/
+static uint32_t bucketIndex(uint64_t ns)
+{
+  uint32_t exponent;
+  uint32_t index;
+
+  if (ns < METRICS_SUB_COUNT) {
+    return (uint32_t)ns;
+  }
+  exponent = 63 - __builtin_clzll(ns);
+  index = (exponent - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT
+          + (uint32_t)((ns >> (exponent - METRICS_SUB_BITS)) & (METRICS_SUB_COUNT - 1));
+  return MIN(index, METRICS_BUCKETS - 1);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Exclusive upper edge of a fine bucket.
+ *  \param[in] index Bucket index.
+ *  \return  Edge in nanoseconds.
+ **************************************************************************************************/
+static uint64_t bucketUpperNs(uint32_t index)
+{
+  uint32_t exponent = index / METRICS_SUB_COUNT + METRICS_SUB_BITS - 1;
+  uint64_t sub = index % METRICS_SUB_COUNT;
+
+  if (index < METRICS_SUB_COUNT) {
+    return index + 1;
+  }
+  return (METRICS_SUB_COUNT + sub + 1) << (exponent - METRICS_SUB_BITS);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Append formatted text, dropping whatever does not fit.
+ *  \param[in] w Writer.
+ *  \param[in] format printf format.
+ **************************************************************************************************/
+static void writerAppend(struct metricsWriter* w, const char* format, ...)
+{
+  va_list args;
+  int n;
+
+  if (w->len + 1 >= w->size) {
+    return;
+  }
+  va_start(args, format);
+  n = vsnprintf(w->buf + w->len, w->size - w->len, format, args);
+  va_end(args);
+  if (n > 0) {
+    w->len = MIN(w->len + n, w->size - 1);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Append the bucket, sum and count lines of one histogram.
+ *  \param[in] w Writer.
+ *  \param[in] name Metric name.
+ *  \param[in] label Extra labels, each followed by a comma, or "".
+ *  \param[in] h Histogram.
+ **************************************************************************************************/
+static void renderHistogram(struct metricsWriter* w, const char* name, const char* label,
+                            const struct metricsHistogram* h)
+{
+  uint64_t cumulative = 0;
+  uint32_t index = 0;
+
+  for (uint8_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++) {
+    uint64_t boundNs = (uint64_t)(bounds[b] * 1e9);
+
+    for (; index < METRICS_BUCKETS && bucketUpperNs(index) <= boundNs; index++) {
+      cumulative += h->buckets[index];
+    }
+    writerAppend(w, "%s_bucket{%sle=\"%g\"} %llu\n", name, label, bounds[b], (unsigned long long)cumulative);
+  }
+  writerAppend(w, "%s_bucket{%sle=\"+Inf\"} %llu\n", name, label, (unsigned long long)h->count);
+  if (label[0] != '\0') {
+    /* Drop the trailing comma for the labelled sum and count lines. */
+    writerAppend(w, "%s_sum{%.*s} %.9f\n%s_count{%.*s} %llu\n", name, (int)strlen(label) - 1, label,
+                 h->sumNs / 1e9, name, (int)strlen(label) - 1, label, (unsigned long long)h->count);
+  } else {
+    writerAppend(w, "%s_sum %.9f\n%s_count %llu\n", name, h->sumNs / 1e9, name, (unsigned long long)h->count);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Rewrite the metrics file atomically, so that readers never see a partial file.
+ **************************************************************************************************/
+static void writeFile(void)
+{
+  char tmpPath[256];
+  size_t len = metricsRender(text, sizeof(text));
+  FILE* fp;
+
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", filePath);
+  fp = fopen(tmpPath, "w");
+  if (fp == NULL) {
+    return;
+  }
+  if (fwrite(text, 1, len, fp) != len) {
+    fclose(fp);
+    remove(tmpPath);
+    return;
+  }
+  fclose(fp);
+  rename(tmpPath, filePath);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Export timer expired: rewrite the metrics file.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onExportTimer(int timerId, void* ctx)
+{
+  writeFile();
+}
+
+/***********************************************************************************************//**
+ *  \brief  A client connected to the metrics socket: send the current metrics and hang up.
+ *  \param[in] fd Listening socket.
+ *  \param[in] revents Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onMetricsClient(int fd, short revents, void* ctx)
+{
+  int client;
+
+  while ((client = accept(fd, NULL, NULL)) >= 0) {
+    size_t len = metricsRender(text, sizeof(text));
+
+    /* One write into an empty socket buffer; a client too slow for that gets a short read. */
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+    if (write(client, text, len) < 0) {
+      /* Nothing to do: the client has gone. */
+    }
+    close(client);
+  }
+}
@@ -0,0 +1,168 @@
+/***********************************************************************************************//**
+ * \file   metrics.h
+ * \brief  Always-on counters and latency histograms, exported in Prometheus text format
+ ***************************************************************************************************
+ * Recording is a counter increment or a histogram bucket increment, so the hooks stay enabled
+ * in production. Histograms are log-linear in the manner of HdrHistogram: 16 sub-buckets per
+ * power of two of nanoseconds, about 6% relative precision from 16 ns to over an hour.
+ **************************************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Counters. */
+enum metricsCounter {
+  METRICS_SCAN_RESPONSES,       /**< scan reports received */
+  METRICS_SCAN_MATCHES,         /**< scan reports that matched a target */
+  METRICS_CONNECT_ATTEMPTS,     /**< le_gap_open commands issued */
+  METRICS_LINKS_OPENED,         /**< connections opened */
+  METRICS_LINKS_READY,          /**< links that reached notifications enabled */
+  METRICS_NOTIFICATIONS,        /**< notifications received */
+  METRICS_NOTIFY_BYTES,         /**< notification payload bytes received */
+  METRICS_POLL_READS,           /**< characteristic values read by GATT profile polls */
+  METRICS_POLL_ROUND_TRIPS,     /**< ATT read requests that carried them */
+  METRICS_COUNTERS
+};
+
+/** Counters kept per BGAPI error or reason code. */
+enum metricsErrorKind {
+  METRICS_CONNECT_FAILURE,      /**< open refused, timed out or closed before opening */
+  METRICS_GATT_FAILURE,         /**< GATT procedure completed with an error */
+  METRICS_DISCONNECT,           /**< established link closed */
+  METRICS_BONDING_FAILURE,      /**< pairing or encryption with a stored bond failed */
+  METRICS_ERROR_KINDS
+};
+
+/** Latency histograms. Per-connection state histograms follow the fixed ones. */
+enum metricsHistogramId {
+  METRICS_SCAN_TIME,            /**< discovery started to target matched */
+  METRICS_SETUP_TIME,           /**< target matched to notifications enabled */
+  METRICS_COMMAND_TIME,         /**< BGAPI command queued to its response */
+  METRICS_RESUME_DIRECT_TIME,   /**< link lost to first notification, reconnected directly */
+  METRICS_RESUME_SCAN_TIME,     /**< link lost to first notification, peer found by scanning */
+  METRICS_WRITE_TIME,           /**< periodic write request to its completion over the air */
+  METRICS_RTT_TIME,             /**< round-trip probe write to its echo notification */
+  METRICS_POLL_TIME,            /**< GATT profile poll read request to its completion */
+  METRICS_PAIR_TIME,            /**< link opened to a new bond */
+  METRICS_ENCRYPT_TIME,         /**< link opened to encryption with a stored bond */
+  METRICS_FIXED_HISTOGRAMS
+};
+
+/** Number of per-connection states with a histogram; see connection.h. */
+#define METRICS_STATES                18
+
+/** Histogram of the time spent in a per-connection state before leaving it. */
+#define METRICS_STATE_TIME(state)     (METRICS_FIXED_HISTOGRAMS + (state))
+
+#define METRICS_HISTOGRAMS            (METRICS_FIXED_HISTOGRAMS + METRICS_STATES)
+
+/** Buckets per histogram: 16 per power of two up to 2^43 ns, about 2.4 hours. Longer values land
+ *  in the last. */
+#define METRICS_BUCKETS               (16 * 40)
+
+/** A latency histogram. The exported ones are kept here; a module may keep more of its own. */
+struct metricsHistogram {
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+  uint32_t buckets[METRICS_BUCKETS];
+};
+
+/** Interval between exports to a metrics file. */
+#define METRICS_EXPORT_MS             5000
+
+/** Counter values, updated in place by metricsInc() / metricsAdd() from any adapter thread. */
+extern uint64_t metricsCounters[METRICS_COUNTERS];
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Increment a counter.
+ *  \param[in] counter Counter.
+ **************************************************************************************************/
+static inline void metricsInc(enum metricsCounter counter)
+{
+  __atomic_fetch_add(&metricsCounters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Add to a counter.
+ *  \param[in] counter Counter.
+ *  \param[in] value Amount.
+ **************************************************************************************************/
+static inline void metricsAdd(enum metricsCounter counter, uint64_t value)
+{
+  __atomic_fetch_add(&metricsCounters[counter], value, __ATOMIC_RELAXED);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Count an error or reason code.
+ *  \param[in] kind What failed.
+ *  \param[in] code BGAPI result or reason code.
+ **************************************************************************************************/
+void metricsError(enum metricsErrorKind kind, uint16_t code);
+
+/***********************************************************************************************//**
+ *  \brief  Record a duration.
+ *  \param[in] histogram Histogram, a metricsHistogramId or METRICS_STATE_TIME().
+ *  \param[in] ns Duration in nanoseconds.
+ **************************************************************************************************/
+void metricsObserve(uint8_t histogram, uint64_t ns);
+
+/***********************************************************************************************//**
+ *  \brief  Record a duration in a histogram of the caller's, without locking.
+ *  \param[in,out] h Histogram, zeroed before first use.
+ *  \param[in] ns Duration in nanoseconds.
+ **************************************************************************************************/
+void metricsHistogramRecord(struct metricsHistogram* h, uint64_t ns);
+
+/***********************************************************************************************//**
+ *  \brief  Estimate a quantile of a histogram of the caller's.
+ *  \param[in] h Histogram.
+ *  \param[in] q Quantile, 0 to 1.
+ *  \return  Upper edge of the bucket holding the quantile, capped at the maximum seen; 0 if the
+ *           histogram is empty.
+ **************************************************************************************************/
+uint64_t metricsHistogramQuantileNs(const struct metricsHistogram* h, double q);
+
+/***********************************************************************************************//**
+ *  \brief  Export periodically. A target of the form "unix:PATH" listens on a Unix-domain
+ *          stream socket and writes the current metrics to every client that connects; any
+ *          other target is a file rewritten every METRICS_EXPORT_MS, e.g. for the node
+ *          exporter's textfile collector. Needs the event loop.
+ *  \param[in] target File path or "unix:" socket path.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int metricsStart(const char* target);
+
+/***********************************************************************************************//**
+ *  \brief  Write the file a last time, or close the socket.
+ **************************************************************************************************/
+void metricsStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Render all metrics in Prometheus text exposition format.
+ *  \param[out] buf Destination.
+ *  \param[in] size Size of buf.
+ *  \return  Length of the text, truncated to size - 1.
+ **************************************************************************************************/
+size_t metricsRender(char* buf, size_t size);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,500 @@
+/***********************************************************************************************//**
+ * \file   notify_pipe.c
+ * \brief  Notification ingestion pipeline: BGAPI thread to consumer threads and sinks
+ ***************************************************************************************************
+ * Each ring has three free-running indices:
+ *   head  next slot the producer fills, written by the producer holding the push lock only;
+ *   tail  oldest slot not yet claimed; the consumer claims a batch by moving it forward with a
+ *         compare-and-swap, and the producer does the same to evict the oldest slot;
+ *   done  every slot before it is free again; the consumer sets it once the sinks returned.
+ * The producer only evicts while no batch is claimed (done == tail), so a slot is never
+ * overwritten while a sink reads it.
+ *
+ * A consumer that runs dry keeps polling for a while before it blocks on its condition
+ * variable, so under steady traffic the producer never has to make a wakeup system call.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+/* Own header */
+#include "notify_pipe.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define NOTIFY_RING_MASK              (NOTIFY_RING_SLOTS - 1)
+
+/** Largest batch handed to the sinks at once. */
+#define NOTIFY_BATCH                  64
+
+/** An idle consumer polls every NOTIFY_POLL_US for NOTIFY_POLL_COUNT rounds, then blocks. */
+#define NOTIFY_POLL_US                500
+#define NOTIFY_POLL_COUNT             40
+
+/** Blocked consumers still wake up this often, and a blocked producer retries this often. */
+#define NOTIFY_IDLE_MS                100
+#define NOTIFY_BLOCK_US               20
+
+/** Serialized record: timestamp, characteristic, connection, length, then the payload. */
+#define NOTIFY_RECORD_HEADER_LEN      12
+
+#define CACHE_LINE                    64
+
+/** One consumer and its ring. Producer and consumer fields sit on separate cache lines. */
+struct notifyRing {
+  struct notifySlot* slots;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t kick;
+  uint8_t pad0[CACHE_LINE];
+  pthread_mutex_t push;         /**< taken by the adapter thread that fills the ring */
+  uint64_t head;
+  uint64_t droppedNewest;
+  uint64_t droppedOldest;
+  uint64_t blockedWaits;
+  uint64_t pushed;
+  uint8_t pad1[CACHE_LINE];
+  uint64_t tail;
+  uint64_t done;
+  int sleeping;
+  uint8_t pad2[CACHE_LINE];
+  uint64_t delivered;
+};
+
+struct notifySink {
+  notifySinkFn fn;
+  void* ctx;
+  void (*close)(void* ctx);
+};
+
+/** State of the file sink. */
+struct fileSink {
+  FILE* fp;
+  pthread_mutex_t lock;
+};
+
+/** State of the socket sink. */
+struct socketSink {
+  int fd;
+  struct sockaddr_un addr;
+};
+
+static struct notifyRing rings[NOTIFY_MAX_CONSUMERS];
+static uint8_t ringCount = 0;
+static struct notifySink sinks[NOTIFY_MAX_SINKS];
+static uint8_t sinkCount = 0;
+static enum notifyOverflow overflow = NOTIFY_DROP_NEWEST;
+static int stopping = 0;
+static uint64_t truncated = 0;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void* notifyConsumer(void* arg);
+static bool notifyMakeRoom(struct notifyRing* ring, uint64_t head);
+static void notifyKick(struct notifyRing* ring);
+static size_t notifyRecord(uint8_t* out, const struct notifySlot* slot);
+static void fileSinkWrite(const struct notifySlot* slots, uint32_t count, void* ctx);
+static void fileSinkClose(void* ctx);
+static void socketSinkWrite(const struct notifySlot* slots, uint32_t count, void* ctx);
+static void socketSinkClose(void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int notifyPipeAddSink(notifySinkFn fn, void* ctx)
+{
+  if (sinkCount >= NOTIFY_MAX_SINKS || ringCount > 0) {
+    return -1;
+  }
+  sinks[sinkCount].fn = fn;
+  sinks[sinkCount].ctx = ctx;
+  sinks[sinkCount].close = NULL;
+  sinkCount++;
+  return 0;
+}
+
+int notifyPipeAddFileSink(const char* path)
+{
+  struct fileSink* sink = calloc(1, sizeof(*sink));
+
+  if (sink == NULL) {
+    return -1;
+  }
+  sink->fp = fopen(path, "wb");
+  if (sink->fp == NULL || fwrite(NOTIFY_FILE_MAGIC, 1, 4, sink->fp) != 4
+      || notifyPipeAddSink(fileSinkWrite, sink) < 0) {
+    if (sink->fp != NULL) {
+      fclose(sink->fp);
+    }
+    free(sink);
+    return -1;
+  }
+  pthread_mutex_init(&sink->lock, NULL);
+  sinks[sinkCount - 1].close = fileSinkClose;
+  return 0;
+}
+
+int notifyPipeAddSocketSink(const char* path)
+{
+  struct socketSink* sink = calloc(1, sizeof(*sink));
+
+  if (sink == NULL) {
+    return -1;
+  }
+  if (strlen(path) >= sizeof(sink->addr.sun_path)) {
+    free(sink);
+    return -1;
+  }
+  sink->addr.sun_family = AF_UNIX;
+  strcpy(sink->addr.sun_path, path);
+  sink->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (sink->fd < 0 || notifyPipeAddSink(socketSinkWrite, sink) < 0) {
+    if (sink->fd >= 0) {
+      close(sink->fd);
+    }
+    free(sink);
+    return -1;
+  }
+  sinks[sinkCount - 1].close = socketSinkClose;
+  return 0;
+}
+
+int notifyPipeStart(uint8_t consumers, enum notifyOverflow policy)
+{
+  sigset_t all, saved;
+  int ret = 0;
+
+  if (consumers < 1 || consumers > NOTIFY_MAX_CONSUMERS || ringCount > 0) {
+    return -1;
+  }
+  overflow = policy;
+  stopping = 0;
+
+  /* Consumers must not take signals meant for the event loop, so start them with all blocked. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &saved);
+  for (uint8_t i = 0; i < consumers && ret == 0; i++) {
+    struct notifyRing* ring = &rings[i];
+
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = calloc(NOTIFY_RING_SLOTS, sizeof(struct notifySlot));
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_mutex_init(&ring->push, NULL);
+    pthread_cond_init(&ring->kick, NULL);
+    if (ring->slots == NULL || pthread_create(&ring->thread, NULL, notifyConsumer, ring) != 0) {
+      free(ring->slots);
+      ret = -1;
+      break;
+    }
+    ringCount++;
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  if (ret < 0) {
+    notifyPipeStop();
+  }
+  return ret;
+}
+
+bool notifyPipeActive(void)
+{
+  return ringCount > 0;
+}
+
+void notifyPipePush(uint8_t connection, uint16_t characteristic, uint64_t tsNs,
+                    const uint8_t* data, uint8_t len)
+{
+  struct notifyRing* ring = &rings[connection % ringCount];
+  uint64_t head;
+  struct notifySlot* slot;
+
+  pthread_mutex_lock(&ring->push);
+  head = ring->head;
+  if (head - __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE) >= NOTIFY_RING_SLOTS
+      && !notifyMakeRoom(ring, head)) {
+    pthread_mutex_unlock(&ring->push);
+    return;
+  }
+  if (len > NOTIFY_SLOT_DATA) {
+    __atomic_fetch_add(&truncated, 1, __ATOMIC_RELAXED);
+    len = NOTIFY_SLOT_DATA;
+  }
+  slot = &ring->slots[head & NOTIFY_RING_MASK];
+  slot->tsNs = tsNs;
+  slot->characteristic = characteristic;
+  slot->connection = connection;
+  slot->len = len;
+  memcpy(slot->data, data, len);
+  ring->pushed++;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+  /* Pairs with the consumer setting sleeping before its last look at head. */
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST)) {
+    notifyKick(ring);
+  }
+  pthread_mutex_unlock(&ring->push);
+}
+
+void notifyPipeStop(void)
+{
+  __atomic_store_n(&stopping, 1, __ATOMIC_SEQ_CST);
+  for (uint8_t i = 0; i < ringCount; i++) {
+    notifyKick(&rings[i]);
+    pthread_join(rings[i].thread, NULL);
+  }
+  for (uint8_t i = 0; i < ringCount; i++) {
+    free(rings[i].slots);
+    rings[i].slots = NULL;
+  }
+  ringCount = 0;
+  for (uint8_t i = 0; i < sinkCount; i++) {
+    if (sinks[i].close != NULL) {
+      sinks[i].close(sinks[i].ctx);
+    }
+  }
+  sinkCount = 0;
+}
+
+void notifyPipeGetStats(struct notifyPipeStats* stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  for (uint8_t i = 0; i < ringCount; i++) {
+    stats->pushed += rings[i].pushed;
+    stats->delivered += __atomic_load_n(&rings[i].delivered, __ATOMIC_RELAXED);
+    stats->droppedNewest += rings[i].droppedNewest;
+    stats->droppedOldest += rings[i].droppedOldest;
+    stats->blockedWaits += rings[i].blockedWaits;
+  }
+  stats->truncated = truncated;
+}
+
+int notifyParsePolicy(const char* name, enum notifyOverflow* policy)
+{
+  if (!strcmp(name, "block")) {
+    *policy = NOTIFY_BLOCK;
+  } else if (!strcmp(name, "drop-oldest")) {
+    *policy = NOTIFY_DROP_OLDEST;
+  } else if (!strcmp(name, "drop-newest")) {
+    *policy = NOTIFY_DROP_NEWEST;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Consumer thread: claim batches and hand them to every sink.
+ *  \param[in] arg Ring of this consumer.
+ *  \return  NULL.
+ **************************************************************************************************/
+static void* notifyConsumer(void* arg)
+{
+  struct notifyRing* ring = arg;
+  const struct timespec pollPause = { 0, NOTIFY_POLL_US * NSEC_PER_USEC };
+  uint32_t idleRounds = 0;
+
+  for (;; ) {
+    /* Sample the stop flag first so that a final pass delivers everything pushed before it. */
+    int stop = __atomic_load_n(&stopping, __ATOMIC_SEQ_CST);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t count;
+
+    if (tail == head) {
+      if (stop) {
+        break;
+      }
+      if (++idleRounds < NOTIFY_POLL_COUNT) {
+        nanosleep(&pollPause, NULL);
+        continue;
+      }
+      pthread_mutex_lock(&ring->lock);
+      __atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail
+          && !__atomic_load_n(&stopping, __ATOMIC_SEQ_CST)) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += NOTIFY_IDLE_MS * NSEC_PER_MSEC;
+        if (deadline.tv_nsec >= NSEC_PER_SEC) {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= NSEC_PER_SEC;
+        }
+        pthread_cond_timedwait(&ring->kick, &ring->lock, &deadline);
+      }
+      __atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&ring->lock);
+      continue;
+    }
+    idleRounds = 0;
+
+    /* One contiguous run of slots per batch, so sinks get a plain array. */
+    count = MIN(head - tail, NOTIFY_BATCH);
+    count = MIN(count, NOTIFY_RING_SLOTS - (tail & NOTIFY_RING_MASK));
+    if (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + count, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      /* The producer evicted the oldest slot meanwhile. */
+      continue;
+    }
+    for (uint8_t i = 0; i < sinkCount; i++) {
+      sinks[i].fn(&ring->slots[tail & NOTIFY_RING_MASK], count, sinks[i].ctx);
+    }
+    __atomic_store_n(&ring->delivered, ring->delivered + count, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->done, tail + count, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  The ring is full: apply the overflow policy.
+ *  \param[in] ring Full ring.
+ *  \param[in] head Producer index.
+ *  \return  true if the slot at head may now be written.
+ **************************************************************************************************/
+static bool notifyMakeRoom(struct notifyRing* ring, uint64_t head)
+{
+  const struct timespec pause = { 0, NOTIFY_BLOCK_US * NSEC_PER_USEC };
+
+  switch (overflow) {
+    case NOTIFY_BLOCK:
+      ring->blockedWaits++;
+      notifyKick(ring);
+      while (head - __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE) >= NOTIFY_RING_SLOTS) {
+        nanosleep(&pause, NULL);
+      }
+      return true;
+
+    case NOTIFY_DROP_OLDEST: {
+      uint64_t done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+      uint64_t tail = done;
+
+      /* Only possible while the consumer holds no batch: the slot to reuse is the oldest one. */
+      if (__atomic_compare_exchange_n(&ring->tail, &tail, done + 1, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_compare_exchange_n(&ring->done, &done, done + 1, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        ring->droppedOldest++;
+        return true;
+      }
+      /* The consumer is busy with the oldest slots; fall back to dropping this one. */
+      ring->droppedNewest++;
+      return false;
+    }
+
+    case NOTIFY_DROP_NEWEST:
+    default:
+      ring->droppedNewest++;
+      return false;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Wake a consumer blocked on its condition variable.
+ *  \param[in] ring Ring of the consumer.
+ **************************************************************************************************/
+static void notifyKick(struct notifyRing* ring)
+{
+  pthread_mutex_lock(&ring->lock);
+  pthread_cond_signal(&ring->kick);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Serialize a notification in the file/socket record layout.
+ *  \param[out] out Destination, NOTIFY_RECORD_HEADER_LEN + NOTIFY_SLOT_DATA bytes of room.
+ *  \param[in] slot Notification.
+ *  \return  Record length.
+ **************************************************************************************************/
+static size_t notifyRecord(uint8_t* out, const struct notifySlot* slot)
+{
+  uint8_t* p = out;
+
+  UINT32_TO_BITSTREAM(p, (uint32_t)slot->tsNs);
+  UINT32_TO_BITSTREAM(p, (uint32_t)(slot->tsNs >> 32));
+  UINT16_TO_BITSTREAM(p, slot->characteristic);
+  UINT8_TO_BITSTREAM(p, slot->connection);
+  UINT8_TO_BITSTREAM(p, slot->len);
+  memcpy(p, slot->data, slot->len);
+  return NOTIFY_RECORD_HEADER_LEN + slot->len;
+}
+
+/***********************************************************************************************//**
+ *  \brief  File sink: append a batch of records.
+ *  \param[in] slots Notifications.
+ *  \param[in] count Number of notifications.
+ *  \param[in] ctx File sink state.
+ **************************************************************************************************/
+static void fileSinkWrite(const struct notifySlot* slots, uint32_t count, void* ctx)
+{
+  struct fileSink* sink = ctx;
+  uint8_t record[NOTIFY_RECORD_HEADER_LEN + NOTIFY_SLOT_DATA];
+
+  pthread_mutex_lock(&sink->lock);
+  for (uint32_t i = 0; i < count; i++) {
+    fwrite(record, 1, notifyRecord(record, &slots[i]), sink->fp);
+  }
+  pthread_mutex_unlock(&sink->lock);
+}
+
+/***********************************************************************************************//**
+ *  \brief  File sink: flush and close.
+ *  \param[in] ctx File sink state.
+ **************************************************************************************************/
+static void fileSinkClose(void* ctx)
+{
+  struct fileSink* sink = ctx;
+
+  fclose(sink->fp);
+  pthread_mutex_destroy(&sink->lock);
+  free(sink);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Socket sink: one datagram per notification, never blocking.
+ *  \param[in] slots Notifications.
+ *  \param[in] count Number of notifications.
+ *  \param[in] ctx Socket sink state.
+ **************************************************************************************************/
+static void socketSinkWrite(const struct notifySlot* slots, uint32_t count, void* ctx)
+{
+  struct socketSink* sink = ctx;
+  uint8_t record[NOTIFY_RECORD_HEADER_LEN + NOTIFY_SLOT_DATA];
+
+  for (uint32_t i = 0; i < count; i++) {
+    sendto(sink->fd, record, notifyRecord(record, &slots[i]), MSG_DONTWAIT,
+           (const struct sockaddr*)&sink->addr, sizeof(sink->addr));
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Socket sink: close the socket.
+ *  \param[in] ctx Socket sink state.
+ **************************************************************************************************/
+static void socketSinkClose(void* ctx)
+{
+  struct socketSink* sink = ctx;
+
+  close(sink->fd);
+  free(sink);
+}
@@ -0,0 +1,144 @@
+/***********************************************************************************************//**
+ * \file   notify_pipe.h
+ * \brief  Notification ingestion pipeline: BGAPI thread to consumer threads and sinks
+ ***************************************************************************************************
+ * The event handler copies each notification once into a preallocated ring of fixed-size slots.
+ * Every consumer thread owns one ring, filled by one adapter thread at a time, and hands batches
+ * of slots, in place, to every registered sink. Links are spread over the consumers by connection
+ * identifier, so the notifications of one link are always delivered in order.
+ **************************************************************************************************/
+
+#ifndef NOTIFY_PIPE_H
+#define NOTIFY_PIPE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Slots per consumer ring, a power of two. */
+#define NOTIFY_RING_SLOTS             1024
+
+/** Payload bytes per slot: a full notification at the largest ATT MTU. Longer ones are cut. */
+#define NOTIFY_SLOT_DATA              247
+
+#define NOTIFY_MAX_CONSUMERS          4
+#define NOTIFY_MAX_SINKS              4
+
+/** File sink layout: "NPF1", then per notification the slot header fields and the payload:
+ *  uint64 timestamp (ns) | uint16 characteristic | uint8 connection | uint8 length | data */
+#define NOTIFY_FILE_MAGIC             "NPF1"
+
+/** What the producer does when a consumer ring is full. */
+enum notifyOverflow {
+  NOTIFY_DROP_NEWEST,           /**< discard the incoming notification */
+  NOTIFY_DROP_OLDEST,           /**< discard the oldest notification not yet taken by the consumer */
+  NOTIFY_BLOCK                  /**< wait for room; stalls the BGAPI thread */
+};
+
+/** One notification. */
+struct notifySlot {
+  uint64_t tsNs;                /**< monotonic time the event was handled */
+  uint16_t characteristic;
+  uint8_t connection;
+  uint8_t len;
+  uint8_t data[NOTIFY_SLOT_DATA];
+};
+
+/** Sink callback: count consecutive slots, valid only for the duration of the call. May be
+ *  called from several consumer threads at once when more than one consumer runs. */
+typedef void (*notifySinkFn)(const struct notifySlot* slots, uint32_t count, void* ctx);
+
+/** Pipeline counters. */
+struct notifyPipeStats {
+  uint64_t pushed;              /**< notifications queued */
+  uint64_t delivered;           /**< notifications handed to the sinks */
+  uint64_t droppedNewest;       /**< incoming notifications discarded on a full ring */
+  uint64_t droppedOldest;       /**< queued notifications evicted on a full ring */
+  uint64_t blockedWaits;        /**< times the producer waited for room */
+  uint64_t truncated;           /**< payloads longer than NOTIFY_SLOT_DATA */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Register a callback sink. Call before notifyPipeStart().
+ *  \param[in] fn Callback.
+ *  \param[in] ctx Passed to the callback.
+ *  \return  0 on success, -1 if the sink table is full.
+ **************************************************************************************************/
+int notifyPipeAddSink(notifySinkFn fn, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Register a sink appending every notification to a binary file.
+ *  \param[in] path File, created or truncated.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int notifyPipeAddFileSink(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Register a sink sending every notification as one datagram to a Unix-domain socket,
+ *          in the file sink record layout. Datagrams are dropped while nobody listens.
+ *  \param[in] path Socket path of the listener.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int notifyPipeAddSocketSink(const char* path);
+
+/***********************************************************************************************//**
+ *  \brief  Allocate the rings and start the consumer threads.
+ *  \param[in] consumers Number of consumer threads, 1 to NOTIFY_MAX_CONSUMERS.
+ *  \param[in] policy Overflow policy.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int notifyPipeStart(uint8_t consumers, enum notifyOverflow policy);
+
+/***********************************************************************************************//**
+ *  \brief  Tell whether the pipeline runs.
+ *  \return  true between notifyPipeStart() and notifyPipeStop().
+ **************************************************************************************************/
+bool notifyPipeActive(void);
+
+/***********************************************************************************************//**
+ *  \brief  Queue one notification. Producer side: adapter threads pushing to the same ring take
+ *          turns.
+ *  \param[in] connection Connection identifier, ADAPTER_LINK_ID() of the adapter and handle.
+ *  \param[in] characteristic Characteristic handle.
+ *  \param[in] tsNs Timestamp.
+ *  \param[in] data Payload.
+ *  \param[in] len Payload length.
+ **************************************************************************************************/
+void notifyPipePush(uint8_t connection, uint16_t characteristic, uint64_t tsNs,
+                    const uint8_t* data, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Deliver everything queued, stop the consumers and close the sinks.
+ **************************************************************************************************/
+void notifyPipeStop(void);
+
+/***********************************************************************************************//**
+ *  \brief  Sum the counters of all rings.
+ *  \param[out] stats Counters.
+ **************************************************************************************************/
+void notifyPipeGetStats(struct notifyPipeStats* stats);
+
+/***********************************************************************************************//**
+ *  \brief  Parse an overflow policy name: "block", "drop-oldest" or "drop-newest".
+ *  \param[in] name Policy name.
+ *  \param[out] policy Parsed policy.
+ *  \return  0 on success, -1 if the name is unknown.
+ **************************************************************************************************/
+int notifyParsePolicy(const char* name, enum notifyOverflow* policy);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* NOTIFY_PIPE_H */
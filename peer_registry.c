@@ -0,0 +1,97 @@
+/***********************************************************************************************//**
+ * \file   peer_registry.c
+ * \brief  Peers claimed by the adapters, so that no two adapters connect to the same device
+ ***************************************************************************************************
+ * A small table under one lock: it is touched once per connection attempt and once per closed
+ * link, never per event.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Own header */
+#include "peer_registry.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+struct peerClaim {
+  bd_addr address;
+  uint8_t adapter;
+  bool used;
+};
+
+static struct peerClaim claims[PEER_REGISTRY_SIZE];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static struct peerClaim* peerRegistryLookup(const bd_addr* address);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+bool peerRegistryClaim(const bd_addr* address, uint8_t adapter)
+{
+  struct peerClaim* claim;
+  bool ok = true;
+
+  pthread_mutex_lock(&lock);
+  claim = peerRegistryLookup(address);
+  if (claim != NULL) {
+    ok = claim->adapter == adapter;
+  } else {
+    for (uint32_t i = 0; i < PEER_REGISTRY_SIZE && claim == NULL; i++) {
+      if (!claims[i].used) {
+        claim = &claims[i];
+      }
+    }
+    if (claim == NULL) {
+      ok = false;
+    } else {
+      claim->address = *address;
+      claim->adapter = adapter;
+      claim->used = true;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return ok;
+}
+
+void peerRegistryRelease(const bd_addr* address, uint8_t adapter)
+{
+  struct peerClaim* claim;
+
+  pthread_mutex_lock(&lock);
+  claim = peerRegistryLookup(address);
+  if (claim != NULL && claim->adapter == adapter) {
+    claim->used = false;
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Find the claim on a peer.
+ *  \param[in] address Peer address.
+ *  \return  The claim, NULL if the peer is free.
+ **************************************************************************************************/
+static struct peerClaim* peerRegistryLookup(const bd_addr* address)
+{
+  for (uint32_t i = 0; i < PEER_REGISTRY_SIZE; i++) {
+    if (claims[i].used && !memcmp(&claims[i].address, address, sizeof(bd_addr))) {
+      return &claims[i];
+    }
+  }
+  return NULL;
+}
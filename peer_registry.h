@@ -0,0 +1,53 @@
+/***********************************************************************************************//**
+ * \file   peer_registry.h
+ * \brief  Peers claimed by the adapters, so that no two adapters connect to the same device
+ ***************************************************************************************************
+ * An adapter claims a peer before it opens a connection to it and releases the claim when the
+ * attempt fails or the link closes. A lost peer is claimed again before a direct reconnection,
+ * so another adapter that found it meanwhile by scanning keeps it.
+ **************************************************************************************************/
+
+#ifndef PEER_REGISTRY_H
+#define PEER_REGISTRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Claims held at once: every link and pending attempt of every adapter. */
+#define PEER_REGISTRY_SIZE            64
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Claim a peer for an adapter.
+ *  \param[in] address Peer address.
+ *  \param[in] adapter Index of the claiming adapter.
+ *  \return  true if the peer is now the adapter's, also when it already was; false if another
+ *           adapter holds it or the registry is full.
+ **************************************************************************************************/
+bool peerRegistryClaim(const bd_addr* address, uint8_t adapter);
+
+/***********************************************************************************************//**
+ *  \brief  Release a claim. A peer held by another adapter is left alone.
+ *  \param[in] address Peer address.
+ *  \param[in] adapter Index of the releasing adapter.
+ **************************************************************************************************/
+void peerRegistryRelease(const bd_addr* address, uint8_t adapter);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* PEER_REGISTRY_H */
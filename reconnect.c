@@ -0,0 +1,146 @@
+/***********************************************************************************************//**
+ * \file   reconnect.c
+ * \brief  Direct reconnection to lost peers, with per-peer timeout and backoff
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "infrastructure.h"
+
+#include "adapter.h"
+#include "timer_wheel.h"
+
+/* Own header */
+#include "reconnect.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+static ADAPTER_LOCAL struct reconnectPeer peers[RECONNECT_MAX_PEERS];
+
+static ADAPTER_LOCAL reconnectDueHandler dueHandler = NULL;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void onBackoffTimer(int timerId, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void reconnectInit(reconnectDueHandler onDue)
+{
+  for (uint8_t i = 0; i < RECONNECT_MAX_PEERS; i++) {
+    if (peers[i].used) {
+      reconnectRemove(&peers[i]);
+    }
+  }
+  dueHandler = onDue;
+}
+
+void reconnectAdd(const bd_addr* address, uint8_t addressType, uint64_t lostNs)
+{
+  struct reconnectPeer* peer = reconnectFind(address);
+
+  for (uint8_t i = 0; i < RECONNECT_MAX_PEERS && peer == NULL; i++) {
+    if (!peers[i].used) {
+      peer = &peers[i];
+    }
+  }
+  if (peer == NULL) {
+    peer = &peers[0];
+    for (uint8_t i = 1; i < RECONNECT_MAX_PEERS; i++) {
+      if (peers[i].lostNs < peer->lostNs) {
+        peer = &peers[i];
+      }
+    }
+  }
+  if (peer->used) {
+    reconnectRemove(peer);
+  }
+  peer->address = *address;
+  peer->addressType = addressType;
+  peer->used = true;
+  peer->due = true;
+  peer->attempts = 0;
+  peer->timer = -1;
+  peer->lostNs = lostNs;
+}
+
+struct reconnectPeer* reconnectFind(const bd_addr* address)
+{
+  for (uint8_t i = 0; i < RECONNECT_MAX_PEERS; i++) {
+    if (peers[i].used && !memcmp(&peers[i].address, address, sizeof(bd_addr))) {
+      return &peers[i];
+    }
+  }
+  return NULL;
+}
+
+struct reconnectPeer* reconnectNextDue(void)
+{
+  struct reconnectPeer* next = NULL;
+
+  for (uint8_t i = 0; i < RECONNECT_MAX_PEERS; i++) {
+    if (peers[i].used && peers[i].due && (next == NULL || peers[i].lostNs < next->lostNs)) {
+      next = &peers[i];
+    }
+  }
+  return next;
+}
+
+void reconnectStarted(struct reconnectPeer* peer)
+{
+  peer->due = false;
+}
+
+void reconnectFailed(struct reconnectPeer* peer)
+{
+  uint32_t backoffMs;
+
+  peer->attempts++;
+  peer->due = false;
+  timerWheelCancel(peer->timer);
+  peer->timer = -1;
+  if (peer->attempts >= RECONNECT_MAX_ATTEMPTS) {
+    /* Left to scanning, but still remembered to time the resumption when it is found. */
+    return;
+  }
+  backoffMs = MIN(RECONNECT_BACKOFF_MIN_MS << (peer->attempts - 1), RECONNECT_BACKOFF_MAX_MS);
+  peer->timer = timerWheelAdd(backoffMs, 0, onBackoffTimer, peer);
+}
+
+void reconnectRemove(struct reconnectPeer* peer)
+{
+  timerWheelCancel(peer->timer);
+  peer->timer = -1;
+  peer->used = false;
+  peer->due = false;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Backoff expired: the peer is due for another attempt.
+ *  \param[in] timerId Expired job.
+ *  \param[in] ctx Peer.
+ **************************************************************************************************/
+static void onBackoffTimer(int timerId, void* ctx)
+{
+  struct reconnectPeer* peer = ctx;
+
+  peer->timer = -1;
+  peer->due = true;
+  if (dueHandler != NULL) {
+    dueHandler();
+  }
+}
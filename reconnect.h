@@ -0,0 +1,109 @@
+/***********************************************************************************************//**
+ * \file   reconnect.h
+ * \brief  Direct reconnection to lost peers, with per-peer timeout and backoff
+ ***************************************************************************************************
+ * A peer whose established link closes is remembered with its address. The application opens
+ * a connection to that address straight away instead of waiting for an advertisement found by
+ * scanning; failed attempts are retried after a doubling wait, during which scanning resumes,
+ * and the peer is left to scanning after RECONNECT_MAX_ATTEMPTS failures.
+ **************************************************************************************************/
+
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Lost peers remembered at once; the one lost first is forgotten when full. */
+#define RECONNECT_MAX_PEERS           8
+
+/** Time a direct attempt may take before it is cancelled. */
+#define RECONNECT_TIMEOUT_MS          2000
+
+/** Wait after a failed attempt, doubled on every further failure. */
+#define RECONNECT_BACKOFF_MIN_MS      250
+#define RECONNECT_BACKOFF_MAX_MS      8000
+
+/** Failed attempts after which the peer is left to scanning. */
+#define RECONNECT_MAX_ATTEMPTS        5
+
+/** A lost peer. */
+struct reconnectPeer {
+  bd_addr address;
+  uint8_t addressType;
+  bool used;
+  bool due;                     /**< the backoff has expired, an attempt may start */
+  uint8_t attempts;             /**< failed direct attempts so far */
+  int timer;                    /**< backoff job on the timer wheel, -1 if none */
+  uint64_t lostNs;              /**< time the link was lost */
+};
+
+/***********************************************************************************************//**
+ *  \brief  Called when a peer becomes due for a direct attempt.
+ **************************************************************************************************/
+typedef void (*reconnectDueHandler)(void);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Forget every peer.
+ *  \param[in] onDue Called from the event loop when a backoff expires.
+ **************************************************************************************************/
+void reconnectInit(reconnectDueHandler onDue);
+
+/***********************************************************************************************//**
+ *  \brief  Remember a peer whose link was lost; it is due at once.
+ *  \param[in] address Peer address.
+ *  \param[in] addressType Peer address type.
+ *  \param[in] lostNs Time the link was lost.
+ **************************************************************************************************/
+void reconnectAdd(const bd_addr* address, uint8_t addressType, uint64_t lostNs);
+
+/***********************************************************************************************//**
+ *  \brief  Look up a lost peer.
+ *  \param[in] address Peer address.
+ *  \return  The peer, NULL if it is not waiting for a reconnection.
+ **************************************************************************************************/
+struct reconnectPeer* reconnectFind(const bd_addr* address);
+
+/***********************************************************************************************//**
+ *  \brief  The peer that has been due the longest.
+ *  \return  The peer, NULL if none is due.
+ **************************************************************************************************/
+struct reconnectPeer* reconnectNextDue(void);
+
+/***********************************************************************************************//**
+ *  \brief  A direct attempt is starting: the peer is no longer due.
+ *  \param[in] peer Peer.
+ **************************************************************************************************/
+void reconnectStarted(struct reconnectPeer* peer);
+
+/***********************************************************************************************//**
+ *  \brief  A direct attempt failed: back off, or leave the peer to scanning for good.
+ *  \param[in] peer Peer.
+ **************************************************************************************************/
+void reconnectFailed(struct reconnectPeer* peer);
+
+/***********************************************************************************************//**
+ *  \brief  Forget a peer, once it is connected again.
+ *  \param[in] peer Peer.
+ **************************************************************************************************/
+void reconnectRemove(struct reconnectPeer* peer);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* RECONNECT_H */
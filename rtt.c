@@ -0,0 +1,301 @@
+/***********************************************************************************************//**
+ * \file   rtt.c
+ * \brief  Round-trip latency probes: writes to the RW characteristic echoed back as notifications
+ ***************************************************************************************************
+ * One periodic timer per adapter sends the probes that fell due on every link, at most
+ * RTT_MAX_BURST per link and tick so that a stalled loop does not catch up in a burst. Probes go
+ * through the command queue like any other write; one the NCP refuses for lack of buffers is
+ * counted apart and not awaited. The window slides as probes are sent: a probe still unechoed
+ * RTT_WINDOW probes later is counted lost, and uncounted again should its echo turn up after all.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "adapter.h"
+#include "bgapi_cmd.h"
+#include "event_loop.h"
+#include "metrics.h"
+
+/* Own header */
+#include "rtt.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Probes sent per link and timer tick at most. */
+#define RTT_MAX_BURST                 4
+
+/** ATT write header: opcode and handle. */
+#define ATT_WRITE_HEADER_LEN          3
+
+/** Command context of a probe: its sequence number above the connection handle. */
+#define RTT_CTX(handle, seq)          ((void*)(uintptr_t)(((uint64_t)(seq) << 8) | (handle)))
+
+/** Counters of the calling adapter since rttInit(). */
+struct rttCounters {
+  uint64_t sent;            /**< probes accepted by the NCP */
+  uint64_t refused;         /**< probes refused, NCP buffers full */
+  uint64_t echoed;          /**< probes echoed */
+  uint64_t lost;            /**< probes not echoed within the window, or on a link that closed */
+  uint64_t reordered;       /**< echoes after the echo of a later probe */
+  uint64_t duplicates;      /**< echoes of a probe already echoed */
+};
+
+static ADAPTER_LOCAL uint32_t probeRate = 0;
+static ADAPTER_LOCAL uint16_t probePayload = RTT_DEFAULT_PAYLOAD;
+static ADAPTER_LOCAL const char* profileName = "";
+static ADAPTER_LOCAL uint64_t periodNs = 0;
+static ADAPTER_LOCAL struct rttCounters counters;
+static ADAPTER_LOCAL struct metricsHistogram latency;
+static ADAPTER_LOCAL uint8_t probe[UINT8_MAX];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void rttSend(struct connection* conn);
+static void windowSlide(struct connection* conn, uint32_t seq);
+static bool windowTest(const struct connection* conn, uint32_t seq);
+static void windowSet(struct connection* conn, uint32_t seq);
+static void onProbeResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+static void onProbeTimer(int timerId, void* ctx);
+static void onReportTimer(int timerId, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void rttInit(uint32_t rate, uint16_t payload, const char* profile)
+{
+  probeRate = rate;
+  probePayload = MAX(payload, RTT_HEADER_LEN);
+  profileName = profile;
+  periodNs = NSEC_PER_SEC / rate;
+  memset(&counters, 0, sizeof(counters));
+  memset(&latency, 0, sizeof(latency));
+  evloopAddTimer(MAX(1000 / rate, 1), true, onProbeTimer, NULL);
+  evloopAddTimer(RTT_REPORT_MS, true, onReportTimer, NULL);
+}
+
+void rttStart(struct connection* conn)
+{
+  conn->rttActive = true;
+  conn->rttSent = 0;
+  conn->rttNext = 0;
+  conn->rttBase = 0;
+  memset(conn->rttEchoed, 0, sizeof(conn->rttEchoed));
+  conn->rttDueNs = timeNowNs();
+  printf("RTT --- > handle %d: probing at %u/s with %u-byte writes\r\n", conn->handle, probeRate,
+         MIN(probePayload, conn->mtu - ATT_WRITE_HEADER_LEN));
+}
+
+void rttStop(struct connection* conn)
+{
+  if (!conn->rttActive) {
+    return;
+  }
+  windowSlide(conn, conn->rttSent + RTT_WINDOW);
+  conn->rttActive = false;
+}
+
+bool rttReceive(struct connection* conn, const uint8_t* data, uint8_t len)
+{
+  uint64_t nowNs = timeNowNs();
+  uint64_t sentNs = 0;
+  uint32_t seq;
+
+  if (!conn->rttActive || len < RTT_HEADER_LEN || memcmp(data, RTT_MAGIC, 4) != 0) {
+    return false;
+  }
+  seq = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+  for (uint8_t i = 0; i < 8; i++) {
+    sentNs |= (uint64_t)data[8 + i] << (8 * i);
+  }
+  if (seq >= conn->rttSent || sentNs > nowNs) {
+    return false;
+  }
+
+  if (seq < conn->rttBase) {
+    /* Counted lost when it left the window. */
+    counters.lost--;
+    counters.reordered++;
+  } else if (windowTest(conn, seq)) {
+    counters.duplicates++;
+    return true;
+  } else {
+    windowSet(conn, seq);
+    if (seq < conn->rttNext) {
+      counters.reordered++;
+    } else {
+      conn->rttNext = seq + 1;
+    }
+  }
+  counters.echoed++;
+  metricsObserve(METRICS_RTT_TIME, nowNs - sentNs);
+  metricsHistogramRecord(&latency, nowNs - sentNs);
+  return true;
+}
+
+void rttReport(void)
+{
+  uint8_t links = 0;
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection* conn = connAt(i);
+    if (conn != NULL && conn->rttActive) {
+      links++;
+    }
+  }
+  printf("RTT --- > %s on %u links, %u-byte probes at %u/s: %llu sent, %llu echoed, %llu lost, "
+         "%llu reordered, %llu duplicates, %llu refused; p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, "
+         "max %.3f ms\r\n", profileName, links, probePayload, probeRate,
+         (unsigned long long)counters.sent, (unsigned long long)counters.echoed,
+         (unsigned long long)counters.lost, (unsigned long long)counters.reordered,
+         (unsigned long long)counters.duplicates, (unsigned long long)counters.refused,
+         metricsHistogramQuantileNs(&latency, 0.5) / 1e6, metricsHistogramQuantileNs(&latency, 0.99) / 1e6,
+         metricsHistogramQuantileNs(&latency, 0.999) / 1e6, latency.maxNs / 1e6);
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Queue the next probe of a link, stamped with the current time.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+static void rttSend(struct connection* conn)
+{
+  uint16_t len = MAX(MIN(probePayload, conn->mtu - ATT_WRITE_HEADER_LEN), RTT_HEADER_LEN);
+  uint32_t seq = conn->rttSent;
+  uint64_t nowNs;
+  uint8_t* p = probe + 4;
+
+  windowSlide(conn, seq);
+  memset(probe, 0, len);
+  memcpy(probe, RTT_MAGIC, 4);
+  UINT32_TO_BITSTREAM(p, seq);
+  nowNs = timeNowNs();
+  UINT32_TO_BITSTREAM(p, (uint32_t)nowNs);
+  UINT32_TO_BITSTREAM(p, (uint32_t)(nowNs >> 32));
+  conn->rttSent++;
+  counters.sent++;
+  bgapiCmdGattWriteCharacteristicValueWithoutResponse(conn->handle, conn->rwHandle, len, probe, onProbeResponse,
+                                                      RTT_CTX(conn->handle, seq));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move the window up to hold a sequence number, counting the probes that leave it
+ *          unechoed as lost.
+ *  \param[in] conn Connection context.
+ *  \param[in] seq Sequence number the window must hold.
+ **************************************************************************************************/
+static void windowSlide(struct connection* conn, uint32_t seq)
+{
+  for (; seq >= conn->rttBase + RTT_WINDOW; conn->rttBase++) {
+    uint32_t bit = conn->rttBase % RTT_WINDOW;
+
+    if (conn->rttBase >= conn->rttSent) {
+      /* Nothing left to wait for: jump. */
+      conn->rttBase = seq - RTT_WINDOW + 1;
+      break;
+    }
+    if (!(conn->rttEchoed[bit / 64] & (1ULL << (bit % 64)))) {
+      counters.lost++;
+    }
+    conn->rttEchoed[bit / 64] &= ~(1ULL << (bit % 64));
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Whether a probe in the window was echoed or refused.
+ *  \param[in] conn Connection context.
+ *  \param[in] seq Sequence number, in the window.
+ *  \return  true if it was.
+ **************************************************************************************************/
+static bool windowTest(const struct connection* conn, uint32_t seq)
+{
+  uint32_t bit = seq % RTT_WINDOW;
+
+  return (conn->rttEchoed[bit / 64] & (1ULL << (bit % 64))) != 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Mark a probe in the window as echoed or refused.
+ *  \param[in] conn Connection context.
+ *  \param[in] seq Sequence number, in the window.
+ **************************************************************************************************/
+static void windowSet(struct connection* conn, uint32_t seq)
+{
+  uint32_t bit = seq % RTT_WINDOW;
+
+  conn->rttEchoed[bit / 64] |= 1ULL << (bit % 64);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to a probe: a refused probe never reaches the peer, so stop awaiting it.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx RTT_CTX() of the probe.
+ **************************************************************************************************/
+static void onProbeResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx)
+{
+  struct connection* conn = connGet((uintptr_t)ctx & 0xff);
+  uint32_t seq = (uint32_t)((uintptr_t)ctx >> 8);
+
+  if (result == 0) {
+    return;
+  }
+  counters.sent--;
+  counters.refused++;
+  if (conn != NULL && conn->rttActive && seq >= conn->rttBase && seq < conn->rttSent) {
+    windowSet(conn, seq);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send the probes that fell due on every ready link.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onProbeTimer(int timerId, void* ctx)
+{
+  uint64_t nowNs = timeNowNs();
+
+  for (uint8_t i = 0; i < MAX_CONNECTIONS; i++) {
+    struct connection* conn = connAt(i);
+
+    if (conn == NULL || !conn->rttActive || conn->state != ENABLING_WRITE) {
+      continue;
+    }
+    for (uint8_t n = 0; n < RTT_MAX_BURST && nowNs >= conn->rttDueNs; n++) {
+      rttSend(conn);
+      conn->rttDueNs += periodNs;
+    }
+    if (nowNs >= conn->rttDueNs) {
+      /* Behind by more than a burst: skip rather than catch up. */
+      conn->rttDueNs = nowNs + periodNs;
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Periodic latency report.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onReportTimer(int timerId, void* ctx)
+{
+  rttReport();
+}
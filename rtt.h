@@ -0,0 +1,84 @@
+/***********************************************************************************************//**
+ * \file   rtt.h
+ * \brief  Round-trip latency probes: writes to the RW characteristic echoed back as notifications
+ ***************************************************************************************************
+ * Every ready link is sent probes with write-without-response at a fixed rate. A probe carries a
+ * magic, a per-link sequence number and the host's monotonic send time; the peer is expected to
+ * notify the written value back. The time from queueing the write to handling its echo covers
+ * the host's command queue, the UART both ways, the NCP and two trips over the air.
+ *
+ * Echoes are matched by sequence number against a window of the last RTT_WINDOW probes of each
+ * link: a probe that falls out of the window unechoed is lost, an echo below the highest one
+ * seen is reordered, and a second echo of a probe is a duplicate.
+ **************************************************************************************************/
+
+#ifndef RTT_H
+#define RTT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "connection.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Probe layout: magic, sequence number, send time; the rest of the payload is zero. */
+#define RTT_MAGIC                     "RTP1"
+#define RTT_HEADER_LEN                16
+
+/** Probe payload when none is given, the most a default ATT MTU carries. */
+#define RTT_DEFAULT_PAYLOAD           20
+
+/** Interval between latency reports. */
+#define RTT_REPORT_MS                 5000
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start probing for the calling adapter: clear the counters and start the send and
+ *          report timers. Links join with rttStart().
+ *  \param[in] rate Probes per second on every link.
+ *  \param[in] payload Bytes per probe, RTT_HEADER_LEN or more; capped at ATT MTU - 3 per link.
+ *  \param[in] profile Name of the link profile, for the reports.
+ **************************************************************************************************/
+void rttInit(uint32_t rate, uint16_t payload, const char* profile);
+
+/***********************************************************************************************//**
+ *  \brief  Start sending probes on a ready link.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+void rttStart(struct connection* conn);
+
+/***********************************************************************************************//**
+ *  \brief  Stop probing a link that closed; probes still awaited are lost.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+void rttStop(struct connection* conn);
+
+/***********************************************************************************************//**
+ *  \brief  Match a notification on the notify characteristic to a probe.
+ *  \param[in] conn Connection context.
+ *  \param[in] data Notification value.
+ *  \param[in] len Value length.
+ *  \return  true if it echoed a probe of this link.
+ **************************************************************************************************/
+bool rttReceive(struct connection* conn, const uint8_t* data, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Print the counters and latency quantiles of the calling adapter since rttInit().
+ **************************************************************************************************/
+void rttReport(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* RTT_H */
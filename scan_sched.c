@@ -0,0 +1,131 @@
+/***********************************************************************************************//**
+ * \file   scan_sched.c
+ * \brief  Scan scheduling: scan interval, window and type chosen from how discovery is going
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "infrastructure.h"
+
+#include "adapter.h"
+#include "timeutil.h"
+
+/* Own header */
+#include "scan_sched.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/* The window stays at 10 ms, the stack default; the interval sets the duty. */
+static const struct scanParams levels[SCAN_LEVELS] = {
+  [SCAN_LEVEL_FAST]   = { "fast", 16, 16, 0 },
+  [SCAN_LEVEL_PROBE]  = { "probe", 16, 16, 1 },
+  [SCAN_LEVEL_MEDIUM] = { "medium", 64, 16, 0 },
+  [SCAN_LEVEL_SLOW]   = { "slow", 256, 16, 0 },
+  [SCAN_LEVEL_IDLE]   = { "idle", 1600, 16, 0 },
+};
+
+/** Scanning of one adapter. */
+struct scanSched {
+  bool adaptive;
+  bool activeNeeded;            /**< a target was heard in a scan response */
+  uint8_t level;
+  uint64_t startNs;
+  uint64_t lastHitNs;           /**< last target heard or link lost */
+  uint64_t updateNs;            /**< last scanSchedUpdate() */
+  uint64_t reports;
+  uint64_t matches;
+  uint64_t found;
+  uint64_t foundNs;             /**< sum of the times to find them */
+  uint64_t levelNs[SCAN_LEVELS + 1]; /**< time scanning at each level, the stack defaults last */
+};
+
+static ADAPTER_LOCAL struct scanSched sched;
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void scanSchedInit(bool adaptive, uint64_t nowNs)
+{
+  memset(&sched, 0, sizeof(sched));
+  sched.adaptive = adaptive;
+  sched.level = adaptive ? SCAN_LEVEL_FAST : SCAN_LEVELS;
+  sched.startNs = nowNs;
+  sched.lastHitNs = nowNs;
+  sched.updateNs = nowNs;
+}
+
+void scanSchedHeard(bool match, uint8_t packetType, uint64_t nowNs)
+{
+  sched.reports++;
+  if (!match) {
+    return;
+  }
+  sched.matches++;
+  sched.lastHitNs = nowNs;
+  if (packetType == SCAN_PACKET_SCAN_RESPONSE) {
+    sched.activeNeeded = true;
+  }
+}
+
+void scanSchedFound(uint64_t scanNs)
+{
+  sched.found++;
+  sched.foundNs += scanNs;
+}
+
+void scanSchedLost(uint64_t nowNs)
+{
+  sched.lastHitNs = nowNs;
+}
+
+uint8_t scanSchedUpdate(uint64_t nowNs, bool scanning, uint8_t links, uint8_t maxLinks)
+{
+  uint64_t quietMs;
+
+  if (scanning) {
+    sched.levelNs[sched.level] += nowNs - sched.updateNs;
+  }
+  sched.updateNs = nowNs;
+  if (!sched.adaptive) {
+    return SCAN_LEVELS;
+  }
+  /* Every link held shortens the full-duty time, down to half of it with all links but one. */
+  quietMs = (nowNs - sched.lastHitNs) / NSEC_PER_MSEC * (maxLinks + links) / MAX(maxLinks, 1);
+  /* Probing with scan requests only pays before anything matched: then advertisements suffice. */
+  sched.level = quietMs < SCAN_SCHED_PROBE_MS ? SCAN_LEVEL_FAST
+                : quietMs < SCAN_SCHED_MEDIUM_MS ? (sched.matches == 0 ? SCAN_LEVEL_PROBE : SCAN_LEVEL_FAST)
+                : quietMs < SCAN_SCHED_SLOW_MS ? SCAN_LEVEL_MEDIUM
+                : quietMs < SCAN_SCHED_IDLE_MS ? SCAN_LEVEL_SLOW : SCAN_LEVEL_IDLE;
+  return sched.level;
+}
+
+void scanSchedParams(uint8_t level, struct scanParams* params)
+{
+  *params = levels[level];
+  params->active |= sched.activeNeeded;
+}
+
+void scanSchedReport(void)
+{
+  double seconds = (timeNowNs() - sched.startNs) / 1e9;
+
+  printf("SCAN --- > %s: %llu reports, %.1f/s, %llu matches, %llu targets found avg %.1f ms after scanning "
+         "started; scanning", sched.adaptive ? "adaptive" : "static", (unsigned long long)sched.reports,
+         seconds > 0 ? sched.reports / seconds : 0.0, (unsigned long long)sched.matches,
+         (unsigned long long)sched.found, sched.found ? sched.foundNs / 1e6 / sched.found : 0.0);
+  if (!sched.adaptive) {
+    printf(" %.1f s\r\n", sched.levelNs[SCAN_LEVELS] / 1e9);
+    return;
+  }
+  for (uint8_t i = 0; i < SCAN_LEVELS; i++) {
+    printf("%s %s %.1f s", i ? "," : "", levels[i].name, sched.levelNs[i] / 1e9);
+  }
+  printf("%s\r\n", sched.activeNeeded ? ", active" : "");
+}
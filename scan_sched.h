@@ -0,0 +1,120 @@
+/***********************************************************************************************//**
+ * \file   scan_sched.h
+ * \brief  Scan scheduling: scan interval, window and type chosen from how discovery is going
+ ***************************************************************************************************
+ * Scanning runs at full duty while targets turn up: after startup, after a target was found and
+ * after a link was lost. When nothing matches for a while it backs off in steps to a duty of
+ * about 1%, where the NCP and the host hear few reports. As long as no target was heard at all,
+ * it first tries active scanning, for targets that name their service in scan responses only.
+ * Links held by the adapter count against the full-duty time, since scanning competes with their
+ * connection events for the radio. Once a match is heard on a scan response, every level scans
+ * actively. The stack's default scan parameters equal the fast level, so a scan that finds its
+ * targets quickly behaves as before.
+ **************************************************************************************************/
+
+#ifndef SCAN_SCHED_H
+#define SCAN_SCHED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Interval between scan level updates while scanning. */
+#define SCAN_SCHED_PERIOD_MS          250
+
+/** Quiet time, with nothing found, after which each level takes over. */
+#define SCAN_SCHED_PROBE_MS           2000
+#define SCAN_SCHED_MEDIUM_MS          4000
+#define SCAN_SCHED_SLOW_MS            10000
+#define SCAN_SCHED_IDLE_MS            30000
+
+/** Scan interval and window unit, in microseconds. */
+#define SCAN_SCHED_UNIT_US            625
+
+/** packet_type of a scan report carrying a scan response. */
+#define SCAN_PACKET_SCAN_RESPONSE     4
+
+/** Scan levels, most aggressive first. */
+enum scanLevel {
+  SCAN_LEVEL_FAST,
+  SCAN_LEVEL_PROBE,
+  SCAN_LEVEL_MEDIUM,
+  SCAN_LEVEL_SLOW,
+  SCAN_LEVEL_IDLE,
+  SCAN_LEVELS
+};
+
+/** Scan parameters of a level. */
+struct scanParams {
+  const char* name;
+  uint16_t interval;            /**< in 0.625 ms units */
+  uint16_t window;              /**< in 0.625 ms units */
+  uint8_t active;               /**< 1 to send scan requests, 0 to listen only */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start over at the fast level and clear the counters of the calling adapter.
+ *  \param[in] adaptive false to stay on the stack defaults and only count.
+ *  \param[in] nowNs Current time.
+ **************************************************************************************************/
+void scanSchedInit(bool adaptive, uint64_t nowNs);
+
+/***********************************************************************************************//**
+ *  \brief  Count a scan report.
+ *  \param[in] match The report advertises a target.
+ *  \param[in] packetType packet_type of the report.
+ *  \param[in] nowNs Current time.
+ **************************************************************************************************/
+void scanSchedHeard(bool match, uint8_t packetType, uint64_t nowNs);
+
+/***********************************************************************************************//**
+ *  \brief  A target was picked to connect to.
+ *  \param[in] scanNs Time from the start of scanning to the report.
+ **************************************************************************************************/
+void scanSchedFound(uint64_t scanNs);
+
+/***********************************************************************************************//**
+ *  \brief  A link was lost: its peer is a target missing again.
+ *  \param[in] nowNs Current time.
+ **************************************************************************************************/
+void scanSchedLost(uint64_t nowNs);
+
+/***********************************************************************************************//**
+ *  \brief  Pick the scan level, and account the time since the last update to the previous one.
+ *  \param[in] nowNs Current time.
+ *  \param[in] scanning Discovery ran since the last update.
+ *  \param[in] links Links open on the adapter.
+ *  \param[in] maxLinks Links the adapter may hold.
+ *  \return  The level, SCAN_LEVELS when scanning stays on the stack defaults.
+ **************************************************************************************************/
+uint8_t scanSchedUpdate(uint64_t nowNs, bool scanning, uint8_t links, uint8_t maxLinks);
+
+/***********************************************************************************************//**
+ *  \brief  Scan parameters of a level.
+ *  \param[in] level Level returned by scanSchedUpdate(), other than SCAN_LEVELS.
+ *  \param[out] params Parameters, active set if the targets have been heard in scan responses.
+ **************************************************************************************************/
+void scanSchedParams(uint8_t level, struct scanParams* params);
+
+/***********************************************************************************************//**
+ *  \brief  Print the scan reports heard by the calling adapter, the targets found and the time
+ *          to find them, and the time spent scanning at each level.
+ **************************************************************************************************/
+void scanSchedReport(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SCAN_SCHED_H */
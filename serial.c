@@ -0,0 +1,289 @@
+/***********************************************************************************************//**
+ * \file   serial.c
+ * \brief  POSIX serial port access for the BGAPI link to the NCP
+ ***************************************************************************************************
+ * The port is opened non-blocking so that its descriptor can be watched by the event loop.
+ * Reads take whatever has arrived; callers that must block wait with serialWaitReadable(),
+ * which sleeps in poll() rather than spinning.
+ *
+ * Every read and write is appended to the BGAPI trace while capturing. When a trace is
+ * replayed, the port is not opened: reads come from the trace and writes are dropped.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "adapter.h"
+#include "bgapi_trace.h"
+
+/* Own header */
+#include "serial.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Descriptor of the open serial port. */
+static ADAPTER_LOCAL int serialFd = -1;
+
+/** Blocking read timeout in milliseconds, negative for none. */
+static ADAPTER_LOCAL int serialTimeout = -1;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static speed_t serialBaudToSpeed(uint32_t baudRate);
+static int serialWait(short events);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int32_t serialOpen(const char* port, uint32_t baudRate, uint32_t rtsCts, int32_t timeout)
+{
+  struct termios options;
+  speed_t speed;
+
+  if (bgapiTraceReplaying()) {
+    serialFd = bgapiTraceReplayStart();
+    serialTimeout = timeout;
+    return serialFd < 0 ? -1 : 0;
+  }
+
+  speed = serialBaudToSpeed(baudRate);
+  if (speed == B0) {
+    printf("Baud rate not supported %s - %u\n", port, baudRate);
+    return -1;
+  }
+
+  serialFd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (serialFd < 0) {
+    printf("Error opening serial port %s - %s(%d).\n", port, strerror(errno), errno);
+    return -1;
+  }
+
+  if (tcgetattr(serialFd, &options) < 0) {
+    printf("Error reading serial port attributes %s - %s(%d).\n", port, strerror(errno), errno);
+    serialClose();
+    return -1;
+  }
+
+  /* Raw 8N1, no echo, no signals, no software flow control. */
+  cfmakeraw(&options);
+  options.c_cflag |= (CLOCAL | CREAD);
+  options.c_cflag &= ~CSTOPB;
+#ifdef CRTSCTS
+  if (rtsCts) {
+    options.c_cflag |= CRTSCTS;
+  } else {
+    options.c_cflag &= ~CRTSCTS;
+  }
+#endif
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+
+  if (tcsetattr(serialFd, TCSANOW, &options) < 0) {
+    printf("Error configuring serial port %s - %s(%d).\n", port, strerror(errno), errno);
+    serialClose();
+    return -1;
+  }
+  tcflush(serialFd, TCIOFLUSH);
+
+  serialTimeout = timeout;
+  return 0;
+}
+
+int32_t serialClose(void)
+{
+  int ret = 0;
+
+  if (bgapiTraceReplaying()) {
+    bgapiTraceReplayStop();
+    serialFd = -1;
+  }
+  if (serialFd >= 0) {
+    ret = close(serialFd);
+    serialFd = -1;
+  }
+  return ret;
+}
+
+int32_t serialRead(uint8_t* data, uint32_t maxLength)
+{
+  ssize_t ret;
+
+  if (bgapiTraceReplaying()) {
+    return bgapiTraceReplayRead(data, maxLength);
+  }
+  do {
+    ret = read(serialFd, data, maxLength);
+  } while (ret < 0 && errno == EINTR);
+
+  /* With VMIN and VTIME 0 a terminal returns 0 rather than EAGAIN when nothing is pending; a
+   * hangup shows as an error (EIO) or as POLLHUP. */
+  if (ret > 0) {
+    bgapiTraceCapture(BGAPI_TRACE_RX, data, ret);
+  }
+  if (ret >= 0) {
+    return ret;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return 0;
+  }
+  return -1;
+}
+
+int32_t serialWaitReadable(void)
+{
+  if (bgapiTraceReplaying()) {
+    return bgapiTraceReplayWait();
+  }
+  return serialWait(POLLIN);
+}
+
+int32_t serialWrite(const uint8_t* data, uint32_t length)
+{
+  ssize_t ret;
+
+  if (bgapiTraceReplaying()) {
+    return length;
+  }
+  do {
+    ret = write(serialFd, data, length);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret > 0) {
+    bgapiTraceCapture(BGAPI_TRACE_TX, data, ret);
+  }
+  if (ret >= 0) {
+    return ret;
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK) {
+    return 0;
+  }
+  return -1;
+}
+
+int32_t serialTx(uint32_t dataLength, const uint8_t* data)
+{
+  uint32_t sent = 0;
+  ssize_t ret;
+
+  if (bgapiTraceReplaying()) {
+    return dataLength;
+  }
+  while (sent < dataLength) {
+    ret = write(serialFd, data + sent, dataLength - sent);
+    if (ret > 0) {
+      bgapiTraceCapture(BGAPI_TRACE_TX, data + sent, ret);
+      sent += ret;
+      continue;
+    }
+    if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      return -1;
+    }
+    if (serialWait(POLLOUT) <= 0) {
+      return -1;
+    }
+  }
+  return sent;
+}
+
+int32_t serialSetBaudRate(uint32_t baudRate)
+{
+  struct termios options;
+  speed_t speed;
+
+  if (bgapiTraceReplaying()) {
+    return 0;
+  }
+  speed = serialBaudToSpeed(baudRate);
+  if (speed == B0 || tcgetattr(serialFd, &options) < 0) {
+    return -1;
+  }
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+  /* What was written leaves at the old rate; what arrived at it can only be garbled. */
+  if (tcsetattr(serialFd, TCSADRAIN, &options) < 0) {
+    return -1;
+  }
+  tcflush(serialFd, TCIFLUSH);
+  return 0;
+}
+
+bool serialBaudRateSupported(uint32_t baudRate)
+{
+  return serialBaudToSpeed(baudRate) != B0;
+}
+
+int serialGetFd(void)
+{
+  return serialFd;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map a numeric baud rate to the termios speed constant.
+ *  \param[in] baudRate Baud rate in bits per second.
+ *  \return  Matching speed_t value, B0 if the rate is not supported.
+ **************************************************************************************************/
+static speed_t serialBaudToSpeed(uint32_t baudRate)
+{
+  switch (baudRate) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    default:      return B0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Wait until the port is readable or writable.
+ *  \param[in] events POLLIN or POLLOUT.
+ *  \return  1 when ready, 0 on timeout, -1 on error.
+ **************************************************************************************************/
+static int serialWait(short events)
+{
+  struct pollfd pfd;
+  int ret;
+
+  pfd.fd = serialFd;
+  pfd.events = events;
+  do {
+    ret = poll(&pfd, 1, serialTimeout);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret > 0 && (pfd.revents & (POLLERR | POLLNVAL))) {
+    return -1;
+  }
+  return ret;
+}
@@ -0,0 +1,92 @@
+/***********************************************************************************************//**
+ * \file   serial.h
+ * \brief  POSIX serial port access for the BGAPI link to the NCP
+ **************************************************************************************************/
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Open and configure the serial port in raw, non-blocking mode.
+ *  \param[in] port Device path of the serial port.
+ *  \param[in] baudRate Baud rate to configure.
+ *  \param[in] rtsCts 1 to enable RTS/CTS hardware flow control, 0 to disable it.
+ *  \param[in] timeout Time in milliseconds a blocking read waits for data before failing,
+ *             or a negative value to wait forever.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int32_t serialOpen(const char* port, uint32_t baudRate, uint32_t rtsCts, int32_t timeout);
+
+/***********************************************************************************************//**
+ *  \brief  Close the serial port.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int32_t serialClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Read whatever has arrived, up to maxLength bytes, without blocking.
+ *  \param[out] data Destination buffer.
+ *  \param[in] maxLength Size of data.
+ *  \return  Number of bytes read, 0 if nothing is pending, -1 on failure or hangup.
+ **************************************************************************************************/
+int32_t serialRead(uint8_t* data, uint32_t maxLength);
+
+/***********************************************************************************************//**
+ *  \brief  Wait until received data is pending, at most the timeout given to serialOpen().
+ *  \return  1 when readable, 0 on timeout, -1 on failure.
+ **************************************************************************************************/
+int32_t serialWaitReadable(void);
+
+/***********************************************************************************************//**
+ *  \brief  Write as many of the given bytes as the driver takes, without blocking.
+ *  \param[in] data Bytes to write.
+ *  \param[in] length Number of bytes.
+ *  \return  Number of bytes written, 0 if the driver is full, -1 on failure.
+ **************************************************************************************************/
+int32_t serialWrite(const uint8_t* data, uint32_t length);
+
+/***********************************************************************************************//**
+ *  \brief  Write all of the given bytes to the serial port.
+ *  \param[in] dataLength Number of bytes to write.
+ *  \param[in] data Bytes to write.
+ *  \return  Number of bytes written on success, -1 on failure.
+ **************************************************************************************************/
+int32_t serialTx(uint32_t dataLength, const uint8_t* data);
+
+/***********************************************************************************************//**
+ *  \brief  Change the baud rate of the open port, once everything written has left; bytes
+ *          received and not yet read are dropped.
+ *  \param[in] baudRate Baud rate to configure.
+ *  \return  0 on success, -1 if the rate is not supported or the port refused it.
+ **************************************************************************************************/
+int32_t serialSetBaudRate(uint32_t baudRate);
+
+/***********************************************************************************************//**
+ *  \brief  Tell whether serialOpen() and serialSetBaudRate() accept a baud rate.
+ *  \param[in] baudRate Baud rate.
+ *  \return  true if the rate maps to a termios speed on this system.
+ **************************************************************************************************/
+bool serialBaudRateSupported(uint32_t baudRate);
+
+/***********************************************************************************************//**
+ *  \brief  File descriptor of the open port, for registering it with an event loop.
+ *  \return  The descriptor, -1 if the port is not open.
+ **************************************************************************************************/
+int serialGetFd(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SERIAL_H */
@@ -0,0 +1,87 @@
+/***********************************************************************************************//**
+ * \file   shm_export.c
+ * \brief  Live export of notifications and matched scan reports to a shared memory ring
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "infrastructure.h"
+
+#include "adapter.h"
+#include "shm_ring.h"
+
+/* Own header */
+#include "shm_export.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Segment of the adapter, header NULL when not exporting. */
+static ADAPTER_LOCAL struct shmRingWriter writer;
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int shmExportOpen(const char* name)
+{
+  uint8_t index = adapterCurrent()->index;
+  char segment[64];
+
+  if (index == 0) {
+    snprintf(segment, sizeof(segment), "%s", name);
+  } else {
+    snprintf(segment, sizeof(segment), "%s.%u", name, index);
+  }
+  return shmRingCreate(&writer, segment, index);
+}
+
+bool shmExportActive(void)
+{
+  return writer.header != NULL;
+}
+
+void shmExportNotify(uint8_t connection, uint16_t characteristic, const bd_addr* address, uint64_t tsNs,
+                     const uint8_t* data, uint8_t len)
+{
+  struct shmRecord* record = shmRingBegin(&writer);
+
+  record->tsNs = tsNs;
+  record->type = SHM_RECORD_NOTIFY;
+  record->connection = connection;
+  record->characteristic = characteristic;
+  record->rssi = 0;
+  record->packetType = 0;
+  record->addressType = 0;
+  record->len = len;
+  memcpy(record->address, address->addr, sizeof(record->address));
+  memcpy(record->data, data, record->len);
+  shmRingCommit(&writer);
+}
+
+void shmExportScan(const struct gecko_msg_le_gap_scan_response_evt_t* report, uint64_t tsNs)
+{
+  struct shmRecord* record = shmRingBegin(&writer);
+
+  record->tsNs = tsNs;
+  record->type = SHM_RECORD_SCAN;
+  record->connection = 0;
+  record->characteristic = 0;
+  record->rssi = report->rssi;
+  record->packetType = report->packet_type;
+  record->addressType = report->address_type;
+  record->len = report->data.len;
+  memcpy(record->address, report->address.addr, sizeof(record->address));
+  memcpy(record->data, report->data.data, record->len);
+  shmRingCommit(&writer);
+}
+
+void shmExportClose(void)
+{
+  shmRingDestroy(&writer);
+}
@@ -0,0 +1,69 @@
+/***********************************************************************************************//**
+ * \file   shm_export.h
+ * \brief  Live export of notifications and matched scan reports to a shared memory ring
+ ***************************************************************************************************
+ * Every adapter writes a segment of its own, so that each ring keeps a single writer: adapter 0
+ * the segment of the given name, the others the name followed by ".<index>". Records are written
+ * from the event handler, in place, and no reader can hold the writer back: a reader too slow
+ * for the traffic loses the oldest records, and learns how many.
+ **************************************************************************************************/
+
+#ifndef SHM_EXPORT_H
+#define SHM_EXPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bg_types.h"
+#include "gecko_bglib.h"
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Create the segment of the calling adapter.
+ *  \param[in] name Segment name of adapter 0.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int shmExportOpen(const char* name);
+
+/***********************************************************************************************//**
+ *  \brief  Tell whether the calling adapter exports.
+ *  \return  true between shmExportOpen() and shmExportClose().
+ **************************************************************************************************/
+bool shmExportActive(void);
+
+/***********************************************************************************************//**
+ *  \brief  Publish a characteristic value, notified or read.
+ *  \param[in] connection Connection identifier, ADAPTER_LINK_ID() of the adapter and handle.
+ *  \param[in] characteristic Characteristic handle.
+ *  \param[in] address Peer address.
+ *  \param[in] tsNs Timestamp.
+ *  \param[in] data Value.
+ *  \param[in] len Value length.
+ **************************************************************************************************/
+void shmExportNotify(uint8_t connection, uint16_t characteristic, const bd_addr* address, uint64_t tsNs,
+                     const uint8_t* data, uint8_t len);
+
+/***********************************************************************************************//**
+ *  \brief  Publish a scan report.
+ *  \param[in] report The report.
+ *  \param[in] tsNs Timestamp.
+ **************************************************************************************************/
+void shmExportScan(const struct gecko_msg_le_gap_scan_response_evt_t* report, uint64_t tsNs);
+
+/***********************************************************************************************//**
+ *  \brief  Close and remove the segment of the calling adapter; readers see it closed.
+ **************************************************************************************************/
+void shmExportClose(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SHM_EXPORT_H */
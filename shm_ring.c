@@ -0,0 +1,206 @@
+/***********************************************************************************************//**
+ * \file   shm_ring.c
+ * \brief  Single-writer, multi-reader ring of fixed-layout records in a shared memory segment
+ ***************************************************************************************************
+ * The segment is opened as a plain file under /dev/shm rather than through shm_open(), which
+ * would need -lrt on older C libraries; the result is the same tmpfs mapping. Nothing here
+ * depends on the rest of the host, so readers link this file alone.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeutil.h"
+
+/* Own header */
+#include "shm_ring.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Bytes of a segment. */
+#define SHM_RING_SIZE                 (sizeof(struct shmRingHeader) + SHM_RING_SLOTS * sizeof(struct shmRecord))
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void* mapSegment(const char* name, bool create, char* path, size_t pathSize);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int shmRingCreate(struct shmRingWriter* w, const char* name, uint8_t adapter)
+{
+  void* map;
+
+  memset(w, 0, sizeof(*w));
+  map = mapSegment(name, true, w->path, sizeof(w->path));
+  if (map == NULL) {
+    return -1;
+  }
+  w->header = map;
+  w->records = (struct shmRecord*)((uint8_t*)map + sizeof(struct shmRingHeader));
+  /* A fresh tmpfs file reads as zeros: every slot starts with seq 0, which no record ever has. */
+  w->header->recordSize = sizeof(struct shmRecord);
+  w->header->headerSize = sizeof(struct shmRingHeader);
+  w->header->slots = SHM_RING_SLOTS;
+  w->header->startNs = timeNowNs();
+  w->header->writerPid = getpid();
+  w->header->adapter = adapter;
+  __atomic_store_n(&w->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+  return 0;
+}
+
+struct shmRecord* shmRingBegin(struct shmRingWriter* w)
+{
+  uint64_t n = w->header->head;
+  struct shmRecord* record = &w->records[n & (SHM_RING_SLOTS - 1)];
+
+  /* Readers that see the odd word drop the slot; the fence keeps the fields written next from
+   * becoming visible before it. */
+  __atomic_store_n(&record->seq, 2 * n + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return record;
+}
+
+void shmRingCommit(struct shmRingWriter* w)
+{
+  uint64_t n = w->header->head;
+
+  __atomic_store_n(&w->records[n & (SHM_RING_SLOTS - 1)].seq, 2 * n + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&w->header->head, n + 1, __ATOMIC_RELEASE);
+}
+
+void shmRingDestroy(struct shmRingWriter* w)
+{
+  if (w->header == NULL) {
+    return;
+  }
+  __atomic_or_fetch(&w->header->flags, SHM_RING_CLOSED, __ATOMIC_RELEASE);
+  munmap(w->header, SHM_RING_SIZE);
+  unlink(w->path);
+  w->header = NULL;
+  w->records = NULL;
+}
+
+int shmRingOpen(struct shmRingReader* r, const char* name)
+{
+  const struct shmRingHeader* header;
+
+  memset(r, 0, sizeof(*r));
+  header = mapSegment(name, false, NULL, 0);
+  if (header == NULL) {
+    return -1;
+  }
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC
+      || header->recordSize != sizeof(struct shmRecord)
+      || header->headerSize != sizeof(struct shmRingHeader)
+      || header->slots != SHM_RING_SLOTS) {
+    munmap((void*)header, SHM_RING_SIZE);
+    return -1;
+  }
+  r->header = header;
+  r->records = (const struct shmRecord*)((const uint8_t*)header + sizeof(struct shmRingHeader));
+  r->next = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  return 0;
+}
+
+int shmRingRead(struct shmRingReader* r, struct shmRecord* record)
+{
+  const struct shmRecord* slot;
+  uint64_t head;
+  uint64_t seq;
+
+  for (;;) {
+    head = __atomic_load_n(&r->header->head, __ATOMIC_ACQUIRE);
+    if (r->next == head) {
+      return (__atomic_load_n(&r->header->flags, __ATOMIC_ACQUIRE) & SHM_RING_CLOSED) ? -1 : 0;
+    }
+    if (head - r->next > SHM_RING_SLOTS) {
+      r->lost += head - r->next - SHM_RING_SLOTS;
+      r->next = head - SHM_RING_SLOTS;
+    }
+    slot = &r->records[r->next & (SHM_RING_SLOTS - 1)];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == 2 * r->next + 2) {
+      memcpy(record, slot, sizeof(*record));
+      /* The copy must be complete before the second look at the sequence word. */
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+        record->seq = r->next++;
+        return 1;
+      }
+    }
+    /* Overwritten before or while it was copied: the writer is a lap ahead. */
+    r->lost++;
+    r->next++;
+  }
+}
+
+void shmRingClose(struct shmRingReader* r)
+{
+  if (r->header != NULL) {
+    munmap((void*)r->header, SHM_RING_SIZE);
+  }
+  r->header = NULL;
+  r->records = NULL;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+static void* mapSegment(const char* name, bool create, char* path, size_t pathSize)
+{
+  char buf[128];
+  struct stat st;
+  void* map;
+  int fd;
+
+  if (path == NULL) {
+    path = buf;
+    pathSize = sizeof(buf);
+  }
+  if (strchr(name, '/') != NULL || snprintf(path, pathSize, SHM_RING_DIR "%s", name) >= (int)pathSize) {
+    return NULL;
+  }
+  if (create) {
+    /* Readers still attached to an older segment of the name keep it; new ones get this one. */
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0 && ftruncate(fd, SHM_RING_SIZE) < 0) {
+      close(fd);
+      unlink(path);
+      return NULL;
+    }
+  } else {
+    fd = open(path, O_RDONLY);
+    /* A segment cut short would fault on access rather than fail here. */
+    if (fd >= 0 && (fstat(fd, &st) < 0 || (size_t)st.st_size < SHM_RING_SIZE)) {
+      close(fd);
+      return NULL;
+    }
+  }
+  if (fd < 0) {
+    return NULL;
+  }
+  map = mmap(NULL, SHM_RING_SIZE, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    if (create) {
+      unlink(path);
+    }
+    return NULL;
+  }
+  return map;
+}
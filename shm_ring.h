@@ -0,0 +1,158 @@
+/***********************************************************************************************//**
+ * \file   shm_ring.h
+ * \brief  Single-writer, multi-reader ring of fixed-layout records in a shared memory segment
+ ***************************************************************************************************
+ * The segment is a file under /dev/shm: a header, then SHM_RING_SLOTS records. The writer numbers
+ * its records from 0 and puts record n in slot n % SHM_RING_SLOTS. Each slot carries a sequence
+ * word, odd while the writer fills the slot and 2n + 2 once record n is complete, and the header
+ * holds the number of records published. Readers take no lock and write nothing to the segment:
+ * they copy a record between two reads of its sequence word and keep it only if the word was
+ * 2n + 2 both times. A reader that falls more than a ring behind, or whose slot was reused while
+ * it copied, counts the records it missed and carries on with the oldest one still there.
+ *
+ * This header and shm_ring.c are the whole reader library: a reader opens the segment by name,
+ * then calls shmRingRead() until it returns 0, as often as it likes.
+ **************************************************************************************************/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Directory of the segments. */
+#define SHM_RING_DIR                  "/dev/shm/"
+
+/** "SRB1", first word of every segment. */
+#define SHM_RING_MAGIC                0x31425253u
+
+/** Records per segment, a power of two. */
+#define SHM_RING_SLOTS                4096
+
+/** Payload bytes per record: a notification at the largest ATT MTU, or extended advertising data. */
+#define SHM_RECORD_DATA               256
+
+/** Record types. */
+#define SHM_RECORD_NOTIFY             1   /**< a characteristic value notified or read */
+#define SHM_RECORD_SCAN               2   /**< a scan report that matched a target */
+
+/** Header flags. */
+#define SHM_RING_CLOSED               0x01 /**< the writer is gone; nothing will follow */
+
+/** Segment header. The writer's position has a cache line of its own. */
+struct shmRingHeader {
+  uint32_t magic;
+  uint16_t recordSize;          /**< sizeof(struct shmRecord) */
+  uint16_t headerSize;          /**< sizeof(struct shmRingHeader), offset of the first record */
+  uint32_t slots;
+  uint32_t flags;
+  uint64_t startNs;             /**< CLOCK_MONOTONIC time the segment was created */
+  int32_t writerPid;
+  uint8_t adapter;              /**< adapter of the writer */
+  uint8_t reserved[35];
+  uint64_t head;                /**< records published */
+  uint8_t pad[56];
+};
+
+/** One record. Timestamps are CLOCK_MONOTONIC, comparable with timeNowNs() of any process. */
+struct shmRecord {
+  uint64_t seq;                 /**< odd while written, 2n + 2 once record n is complete */
+  uint64_t tsNs;                /**< time the event was handled */
+  uint8_t type;                 /**< SHM_RECORD_NOTIFY or SHM_RECORD_SCAN */
+  uint8_t connection;           /**< notification: ADAPTER_LINK_ID() of the link */
+  uint16_t characteristic;      /**< notification: characteristic handle */
+  int8_t rssi;                  /**< scan: signal strength */
+  uint8_t packetType;           /**< scan: packet_type of the report */
+  uint8_t addressType;
+  uint8_t len;                  /**< bytes used in data */
+  uint8_t address[6];           /**< scan: advertiser, notification: peer */
+  uint8_t reserved[2];
+  uint8_t data[SHM_RECORD_DATA];
+};
+
+/** Writer side of a segment. */
+struct shmRingWriter {
+  struct shmRingHeader* header;
+  struct shmRecord* records;
+  char path[128];
+};
+
+/** Reader side of a segment. */
+struct shmRingReader {
+  const struct shmRingHeader* header;
+  const struct shmRecord* records;
+  uint64_t next;                /**< number of the next record to read */
+  uint64_t lost;                /**< records overwritten before they were read */
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Create a segment, replacing any of the same name.
+ *  \param[out] w Writer.
+ *  \param[in] name Segment name, a file under SHM_RING_DIR.
+ *  \param[in] adapter Adapter index of the writer.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int shmRingCreate(struct shmRingWriter* w, const char* name, uint8_t adapter);
+
+/***********************************************************************************************//**
+ *  \brief  Start the next record: its slot, marked as being written. Its fields are all stale
+ *          but seq; fill them, then call shmRingCommit().
+ *  \param[in] w Writer.
+ *  \return  The record.
+ **************************************************************************************************/
+struct shmRecord* shmRingBegin(struct shmRingWriter* w);
+
+/***********************************************************************************************//**
+ *  \brief  Publish the record started by shmRingBegin().
+ *  \param[in] w Writer.
+ **************************************************************************************************/
+void shmRingCommit(struct shmRingWriter* w);
+
+/***********************************************************************************************//**
+ *  \brief  Mark the segment closed, unmap and remove it. Readers keep their mapping.
+ *  \param[in] w Writer.
+ **************************************************************************************************/
+void shmRingDestroy(struct shmRingWriter* w);
+
+/***********************************************************************************************//**
+ *  \brief  Attach to a segment, at its newest record: only records published from now on are
+ *          read.
+ *  \param[out] r Reader.
+ *  \param[in] name Segment name, a file under SHM_RING_DIR.
+ *  \return  0 on success, -1 if there is no such segment or it is not a ring of this layout.
+ **************************************************************************************************/
+int shmRingOpen(struct shmRingReader* r, const char* name);
+
+/***********************************************************************************************//**
+ *  \brief  Copy the next record.
+ *  \param[in] r Reader; r->lost grows by the records missed on the way.
+ *  \param[out] record The record, data valid up to len, seq replaced by the record number.
+ *  \return  1 if a record was copied, 0 if there is none yet, -1 if there is none and the
+ *           writer closed the segment.
+ **************************************************************************************************/
+int shmRingRead(struct shmRingReader* r, struct shmRecord* record);
+
+/***********************************************************************************************//**
+ *  \brief  Detach from a segment.
+ *  \param[in] r Reader.
+ **************************************************************************************************/
+void shmRingClose(struct shmRingReader* r);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* SHM_RING_H */
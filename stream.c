@@ -0,0 +1,203 @@
+/***********************************************************************************************//**
+ * \file   stream.c
+ * \brief  Bulk write streaming to the RW characteristic with write-without-response
+ ***************************************************************************************************
+ * Writes go through the command queue one at a time, each response sending the next, so that
+ * the event loop keeps running while streaming. A write the NCP refuses for lack of buffers is
+ * sent again after a short, doubling wait. The last chunk is sent as an acknowledged write: ATT
+ * keeps the order of writes on a bearer, so its completion means every earlier write reached
+ * the peer.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "adapter.h"
+#include "bgapi_cmd.h"
+#include "event_loop.h"
+
+/* Own header */
+#include "stream.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Wait after a full NCP buffer, doubled on every consecutive refusal. */
+#define STREAM_BACKOFF_MIN_MS         1
+#define STREAM_BACKOFF_MAX_MS         16
+
+/** ATT write header: opcode and handle. */
+#define ATT_WRITE_HEADER_LEN          3
+
+/** Context of a write: the link and the write's number, so that a response to a write of an
+ *  earlier stream or link is told apart. */
+#define STREAM_CTX(handle, write)     ((void*)(uintptr_t)(((uint64_t)(write) << 8) | (handle)))
+
+static ADAPTER_LOCAL uint8_t streamData[STREAM_MAX_MTU];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void streamPump(struct connection* conn);
+static void onWriteResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+static void streamSchedule(struct connection* conn, uint32_t delayMs);
+static void onStreamTimer(int timerId, void* ctx);
+static void streamReport(const struct connection* conn, const char* outcome);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+void streamStart(struct connection* conn, uint32_t totalBytes, uint16_t payload)
+{
+  connSetState(conn, STREAMING);
+  conn->streamLeft = totalBytes;
+  conn->streamPayload = MIN(payload ? payload : conn->mtu - ATT_WRITE_HEADER_LEN,
+                            conn->mtu - ATT_WRITE_HEADER_LEN);
+  conn->streamBackoffMs = STREAM_BACKOFF_MIN_MS;
+  conn->streamBytes = 0;
+  conn->streamWrites = 0;
+  conn->streamRetries = 0;
+  conn->streamErrors = 0;
+  conn->streamStartNs = timeNowNs();
+  printf("STREAM --- > handle %d: sending %u bytes in writes of %u bytes (MTU %u)\r\n",
+         conn->handle, totalBytes, conn->streamPayload, conn->mtu);
+  streamPump(conn);
+}
+
+void streamCompleted(struct connection* conn, uint16_t result)
+{
+  if (result != 0) {
+    conn->streamErrors++;
+  }
+  streamReport(conn, result == 0 ? "done" : "final write failed");
+  connSetState(conn, WRITE_ENABLED);
+}
+
+void streamStop(struct connection* conn)
+{
+  evloopRemoveTimer(conn->streamTimer);
+  conn->streamTimer = -1;
+  if (conn->state == STREAMING || conn->state == STREAM_DRAINING) {
+    streamReport(conn, "aborted");
+    connSetState(conn, WRITE_ENABLED);
+  }
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Queue the next write; its response sends the one after.
+ *  \param[in] conn Connection context in state STREAMING.
+ **************************************************************************************************/
+static void streamPump(struct connection* conn)
+{
+  uint16_t len = MIN(conn->streamPayload, conn->streamLeft);
+  uint8_t* p = streamData;
+  void* ctx = STREAM_CTX(conn->handle, conn->streamWrites);
+
+  /* Number every write so that the peer can detect losses. */
+  UINT32_TO_BITSTREAM(p, (uint32_t)conn->streamWrites);
+  if (len == conn->streamLeft) {
+    bgapiCmdGattWriteCharacteristicValue(conn->handle, conn->rwHandle, len, streamData, onWriteResponse, ctx);
+  } else {
+    bgapiCmdGattWriteCharacteristicValueWithoutResponse(conn->handle, conn->rwHandle, len, streamData,
+                                                        onWriteResponse, ctx);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to a streamed write: count it and send the next, or back off while the NCP
+ *          is out of buffers.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp The response.
+ *  \param[in] ctx STREAM_CTX() of the write.
+ **************************************************************************************************/
+static void onWriteResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx)
+{
+  struct connection* conn = connGet((uintptr_t)ctx & 0xff);
+  uint16_t sent;
+
+  if (conn == NULL || conn->state != STREAMING || ctx != STREAM_CTX(conn->handle, conn->streamWrites)) {
+    return;
+  }
+  if (result == bg_err_out_of_memory) {
+    conn->streamRetries++;
+    streamSchedule(conn, conn->streamBackoffMs);
+    conn->streamBackoffMs = MIN(conn->streamBackoffMs * 2, STREAM_BACKOFF_MAX_MS);
+    return;
+  }
+  if (result != 0) {
+    conn->streamErrors++;
+    printf("Error!!! Stream write failed on handle %d, error code = 0x%04x\r\n", conn->handle, result);
+    streamStop(conn);
+    return;
+  }
+  /* Only the last write is acknowledged, and it carries what is left. */
+  sent = conn->streamLeft <= conn->streamPayload
+         ? conn->streamLeft : rsp->data.rsp_gatt_write_characteristic_value_without_response.sent_len;
+  conn->streamBackoffMs = STREAM_BACKOFF_MIN_MS;
+  conn->streamWrites++;
+  conn->streamBytes += sent;
+  conn->streamLeft -= MIN(sent, conn->streamLeft);
+  if (conn->streamLeft == 0) {
+    /* The acknowledged write went out; its procedure completed event ends the stream. */
+    connSetState(conn, STREAM_DRAINING);
+    return;
+  }
+  streamPump(conn);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Resume the stream after a delay.
+ *  \param[in] conn Connection context.
+ *  \param[in] delayMs Delay, 0 for the next event loop pass.
+ **************************************************************************************************/
+static void streamSchedule(struct connection* conn, uint32_t delayMs)
+{
+  conn->streamTimer = evloopAddTimer(delayMs, false, onStreamTimer, conn);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Pacing timer expired: continue streaming.
+ *  \param[in] timerId Expired timer.
+ *  \param[in] ctx Connection context.
+ **************************************************************************************************/
+static void onStreamTimer(int timerId, void* ctx)
+{
+  struct connection* conn = ctx;
+
+  conn->streamTimer = -1;
+  if (conn->state == STREAMING) {
+    streamPump(conn);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Print the goodput and write counters of a stream.
+ *  \param[in] conn Connection context.
+ *  \param[in] outcome How the stream ended.
+ **************************************************************************************************/
+static void streamReport(const struct connection* conn, const char* outcome)
+{
+  double seconds = (timeNowNs() - conn->streamStartNs) / 1e9;
+
+  printf("STREAM --- > handle %d %s: %llu bytes in %.3f s, goodput %.1f kB/s; %llu writes of %u bytes, "
+         "%llu retried (NCP buffers full), %llu failed\r\n",
+         conn->handle, outcome, (unsigned long long)conn->streamBytes, seconds,
+         seconds > 0 ? conn->streamBytes / seconds / 1000 : 0.0,
+         (unsigned long long)conn->streamWrites, conn->streamPayload,
+         (unsigned long long)conn->streamRetries, (unsigned long long)conn->streamErrors);
+}
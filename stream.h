@@ -0,0 +1,53 @@
+/***********************************************************************************************//**
+ * \file   stream.h
+ * \brief  Bulk write streaming to the RW characteristic with write-without-response
+ **************************************************************************************************/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "connection.h"
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** ATT MTU requested from the stack when streaming, the largest the 2.x stack accepts. */
+#define STREAM_MAX_MTU                250
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Start streaming on a link whose handles are known.
+ *  \param[in] conn Connection context.
+ *  \param[in] totalBytes Bytes to send.
+ *  \param[in] payload Bytes per write, 0 to fill every packet (ATT MTU - 3).
+ **************************************************************************************************/
+void streamStart(struct connection* conn, uint32_t totalBytes, uint16_t payload);
+
+/***********************************************************************************************//**
+ *  \brief  The acknowledged write closing a stream completed; report the result.
+ *  \param[in] conn Connection context in state STREAM_DRAINING.
+ *  \param[in] result Procedure result.
+ **************************************************************************************************/
+void streamCompleted(struct connection* conn, uint16_t result);
+
+/***********************************************************************************************//**
+ *  \brief  Abandon a stream, e.g. because the link closed, and report what was sent.
+ *  \param[in] conn Connection context.
+ **************************************************************************************************/
+void streamStop(struct connection* conn);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* STREAM_H */
@@ -0,0 +1,415 @@
+/***********************************************************************************************//**
+ * \file   timer_wheel.c
+ * \brief  Hierarchical timer wheel for per-connection periodic and one-shot jobs
+ ***************************************************************************************************
+ * Jobs live in a pool allocated once, chained in doubly linked lists by index, one list per
+ * slot, so a job can be unlinked from the middle of its slot. A bitmap per level marks the slots
+ * that have jobs: the next tick with something to do is found with one count of trailing zeros
+ * per level, and ticks with nothing to do are skipped.
+ *
+ * A job of level L sits in the slot of bits L of its due tick. Every slot also keeps the earliest
+ * due tick of its jobs, and the wheel wakes up for that tick rather than for the start of the
+ * slot: the slot moves down in the same pass that runs its first job, so a job of a higher level
+ * costs no extra wakeup. The earliest due tick is not updated when a job is cancelled; the slot
+ * is then moved down for nothing, which puts it right.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "infrastructure.h"
+#include "timeutil.h"
+
+#include "adapter.h"
+#include "event_loop.h"
+
+/* Own header */
+#include "timer_wheel.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define JOB_ID(index, gen)            ((int)(((uint32_t)(gen) << 16) | (index)))
+#define JOB_INDEX(id)                 ((uint32_t)(id) & 0xFFFF)
+
+/** Jobs at most: an index fits the low half of an identifier. */
+#define TIMER_WHEEL_MAX_CAPACITY      0xFFFF
+
+#define TICK_NS                       (TIMER_WHEEL_TICK_MS * NSEC_PER_MSEC)
+#define SLOT_MASK                     (TIMER_WHEEL_SLOTS - 1)
+#define NO_JOB                        UINT32_MAX
+#define NO_BUCKET                     UINT16_MAX
+#define NO_TICK                       UINT64_MAX
+
+struct timerWheelJob {
+  uint64_t dueTick;
+  uint32_t periodTicks;         /**< 0 for a one-shot job */
+  uint32_t prev;
+  uint32_t next;                /**< in its slot, or in the free list */
+  uint16_t bucket;              /**< level * TIMER_WHEEL_SLOTS + slot, NO_BUCKET if not scheduled */
+  uint16_t gen;
+  timerWheelHandler handler;
+  void* ctx;
+};
+
+/** Wheel of one adapter. */
+static ADAPTER_LOCAL struct {
+  struct timerWheelJob* jobs;
+  uint32_t capacity;
+  uint32_t freeHead;
+  uint32_t heads[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  uint64_t minDue[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS]; /**< earliest due tick of the slot's jobs */
+  uint64_t tick;                /**< last tick processed */
+  uint64_t armedTick;           /**< tick the event loop timer is set for, NO_TICK if none */
+  bool running;                 /**< handlers are being called */
+  int timer;
+  struct timerWheelStats stats;
+} wheel = { .timer = -1 };
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void timerWheelInsert(uint32_t index);
+static void timerWheelUnlink(uint32_t index);
+static void timerWheelRelease(uint32_t index);
+static uint64_t timerWheelNextTick(void);
+static void timerWheelCascade(uint8_t level, uint32_t slot);
+static void timerWheelRunSlot(uint64_t tick, uint64_t nowNs, uint64_t nowTick);
+static void timerWheelArm(void);
+static void onWheelTimer(int timerId, void* ctx);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int timerWheelInit(uint32_t capacity)
+{
+  timerWheelClose();
+  if (capacity == 0 || capacity > TIMER_WHEEL_MAX_CAPACITY) {
+    return -1;
+  }
+  wheel.jobs = calloc(capacity, sizeof(struct timerWheelJob));
+  if (wheel.jobs == NULL) {
+    return -1;
+  }
+  /* Periodic so that the event loop keeps it; it is always set for a single expiry. */
+  wheel.timer = evloopAddTimer(TIMER_WHEEL_TICK_MS, true, onWheelTimer, NULL);
+  if (wheel.timer < 0) {
+    timerWheelClose();
+    return -1;
+  }
+  evloopSetTimer(wheel.timer, 0);
+  wheel.capacity = capacity;
+  for (uint32_t i = 0; i < capacity; i++) {
+    wheel.jobs[i].bucket = NO_BUCKET;
+    wheel.jobs[i].next = i + 1 < capacity ? i + 1 : NO_JOB;
+  }
+  wheel.freeHead = 0;
+  for (uint32_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++) {
+    wheel.heads[i] = NO_JOB;
+  }
+  memset(wheel.occupied, 0, sizeof(wheel.occupied));
+  memset(&wheel.stats, 0, sizeof(wheel.stats));
+  wheel.tick = timeNowNs() / TICK_NS;
+  wheel.armedTick = NO_TICK;
+  return 0;
+}
+
+void timerWheelClose(void)
+{
+  evloopRemoveTimer(wheel.timer);
+  wheel.timer = -1;
+  free(wheel.jobs);
+  wheel.jobs = NULL;
+  wheel.capacity = 0;
+}
+
+int timerWheelAdd(uint32_t delayMs, uint32_t periodMs, timerWheelHandler handler, void* ctx)
+{
+  uint64_t nowNs = timeNowNs();
+  uint64_t nowTick = nowNs / TICK_NS;
+  uint32_t index = wheel.freeHead;
+  struct timerWheelJob* job;
+
+  if (wheel.jobs == NULL || index == NO_JOB) {
+    return -1;
+  }
+  /* An idle wheel catches up with the clock, so that the delay sets the level; with jobs overdue,
+   * or running, it stays behind until they have run. */
+  if (!wheel.running && nowTick > wheel.tick && timerWheelNextTick() > nowTick) {
+    wheel.tick = nowTick;
+  }
+  job = &wheel.jobs[index];
+  wheel.freeHead = job->next;
+  job->gen = (uint16_t)((job->gen + 1) & 0x7FFF);
+  /* Rounded up to a tick: a job never runs before its delay is over. */
+  job->dueTick = MAX((nowNs + (uint64_t)delayMs * NSEC_PER_MSEC + TICK_NS - 1) / TICK_NS, nowTick + 1);
+  job->periodTicks = periodMs == 0 ? 0 : MAX(periodMs / TIMER_WHEEL_TICK_MS, 1);
+  job->handler = handler;
+  job->ctx = ctx;
+  timerWheelInsert(index);
+  wheel.stats.active++;
+  wheel.stats.peak = MAX(wheel.stats.peak, wheel.stats.active);
+  if (!wheel.running) {
+    /* Handlers leave it to the end of the pass. */
+    timerWheelArm();
+  }
+  return JOB_ID(index, job->gen);
+}
+
+void timerWheelCancel(int jobId)
+{
+  uint32_t index;
+
+  if (jobId < 0 || wheel.jobs == NULL) {
+    return;
+  }
+  index = JOB_INDEX(jobId);
+  if (index < wheel.capacity && wheel.jobs[index].bucket != NO_BUCKET
+      && JOB_ID(index, wheel.jobs[index].gen) == jobId) {
+    timerWheelUnlink(index);
+    timerWheelRelease(index);
+    /* The event loop timer may now fire for nothing; it is set again then. */
+  }
+}
+
+uint32_t timerWheelAlign(uint32_t periodMs)
+{
+  uint64_t nowMs = timeNowNs() / NSEC_PER_MSEC;
+
+  return periodMs == 0 ? 1 : periodMs - (uint32_t)(nowMs % periodMs);
+}
+
+const struct timerWheelStats* timerWheelGetStats(void)
+{
+  return &wheel.stats;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Put a job in the slot of the level that covers its delay from the current tick.
+ *  \param[in] index Job index.
+ **************************************************************************************************/
+static void timerWheelInsert(uint32_t index)
+{
+  struct timerWheelJob* job = &wheel.jobs[index];
+  uint64_t delta;
+  uint8_t level = 0;
+  uint16_t bucket;
+
+  if (job->dueTick < wheel.tick) {
+    job->dueTick = wheel.tick;
+  }
+  delta = job->dueTick - wheel.tick;
+  if (delta > TIMER_WHEEL_MAX_TICKS) {
+    delta = TIMER_WHEEL_MAX_TICKS;
+    job->dueTick = wheel.tick + delta;
+  }
+  while (level + 1 < TIMER_WHEEL_LEVELS && (delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1))) != 0) {
+    level++;
+  }
+  bucket = level * TIMER_WHEEL_SLOTS + ((job->dueTick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK);
+  job->bucket = bucket;
+  job->prev = NO_JOB;
+  job->next = wheel.heads[bucket];
+  if (job->next != NO_JOB) {
+    wheel.jobs[job->next].prev = index;
+    wheel.minDue[bucket] = MIN(wheel.minDue[bucket], job->dueTick);
+  } else {
+    wheel.minDue[bucket] = job->dueTick;
+  }
+  wheel.heads[bucket] = index;
+  wheel.occupied[level] |= 1ULL << (bucket & SLOT_MASK);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Take a job out of its slot.
+ *  \param[in] index Job index.
+ **************************************************************************************************/
+static void timerWheelUnlink(uint32_t index)
+{
+  struct timerWheelJob* job = &wheel.jobs[index];
+
+  if (job->prev != NO_JOB) {
+    wheel.jobs[job->prev].next = job->next;
+  } else {
+    wheel.heads[job->bucket] = job->next;
+    if (job->next == NO_JOB) {
+      wheel.occupied[job->bucket / TIMER_WHEEL_SLOTS] &= ~(1ULL << (job->bucket & SLOT_MASK));
+    }
+  }
+  if (job->next != NO_JOB) {
+    wheel.jobs[job->next].prev = job->prev;
+  }
+  job->bucket = NO_BUCKET;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Return an unlinked job to the free list.
+ *  \param[in] index Job index.
+ **************************************************************************************************/
+static void timerWheelRelease(uint32_t index)
+{
+  wheel.jobs[index].next = wheel.freeHead;
+  wheel.freeHead = index;
+  wheel.stats.active--;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Next tick with jobs due in it, at any level.
+ *  \return  The tick, NO_TICK if the wheel is empty.
+ **************************************************************************************************/
+static uint64_t timerWheelNextTick(void)
+{
+  uint64_t nearest = NO_TICK;
+
+  for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    uint8_t shift = TIMER_WHEEL_SLOT_BITS * level;
+    uint32_t current = (wheel.tick >> shift) & SLOT_MASK;
+    uint32_t rotate = (current + 1) & SLOT_MASK;
+    uint64_t bits = wheel.occupied[level];
+
+    if (level > 0 && (bits & (1ULL << current)) != 0) {
+      /* The slot the ticks are in holds jobs of this round not moved down yet, or of the next
+       * round, which any other slot comes before. */
+      nearest = MIN(nearest, wheel.minDue[level * TIMER_WHEEL_SLOTS + current]);
+      bits &= ~(1ULL << current);
+    }
+    if (bits == 0) {
+      continue;
+    }
+    if (rotate != 0) {
+      bits = (bits >> rotate) | (bits << (TIMER_WHEEL_SLOTS - rotate));
+    }
+    /* Slots in the order of their rounds: the first one holds the earliest jobs. Level 0 slots are
+     * single ticks. */
+    if (level == 0) {
+      nearest = MIN(nearest, wheel.tick + 1 + __builtin_ctzll(bits));
+    } else {
+      uint32_t slot = (rotate + __builtin_ctzll(bits)) & SLOT_MASK;
+
+      nearest = MIN(nearest, wheel.minDue[level * TIMER_WHEEL_SLOTS + slot]);
+    }
+  }
+  /* Never behind the ticks processed, should a stale earliest tick say so. */
+  return nearest == NO_TICK ? NO_TICK : MAX(nearest, wheel.tick + 1);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move the jobs of a slot down, now that the ticks reached its earliest job. Jobs of a
+ *          later round of the slot go back where they belong.
+ *  \param[in] level Level, 1 or above.
+ *  \param[in] slot Slot.
+ **************************************************************************************************/
+static void timerWheelCascade(uint8_t level, uint32_t slot)
+{
+  uint16_t bucket = level * TIMER_WHEEL_SLOTS + slot;
+  uint32_t index = wheel.heads[bucket];
+
+  wheel.heads[bucket] = NO_JOB;
+  wheel.occupied[level] &= ~(1ULL << slot);
+  while (index != NO_JOB) {
+    uint32_t next = wheel.jobs[index].next;
+
+    timerWheelInsert(index);
+    wheel.stats.cascaded++;
+    index = next;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Run the jobs due in a tick, in one pass.
+ *  \param[in] tick The tick, the current one of the wheel.
+ *  \param[in] nowNs Current time.
+ *  \param[in] nowTick Tick of the current time, later than tick after a stall.
+ **************************************************************************************************/
+static void timerWheelRunSlot(uint64_t tick, uint64_t nowNs, uint64_t nowTick)
+{
+  uint16_t bucket = tick & SLOT_MASK;
+  uint32_t index;
+
+  if (wheel.heads[bucket] != NO_JOB) {
+    wheel.stats.passes++;
+  }
+  /* Handlers may cancel other jobs of this slot: take them one at a time. New and rescheduled
+   * jobs are due after this tick and go elsewhere. */
+  while ((index = wheel.heads[bucket]) != NO_JOB) {
+    struct timerWheelJob* job = &wheel.jobs[index];
+    int id = JOB_ID(index, job->gen);
+    uint64_t lateNs = nowNs - MIN(nowNs, job->dueTick * TICK_NS);
+    timerWheelHandler handler = job->handler;
+    void* ctx = job->ctx;
+
+    timerWheelUnlink(index);
+    if (job->periodTicks != 0) {
+      job->dueTick += job->periodTicks;
+      if (job->dueTick <= nowTick) {
+        /* Runs missed while the thread was held up are dropped, not caught up with: the next one
+         * is a period from now, not from the tick the wheel is catching up on. */
+        job->dueTick = nowTick + job->periodTicks;
+      }
+      timerWheelInsert(index);
+    } else {
+      timerWheelRelease(index);
+    }
+    wheel.stats.fired++;
+    wheel.stats.lateNs += lateNs;
+    wheel.stats.lateMaxNs = MAX(wheel.stats.lateMaxNs, lateNs);
+    handler(id, ctx);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Set the event loop timer for the next tick with something to do.
+ **************************************************************************************************/
+static void timerWheelArm(void)
+{
+  uint64_t next = timerWheelNextTick();
+
+  if (next != wheel.armedTick) {
+    wheel.armedTick = next;
+    evloopSetTimer(wheel.timer, next == NO_TICK ? 0 : next * TICK_NS);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Event loop timer: process every tick with something to do up to now, then sleep
+ *          until the next one.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onWheelTimer(int timerId, void* ctx)
+{
+  uint64_t nowNs = timeNowNs();
+  uint64_t nowTick = nowNs / TICK_NS;
+  uint64_t tick;
+
+  wheel.stats.wakeups++;
+  wheel.armedTick = NO_TICK;
+  wheel.running = true;
+  while ((tick = timerWheelNextTick()) <= nowTick) {
+    wheel.tick = tick;
+    /* Higher levels first: what they move down may land in a slot moved down next. */
+    for (uint8_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      uint32_t slot = (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+
+      if ((wheel.occupied[level] & (1ULL << slot)) != 0
+          && wheel.minDue[level * TIMER_WHEEL_SLOTS + slot] <= tick) {
+        timerWheelCascade(level, slot);
+      }
+    }
+    timerWheelRunSlot(tick, nowNs, nowTick);
+  }
+  wheel.running = false;
+  wheel.tick = MAX(wheel.tick, nowTick);
+  timerWheelArm();
+}
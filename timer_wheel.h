@@ -0,0 +1,118 @@
+/***********************************************************************************************//**
+ * \file   timer_wheel.h
+ * \brief  Hierarchical timer wheel for per-connection periodic and one-shot jobs
+ ***************************************************************************************************
+ * Every adapter has one wheel of TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots, ticking
+ * every millisecond of the monotonic clock: level 0 holds the jobs due within 64 ms, one slot per
+ * tick, and each further level 64 times the span of the one below, up to about 4.6 hours. A job
+ * goes into the slot of the level that covers its delay and moves down in the pass that reaches
+ * the earliest job of its slot, so adding and cancelling a job are a few list operations whatever
+ * the number of jobs, and a tick only touches the jobs due in it.
+ *
+ * The wheel sleeps in the event loop behind a single timer, set to the next tick that has jobs
+ * due, so an idle wheel costs no wakeups and moving jobs down costs none either. All jobs due in
+ * the same tick run in one pass: periodic jobs whose first expiry falls on a multiple of their
+ * period (see timerWheelAlign()) fall due together and their commands leave in the same UART
+ * write.
+ *
+ * Like the event loop, a wheel belongs to the adapter thread that created it, and its handlers
+ * run on that thread. Handlers may add and cancel jobs, but not close the wheel.
+ **************************************************************************************************/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** Tick of the wheel. */
+#define TIMER_WHEEL_TICK_MS           1
+
+/** Levels, and slots per level as a power of two. */
+#define TIMER_WHEEL_LEVELS            4
+#define TIMER_WHEEL_SLOT_BITS         6
+#define TIMER_WHEEL_SLOTS             (1 << TIMER_WHEEL_SLOT_BITS)
+
+/** Longest delay in ticks; longer ones are cut to it. */
+#define TIMER_WHEEL_MAX_TICKS         ((1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+/***********************************************************************************************//**
+ *  \brief  Called when a job falls due. A periodic job is already rescheduled and may cancel
+ *          itself; a one-shot job is gone.
+ *  \param[in] jobId Identifier returned by timerWheelAdd().
+ *  \param[in] ctx Context pointer given with the job.
+ **************************************************************************************************/
+typedef void (*timerWheelHandler)(int jobId, void* ctx);
+
+/** Counters of the calling adapter's wheel. */
+struct timerWheelStats {
+  uint64_t fired;           /**< handler calls */
+  uint64_t passes;          /**< ticks that had jobs due: fired / passes is the batch size */
+  uint64_t cascaded;        /**< jobs moved down a level */
+  uint64_t wakeups;         /**< event loop timer expiries */
+  uint64_t lateNs;          /**< sum of the time from due to run, over the jobs fired */
+  uint64_t lateMaxNs;
+  uint32_t active;          /**< jobs scheduled */
+  uint32_t peak;
+};
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Create the wheel of the calling adapter, after its event loop was set up.
+ *  \param[in] capacity Jobs scheduled at the same time at most.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+int timerWheelInit(uint32_t capacity);
+
+/***********************************************************************************************//**
+ *  \brief  Drop every job and free the wheel of the calling adapter.
+ **************************************************************************************************/
+void timerWheelClose(void);
+
+/***********************************************************************************************//**
+ *  \brief  Schedule a job.
+ *  \param[in] delayMs Time until the first run, at least one tick.
+ *  \param[in] periodMs Time between runs, 0 for a one-shot job.
+ *  \param[in] handler Function called when the job falls due.
+ *  \param[in] ctx Passed back to the handler.
+ *  \return  Job identifier (>= 0), -1 if the wheel is full.
+ **************************************************************************************************/
+int timerWheelAdd(uint32_t delayMs, uint32_t periodMs, timerWheelHandler handler, void* ctx);
+
+/***********************************************************************************************//**
+ *  \brief  Cancel a job. One-shot jobs are removed automatically once they run; an identifier
+ *          that is no longer scheduled, or -1, is ignored.
+ *  \param[in] jobId Identifier returned by timerWheelAdd().
+ **************************************************************************************************/
+void timerWheelCancel(int jobId);
+
+/***********************************************************************************************//**
+ *  \brief  Delay that puts the first run of a periodic job on a multiple of its period, so that
+ *          jobs of the same period run in the same tick.
+ *  \param[in] periodMs Period of the job.
+ *  \return  Delay in milliseconds, 1 to periodMs.
+ **************************************************************************************************/
+uint32_t timerWheelAlign(uint32_t periodMs);
+
+/***********************************************************************************************//**
+ *  \brief  Access the counters of the calling adapter's wheel.
+ *  \return  Pointer to the live statistics.
+ **************************************************************************************************/
+const struct timerWheelStats* timerWheelGetStats(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* TIMER_WHEEL_H */
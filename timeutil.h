@@ -0,0 +1,48 @@
+/***********************************************************************************************//**
+ * \file   timeutil.h
+ * \brief  Monotonic and CPU clock helpers used for scheduling and measurements
+ **************************************************************************************************/
+
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#define NSEC_PER_USEC             1000ULL
+#define NSEC_PER_MSEC             1000000ULL
+#define NSEC_PER_SEC              1000000000ULL
+
+/***********************************************************************************************//**
+ *  \brief  Read the monotonic clock.
+ *  \return  Nanoseconds since an arbitrary, fixed point in the past.
+ **************************************************************************************************/
+static inline uint64_t timeNowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Read the CPU time consumed by the whole process (user + system).
+ *  \return  Nanoseconds of CPU time.
+ **************************************************************************************************/
+static inline uint64_t timeCpuNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* TIMEUTIL_H */
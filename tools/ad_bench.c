@@ -0,0 +1,373 @@
+/***********************************************************************************************//**
+ * \file   ad_bench.c
+ * \brief  Microbenchmark of scan report parsing, UUID matching and deduplication
+ ***************************************************************************************************
+ * Usage: ad_bench [-n reports] [-d devices] [-c change percent] [binary log file]
+ *
+ * Without a log file, a synthetic dense-environment capture is generated: phones sending Apple
+ * and Microsoft manufacturer data, beacons, trackers, wearables and a few Demo Service
+ * peripherals, with a share of reports whose payload changed since the device's last one.
+ * With a log file written by BLECentral -l, its scan reports are replayed instead.
+ *
+ * Every capture is run through the old first-UUID-only check, the full parser plus a three-UUID
+ * target set, and the deduplicated path used by the application.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "infrastructure.h"
+#include "ad_parser.h"
+#include "adv_dedup.h"
+#include "binlog.h"
+#include "timeutil.h"
+#include "bench_util.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_MAX_DEVICES             4096
+#define BENCH_MAX_CAPTURE             200000
+
+/** One captured scan report. */
+struct benchReport {
+  bd_addr address;
+  uint8_t addressType;
+  uint8_t packetType;
+  uint8_t len;
+  uint8_t data[31 + 16];          /**< slack: the old check compared 16 bytes past any AD type */
+};
+
+/* Demo Service, Heart Rate and Eddystone, little-endian */
+static const uint8_t demoUUID[16] = { 0xed, 0x52, 0x0b, 0x6b, 0x1f, 0x1a, 0x3a, 0x94,
+                                      0x6d, 0x48, 0xd1, 0x32, 0x89, 0x8b, 0x6a, 0xdf };
+static const uint8_t heartRateUUID[2] = { 0x0d, 0x18 };
+static const uint8_t eddystoneUUID[2] = { 0xaa, 0xfe };
+
+static struct benchReport capture[BENCH_MAX_CAPTURE];
+static uint32_t captureCount = 0;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static uint8_t buildPayload(uint32_t device, uint32_t counter, uint8_t* out, uint8_t* packetType);
+static void generateCapture(uint32_t reports, uint32_t devices, uint32_t changePercent);
+static int loadCapture(const char* path);
+static int legacyMatch(const struct benchReport* r);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options and an optional log file.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  uint32_t reports = BENCH_MAX_CAPTURE;
+  uint32_t devices = 300;
+  uint32_t changePercent = 10;
+  struct adTargetSet targets;
+  uint32_t rounds = 10;
+  uint64_t startNs, legacyNs, parseNs, dedupNs;
+  uint64_t legacyHits = 0, parseHits = 0, dedupHits = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:d:c:")) != -1) {
+    switch (opt) {
+      case 'n':
+        reports = MIN((uint32_t)atoi(optarg), BENCH_MAX_CAPTURE);
+        break;
+      case 'd':
+        devices = MIN((uint32_t)atoi(optarg), BENCH_MAX_DEVICES);
+        break;
+      case 'c':
+        changePercent = atoi(optarg);
+        break;
+      default:
+        printf("Usage: %s [-n reports] [-d devices] [-c change percent] [binary log file]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc) {
+    if (loadCapture(argv[optind]) < 0) {
+      return 1;
+    }
+    printf("Capture: %u scan reports from %s\n", captureCount, argv[optind]);
+  } else {
+    generateCapture(MAX(reports, 1), MAX(devices, 1), changePercent);
+    printf("Capture: %u synthetic scan reports from %u devices, %u%% with a changed payload\n",
+           captureCount, devices, changePercent);
+  }
+  if (captureCount == 0) {
+    return 1;
+  }
+
+  adTargetInit(&targets);
+  adTargetAdd(&targets, heartRateUUID, sizeof(heartRateUUID));
+  adTargetAdd(&targets, eddystoneUUID, sizeof(eddystoneUUID));
+  adTargetAdd(&targets, demoUUID, sizeof(demoUUID));
+
+  startNs = timeNowNs();
+  for (uint32_t n = 0; n < rounds; n++) {
+    for (uint32_t i = 0; i < captureCount; i++) {
+      legacyHits += legacyMatch(&capture[i]);
+    }
+  }
+  legacyNs = timeNowNs() - startNs;
+
+  startNs = timeNowNs();
+  for (uint32_t n = 0; n < rounds; n++) {
+    for (uint32_t i = 0; i < captureCount; i++) {
+      struct adInfo info;
+
+      adParse(capture[i].data, capture[i].len, &info);
+      parseHits += (adMatch(&info, &targets) != AD_NO_MATCH);
+    }
+  }
+  parseNs = timeNowNs() - startNs;
+
+  /* The table is emptied every round so that each round sees the same first-sighting misses. */
+  startNs = timeNowNs();
+  for (uint32_t n = 0; n < rounds; n++) {
+    advDedupInit();
+    for (uint32_t i = 0; i < captureCount; i++) {
+      const struct benchReport* r = &capture[i];
+      uint64_t key = advDedupKey(&r->address, r->addressType, r->packetType);
+      uint32_t hash = advDedupHash(r->data, r->len);
+      int8_t match = advDedupLookup(key, hash);
+
+      if (match == ADV_DEDUP_MISS) {
+        struct adInfo info;
+
+        adParse(r->data, r->len, &info);
+        match = adMatch(&info, &targets);
+        advDedupStore(key, hash, match);
+      }
+      dedupHits += (match != AD_NO_MATCH);
+    }
+  }
+  dedupNs = timeNowNs() - startNs;
+
+  printf("first 128-bit UUID only (old)  %7.1f ns/report, %llu matches\n",
+         (double)legacyNs / rounds / captureCount, (unsigned long long)(legacyHits / rounds));
+  printf("full parse, 3 targets          %7.1f ns/report, %llu matches\n",
+         (double)parseNs / rounds / captureCount, (unsigned long long)(parseHits / rounds));
+  printf("deduplicated parse, 3 targets  %7.1f ns/report, %llu matches, %.1f%% skipped, %llu evictions\n",
+         (double)dedupNs / rounds / captureCount, (unsigned long long)(dedupHits / rounds),
+         100.0 * advDedupGetStats()->hits / captureCount,
+         (unsigned long long)advDedupGetStats()->evictions);
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Build the payload a device sends. The device number picks its kind; counter changes
+ *          the rotating bytes that real devices update.
+ *  \param[in] device Device number.
+ *  \param[in] counter Payload generation.
+ *  \param[out] out Payload, 31 bytes of room.
+ *  \param[out] packetType Packet type of the report.
+ *  \return  Payload length.
+ **************************************************************************************************/
+static uint8_t buildPayload(uint32_t device, uint32_t counter, uint8_t* out, uint8_t* packetType)
+{
+  uint8_t* p = out;
+  uint8_t c = (uint8_t)counter;
+
+  *packetType = 0;
+  switch (device % 20) {
+    case 0: case 1: case 2: case 3: case 4: case 5: case 6: case 7: {
+      /* Phone, Apple Continuity: flags + manufacturer data with rotating bytes */
+      const uint8_t adv[] = { 0x02, 0x01, 0x1a, 0x0e, 0xff, 0x4c, 0x00, 0x10, 0x09, 0x1b,
+                              0x1c, c, (uint8_t)(c * 7), 0x3a, 0x90, 0x5b, 0x21, 0x08 };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 8: case 9: {
+      /* Windows PC, Microsoft CDP beacon */
+      const uint8_t adv[] = { 0x1e, 0xff, 0x06, 0x00, 0x01, 0x09, 0x20, 0x02, c, 0x8c, 0x5e,
+                              0x2f, 0x7a, 0x3b, 0x40, 0x11, 0x9e, 0x02, 0x51, 0x24, 0x6d, 0x00,
+                              0x1a, 0xcc, 0x03, 0x4e, 0x7f, 0xb1, 0x62, 0x13, 0x44 };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 10: {
+      /* iBeacon */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 0xe2, 0xc5,
+                              0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2, 0xb0, 0x60, 0xd0, 0xf5, 0xa7,
+                              0x10, 0x96, 0xe0, 0x00, 0x01, 0x00, (uint8_t)device, 0xc5 };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 11: {
+      /* Eddystone-TLM: 16-bit UUID list + service data with a rotating counter */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe,
+                              0x20, 0x00, 0x0b, 0xb8, 0x17, 0x00, 0x00, 0x00, 0x10, c, 0x00,
+                              0x00, 0x4e, 0x20 };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 12: case 13: {
+      /* Tracker tag: 16-bit UUID list + service data */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0xed, 0xfe, 0x0e, 0x16, 0xed, 0xfe,
+                              0x02, 0x00, 0xb4, 0x8d, 0x1e, (uint8_t)device, 0x5a, 0x02, 0x71, c };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 14: {
+      /* Heart rate strap: two 16-bit UUIDs and a name */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x05, 0x02, 0x0f, 0x18, 0x0d, 0x18, 0x09, 0x09,
+                              'H', 'R', 'M', '-', '4', '0', '2', '1' };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 15: {
+      /* Fast Pair headset: 16-bit service data */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x06, 0x16, 0x2c, 0xfe, 0x00, 0xb7, 0x27, 0x02,
+                              0x0a, 0xf2 };
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 16: {
+      /* Scan response carrying a complete name and the TX power */
+      const uint8_t adv[] = { 0x0d, 0x09, 'L', 'E', 'D', ' ', 'S', 't', 'r', 'i', 'p', ' ', '0',
+                              '7', 0x02, 0x0a, 0x04 };
+      *packetType = 4;
+      memcpy(p, adv, sizeof(adv));
+      return sizeof(adv);
+    }
+    case 17: {
+      /* Sensor listing another 128-bit service first, the Demo Service in the scan response */
+      const uint8_t adv[] = { 0x02, 0x01, 0x06, 0x11, 0x07, 0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5,
+                              0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x01, 0x00, 0x40, 0x6e };
+      memcpy(p, adv, sizeof(adv));
+      if (counter & 1) {
+        *packetType = 4;
+        p[0] = 0x11;
+        p[1] = AD_TYPE_UUID128_COMPLETE;
+        memcpy(p + 2, demoUUID, 16);
+        return 18;
+      }
+      return sizeof(adv);
+    }
+    default: {
+      /* Demo Service peripheral, as advertised by the SoC example */
+      uint8_t len = 0;
+
+      p[len++] = 0x02;
+      p[len++] = AD_TYPE_FLAGS;
+      p[len++] = 0x06;
+      p[len++] = 0x11;
+      p[len++] = AD_TYPE_UUID128_COMPLETE;
+      memcpy(p + len, demoUUID, 16);
+      len += 16;
+      return len;
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Fill the capture with reports from randomly chosen devices.
+ *  \param[in] reports Number of reports.
+ *  \param[in] devices Number of distinct advertisers.
+ *  \param[in] changePercent Share of reports with a payload different from the device's last.
+ **************************************************************************************************/
+static void generateCapture(uint32_t reports, uint32_t devices, uint32_t changePercent)
+{
+  static uint32_t generation[BENCH_MAX_DEVICES];
+
+  for (captureCount = 0; captureCount < reports; captureCount++) {
+    struct benchReport* r = &capture[captureCount];
+    uint32_t device = rng() % devices;
+
+    if (rng() % 100 < changePercent) {
+      generation[device]++;
+    }
+    memset(r, 0, sizeof(*r));
+    r->address.addr[0] = (uint8_t)device;
+    r->address.addr[1] = (uint8_t)(device >> 8);
+    r->address.addr[5] = 0xc0;
+    r->addressType = (device % 20 < 10) ? 1 : 0;
+    r->len = buildPayload(device, generation[device], r->data, &r->packetType);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Load the scan reports of a binary event log.
+ *  \param[in] path Log file written by BLECentral -l.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int loadCapture(const char* path)
+{
+  uint8_t header[BINLOG_RECORD_HEADER_LEN];
+  struct gecko_cmd_packet packet;
+  FILE* fp = fopen(path, "rb");
+
+  if (fp == NULL || fread(header, 1, 4, fp) != 4 || memcmp(header, BINLOG_MAGIC, 4)) {
+    printf("Error!!! %s is not a BLECentral event log\n", path);
+    if (fp != NULL) {
+      fclose(fp);
+    }
+    return -1;
+  }
+  while (captureCount < BENCH_MAX_CAPTURE && fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+    uint16_t len = header[8] | (header[9] << 8);
+    const struct gecko_msg_le_gap_scan_response_evt_t* sr = &packet.data.evt_le_gap_scan_response;
+    struct benchReport* r = &capture[captureCount];
+
+    if (len < BGLIB_MSG_HEADER_LEN || len > sizeof(packet) || fread(&packet, 1, len, fp) != len) {
+      break;
+    }
+    if (BGLIB_MSG_ID(packet.header) != gecko_evt_le_gap_scan_response_id) {
+      continue;
+    }
+    r->address = sr->address;
+    r->addressType = sr->address_type;
+    r->packetType = sr->packet_type;
+    r->len = MIN(sr->data.len, 31);
+    memcpy(r->data, sr->data.data, r->len);
+    captureCount++;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  The matching BLECentral used before: the Demo Service must be the first UUID of a
+ *          128-bit UUID list.
+ *  \param[in] r Scan report.
+ *  \return  1 on a match, 0 otherwise.
+ **************************************************************************************************/
+static int legacyMatch(const struct benchReport* r)
+{
+  uint8_t i = 0;
+
+  while (i < (r->len - 1)) {
+    uint8_t ad_len = r->data[i];
+    uint8_t ad_type = r->data[i + 1];
+
+    if (ad_type == 0x07 || ad_type == 0x06) {
+      if (!memcmp(r->data + i + 2, demoUUID, 16)) {
+        return 1;
+      }
+    }
+    i = i + ad_len + 1;
+  }
+  return 0;
+}
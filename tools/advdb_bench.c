@@ -0,0 +1,161 @@
+/***********************************************************************************************//**
+ * \file   advdb_bench.c
+ * \brief  Microbenchmark of the advertiser database: cost of a report against the table size
+ ***************************************************************************************************
+ * Usage: advdb_bench [-n reports] [-c change percent]
+ *
+ * For growing numbers of devices, random devices report in turn on a synthetic clock, 10000
+ * reports per second; a share of the reports carries a changed payload and stores its parsed
+ * fields, the others only update RSSI, times and rate. Past ADV_DB_CAPACITY devices most
+ * sightings evict an advertiser. The cost per report should not grow with the device count
+ * beyond what cache misses add. Each row also times the three queries on the full table.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "ad_parser.h"
+#include "adv_db.h"
+#include "timeutil.h"
+#include "bench_util.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_MAX_REPORTS             4000000
+#define BENCH_KINDS                   4
+#define BENCH_REPORT_NS               (100 * NSEC_PER_USEC)
+
+/** One report to record. */
+struct benchReport {
+  bd_addr address;
+  int8_t rssi;
+  uint8_t kind;                   /**< payload template */
+  bool changed;
+};
+
+/* Payload templates: a sensor, a heart rate strap, a beacon and a phone. */
+static const uint8_t payloads[BENCH_KINDS][31] = {
+  { 2, 0x01, 0x06, 7, 0x09, 'S', 'e', 'n', 's', 'o', 'r', 3, 0x03, 0x1a, 0x18, 5, 0xff, 0x47, 0x00, 0x01, 0x02 },
+  { 2, 0x01, 0x06, 3, 0x03, 0x0d, 0x18, 2, 0x0a, 0x04, 7, 0x09, 'H', 'R', 'M', '-', '4', '2' },
+  { 3, 0x03, 0xaa, 0xfe, 9, 0x16, 0xaa, 0xfe, 0x10, 0xf4, 0x00, 'a', 'b', 'c' },
+  { 2, 0x01, 0x1a, 9, 0xff, 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x2a, 0x3b },
+};
+static const uint8_t payloadLens[BENCH_KINDS] = { 21, 18, 14, 13 };
+
+static struct benchReport reports[BENCH_MAX_REPORTS];
+static char answer[1024 * 1024];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static uint64_t timeQuery(const char* request, uint64_t nowNs, uint32_t* lines);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  static const uint32_t deviceCounts[] = { 100, 1000, ADV_DB_CAPACITY, 4 * ADV_DB_CAPACITY, 16 * ADV_DB_CAPACITY };
+  uint32_t count = 2000000;
+  uint32_t changePercent = 10;
+  struct adInfo infos[BENCH_KINDS];
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = MIN((uint32_t)atoi(optarg), BENCH_MAX_REPORTS);
+        break;
+      case 'c':
+        changePercent = atoi(optarg);
+        break;
+      default:
+        printf("Usage: %s [-n reports] [-c change percent]\n", argv[0]);
+        return 1;
+    }
+  }
+  count = MAX(count, 1);
+  for (uint8_t k = 0; k < BENCH_KINDS; k++) {
+    adParse(payloads[k], payloadLens[k], &infos[k]);
+  }
+
+  printf("%u reports per row, %u%% with a changed payload, table of %u advertisers\n",
+         count, changePercent, ADV_DB_CAPACITY);
+  printf("devices  ns/report  evictions    top 10 ms  uuid 180d ms  seen 1 s ms\n");
+  for (uint32_t d = 0; d < sizeof(deviceCounts) / sizeof(deviceCounts[0]); d++) {
+    struct advDbStats stats;
+    uint64_t startNs, recordNs, nowNs = NSEC_PER_SEC;
+    uint64_t topNs, uuidNs, seenNs;
+    uint32_t topLines, uuidLines, seenLines;
+
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t device = rng() % deviceCounts[d];
+
+      memset(&reports[i].address, 0, sizeof(bd_addr));
+      memcpy(reports[i].address.addr, &device, sizeof(device));
+      reports[i].address.addr[5] = 0xc0;
+      reports[i].rssi = -40 - (int8_t)(rng() % 60);
+      reports[i].kind = device % BENCH_KINDS;
+      reports[i].changed = rng() % 100 < changePercent;
+    }
+
+    advDbInit();
+    startNs = timeNowNs();
+    for (uint32_t i = 0; i < count; i++) {
+      const struct benchReport* r = &reports[i];
+
+      advDbRecord(&r->address, 1, 0, r->rssi, nowNs, r->changed ? &infos[r->kind] : NULL, AD_NO_MATCH);
+      nowNs += BENCH_REPORT_NS;
+    }
+    recordNs = timeNowNs() - startNs;
+    advDbGetStats(&stats);
+
+    topNs = timeQuery("top 10", nowNs, &topLines);
+    uuidNs = timeQuery("uuid 180d", nowNs, &uuidLines);
+    seenNs = timeQuery("seen 1", nowNs, &seenLines);
+    printf("%7u  %9.1f  %9llu  %11.3f  %12.3f  %11.3f   (%u, %u, %u advertisers)\n",
+           deviceCounts[d], (double)recordNs / count, (unsigned long long)stats.evictions,
+           topNs / 1e6, uuidNs / 1e6, seenNs / 1e6, topLines, uuidLines, seenLines);
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Time one query, formatting included.
+ *  \param[in] request Request line.
+ *  \param[in] nowNs Time of the query on the synthetic clock.
+ *  \param[out] lines Advertisers in the answer.
+ *  \return  Nanoseconds taken.
+ **************************************************************************************************/
+static uint64_t timeQuery(const char* request, uint64_t nowNs, uint32_t* lines)
+{
+  uint64_t startNs = timeNowNs();
+  size_t len = advDbQuery(request, nowNs, answer, sizeof(answer));
+  uint64_t ns = timeNowNs() - startNs;
+
+  *lines = 0;
+  for (size_t i = 0; i < len; i++) {
+    *lines += answer[i] == '\n';
+  }
+  return ns;
+}
@@ -0,0 +1,325 @@
+#!/bin/sh
+#
+# End-to-end benchmark: BLECentral against the simulated NCP, one run per scenario.
+#
+# Usage: tools/bench.sh [exe dir]
+# BENCH_TIME sets the seconds per scenario (default 10), BENCH_BAUDS the line rates of the
+# UART sweep (default 115200 921600 2000000 4000000).
+#
+# Every scenario reports the host's events/s, CPU usage and event latency split into the read
+# (UART read and BGAPI framing) and handler stages, read() calls per event, the BGAPI commands
+# queued and their response time, the link setup time split into connect and GATT stages, the
+# time from a link loss to data flowing again on the new link, the timer wheel jobs run per pass
+# and wakeup, and the simulator's own counters.
+#
+# Scenarios, in order:
+#   - periodic writes every 20 ms, those of all links due in the same timer wheel pass;
+#   - link churn, reconnecting lost peers directly and, with -D, only once scanning finds them,
+#     then link churn on a line busy with a notification flood;
+#   - four peers for eight links among busy background advertisers, which keeps discovery
+#     running, with the stack's default scan parameters and with the scan scheduler;
+#   - every link profile, reporting the negotiated interval and the periodic writes' round
+#     trip, then again with round-trip probes echoed by the peers;
+#   - a GATT profile polling five characteristics at periods and phases that let most reads
+#     share a read multiple request;
+#   - startup three times on one simulator with a 250 ms boot: reusing the idle NCP, reusing it
+#     with the previous run's links open, and resetting it with -C;
+#   - bonding twice with -k on peers that use private addresses and require encryption: the
+#     first run pairs, the second encrypts with the stored bonds;
+#   - a UART sweep: a notification flood at every BENCH_BAUDS rate and unpaced, then uart_bench
+#     raising the line through the rates the simulator accepts;
+#   - timer_bench: thousands of timer wheel jobs against a 1 ms scan of every job;
+#   - a scan flood and a notification flood captured as BGAPI traces, each replayed without the
+#     simulator as fast as the host takes it;
+#   - 1 to 4 simulated NCPs driven from one host, then two adapters hearing the same peers,
+#     which must each be connected once.
+
+EXE=${1:-exe}
+TIME=${BENCH_TIME:-10}
+BAUDS=${BENCH_BAUDS:-115200 921600 2000000 4000000}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/blebench.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT INT TERM
+
+# Extra BLECentral options and link profile for the next run.
+hostopts=
+profile=
+
+# run NAME SIMULATOR-OPTIONS...
+run() {
+  name=$1
+  shift
+  rm -f "$DIR/pty" "$DIR/cache.bin"
+  "$EXE/ncpsim" -t "$TIME" "$@" > "$DIR/pty" 2> "$DIR/sim" &
+  sim=$!
+  while [ ! -s "$DIR/pty" ]; do
+    if ! kill -0 $sim 2> /dev/null; then
+      echo "$name: simulator failed to start"
+      cat "$DIR/sim"
+      return 1
+    fi
+    sleep 1
+  done
+
+  # The host exits when the simulator closes the pseudo-terminal.
+  "$EXE/BLECentral" -m -s -v 0 $hostopts -c "$DIR/cache.bin" "$(head -n 1 "$DIR/pty")" 115200 0 $profile > "$DIR/host" 2>&1
+  wait $sim
+
+  echo "== $name (ncpsim $*${hostopts:+, BLECentral $hostopts}${profile:+, profile $profile})"
+  awk '
+    function after(word,    i) {
+      for (i = 1; i < NF; i++) {
+        if ($i == word) {
+          return $(i + 1) + 0
+        }
+      }
+      return 0
+    }
+    /^MEASURE --- > [0-9.]+ s:/ {
+      window = $6
+      wall += $4; events += window; cpu += after("cpu")
+      latency += after("avg") * window
+      if (after("max") > latencyMax) latencyMax = after("max")
+    }
+    /^MEASURE --- > stages:/ {
+      readAvg += $7 * window; handlerAvg += $14 * window
+    }
+    /^MEASURE --- > uart:/ {
+      reads += $5; bytes += $7
+    }
+    /^MEASURE --- > commands:/ {
+      commands += $5; writes += $7; response += $11 * $5
+    }
+    /^MEASURE --- > timers:/ {
+      timerRuns += $7; timerPasses += $10; timerWakeups += $15; timerLate += $19 * $7
+    }
+    /^RECONNECT --- > data resumed/ {
+      if ($NF ~ /^direct/) {
+        direct++; directMs += $9
+      } else {
+        scanned++; scannedMs += $9
+      }
+    }
+    /^PROFILE --- > [a-z-]+ on/ {
+      interval = $10
+      profileWrites += substr($24, 2); roundTrip += $22 * substr($24, 2)
+    }
+    /^POLL --- > [0-9]+ links:/ {
+      poll = $0
+      sub(/^POLL --- > /, "", poll)
+      sub(/\r$/, "", poll)
+    }
+    /^SCAN --- > (static|adaptive):/ {
+      scan = $0
+      sub(/^SCAN --- > /, "", scan)
+      sub(/\r$/, "", scan)
+    }
+    /^RTT --- > [a-z-]+ on/ {
+      rtt = $0
+      sub(/^RTT --- > /, "", rtt)
+      sub(/\r$/, "", rtt)
+    }
+    /^STRESS --- > .*set up in/ {
+      links++
+      setup += after("in"); connect += after("(connect"); gatt += after("GATT")
+    }
+    END {
+      if (wall == 0) {
+        print "  no measurement report: did BLECentral start?"
+        exit
+      }
+      printf "  host: %.0f events/s, cpu %.1f%%, %.1f us cpu/event\n",
+             events / wall, cpu / 10 / wall, events ? cpu * 1000 / events : 0
+      printf "  latency: avg %.1f us, max %.1f us (read avg %.1f us, handler avg %.1f us)\n",
+             events ? latency / events : 0, latencyMax,
+             events ? readAvg / events : 0, events ? handlerAvg / events : 0
+      printf "  uart: %.3f reads/event, %.0f bytes/read\n",
+             events ? reads / events : 0, reads ? bytes / reads : 0
+      if (commands)
+        printf "  commands: %d queued in %d writes, response avg %.1f us\n",
+               commands, writes, response / commands
+      if (timerRuns)
+        printf "  timers: %d runs in %d passes (%.1f per pass), %d wakeups, late avg %.1f us\n",
+               timerRuns, timerPasses, timerRuns / timerPasses, timerWakeups, timerLate / timerRuns
+      if (links)
+        printf "  setup: %d links, avg %.1f ms (connect %.1f ms, GATT %.1f ms)\n",
+               links, setup / links, connect / links, gatt / links
+      if (profileWrites)
+        printf "  profile: interval %.2f ms, write round trip avg %.2f ms over %d writes\n",
+               interval, roundTrip / profileWrites, profileWrites
+      if (rtt)
+        printf "  rtt: %s\n", rtt
+      if (poll)
+        printf "  poll: %s\n", poll
+      if (scan)
+        printf "  scan: %s\n", scan
+      if (direct + scanned)
+        printf "  resume: %d direct avg %.1f ms, %d scanned avg %.1f ms\n",
+               direct, direct ? directMs / direct : 0, scanned, scanned ? scannedMs / scanned : 0
+    }' "$DIR/host"
+  sed 's/^ncpsim: /  ncpsim: /' "$DIR/sim"
+}
+
+run "idle links" -p 8 -n 10
+hostopts="-W 20"
+run "periodic writes every 20 ms" -p 8 -n 10
+hostopts=
+run "notification flood" -p 8 -n 1000
+run "scan flood" -p 0 -b 20000 -B 2000
+run "link churn" -p 8 -n 100 -d 5
+hostopts=-D
+run "link churn, reconnect by scanning" -p 8 -n 100 -d 5
+hostopts=
+run "link churn on a busy line" -p 8 -n 2000 -d 10 -r 921600
+hostopts="-D -S"
+run "sparse peers, static scan" -p 4 -n 10 -b 2000 -B 200 -d 0.2
+hostopts=-D
+run "sparse peers, adaptive scan" -p 4 -n 10 -b 2000 -B 200 -d 0.2
+hostopts=
+for profile in default low-latency throughput low-power; do
+  run "link profile $profile" -p 8 -n 20
+done
+hostopts="-e 20"
+for profile in default low-latency throughput low-power; do
+  run "round trip, profile $profile" -p 8 -n 0 -e
+done
+hostopts=
+profile=
+
+# The Demo Service as the built-in profile has it, and polls on top: the Database Hash and four
+# Device Information strings at periods that fall due together, one of them a quarter period
+# late, so that most reads share a read multiple request.
+cat > "$DIR/profile.gatt" << EOF
+service df6a8b89-32d1-486d-943a-1a1f6b0b52ed
+subscribe 0ced7930-b31f-457d-a6a2-b3db9b03e39a
+write fb958909-f26e-43a9-927c-7e17d8fb2d8d
+service 1801
+poll 2b2a 100
+service 180a
+poll 2a29 100
+poll 2a24 100 25
+poll 2a26 200
+poll 2a28 500
+EOF
+hostopts="-g $DIR/profile.gatt"
+run "GATT profile with polls" -p 8 -n 20
+hostopts=
+
+# One simulator that outlives three hosts, each stopped with SIGINT after 2 seconds.
+rm -f "$DIR/pty" "$DIR/cache.bin"
+"$EXE/ncpsim" -t 0 -u 250 -p 8 -n 10 > "$DIR/pty" 2> "$DIR/sim" &
+sim=$!
+while [ ! -s "$DIR/pty" ]; do
+  sleep 1
+done
+echo "== startup (ncpsim -u 250 -p 8 -n 10)"
+for opts in "" "" -C; do
+  "$EXE/BLECentral" -v 0 $opts -c "$DIR/cache.bin" "$(head -n 1 "$DIR/pty")" 115200 0 > "$DIR/host" 2>&1 &
+  host=$!
+  sleep 2
+  kill -INT $host
+  wait $host
+  tr -d '\r' < "$DIR/host" | sed -n "s/^STARTUP --- > /  ${opts:-  } /p"
+done
+kill $sim
+wait $sim 2> /dev/null
+
+# One simulator keeps the bonds for two hosts sharing a bond file, each stopped after 4 seconds.
+rm -f "$DIR/pty" "$DIR/cache.bin" "$DIR/bonds.bin"
+"$EXE/ncpsim" -t 0 -k -p 8 -d 1 > "$DIR/pty" 2> "$DIR/sim" &
+sim=$!
+while [ ! -s "$DIR/pty" ]; do
+  sleep 1
+done
+echo "== bonding (ncpsim -k -p 8 -d 1, BLECentral -k)"
+for pass in first second; do
+  "$EXE/BLECentral" -v 0 -k "$DIR/bonds.bin" -c "$DIR/cache.bin" "$(head -n 1 "$DIR/pty")" 115200 0 > "$DIR/host" 2>&1 &
+  host=$!
+  sleep 4
+  kill -INT $host
+  wait $host
+  tr -d '\r' < "$DIR/host" | sed -n "s/^BOND --- > \([0-9]* bonded peers\)/  $pass run: \1/p"
+done
+kill $sim
+wait $sim 2> /dev/null
+
+for baud in $BAUDS; do
+  run "UART at $baud baud" -p 8 -n 5000 -r "$baud"
+done
+run "UART unpaced" -p 8 -n 5000
+
+# The simulator boots at 115200 baud and accepts rates up to 2000000 through the user message.
+rm -f "$DIR/pty"
+"$EXE/ncpsim" -t 0 -p 0 -b 50000 -B 2000 -r 115200 -H 2000000 > "$DIR/pty" 2> "$DIR/sim" &
+sim=$!
+while [ ! -s "$DIR/pty" ]; do
+  sleep 1
+done
+echo "== UART rates negotiated (ncpsim -p 0 -b 50000 -B 2000 -r 115200 -H 2000000)"
+rates=$(echo 115200 $BAUDS | tr ' ' '\n' | awk '$1 <= 2000000' | sort -nu | paste -sd,)
+"$EXE/uart_bench" -t "$TIME" -r "$rates" "$(head -n 1 "$DIR/pty")" 115200 | sed 's/^/  /'
+kill $sim
+wait $sim 2> /dev/null
+
+echo "== timer wheel (timer_bench)"
+"$EXE/timer_bench" -t $(((TIME + 4) / 5)) | sed 's/^/  /'
+
+# replay NAME: replay the last captured trace as fast as possible.
+replay() {
+  rm -f "$DIR/cache.bin"
+  "$EXE/BLECentral" -v 0 -F -c "$DIR/cache.bin" -R "$DIR/trace.bgt" > "$DIR/host" 2>&1
+  echo "== $1 ($(wc -c < "$DIR/trace.bgt") bytes of trace)"
+  tr -d '\r' < "$DIR/host" | sed -n 's/^REPLAY --- > /  /p'
+}
+
+hostopts="-T $DIR/trace.bgt"
+run "scan flood, captured" -p 0 -b 20000 -B 2000
+hostopts=
+replay "scan flood, replayed"
+hostopts="-T $DIR/trace.bgt"
+run "notification flood, captured" -p 8 -n 1000
+hostopts=
+replay "notification flood, replayed"
+
+# adapters NAME COUNT SHARED SIMULATOR-OPTIONS...
+# COUNT simulators, numbered apart unless SHARED is 1, all driven by one host.
+adapters() {
+  name=$1
+  count=$2
+  shared=$3
+  shift 3
+  ports=
+  rm -f "$DIR"/sim* "$DIR"/pty*
+  for i in $(seq 1 "$count"); do
+    "$EXE/ncpsim" -t "$TIME" -i $((shared ? 0 : i)) "$@" > "$DIR/pty$i" 2> "$DIR/sim$i" &
+  done
+  for i in $(seq 1 "$count"); do
+    while [ ! -s "$DIR/pty$i" ]; do
+      sleep 1
+    done
+    [ "$i" -gt 1 ] && ports="$ports -a $(head -n 1 "$DIR/pty$i")"
+  done
+  rm -f "$DIR/cache.bin"
+  "$EXE/BLECentral" -m -s -v 0 $ports -c "$DIR/cache.bin" "$(head -n 1 "$DIR/pty1")" 115200 0 > "$DIR/host" 2>&1
+  wait
+
+  echo "== $name (ncpsim $*)"
+  awk '
+    # Links are counted by each adapter at its own report, so the first has none yet.
+    /^STRESS --- > [0-9]+ adapters,/ && $6 > 0 {
+      reports++; rate += $8
+      if ($6 > links) links = $6
+    }
+    /^STRESS --- > .*set up in/ {
+      setups++
+    }
+    END {
+      printf "  %d links set up, at most %d ready, %.0f notifications/s over all adapters\n",
+             setups, links, reports ? rate / reports : 0
+    }' "$DIR/host"
+  cat "$DIR"/sim* | sed 's/^ncpsim: /  ncpsim: /'
+}
+
+for count in 1 2 3 4; do
+  adapters "$count adapters" "$count" 0 -p 8 -n 1000 -r 921600
+done
+adapters "2 adapters hearing the same peers" 2 1 -p 8 -n 1000 -r 921600
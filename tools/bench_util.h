@@ -0,0 +1,37 @@
+/***********************************************************************************************//**
+ * \file   bench_util.h
+ * \brief  Helpers shared by the benchmark tools
+ **************************************************************************************************/
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/** Seed of rng(), so that every run draws the same numbers. */
+#define BENCH_RNG_SEED            0x12345678
+
+/** State of rng(); a benchmark may reseed it between rows. */
+static uint32_t rngState = BENCH_RNG_SEED;
+
+/***********************************************************************************************//**
+ *  \brief  xorshift32 pseudo random numbers, reproducible between runs.
+ *  \return  Next value.
+ **************************************************************************************************/
+static inline uint32_t rng(void)
+{
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* BENCH_UTIL_H */
@@ -0,0 +1,70 @@
+/***********************************************************************************************//**
+ * \file   binlog_decode.c
+ * \brief  Render a binary event log written by BLECentral -l as text
+ ***************************************************************************************************
+ * Usage: binlog_decode <log file>
+ * Every record is printed on one line, prefixed with its time in seconds since the first record.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "binlog.h"
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Log file path.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  uint8_t header[BINLOG_RECORD_HEADER_LEN];
+  struct gecko_cmd_packet packet;
+  char line[1024];
+  uint64_t firstNs = 0;
+  uint64_t records = 0;
+  FILE* fp;
+
+  if (argc != 2) {
+    printf("Usage: %s <log file>\n", argv[0]);
+    return 1;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    printf("Error!!! Could not open %s\n", argv[1]);
+    return 1;
+  }
+  if (fread(header, 1, 4, fp) != 4 || memcmp(header, BINLOG_MAGIC, 4)) {
+    printf("Error!!! %s is not a BLECentral event log\n", argv[1]);
+    fclose(fp);
+    return 1;
+  }
+
+  while (fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+    uint64_t tsNs = 0;
+    uint16_t len = header[8] | (header[9] << 8);
+
+    for (int i = 7; i >= 0; i--) {
+      tsNs = (tsNs << 8) | header[i];
+    }
+    if (len < BGLIB_MSG_HEADER_LEN || len > sizeof(packet)
+        || fread(&packet, 1, len, fp) != len) {
+      printf("Error!!! Truncated record after %llu records\n", (unsigned long long)records);
+      break;
+    }
+    if (records++ == 0) {
+      firstNs = tsNs;
+    }
+    binlogFormatEvent(line, sizeof(line), &packet);
+    printf("[%12.6f] %s", (tsNs - firstNs) / 1e9, line);
+  }
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,235 @@
+/***********************************************************************************************//**
+ * \file   gattprofile_bench.c
+ * \brief  Microbenchmark of the GATT profile: cost of classifying discovered attributes against
+ *         the profile size
+ ***************************************************************************************************
+ * Usage: gattprofile_bench [-n lookups]
+ *
+ * For growing profiles, services of 16 entries mixing 16-bit and 128-bit UUIDs are written to a
+ * profile file and loaded. Discovery of a peer holding every attribute of the profile, and as
+ * many that are not in it, is then replayed through gattProfileLookup(), against a search
+ * through the entries one by one as a chain of UUID comparisons would do. The cost per lookup
+ * should not grow with the profile; the chain's grows with it, most of all for the misses.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "gatt_profile.h"
+#include "timeutil.h"
+#include "bench_util.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Entries per service, the service included. */
+#define BENCH_SERVICE_ENTRIES         16
+
+/** One attribute as discovered on a peer. */
+struct benchAttr {
+  uint8_t uuid[16];
+  uint8_t len;
+  uint16_t service;               /**< entry index of its service, GATT_PROFILE_NO_SERVICE for a service */
+};
+
+static struct benchAttr hits[GATT_PROFILE_CAPACITY];
+static struct benchAttr misses[GATT_PROFILE_CAPACITY];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void randomAttr(struct benchAttr* attr, uint32_t i);
+static int writeProfile(const char* path, uint16_t size);
+static const struct gattProfileAttr* linearLookup(const uint8_t* uuid, uint8_t len, uint16_t service);
+static uint64_t timeLookups(const struct benchAttr* attrs, uint16_t size, uint32_t count, bool linear,
+                            uint32_t* found);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  static const uint16_t sizes[] = { 8, 64, 512, GATT_PROFILE_CAPACITY };
+  char path[] = "/tmp/gattprofile_bench.XXXXXX";
+  uint32_t count = 1000000;
+  int opt;
+  int fd;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n':
+        count = MAX((uint32_t)atoi(optarg), 1);
+        break;
+      default:
+        printf("Usage: %s [-n lookups]\n", argv[0]);
+        return 1;
+    }
+  }
+  fd = mkstemp(path);
+  if (fd < 0) {
+    printf("Error!!! Cannot create %s\n", path);
+    return 1;
+  }
+  close(fd);
+
+  printf("%u lookups per column, services of %u entries, half the UUIDs 16-bit\n", count, BENCH_SERVICE_ENTRIES);
+  printf("entries  load us  hash hit ns  hash miss ns  linear hit ns  linear miss ns\n");
+  for (uint32_t s = 0; s < COUNTOF(sizes); s++) {
+    uint16_t size = sizes[s];
+    uint64_t startNs, loadNs, hashHitNs, hashMissNs, linearHitNs, linearMissNs;
+    uint32_t found[4];
+
+    if (writeProfile(path, size) < 0) {
+      printf("Error!!! Cannot write %s\n", path);
+      unlink(path);
+      return 1;
+    }
+    startNs = timeNowNs();
+    if (gattProfileLoad(path) < 0) {
+      unlink(path);
+      return 1;
+    }
+    loadNs = timeNowNs() - startNs;
+
+    /* The peer's attributes: those of the profile, and as many others in the same services. */
+    for (uint16_t i = 0; i < size; i++) {
+      const struct gattProfileAttr* e = gattProfileAt(i);
+
+      memcpy(hits[i].uuid, e->len == 16 ? e->uuid : e->uuid + 12, e->len);
+      hits[i].len = e->len;
+      hits[i].service = e->service;
+      randomAttr(&misses[i], i);
+      misses[i].service = e->service;
+    }
+
+    hashHitNs = timeLookups(hits, size, count, false, &found[0]);
+    hashMissNs = timeLookups(misses, size, count, false, &found[1]);
+    linearHitNs = timeLookups(hits, size, count, true, &found[2]);
+    linearMissNs = timeLookups(misses, size, count, true, &found[3]);
+    printf("%7u  %7.1f  %11.1f  %12.1f  %13.1f  %14.1f   (%u, %u, %u, %u found)\n", size, loadNs / 1e3,
+           (double)hashHitNs / count, (double)hashMissNs / count, (double)linearHitNs / count,
+           (double)linearMissNs / count, found[0], found[1], found[2], found[3]);
+  }
+  unlink(path);
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Make up an attribute: a 16-bit UUID for even indices, a random 128-bit one for odd.
+ *  \param[out] attr Attribute, its service left alone.
+ *  \param[in] i Index, unique among the attributes made up for one profile.
+ **************************************************************************************************/
+static void randomAttr(struct benchAttr* attr, uint32_t i)
+{
+  if (i % 2 == 0) {
+    /* Clear of the 16-bit UUIDs of the profile, 0x2000 up to 0x2000 + capacity. */
+    uint16_t uuid = (uint16_t)(0x8000 + i);
+
+    memcpy(attr->uuid, &uuid, sizeof(uuid));
+    attr->len = 2;
+    return;
+  }
+  for (uint8_t b = 0; b < 16; b += 4) {
+    uint32_t r = rng();
+
+    memcpy(attr->uuid + b, &r, sizeof(r));
+  }
+  attr->len = 16;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Write a profile of services with BENCH_SERVICE_ENTRIES entries each, the characteristics
+ *          cycling through subscribe, poll and write.
+ *  \param[in] path Profile file.
+ *  \param[in] size Entries.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int writeProfile(const char* path, uint16_t size)
+{
+  static const char* const actions[] = { "subscribe", "poll", "write" };
+  FILE* f = fopen(path, "w");
+
+  if (f == NULL) {
+    return -1;
+  }
+  for (uint16_t i = 0; i < size; i++) {
+    struct benchAttr attr;
+    const char* action = i % BENCH_SERVICE_ENTRIES == 0 ? "service" : actions[i % COUNTOF(actions)];
+
+    if (i % 2 == 0) {
+      fprintf(f, "%s %04x", action, 0x2000 + i);
+    } else {
+      randomAttr(&attr, i);
+      fprintf(f, "%s ", action);
+      for (int b = 15; b >= 0; b--) {
+        fprintf(f, b == 11 || b == 9 || b == 7 || b == 5 ? "%02x-" : "%02x", attr.uuid[b]);
+      }
+    }
+    fprintf(f, strcmp(action, "poll") == 0 ? " 100\n" : "\n");
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Classify an attribute by comparing it with every entry in turn.
+ *  \param[in] uuid UUID as discovered, little-endian.
+ *  \param[in] len UUID length: 2, 4 or 16.
+ *  \param[in] service Entry index of its service, GATT_PROFILE_NO_SERVICE for a service.
+ *  \return  The profile entry, NULL if the attribute is not part of the profile.
+ **************************************************************************************************/
+static const struct gattProfileAttr* linearLookup(const uint8_t* uuid, uint8_t len, uint16_t service)
+{
+  for (uint16_t i = 0; i < gattProfileSize(); i++) {
+    const struct gattProfileAttr* e = gattProfileAt(i);
+
+    if (e->service == service && e->len == len && !memcmp(len == 16 ? e->uuid : e->uuid + 12, uuid, len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Time lookups cycling through attributes.
+ *  \param[in] attrs Attributes.
+ *  \param[in] size Attributes to cycle through.
+ *  \param[in] count Lookups.
+ *  \param[in] linear true for linearLookup(), false for gattProfileLookup().
+ *  \param[out] found Lookups that found an entry.
+ *  \return  Nanoseconds taken.
+ **************************************************************************************************/
+static uint64_t timeLookups(const struct benchAttr* attrs, uint16_t size, uint32_t count, bool linear,
+                            uint32_t* found)
+{
+  uint64_t startNs = timeNowNs();
+  uint16_t a = 0;
+
+  *found = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const struct benchAttr* attr = &attrs[a];
+
+    *found += (linear ? linearLookup(attr->uuid, attr->len, attr->service)
+               : gattProfileLookup(attr->uuid, attr->len, attr->service)) != NULL;
+    a = a + 1 == size ? 0 : a + 1;
+  }
+  return timeNowNs() - startNs;
+}
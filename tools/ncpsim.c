@@ -0,0 +1,1728 @@
+/***********************************************************************************************//**
+ * \file   ncpsim.c
+ * \brief  Simulated Bluetooth NCP speaking BGAPI over a pseudo-terminal
+ ***************************************************************************************************
+ * Usage: ncpsim [-p peers] [-a adverts/s] [-b reports/s] [-B devices] [-n notifications/s]
+ *               [-s payload] [-d disconnects/s] [-R reboots/s] [-e] [-k] [-r baud] [-H baud]
+ *               [-X baud] [-Q] [-t seconds] [-i number] [-u boot ms]
+ *
+ * Prints the slave side of a new pseudo-terminal on the first line of stdout, then answers the
+ * commands BLECentral uses the way ncp-MG13P does: system reset/hello, scanning, connection
+ * open/close, connection parameters, PHY and MTU, GATT discovery, notification enable, reads and
+ * writes, and the soft timer. Every peer carries the Demo Service with the layout of the WSTK
+ * example, the Generic Attribute service with its Database Hash, which can be read by UUID
+ * or by handle, and a Device Information service whose Software Revision String is longer than
+ * a default ATT MTU. Readable values can also be read several at once with read multiple;
+ * values longer than ATT_MTU - 1 take a read and blob reads, a procedure each. GATT procedures
+ * take longer on links with a longer connection interval or a slave latency, and writes without
+ * response leave twice as fast on the 2M PHY.
+ *
+ * Traffic is generated at the given rates:
+ *   -a  scan reports per second from every peer not connected (default 20)
+ *   -b  scan reports per second from background devices (default 0), spread over -B of them
+ *       (default 500); their manufacturer data changes every 8th report
+ *   -n  notifications per second on every link with notifications enabled (default 10), each
+ *       carrying a per-link sequence number in -s bytes (default 20)
+ *   -d  link losses per second over all links (default 0), reported as supervision timeouts
+ *   -R  reboots per second on the NCP's own (default 0), losing every link without an event
+ * Scan reports arrive at the scan duty set with le_gap_set_scan_parameters, window over interval
+ * (the defaults scan all the time), and active scanning adds a scan response after every
+ * advertisement, with the peer's name.
+ * With -e, every peer echoes the values written to its RW characteristic as notifications, at
+ * the first connection event the peer listens to after the write and one interval later, up to
+ * SIM_ECHO_DEPTH at once per link; the host's round-trip probes measure themselves against it.
+ * With -k, peers use privacy and require encryption: they advertise from a resolvable private
+ * address that changes every SIM_RPA_PERIOD_MS, refuse CCC writes on unencrypted links, and pair
+ * Just Works on sm_increase_security, which takes SIM_PAIR_EVENTS connection intervals and
+ * SIM_PAIR_COMPUTE_US of key generation, and ends with sm_bonded. The NCP keeps the bonds across
+ * resets, resolves the private addresses of bonded peers (the bonding field of their scan
+ * reports) and encrypts links to them with the stored keys in SIM_ENCRYPT_EVENTS intervals.
+ * Bonded peers leave the Demo Service out of their advertisements, so that only the bond
+ * tells them apart.
+ * With -r, host-bound bytes leave at the pace of a UART at that baud rate (8N1, 10 bits per
+ * byte), once per tick; without it the pseudo-terminal takes them as fast as the host reads.
+ * With -H, the NCP image has the baud rate user command of uart_speed.h, for rates up to the
+ * given one, and boots at the -r rate (default 115200). Its UART switches once the response
+ * has left and goes back unless a command arrives within UART_SPEED_REVERT_MS; with -r the pace
+ * follows. The line then carries nothing while the speed the host set on the terminal differs
+ * from the NCP's, and nothing at all at the -X rate, as with a USB bridge that cannot run it.
+ * With -Q, user messages go unanswered, as with an NCP image without a handler for them.
+ * Flood traffic is held back while more than SIM_HIGH_WATER bytes, or with -r more than
+ * SIM_HIGH_WATER_MS of line time, wait for the host, the way a real NCP runs out of buffers; the count is part of the summary printed on stderr at exit.
+ * After -t seconds (default 10, 0 for no limit) the pseudo-terminal is closed. The -i number
+ * (default 0) is part of every peer address: simulators with different numbers stand for
+ * adapters in different places, with the same number for adapters that hear the same peers.
+ * A reset drops every link and is followed by the boot event after -u milliseconds (default 1).
+ * The NCP keeps its links while no host has the terminal open, so a host started later finds
+ * it running.
+ **************************************************************************************************/
+
+/* posix_openpt() and the other pseudo-terminal calls are XSI: glibc needs _XOPEN_SOURCE. */
+#if defined(__linux__)
+#define _XOPEN_SOURCE 600
+#endif
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "infrastructure.h"
+#include "timeutil.h"
+#include "uart_speed.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Links the MG13 NCP image supports. */
+#define SIM_MAX_LINKS                 8
+
+#define SIM_MAX_PEERS                 250
+#define SIM_MAX_PENDING               256
+#define SIM_MAX_TIMERS                4
+
+/** Host-bound bytes buffered at most, and the level above which flood traffic is held back. */
+#define SIM_OUT_SIZE                  (1024 * 1024)
+#define SIM_HIGH_WATER                (64 * 1024)
+#define SIM_HIGH_WATER_MS             20
+#define SIM_RX_SIZE                   4096
+
+/** Loop period: rates are turned into events once per tick. */
+#define SIM_TICK_MS                   1
+
+/** Line time owed at most with -r, so that a stall is not followed by a burst above the rate. */
+#define SIM_MAX_LINE_CREDIT_MS        2
+
+/** Flood events owed at most, so that a stall is not followed by an unbounded burst. */
+#define SIM_MAX_CREDIT                4096.0
+
+/** Response times of the simulated stack and peers; GATT procedures at the default interval.
+ * The boot time after a reset is an option. */
+#define SIM_CONNECT_US                5000
+#define SIM_PROCEDURE_US              2000
+#define SIM_WRITE_US                  8000
+#define SIM_CLOSE_US                  1000
+
+/** Connection parameters a link opens with: 7.5 ms interval, 1 s supervision timeout. */
+#define SIM_DEFAULT_INTERVAL          6
+#define SIM_DEFAULT_TIMEOUT           100
+
+/** Connection events from a parameter request to the instant the new parameters apply. */
+#define SIM_UPDATE_EVENTS             6
+
+/** Link-layer payload bytes, without and with a larger MTU (data length extension). */
+#define SIM_DEFAULT_TXSIZE            27
+#define SIM_MAX_TXSIZE                251
+
+/** NCP buffers for write-without-response per link, and how fast they empty. */
+#define SIM_TX_BUFFERS                10
+#define SIM_TX_PER_SECOND             800
+
+/** Written values a peer holds for echoing at most; further ones are not echoed. */
+#define SIM_ECHO_DEPTH                16
+
+/** Resolvable private address lifetime with -k, much shorter than a real device's. */
+#define SIM_RPA_PERIOD_MS             2000
+
+/** Connection events of a Just Works pairing, and the peer's key generation time. */
+#define SIM_PAIR_EVENTS               12
+#define SIM_PAIR_COMPUTE_US           60000
+
+/** Connection events of an encryption with a stored bond. */
+#define SIM_ENCRYPT_EVENTS            3
+
+/** Bonds the NCP stores at most. */
+#define SIM_MAX_BONDS                 14
+
+/** Baud rate the NCP boots at with -H and no -r. */
+#define SIM_BOOT_BAUD                 115200
+
+#define SIM_DEFAULT_MTU               23
+#define SIM_MAX_ATT_MTU               247
+
+/* Attribute handles of the simulated peer database. */
+#define SIM_GATT_SERVICE              0x00050001
+#define SIM_DB_HASH_HANDLE            0x0005
+#define SIM_DEMO_SERVICE              0x00100010
+#define SIM_NOTIFY_HANDLE             0x0012
+#define SIM_CCC_HANDLE                0x0013
+#define SIM_RW_HANDLE                 0x0015
+#define SIM_DIS_SERVICE               0x00200020
+
+/** Characteristics read at once by a read multiple request at most. */
+#define SIM_READ_MAX                  16
+
+/* ATT opcodes of characteristic value events. */
+#define SIM_ATT_READ_BY_TYPE_RSP      0x09
+#define SIM_ATT_READ_RSP              0x0b
+#define SIM_ATT_READ_BLOB_RSP         0x0d
+#define SIM_ATT_READ_MULTIPLE_RSP     0x0f
+#define SIM_ATT_NOTIFICATION          0x1b
+
+/** Delayed events. */
+enum simPendingKind {
+  SIM_BOOT,
+  SIM_OPENED,
+  SIM_CLOSED,
+  SIM_SERVICE_DEMO,
+  SIM_SERVICE_GATT,
+  SIM_SERVICE_NONE,
+  SIM_SERVICES_ALL,
+  SIM_CHARACTERISTICS,
+  SIM_CHARACTERISTICS_GATT,
+  SIM_CHARACTERISTICS_DIS,
+  SIM_DESCRIPTORS,
+  SIM_DB_HASH,
+  SIM_READ,
+  SIM_READ_MULTIPLE,
+  SIM_READ_FAILED,
+  SIM_COMPLETED,
+  SIM_NOTIFY_ON,
+  SIM_NOTIFY_OFF,
+  SIM_PARAMETERS,
+  SIM_ECHO,
+  SIM_ENCRYPTED,
+  SIM_BONDED,
+  SIM_INSUFFICIENT_ENCRYPTION
+};
+
+struct simPending {
+  uint64_t dueNs;
+  uint8_t kind;
+  uint8_t connection;
+  uint16_t generation;        /**< link generation it belongs to, stale once the link is gone */
+};
+
+struct simLink {
+  bool used;
+  bool notifying;
+  bool encrypted;
+  bool securing;              /**< sm_increase_security in progress */
+  uint8_t peer;
+  uint16_t generation;
+  uint32_t sequence;
+  uint32_t txQueued;          /**< writes without response waiting for air time */
+  double txCredit;            /**< writes without response owed air time */
+  uint8_t phy;
+  uint16_t interval;          /**< connection interval, 1.25 ms units */
+  uint16_t latency;           /**< slave latency */
+  uint16_t timeout;           /**< supervision timeout, 10 ms units */
+  uint16_t nextInterval;      /**< parameters requested, applied at the update instant */
+  uint16_t nextLatency;
+  uint16_t nextTimeout;
+  uint8_t echoHead;           /**< oldest value awaiting its echo */
+  uint8_t echoCount;
+  uint8_t echoLen[SIM_ECHO_DEPTH];
+  uint8_t echoData[SIM_ECHO_DEPTH][SIM_MAX_ATT_MTU - 3];
+  uint8_t readCount;          /**< characteristics of the read in progress */
+  uint16_t readHandles[SIM_READ_MAX];
+};
+
+struct simTimer {
+  uint64_t periodNs;
+  uint64_t dueNs;
+  bool singleShot;
+};
+
+/* UUIDs of the Demo Service and its characteristics, and of the GATT service, little-endian */
+static const uint8_t demoServiceUUID[16] = { 0xed, 0x52, 0x0b, 0x6b, 0x1f, 0x1a, 0x3a, 0x94,
+                                             0x6d, 0x48, 0xd1, 0x32, 0x89, 0x8b, 0x6a, 0xdf };
+static const uint8_t notifyCharUUID[16] = { 0x9a, 0xe3, 0x03, 0x9b, 0xdb, 0xb3, 0xa2, 0xa6,
+                                            0x7d, 0x45, 0x1f, 0xb3, 0x30, 0x79, 0xed, 0x0c };
+static const uint8_t rwCharUUID[16] = { 0x8d, 0x2d, 0xfb, 0xd8, 0x17, 0x7e, 0x7c, 0x92,
+                                        0xa9, 0x43, 0x6e, 0xf2, 0x09, 0x89, 0x95, 0xfb };
+static const uint8_t gattServiceUUID[2] = { 0x01, 0x18 };
+static const uint8_t disServiceUUID[2] = { 0x0a, 0x18 };
+
+/* Every peer runs the same GATT database, so they share one hash. */
+static const uint8_t dbHash[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+
+/** Readable characteristics of the simulated peer database. */
+static const struct {
+  uint16_t handle;
+  uint16_t uuid;
+  uint8_t len;
+  const uint8_t* value;
+} simValues[] = {
+  { SIM_DB_HASH_HANDLE, 0x2b2a, sizeof(dbHash), dbHash },
+  { 0x0022, 0x2a29, 12, (const uint8_t*)"Silicon Labs" },
+  { 0x0024, 0x2a24, 8, (const uint8_t*)"BRD4104A" },
+  { 0x0026, 0x2a26, 6, (const uint8_t*)"2.13.2" },
+  { 0x0028, 0x2a28, 45, (const uint8_t*)"ncpsim peer, Demo Service of the WSTK example" },
+};
+static const uint8_t cccDescriptorUUID[2] = { 0x02, 0x29 };
+
+/* Options */
+static uint32_t peerCount = SIM_MAX_LINKS;
+static double advertRate = 20;
+static double backgroundRate = 0;
+static uint32_t backgroundDevices = 500;
+static double notifyRate = 10;
+static uint8_t notifyPayload = 20;
+static double disconnectRate = 0;
+static double rebootRate = 0;
+static bool echoMode = false;
+static bool privacyMode = false;
+static double lineRate = 0;
+static uint8_t simNumber = 0;
+static uint32_t bootUs = 1000;
+static uint32_t bootBaud = SIM_BOOT_BAUD;
+static uint32_t speedMax = 0;
+static uint32_t speedBroken = 0;
+static bool userSilent = false;
+
+/* State of the simulated NCP */
+static int masterFd = -1;
+static bool scanning = false;
+static double scanDuty = 1;
+static bool scanActive = false;
+static uint16_t maxMtu = SIM_DEFAULT_MTU;
+static uint32_t lineBaud = SIM_BOOT_BAUD;
+static uint32_t nextBaud = 0;         /**< rate to switch to once the output has left */
+static uint32_t revertBaud = 0;
+static uint64_t revertNs = 0;         /**< back to revertBaud at this time, 0 once a command confirmed the rate */
+static struct simLink links[SIM_MAX_LINKS];
+static bool peerConnected[SIM_MAX_PEERS + 1];
+static uint8_t bondPeers[SIM_MAX_BONDS];  /**< peer of every bonding handle, 0 for none; kept across resets */
+static struct simPending pending[SIM_MAX_PENDING];
+static uint32_t pendingCount = 0;
+static struct simTimer timers[SIM_MAX_TIMERS];
+static uint32_t advertPeer = 0;
+static uint32_t backgroundSequence = 0;
+static uint32_t rngState = 0x2545f491;
+
+/* Flood credits: events owed at the configured rates */
+static double advertCredit = 0;
+static double backgroundCredit = 0;
+static double notifyCredit = 0;
+static double disconnectCredit = 0;
+static double rebootCredit = 0;
+static double lineCredit = 0;
+
+/* Host-bound bytes and the packet being built */
+static uint8_t out[SIM_OUT_SIZE];
+static uint32_t outHead = 0;
+static uint32_t outTail = 0;
+static struct gecko_cmd_packet pkt;
+
+/* Host-to-NCP bytes not yet parsed */
+static uint8_t rx[SIM_RX_SIZE];
+static uint32_t rxLen = 0;
+
+/** Summary counters. */
+static struct {
+  uint64_t commands;
+  uint64_t events;
+  uint64_t bytes;
+  uint64_t scanReports;
+  uint64_t notifications;
+  uint64_t disconnects;
+  uint64_t connections;
+  uint64_t writes;
+  uint64_t reads;
+  uint64_t writesRefused;
+  uint64_t echoesDropped;
+  uint64_t heldBack;
+  uint64_t garbled;                   /**< bytes lost to a baud rate mismatch */
+  uint32_t baudChanges;
+  uint32_t pairings;
+  uint32_t encryptions;               /**< with a stored bond */
+} stats;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static int simOpenPty(void);
+static uint32_t rng(void);
+static void simSend(uint32_t id, uint32_t len);
+static void simResult(uint32_t id, uint16_t result);
+static void simSchedule(uint32_t delayUs, uint8_t kind, uint8_t connection);
+static int simValue(uint16_t handle);
+static uint32_t simAirUs(const struct simLink* link, uint32_t baseUs);
+static void simEcho(struct simLink* link, uint8_t connection, const uint8_t* data, uint8_t len);
+static void simSendParameters(uint8_t connection);
+static void simHandleCommand(void);
+static void simRunPending(uint64_t now);
+static void simTick(uint64_t elapsedNs);
+static void simScanReport(const bd_addr* address, uint8_t addressType, uint8_t bonding, uint8_t packetType,
+                          const uint8_t* data, uint8_t len);
+static void simScanResponse(const bd_addr* address, uint8_t addressType, uint8_t bonding, const char* name);
+static void simAdvertPeer(void);
+static void simAdvertBackground(void);
+static void simNotify(void);
+static void simDropLink(void);
+static void simReboot(void);
+static void simFlush(uint64_t elapsedNs);
+static void simSetBaud(uint32_t baudRate);
+static bool simLineGarbled(void);
+static speed_t simBaudSpeed(uint32_t baudRate);
+static bd_addr peerAddress(uint8_t peer);
+static bd_addr peerPrivateAddress(uint8_t peer, uint64_t epoch);
+static uint8_t peerBonding(uint8_t peer);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  double seconds = 10;
+  uint64_t startNs;
+  uint64_t lastNs;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:a:b:B:n:s:d:R:ekr:H:X:Qt:i:u:")) != -1) {
+    switch (opt) {
+      case 'p':
+        peerCount = MIN(strtoul(optarg, NULL, 0), SIM_MAX_PEERS);
+        break;
+      case 'a':
+        advertRate = atof(optarg);
+        break;
+      case 'b':
+        backgroundRate = atof(optarg);
+        break;
+      case 'B':
+        backgroundDevices = MAX(strtoul(optarg, NULL, 0), 1);
+        break;
+      case 'n':
+        notifyRate = atof(optarg);
+        break;
+      case 's':
+        notifyPayload = MAX(MIN(strtoul(optarg, NULL, 0), SIM_MAX_ATT_MTU - 3), 4);
+        break;
+      case 'd':
+        disconnectRate = atof(optarg);
+        break;
+      case 'R':
+        rebootRate = atof(optarg);
+        break;
+      case 'e':
+        echoMode = true;
+        break;
+      case 'k':
+        privacyMode = true;
+        break;
+      case 'r':
+        lineRate = atof(optarg) / 10;
+        bootBaud = strtoul(optarg, NULL, 0);
+        break;
+      case 'H':
+        speedMax = strtoul(optarg, NULL, 0);
+        break;
+      case 'X':
+        speedBroken = strtoul(optarg, NULL, 0);
+        break;
+      case 'Q':
+        userSilent = true;
+        break;
+      case 't':
+        seconds = atof(optarg);
+        break;
+      case 'i':
+        simNumber = strtoul(optarg, NULL, 0);
+        break;
+      case 'u':
+        bootUs = atof(optarg) * 1000;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-p peers] [-a adverts/s] [-b reports/s] [-B devices] "
+                "[-n notifications/s] [-s payload] [-d disconnects/s] [-R reboots/s] [-e] [-k] [-r baud] [-H baud] [-X baud] [-Q] [-t seconds] "
+                "[-i number] [-u boot ms]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  lineBaud = bootBaud;
+  if (simOpenPty() < 0) {
+    fprintf(stderr, "ncpsim: cannot open a pseudo-terminal, errno: %d\n", errno);
+    return 1;
+  }
+
+  startNs = lastNs = timeNowNs();
+  while (seconds <= 0 || timeNowNs() - startNs < seconds * NSEC_PER_SEC) {
+    /* A paced line is written once per tick, in the 1 ms bursts of a USB serial adapter. */
+    struct pollfd pfd = { masterFd, POLLIN | (outHead != outTail && lineRate == 0 ? POLLOUT : 0), 0 };
+    uint64_t now;
+
+    if (poll(&pfd, 1, SIM_TICK_MS) < 0 && errno != EINTR) {
+      break;
+    }
+    if (pfd.revents & POLLIN) {
+      ssize_t n = read(masterFd, rx + rxLen, sizeof(rx) - rxLen);
+
+      if (n > 0 && simLineGarbled()) {
+        stats.garbled += n;
+      } else if (n > 0) {
+        rxLen += n;
+        simHandleCommand();
+      }
+    }
+    now = timeNowNs();
+    if (revertNs != 0 && now >= revertNs) {
+      simSetBaud(revertBaud);
+    }
+    simRunPending(now);
+    simTick(now - lastNs);
+    simFlush(now - lastNs);
+    lastNs = now;
+  }
+
+  fprintf(stderr, "ncpsim: %.1f s, %llu commands, %llu events (%llu bytes): %llu scan reports, "
+          "%llu notifications, %llu connections, %llu link losses, %llu writes (%llu refused), "
+          "%llu reads, %llu echoes dropped, %llu flood events held back, %u baud rate changes, "
+          "%llu bytes lost to a baud rate mismatch, %u pairings, %u encryptions with a stored bond\n",
+          (timeNowNs() - startNs) / 1e9, (unsigned long long)stats.commands,
+          (unsigned long long)stats.events, (unsigned long long)stats.bytes,
+          (unsigned long long)stats.scanReports, (unsigned long long)stats.notifications,
+          (unsigned long long)stats.connections, (unsigned long long)stats.disconnects,
+          (unsigned long long)stats.writes, (unsigned long long)stats.writesRefused,
+          (unsigned long long)stats.reads, (unsigned long long)stats.echoesDropped, (unsigned long long)stats.heldBack,
+          stats.baudChanges, (unsigned long long)stats.garbled, stats.pairings, stats.encryptions);
+  close(masterFd);
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Open a raw pseudo-terminal and print its slave path.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int simOpenPty(void)
+{
+  struct termios tio;
+  const char* name;
+  int slaveFd;
+
+  masterFd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (masterFd < 0 || grantpt(masterFd) < 0 || unlockpt(masterFd) < 0
+      || (name = ptsname(masterFd)) == NULL) {
+    return -1;
+  }
+  /* Keep a slave descriptor open for the whole run: without one, the master reports a hangup
+   * until the host has opened the port. */
+  slaveFd = open(name, O_RDWR | O_NOCTTY);
+  if (slaveFd < 0 || tcgetattr(slaveFd, &tio) < 0) {
+    return -1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(slaveFd, TCSANOW, &tio);
+  fcntl(masterFd, F_SETFL, fcntl(masterFd, F_GETFL) | O_NONBLOCK);
+
+  printf("%s\n", name);
+  fflush(stdout);
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  xorshift32 generator, deterministic across runs.
+ *  \return  Next pseudo-random number.
+ **************************************************************************************************/
+static uint32_t rng(void)
+{
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Queue the packet built in pkt for the host.
+ *  \param[in] id Message ID.
+ *  \param[in] len Payload length.
+ **************************************************************************************************/
+static void simSend(uint32_t id, uint32_t len)
+{
+  if (outTail + BGLIB_MSG_HEADER_LEN + len > sizeof(out)) {
+    /* Only reachable if the host stops reading for good: responses are lost as with a dead
+     * UART, which makes the host fail its command. */
+    return;
+  }
+  pkt.header = id | ((len & 0xff) << 8) | ((len >> 8) & 0x7);
+  memcpy(out + outTail, &pkt, BGLIB_MSG_HEADER_LEN + len);
+  outTail += BGLIB_MSG_HEADER_LEN + len;
+  if ((id & gecko_msg_type_evt) != 0) {
+    stats.events++;
+  }
+  stats.bytes += BGLIB_MSG_HEADER_LEN + len;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send a response that only carries a result code.
+ *  \param[in] id Message ID of the command.
+ *  \param[in] result Result code.
+ **************************************************************************************************/
+static void simResult(uint32_t id, uint16_t result)
+{
+  pkt.data.rsp_system_hello.result = result;
+  simSend(id, sizeof(pkt.data.rsp_system_hello));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Queue an event for later.
+ *  \param[in] delayUs Delay from now.
+ *  \param[in] kind Event to generate.
+ *  \param[in] connection Link it belongs to, 0 for none.
+ **************************************************************************************************/
+static void simSchedule(uint32_t delayUs, uint8_t kind, uint8_t connection)
+{
+  struct simPending* p;
+
+  if (pendingCount >= SIM_MAX_PENDING) {
+    return;
+  }
+  p = &pending[pendingCount++];
+  p->dueNs = timeNowNs() + delayUs * NSEC_PER_USEC;
+  p->kind = kind;
+  p->connection = connection;
+  p->generation = connection ? links[connection - 1].generation : 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Find a readable characteristic.
+ *  \param[in] handle Characteristic handle.
+ *  \return  Its simValues[] index, -1 if there is none.
+ **************************************************************************************************/
+static int simValue(uint16_t handle)
+{
+  for (uint32_t i = 0; i < COUNTOF(simValues); i++) {
+    if (simValues[i].handle == handle) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Duration of an exchange with a peer, from its duration at the default interval: it
+ *          grows with the interval, and with half the events a slave latency lets the peer skip.
+ *  \param[in] link Link.
+ *  \param[in] baseUs Duration at SIM_DEFAULT_INTERVAL without slave latency.
+ *  \return  Duration on this link.
+ **************************************************************************************************/
+static uint32_t simAirUs(const struct simLink* link, uint32_t baseUs)
+{
+  return (uint32_t)((uint64_t)baseUs * link->interval * (2 + link->latency) / (2 * SIM_DEFAULT_INTERVAL));
+}
+
+/***********************************************************************************************//**
+ *  \brief  With -e, have the peer notify a value written to its RW characteristic back. The peer
+ *          hears the write at the next connection event it listens to, every 1 + latency
+ *          intervals, and the notification goes out at the event after.
+ *  \param[in] link Link.
+ *  \param[in] connection Connection handle.
+ *  \param[in] data Value written.
+ *  \param[in] len Value length.
+ **************************************************************************************************/
+static void simEcho(struct simLink* link, uint8_t connection, const uint8_t* data, uint8_t len)
+{
+  uint64_t intervalUs = link->interval * 1250ULL;
+  uint64_t periodUs = intervalUs * (1 + link->latency);
+  uint8_t slot;
+
+  if (!echoMode || !link->notifying) {
+    return;
+  }
+  if (link->echoCount >= SIM_ECHO_DEPTH || pendingCount >= SIM_MAX_PENDING) {
+    stats.echoesDropped++;
+    return;
+  }
+  slot = (link->echoHead + link->echoCount++) % SIM_ECHO_DEPTH;
+  link->echoLen[slot] = MIN(len, sizeof(link->echoData[slot]));
+  memcpy(link->echoData[slot], data, link->echoLen[slot]);
+  simSchedule(periodUs - timeNowNs() / NSEC_PER_USEC % periodUs + intervalUs, SIM_ECHO, connection);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Report the current connection parameters of a link.
+ *  \param[in] connection Connection handle.
+ **************************************************************************************************/
+static void simSendParameters(uint8_t connection)
+{
+  struct simLink* link = &links[connection - 1];
+
+  pkt.data.evt_le_connection_parameters.connection = connection;
+  pkt.data.evt_le_connection_parameters.interval = link->interval;
+  pkt.data.evt_le_connection_parameters.latency = link->latency;
+  pkt.data.evt_le_connection_parameters.timeout = link->timeout;
+  pkt.data.evt_le_connection_parameters.security_mode = link->encrypted ? le_connection_mode1_level2
+                                                        : le_connection_mode1_level1;
+  pkt.data.evt_le_connection_parameters.txsize = maxMtu > SIM_DEFAULT_MTU ? SIM_MAX_TXSIZE : SIM_DEFAULT_TXSIZE;
+  simSend(gecko_evt_le_connection_parameters_id, sizeof(pkt.data.evt_le_connection_parameters));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Answer every complete command in the receive buffer.
+ **************************************************************************************************/
+static void simHandleCommand(void)
+{
+  uint32_t offset = 0;
+
+  while (rxLen - offset >= BGLIB_MSG_HEADER_LEN) {
+    uint32_t header;
+    uint32_t len;
+    uint32_t id;
+    struct simLink* link = NULL;
+    uint8_t connection;
+
+    memcpy(&header, rx + offset, sizeof(header));
+    len = BGLIB_MSG_LEN(header);
+    if (rxLen - offset < BGLIB_MSG_HEADER_LEN + len) {
+      break;
+    }
+    memcpy(&pkt, rx + offset, BGLIB_MSG_HEADER_LEN + MIN(len, BGLIB_MSG_MAX_PAYLOAD));
+    offset += BGLIB_MSG_HEADER_LEN + len;
+    id = BGLIB_MSG_ID(header);
+    stats.commands++;
+    /* A command at a new baud rate confirms it. */
+    revertNs = 0;
+
+    /* The connection handle is the first field of every le_connection and gatt client command. */
+    connection = pkt.data.handle;
+    if (connection >= 1 && connection <= SIM_MAX_LINKS && links[connection - 1].used) {
+      link = &links[connection - 1];
+    }
+
+    switch (id) {
+      case gecko_cmd_system_reset_id:
+        /* No response: the NCP reboots and announces itself. */
+        simReboot();
+        break;
+
+      case gecko_cmd_system_hello_id:
+        simResult(id, 0);
+        break;
+
+      case gecko_cmd_le_gap_discover_id:
+        scanning = true;
+        simResult(id, 0);
+        break;
+
+      case gecko_cmd_le_gap_set_scan_parameters_id: {
+        uint16_t interval = pkt.data.cmd_le_gap_set_scan_parameters.scan_interval;
+        uint16_t window = pkt.data.cmd_le_gap_set_scan_parameters.scan_window;
+
+        if (window == 0 || window > interval) {
+          simResult(id, bg_err_invalid_param);
+          break;
+        }
+        scanDuty = (double)window / interval;
+        scanActive = pkt.data.cmd_le_gap_set_scan_parameters.active != 0;
+        simResult(id, 0);
+        break;
+      }
+
+      case gecko_cmd_le_gap_end_procedure_id:
+        scanning = false;
+        simResult(id, 0);
+        break;
+
+      case gecko_cmd_le_gap_open_id: {
+        uint8_t peer = pkt.data.cmd_le_gap_open.address.addr[0];
+        bd_addr address = peerAddress(peer);
+        uint64_t epoch = timeNowNs() / (SIM_RPA_PERIOD_MS * NSEC_PER_MSEC);
+        bool reachable = !memcmp(&pkt.data.cmd_le_gap_open.address, &address, sizeof(address));
+        uint8_t handle = 0;
+
+        /* With privacy, the NCP finds a bonded peer by its identity address; others only answer
+         * at their current private address or the one before it. */
+        if (privacyMode && pkt.data.cmd_le_gap_open.address_type == le_gap_address_type_public_identity) {
+          reachable = reachable && peerBonding(peer) != 0xff;
+        } else if (privacyMode) {
+          address = peerPrivateAddress(peer, epoch);
+          reachable = !memcmp(&pkt.data.cmd_le_gap_open.address, &address, sizeof(address));
+          address = peerPrivateAddress(peer, epoch - 1);
+          reachable = reachable || !memcmp(&pkt.data.cmd_le_gap_open.address, &address, sizeof(address));
+        }
+
+        for (uint8_t i = 0; i < SIM_MAX_LINKS && handle == 0; i++) {
+          if (!links[i].used) {
+            handle = i + 1;
+          }
+        }
+        /* Background devices are not connectable; only peers answer. */
+        if (handle == 0 || peer == 0 || peer > peerCount || peerConnected[peer] || !reachable) {
+          pkt.data.rsp_le_gap_open.result = handle == 0 ? bg_err_out_of_memory : bg_err_invalid_param;
+          pkt.data.rsp_le_gap_open.connection = 0;
+        } else {
+          link = &links[handle - 1];
+          link->used = true;
+          link->notifying = false;
+          link->encrypted = false;
+          link->securing = false;
+          link->peer = peer;
+          link->generation++;
+          link->sequence = 0;
+          link->txQueued = 0;
+          link->txCredit = 0;
+          link->echoCount = 0;
+          link->phy = le_gap_phy_1m;
+          link->interval = SIM_DEFAULT_INTERVAL;
+          link->latency = 0;
+          link->timeout = SIM_DEFAULT_TIMEOUT;
+          peerConnected[peer] = true;
+          scanning = false;
+          pkt.data.rsp_le_gap_open.result = 0;
+          pkt.data.rsp_le_gap_open.connection = handle;
+          simSchedule(SIM_CONNECT_US, SIM_OPENED, handle);
+        }
+        simSend(id, sizeof(pkt.data.rsp_le_gap_open));
+        break;
+      }
+
+      case gecko_cmd_le_connection_close_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(SIM_CLOSE_US, SIM_CLOSED, connection);
+        }
+        break;
+
+      case gecko_cmd_le_connection_set_parameters_id:
+        {
+          uint16_t minInterval = pkt.data.cmd_le_connection_set_parameters.min_interval;
+          uint16_t maxInterval = pkt.data.cmd_le_connection_set_parameters.max_interval;
+          uint16_t latency = pkt.data.cmd_le_connection_set_parameters.latency;
+          uint16_t timeout = pkt.data.cmd_le_connection_set_parameters.timeout;
+          bool valid = minInterval >= 6 && minInterval <= maxInterval && maxInterval <= 3200 && latency <= 499
+                       && timeout >= 10 && timeout <= 3200;
+
+          simResult(id, !link ? bg_err_invalid_conn_handle : valid ? 0 : bg_err_invalid_param);
+          if (link && valid) {
+            /* The central's controller settles on the shortest interval allowed. */
+            link->nextInterval = minInterval;
+            link->nextLatency = latency;
+            link->nextTimeout = timeout;
+            simSchedule(SIM_UPDATE_EVENTS * link->interval * 1250, SIM_PARAMETERS, connection);
+          }
+        }
+        break;
+
+      case gecko_cmd_le_connection_set_phy_id:
+        {
+          uint8_t phy = pkt.data.cmd_le_connection_set_phy.phy;
+
+          simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+          if (link) {
+            link->phy = (phy & le_gap_phy_2m) ? le_gap_phy_2m : le_gap_phy_1m;
+            pkt.data.evt_le_connection_phy_status.connection = connection;
+            pkt.data.evt_le_connection_phy_status.phy = phy;
+            simSend(gecko_evt_le_connection_phy_status_id, sizeof(pkt.data.evt_le_connection_phy_status));
+          }
+        }
+        break;
+
+      case gecko_cmd_gatt_set_max_mtu_id:
+        maxMtu = MAX(MIN(pkt.data.cmd_gatt_set_max_mtu.max_mtu, SIM_MAX_ATT_MTU), SIM_DEFAULT_MTU);
+        pkt.data.rsp_gatt_set_max_mtu.result = 0;
+        pkt.data.rsp_gatt_set_max_mtu.max_mtu = maxMtu;
+        simSend(id, sizeof(pkt.data.rsp_gatt_set_max_mtu));
+        break;
+
+      case gecko_cmd_gatt_discover_primary_services_by_uuid_id: {
+        const uint8array* uuid = &pkt.data.cmd_gatt_discover_primary_services_by_uuid.uuid;
+        uint8_t kind = SIM_SERVICE_NONE;
+
+        if (uuid->len == sizeof(demoServiceUUID) && !memcmp(uuid->data, demoServiceUUID, uuid->len)) {
+          kind = SIM_SERVICE_DEMO;
+        } else if (uuid->len == sizeof(gattServiceUUID) && !memcmp(uuid->data, gattServiceUUID, uuid->len)) {
+          kind = SIM_SERVICE_GATT;
+        }
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), kind, connection);
+        }
+        break;
+      }
+
+      case gecko_cmd_gatt_discover_primary_services_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), SIM_SERVICES_ALL, connection);
+        }
+        break;
+
+      case gecko_cmd_gatt_discover_characteristics_id: {
+        uint32_t service = pkt.data.cmd_gatt_discover_characteristics.service;
+        uint8_t kind = service == SIM_GATT_SERVICE ? SIM_CHARACTERISTICS_GATT
+                       : service == SIM_DIS_SERVICE ? SIM_CHARACTERISTICS_DIS : SIM_CHARACTERISTICS;
+
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), kind, connection);
+        }
+        break;
+      }
+
+      case gecko_cmd_gatt_discover_descriptors_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), SIM_DESCRIPTORS, connection);
+        }
+        break;
+
+      case gecko_cmd_gatt_read_characteristic_value_by_uuid_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), SIM_DB_HASH, connection);
+        }
+        break;
+
+      case gecko_cmd_gatt_read_characteristic_value_id: {
+        int v = simValue(pkt.data.cmd_gatt_read_characteristic_value.characteristic);
+        /* A long value takes a read and then a blob read per ATT_MTU - 1 bytes. */
+        uint32_t requests = v < 0 ? 1 : simValues[v].len / (maxMtu - 1) + 1;
+
+        if (link) {
+          link->readCount = 1;
+          link->readHandles[0] = pkt.data.cmd_gatt_read_characteristic_value.characteristic;
+        }
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          stats.reads += requests;
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US * requests), v < 0 ? SIM_READ_FAILED : SIM_READ, connection);
+        }
+        break;
+      }
+
+      case gecko_cmd_gatt_read_multiple_characteristic_values_id: {
+        const uint8array* list = &pkt.data.cmd_gatt_read_multiple_characteristic_values.characteristic_list;
+        uint8_t kind = list->len >= 4 && list->len % 2 == 0 && list->len / 2 <= SIM_READ_MAX
+                       ? SIM_READ_MULTIPLE : SIM_READ_FAILED;
+
+        if (link) {
+          link->readCount = list->len / 2;
+          for (uint8_t i = 0; i < link->readCount && kind == SIM_READ_MULTIPLE; i++) {
+            link->readHandles[i] = list->data[2 * i] | (list->data[2 * i + 1] << 8);
+            if (simValue(link->readHandles[i]) < 0) {
+              kind = SIM_READ_FAILED;
+            }
+          }
+        }
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          stats.reads++;
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US), kind, connection);
+        }
+        break;
+      }
+
+      case gecko_cmd_gatt_set_characteristic_notification_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link && privacyMode && !link->encrypted) {
+          simSchedule(simAirUs(link, SIM_WRITE_US), SIM_INSUFFICIENT_ENCRYPTION, connection);
+        } else if (link) {
+          simSchedule(simAirUs(link, SIM_PROCEDURE_US),
+                      (pkt.data.cmd_gatt_set_characteristic_notification.flags & gatt_notification)
+                      ? SIM_NOTIFY_ON : SIM_NOTIFY_OFF, connection);
+        }
+        break;
+
+      case gecko_cmd_gatt_write_descriptor_value_id:
+        {
+          /* Decoded before the response overwrites the command in pkt. */
+          bool ccc = pkt.data.cmd_gatt_write_descriptor_value.descriptor == SIM_CCC_HANDLE
+                     && pkt.data.cmd_gatt_write_descriptor_value.value.len >= 1;
+          bool notify = ccc && (pkt.data.cmd_gatt_write_descriptor_value.value.data[0] & gatt_notification);
+
+          simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+          if (link && ccc && privacyMode && !link->encrypted) {
+            simSchedule(simAirUs(link, SIM_WRITE_US), SIM_INSUFFICIENT_ENCRYPTION, connection);
+          } else if (link) {
+            simSchedule(simAirUs(link, SIM_WRITE_US), !ccc ? SIM_COMPLETED : notify ? SIM_NOTIFY_ON : SIM_NOTIFY_OFF,
+                        connection);
+          }
+        }
+        break;
+
+      case gecko_cmd_gatt_write_characteristic_value_id:
+        if (link && pkt.data.cmd_gatt_write_characteristic_value.characteristic == SIM_RW_HANDLE) {
+          simEcho(link, connection, pkt.data.cmd_gatt_write_characteristic_value.value.data,
+                  pkt.data.cmd_gatt_write_characteristic_value.value.len);
+        }
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link) {
+          stats.writes++;
+          simSchedule(simAirUs(link, SIM_WRITE_US), SIM_COMPLETED, connection);
+        }
+        break;
+
+      case gecko_cmd_gatt_write_characteristic_value_without_response_id:
+        if (link == NULL) {
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.result = bg_err_invalid_conn_handle;
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.sent_len = 0;
+        } else if (link->txQueued >= SIM_TX_BUFFERS) {
+          stats.writesRefused++;
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.result = bg_err_out_of_memory;
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.sent_len = 0;
+        } else {
+          uint16_t sent = pkt.data.cmd_gatt_write_characteristic_value_without_response.value.len;
+
+          if (pkt.data.cmd_gatt_write_characteristic_value_without_response.characteristic == SIM_RW_HANDLE) {
+            simEcho(link, connection, pkt.data.cmd_gatt_write_characteristic_value_without_response.value.data, sent);
+          }
+          stats.writes++;
+          link->txQueued++;
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.result = 0;
+          pkt.data.rsp_gatt_write_characteristic_value_without_response.sent_len = sent;
+        }
+        simSend(id, sizeof(pkt.data.rsp_gatt_write_characteristic_value_without_response));
+        break;
+
+      case gecko_cmd_hardware_set_soft_timer_id: {
+        uint8_t handle = pkt.data.cmd_hardware_set_soft_timer.handle;
+
+        if (handle < SIM_MAX_TIMERS) {
+          /* The timer runs from the 32768 Hz sleep clock. */
+          timers[handle].periodNs = pkt.data.cmd_hardware_set_soft_timer.time * NSEC_PER_SEC / 32768;
+          timers[handle].dueNs = timeNowNs() + timers[handle].periodNs;
+          timers[handle].singleShot = pkt.data.cmd_hardware_set_soft_timer.single_shot;
+        }
+        simResult(id, handle < SIM_MAX_TIMERS ? 0 : bg_err_invalid_param);
+        break;
+      }
+
+      case gecko_cmd_user_message_to_target_id: {
+        uint8_t msg[UART_SPEED_MSG_LEN];
+        uint32_t rate = 0;
+
+        /* The baud rate command of uart_speed.h, in an NCP image that has it. */
+        if (userSilent) {
+          break;
+        }
+        if (speedMax == 0 || pkt.data.cmd_user_message_to_target.data.len != UART_SPEED_MSG_LEN
+            || pkt.data.cmd_user_message_to_target.data.data[0] != UART_SPEED_MSG_SET) {
+          pkt.data.rsp_user_message_to_target.result = bg_err_not_implemented;
+          pkt.data.rsp_user_message_to_target.data.len = 0;
+          simSend(id, sizeof(pkt.data.rsp_user_message_to_target));
+          break;
+        }
+        memcpy(msg, pkt.data.cmd_user_message_to_target.data.data, sizeof(msg));
+        rate = msg[1] | msg[2] << 8 | (uint32_t)msg[3] << 16 | (uint32_t)msg[4] << 24;
+        if (rate > speedMax || simBaudSpeed(rate) == B0) {
+          pkt.data.rsp_user_message_to_target.result = bg_err_invalid_param;
+          pkt.data.rsp_user_message_to_target.data.len = 0;
+          simSend(id, sizeof(pkt.data.rsp_user_message_to_target));
+          break;
+        }
+        pkt.data.rsp_user_message_to_target.result = 0;
+        pkt.data.rsp_user_message_to_target.data.len = sizeof(msg);
+        memcpy(pkt.data.rsp_user_message_to_target.data.data, msg, sizeof(msg));
+        simSend(id, sizeof(pkt.data.rsp_user_message_to_target) + sizeof(msg));
+        nextBaud = rate;
+        break;
+      }
+
+      case gecko_cmd_sm_configure_id:
+      case gecko_cmd_sm_set_bondable_mode_id:
+        simResult(id, 0);
+        break;
+
+      case gecko_cmd_sm_increase_security_id:
+        simResult(id, link ? 0 : bg_err_invalid_conn_handle);
+        if (link && !link->encrypted && !link->securing) {
+          uint32_t eventUs = link->interval * 1250;
+
+          link->securing = true;
+          if (peerBonding(link->peer) != 0xff) {
+            simSchedule(SIM_ENCRYPT_EVENTS * eventUs, SIM_ENCRYPTED, connection);
+          } else {
+            simSchedule(SIM_PAIR_EVENTS * eventUs + SIM_PAIR_COMPUTE_US, SIM_BONDED, connection);
+          }
+        }
+        break;
+
+      case gecko_cmd_sm_delete_bonding_id: {
+        uint8_t bonding = pkt.data.cmd_sm_delete_bonding.bonding;
+
+        if (bonding < SIM_MAX_BONDS && bondPeers[bonding] != 0) {
+          bondPeers[bonding] = 0;
+          simResult(id, 0);
+        } else {
+          simResult(id, bg_err_invalid_param);
+        }
+        break;
+      }
+
+      case gecko_cmd_sm_delete_bondings_id:
+        memset(bondPeers, 0, sizeof(bondPeers));
+        simResult(id, 0);
+        break;
+
+      case gecko_cmd_sm_list_all_bondings_id:
+        simResult(id, 0);
+        for (uint8_t i = 0; i < SIM_MAX_BONDS; i++) {
+          if (bondPeers[i] != 0) {
+            pkt.data.evt_sm_list_bonding_entry.bonding = i;
+            pkt.data.evt_sm_list_bonding_entry.address = peerAddress(bondPeers[i]);
+            pkt.data.evt_sm_list_bonding_entry.address_type = le_gap_address_type_public;
+            simSend(gecko_evt_sm_list_bonding_entry_id, sizeof(pkt.data.evt_sm_list_bonding_entry));
+          }
+        }
+        simSend(gecko_evt_sm_list_all_bondings_complete_id, 0);
+        break;
+
+      default:
+        simResult(id, bg_err_not_implemented);
+        break;
+    }
+  }
+  memmove(rx, rx + offset, rxLen - offset);
+  rxLen -= offset;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send the delayed events that are due.
+ *  \param[in] now Current time.
+ **************************************************************************************************/
+static void simRunPending(uint64_t now)
+{
+  for (uint32_t i = 0; i < pendingCount; ) {
+    struct simPending p = pending[i];
+    struct simLink* link = p.connection ? &links[p.connection - 1] : NULL;
+
+    if (p.dueNs > now) {
+      i++;
+      continue;
+    }
+    pending[i] = pending[--pendingCount];
+    if (link != NULL && (!link->used || link->generation != p.generation)) {
+      continue;
+    }
+
+    switch (p.kind) {
+      case SIM_BOOT:
+        pkt.data.evt_system_boot.major = 2;
+        pkt.data.evt_system_boot.minor = 7;
+        pkt.data.evt_system_boot.patch = 0;
+        pkt.data.evt_system_boot.build = 0;
+        pkt.data.evt_system_boot.bootloader = 0;
+        pkt.data.evt_system_boot.hw = 1;
+        pkt.data.evt_system_boot.hash = 0;
+        simSend(gecko_evt_system_boot_id, sizeof(pkt.data.evt_system_boot));
+        break;
+
+      case SIM_OPENED:
+        stats.connections++;
+        pkt.data.evt_le_connection_opened.address = peerAddress(link->peer);
+        pkt.data.evt_le_connection_opened.address_type = le_gap_address_type_public;
+        pkt.data.evt_le_connection_opened.master = 1;
+        pkt.data.evt_le_connection_opened.connection = p.connection;
+        pkt.data.evt_le_connection_opened.bonding = peerBonding(link->peer);
+        pkt.data.evt_le_connection_opened.advertiser = 0xff;
+        simSend(gecko_evt_le_connection_opened_id, sizeof(pkt.data.evt_le_connection_opened));
+        if (maxMtu > SIM_DEFAULT_MTU) {
+          pkt.data.evt_gatt_mtu_exchanged.connection = p.connection;
+          pkt.data.evt_gatt_mtu_exchanged.mtu = maxMtu;
+          simSend(gecko_evt_gatt_mtu_exchanged_id, sizeof(pkt.data.evt_gatt_mtu_exchanged));
+        }
+        simSendParameters(p.connection);
+        break;
+
+      case SIM_PARAMETERS:
+        link->interval = link->nextInterval;
+        link->latency = link->nextLatency;
+        link->timeout = link->nextTimeout;
+        simSendParameters(p.connection);
+        break;
+
+      case SIM_CLOSED:
+        link->used = false;
+        peerConnected[link->peer] = false;
+        pkt.data.evt_le_connection_closed.reason = bg_err_bt_connection_terminated_by_local_host;
+        pkt.data.evt_le_connection_closed.connection = p.connection;
+        simSend(gecko_evt_le_connection_closed_id, sizeof(pkt.data.evt_le_connection_closed));
+        break;
+
+      case SIM_SERVICE_DEMO:
+      case SIM_SERVICE_GATT:
+      case SIM_SERVICES_ALL:
+        pkt.data.evt_gatt_service.connection = p.connection;
+        if (p.kind != SIM_SERVICE_DEMO) {
+          pkt.data.evt_gatt_service.service = SIM_GATT_SERVICE;
+          pkt.data.evt_gatt_service.uuid.len = sizeof(gattServiceUUID);
+          memcpy(pkt.data.evt_gatt_service.uuid.data, gattServiceUUID, sizeof(gattServiceUUID));
+          simSend(gecko_evt_gatt_service_id, sizeof(pkt.data.evt_gatt_service) + sizeof(gattServiceUUID));
+        }
+        if (p.kind != SIM_SERVICE_GATT) {
+          pkt.data.evt_gatt_service.service = SIM_DEMO_SERVICE;
+          pkt.data.evt_gatt_service.uuid.len = sizeof(demoServiceUUID);
+          memcpy(pkt.data.evt_gatt_service.uuid.data, demoServiceUUID, sizeof(demoServiceUUID));
+          simSend(gecko_evt_gatt_service_id, sizeof(pkt.data.evt_gatt_service) + sizeof(demoServiceUUID));
+        }
+        if (p.kind == SIM_SERVICES_ALL) {
+          pkt.data.evt_gatt_service.service = SIM_DIS_SERVICE;
+          pkt.data.evt_gatt_service.uuid.len = sizeof(disServiceUUID);
+          memcpy(pkt.data.evt_gatt_service.uuid.data, disServiceUUID, sizeof(disServiceUUID));
+          simSend(gecko_evt_gatt_service_id, sizeof(pkt.data.evt_gatt_service) + sizeof(disServiceUUID));
+        }
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+
+      case SIM_CHARACTERISTICS:
+        pkt.data.evt_gatt_characteristic.connection = p.connection;
+        pkt.data.evt_gatt_characteristic.characteristic = SIM_NOTIFY_HANDLE;
+        pkt.data.evt_gatt_characteristic.properties = 0x10;
+        pkt.data.evt_gatt_characteristic.uuid.len = sizeof(notifyCharUUID);
+        memcpy(pkt.data.evt_gatt_characteristic.uuid.data, notifyCharUUID, sizeof(notifyCharUUID));
+        simSend(gecko_evt_gatt_characteristic_id, sizeof(pkt.data.evt_gatt_characteristic) + sizeof(notifyCharUUID));
+        pkt.data.evt_gatt_characteristic.characteristic = SIM_RW_HANDLE;
+        pkt.data.evt_gatt_characteristic.properties = 0x0a;
+        memcpy(pkt.data.evt_gatt_characteristic.uuid.data, rwCharUUID, sizeof(rwCharUUID));
+        simSend(gecko_evt_gatt_characteristic_id, sizeof(pkt.data.evt_gatt_characteristic) + sizeof(rwCharUUID));
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+
+      case SIM_CHARACTERISTICS_GATT:
+      case SIM_CHARACTERISTICS_DIS:
+        /* The Database Hash heads simValues[], the Device Information characteristics follow. */
+        for (uint32_t i = 0; i < COUNTOF(simValues); i++) {
+          if ((i == 0) != (p.kind == SIM_CHARACTERISTICS_GATT)) {
+            continue;
+          }
+          pkt.data.evt_gatt_characteristic.connection = p.connection;
+          pkt.data.evt_gatt_characteristic.characteristic = simValues[i].handle;
+          pkt.data.evt_gatt_characteristic.properties = 0x02;
+          pkt.data.evt_gatt_characteristic.uuid.len = 2;
+          pkt.data.evt_gatt_characteristic.uuid.data[0] = (uint8_t)simValues[i].uuid;
+          pkt.data.evt_gatt_characteristic.uuid.data[1] = (uint8_t)(simValues[i].uuid >> 8);
+          simSend(gecko_evt_gatt_characteristic_id, sizeof(pkt.data.evt_gatt_characteristic) + 2);
+        }
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+
+      case SIM_DESCRIPTORS:
+        pkt.data.evt_gatt_descriptor.connection = p.connection;
+        pkt.data.evt_gatt_descriptor.descriptor = SIM_CCC_HANDLE;
+        pkt.data.evt_gatt_descriptor.uuid.len = sizeof(cccDescriptorUUID);
+        memcpy(pkt.data.evt_gatt_descriptor.uuid.data, cccDescriptorUUID, sizeof(cccDescriptorUUID));
+        simSend(gecko_evt_gatt_descriptor_id, sizeof(pkt.data.evt_gatt_descriptor) + sizeof(cccDescriptorUUID));
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+
+      case SIM_DB_HASH:
+        pkt.data.evt_gatt_characteristic_value.connection = p.connection;
+        pkt.data.evt_gatt_characteristic_value.characteristic = SIM_DB_HASH_HANDLE;
+        pkt.data.evt_gatt_characteristic_value.att_opcode = SIM_ATT_READ_BY_TYPE_RSP;
+        pkt.data.evt_gatt_characteristic_value.offset = 0;
+        pkt.data.evt_gatt_characteristic_value.value.len = sizeof(dbHash);
+        memcpy(pkt.data.evt_gatt_characteristic_value.value.data, dbHash, sizeof(dbHash));
+        simSend(gecko_evt_gatt_characteristic_value_id, sizeof(pkt.data.evt_gatt_characteristic_value) + sizeof(dbHash));
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+
+      case SIM_READ: {
+        int v = simValue(link->readHandles[0]);
+
+        /* One value event per ATT response, a read and then blob reads. */
+        for (uint16_t offset = 0; offset == 0 || offset < simValues[v].len; offset += maxMtu - 1) {
+          uint8_t len = MIN(simValues[v].len - offset, maxMtu - 1);
+
+          pkt.data.evt_gatt_characteristic_value.connection = p.connection;
+          pkt.data.evt_gatt_characteristic_value.characteristic = simValues[v].handle;
+          pkt.data.evt_gatt_characteristic_value.att_opcode = offset == 0 ? SIM_ATT_READ_RSP : SIM_ATT_READ_BLOB_RSP;
+          pkt.data.evt_gatt_characteristic_value.offset = offset;
+          pkt.data.evt_gatt_characteristic_value.value.len = len;
+          memcpy(pkt.data.evt_gatt_characteristic_value.value.data, simValues[v].value + offset, len);
+          simSend(gecko_evt_gatt_characteristic_value_id, sizeof(pkt.data.evt_gatt_characteristic_value) + len);
+        }
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+      }
+
+      case SIM_READ_MULTIPLE: {
+        uint8_t len = 0;
+
+        /* The values back to back, as many bytes as fit in one response. */
+        for (uint8_t i = 0; i < link->readCount; i++) {
+          int v = simValue(link->readHandles[i]);
+          uint8_t n = MIN(simValues[v].len, maxMtu - 1 - len);
+
+          memcpy(pkt.data.evt_gatt_characteristic_value.value.data + len, simValues[v].value, n);
+          len += n;
+        }
+        pkt.data.evt_gatt_characteristic_value.connection = p.connection;
+        pkt.data.evt_gatt_characteristic_value.characteristic = 0;
+        pkt.data.evt_gatt_characteristic_value.att_opcode = SIM_ATT_READ_MULTIPLE_RSP;
+        pkt.data.evt_gatt_characteristic_value.offset = 0;
+        pkt.data.evt_gatt_characteristic_value.value.len = len;
+        simSend(gecko_evt_gatt_characteristic_value_id, sizeof(pkt.data.evt_gatt_characteristic_value) + len);
+        simSchedule(0, SIM_COMPLETED, p.connection);
+        break;
+      }
+
+      case SIM_READ_FAILED:
+        pkt.data.evt_gatt_procedure_completed.connection = p.connection;
+        pkt.data.evt_gatt_procedure_completed.result = bg_err_att_invalid_handle;
+        simSend(gecko_evt_gatt_procedure_completed_id, sizeof(pkt.data.evt_gatt_procedure_completed));
+        break;
+
+      case SIM_ECHO: {
+        uint8_t len = link->echoLen[link->echoHead];
+
+        pkt.data.evt_gatt_characteristic_value.connection = p.connection;
+        pkt.data.evt_gatt_characteristic_value.characteristic = SIM_NOTIFY_HANDLE;
+        pkt.data.evt_gatt_characteristic_value.att_opcode = SIM_ATT_NOTIFICATION;
+        pkt.data.evt_gatt_characteristic_value.offset = 0;
+        pkt.data.evt_gatt_characteristic_value.value.len = len;
+        memcpy(pkt.data.evt_gatt_characteristic_value.value.data, link->echoData[link->echoHead], len);
+        link->echoHead = (link->echoHead + 1) % SIM_ECHO_DEPTH;
+        link->echoCount--;
+        simSend(gecko_evt_gatt_characteristic_value_id, sizeof(pkt.data.evt_gatt_characteristic_value) + len);
+        stats.notifications++;
+        break;
+      }
+
+      case SIM_ENCRYPTED:
+        link->securing = false;
+        link->encrypted = true;
+        stats.encryptions++;
+        simSendParameters(p.connection);
+        break;
+
+      case SIM_BONDED: {
+        uint8_t bonding = 0xff;
+
+        /* A full bond table refuses new bonds; the link is encrypted all the same. */
+        for (uint8_t i = 0; i < SIM_MAX_BONDS && bonding == 0xff; i++) {
+          if (bondPeers[i] == 0) {
+            bonding = i;
+            bondPeers[i] = link->peer;
+          }
+        }
+        link->securing = false;
+        link->encrypted = true;
+        stats.pairings++;
+        simSendParameters(p.connection);
+        pkt.data.evt_sm_bonded.connection = p.connection;
+        pkt.data.evt_sm_bonded.bonding = bonding;
+        simSend(gecko_evt_sm_bonded_id, sizeof(pkt.data.evt_sm_bonded));
+        break;
+      }
+
+      case SIM_INSUFFICIENT_ENCRYPTION:
+        pkt.data.evt_gatt_procedure_completed.connection = p.connection;
+        pkt.data.evt_gatt_procedure_completed.result = bg_err_att_insufficient_encryption;
+        simSend(gecko_evt_gatt_procedure_completed_id, sizeof(pkt.data.evt_gatt_procedure_completed));
+        break;
+
+      case SIM_NOTIFY_ON:
+      case SIM_NOTIFY_OFF:
+        link->notifying = (p.kind == SIM_NOTIFY_ON);
+      /** Falls through on purpose. */
+      case SIM_COMPLETED:
+        pkt.data.evt_gatt_procedure_completed.connection = p.connection;
+        pkt.data.evt_gatt_procedure_completed.result = 0;
+        simSend(gecko_evt_gatt_procedure_completed_id, sizeof(pkt.data.evt_gatt_procedure_completed));
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  for (uint8_t i = 0; i < SIM_MAX_TIMERS; i++) {
+    if (timers[i].periodNs != 0 && timers[i].dueNs <= now) {
+      pkt.data.evt_hardware_soft_timer.handle = i;
+      simSend(gecko_evt_hardware_soft_timer_id, sizeof(pkt.data.evt_hardware_soft_timer));
+      timers[i].dueNs += timers[i].periodNs;
+      if (timers[i].singleShot) {
+        timers[i].periodNs = 0;
+      }
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Turn the configured rates into scan reports, notifications and link losses.
+ *  \param[in] elapsedNs Time since the previous tick.
+ **************************************************************************************************/
+static void simTick(uint64_t elapsedNs)
+{
+  double dt = elapsedNs / 1e9;
+  uint32_t freePeers = 0;
+  uint32_t notifying = 0;
+  uint32_t connected = 0;
+
+  for (uint32_t i = 1; i <= peerCount; i++) {
+    freePeers += !peerConnected[i];
+  }
+  for (uint8_t i = 0; i < SIM_MAX_LINKS; i++) {
+    connected += links[i].used;
+    notifying += links[i].used && links[i].notifying;
+  }
+
+  if (scanning) {
+    advertCredit = MIN(advertCredit + dt * advertRate * freePeers * scanDuty, SIM_MAX_CREDIT);
+    backgroundCredit = MIN(backgroundCredit + dt * backgroundRate * scanDuty, SIM_MAX_CREDIT);
+  }
+  notifyCredit = MIN(notifyCredit + dt * notifyRate * notifying, SIM_MAX_CREDIT);
+  disconnectCredit = MIN(disconnectCredit + (connected ? dt * disconnectRate : 0), SIM_MAX_CREDIT);
+  rebootCredit = MIN(rebootCredit + dt * rebootRate, 1);
+
+  /* Writes without response leave the NCP at the link's pace, twice as fast on the 2M PHY. */
+  for (uint8_t i = 0; i < SIM_MAX_LINKS; i++) {
+    links[i].txCredit += dt * SIM_TX_PER_SECOND * (links[i].phy == le_gap_phy_2m ? 2 : 1);
+    links[i].txQueued -= MIN(links[i].txQueued, (uint32_t)links[i].txCredit);
+    links[i].txCredit -= (uint32_t)links[i].txCredit;
+  }
+
+  for (; disconnectCredit >= 1; disconnectCredit -= 1) {
+    simDropLink();
+  }
+  if (rebootCredit >= 1) {
+    rebootCredit = 0;
+    simReboot();
+  }
+
+  if (outTail - outHead > (lineRate > 0 ? MIN(SIM_HIGH_WATER, lineRate * SIM_HIGH_WATER_MS / 1000)
+                           : SIM_HIGH_WATER)) {
+    stats.heldBack += (uint64_t)advertCredit + (uint64_t)backgroundCredit + (uint64_t)notifyCredit;
+    advertCredit -= (uint64_t)advertCredit;
+    backgroundCredit -= (uint64_t)backgroundCredit;
+    notifyCredit -= (uint64_t)notifyCredit;
+    return;
+  }
+  for (; scanning && advertCredit >= 1; advertCredit -= 1) {
+    simAdvertPeer();
+  }
+  for (; scanning && backgroundCredit >= 1; backgroundCredit -= 1) {
+    simAdvertBackground();
+  }
+  for (; notifyCredit >= 1; notifyCredit -= 1) {
+    simNotify();
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send one scan report.
+ *  \param[in] address Advertiser address.
+ *  \param[in] packetType 0 for an advertisement, 4 for a scan response.
+ *  \param[in] data Advertising data.
+ *  \param[in] len Advertising data length.
+ **************************************************************************************************/
+static void simScanReport(const bd_addr* address, uint8_t addressType, uint8_t bonding, uint8_t packetType,
+                          const uint8_t* data, uint8_t len)
+{
+  pkt.data.evt_le_gap_scan_response.rssi = -40 - (int8_t)(rng() % 50);
+  pkt.data.evt_le_gap_scan_response.packet_type = packetType;
+  pkt.data.evt_le_gap_scan_response.address = *address;
+  pkt.data.evt_le_gap_scan_response.address_type = addressType;
+  pkt.data.evt_le_gap_scan_response.bonding = bonding;
+  pkt.data.evt_le_gap_scan_response.data.len = len;
+  memcpy(pkt.data.evt_le_gap_scan_response.data.data, data, len);
+  simSend(gecko_evt_le_gap_scan_response_id, sizeof(pkt.data.evt_le_gap_scan_response) + len);
+  stats.scanReports++;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Answer the scan request that follows an advertisement when scanning actively.
+ *  \param[in] address Advertiser address.
+ *  \param[in] name Complete local name.
+ **************************************************************************************************/
+static void simScanResponse(const bd_addr* address, uint8_t addressType, uint8_t bonding, const char* name)
+{
+  uint8_t data[31];
+  uint8_t len = (uint8_t)MIN(strlen(name), sizeof(data) - 2);
+
+  if (!scanActive) {
+    return;
+  }
+  data[0] = len + 1;
+  data[1] = 0x09;
+  memcpy(data + 2, name, len);
+  simScanReport(address, addressType, bonding, 4, data, len + 2);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send an advertisement of the next peer not connected: flags and the Demo Service.
+ **************************************************************************************************/
+static void simAdvertPeer(void)
+{
+  uint8_t data[3 + 2 + sizeof(demoServiceUUID)] = { 2, 0x01, 0x06, 17, 0x07 };
+  bd_addr address;
+
+  uint8_t addressType = le_gap_address_type_public;
+  uint8_t bonding;
+
+  for (uint32_t n = 0; n < peerCount; n++) {
+    advertPeer = advertPeer % peerCount + 1;
+    if (!peerConnected[advertPeer]) {
+      memcpy(data + 5, demoServiceUUID, sizeof(demoServiceUUID));
+      address = peerAddress(advertPeer);
+      bonding = peerBonding(advertPeer);
+      if (privacyMode) {
+        address = peerPrivateAddress(advertPeer, timeNowNs() / (SIM_RPA_PERIOD_MS * NSEC_PER_MSEC));
+        addressType = le_gap_address_type_random;
+      }
+      /* Only the flags: a bonded peer is known by its resolved address alone. */
+      simScanReport(&address, addressType, bonding, 0, data, privacyMode && bonding != 0xff ? 3 : sizeof(data));
+      simScanResponse(&address, addressType, bonding, "ncpsim peer");
+      return;
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send an advertisement of a background device: flags and an iBeacon-style frame.
+ **************************************************************************************************/
+static void simAdvertBackground(void)
+{
+  uint32_t device = backgroundSequence % backgroundDevices;
+  uint32_t round = backgroundSequence / backgroundDevices;
+  uint8_t data[3 + 27] = { 2, 0x01, 0x06, 26, 0xff, 0x4c, 0x00, 0x02, 0x15 };
+  bd_addr address = { { device & 0xff, (device >> 8) & 0xff, 0x5e, 0xc0, 0xcd, 0xab } };
+
+  backgroundSequence++;
+  for (uint8_t i = 9; i < sizeof(data); i++) {
+    data[i] = (uint8_t)(device * 31 + i);
+  }
+  /* Minor number: changes every 8th report of this device. */
+  data[sizeof(data) - 2] = (uint8_t)(round / 8);
+  simScanReport(&address, le_gap_address_type_public, 0xff, 0, data, sizeof(data));
+  simScanResponse(&address, le_gap_address_type_public, 0xff, "beacon");
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send one notification on the next link that has them enabled.
+ **************************************************************************************************/
+static void simNotify(void)
+{
+  static uint8_t next = 0;
+
+  for (uint8_t n = 0; n < SIM_MAX_LINKS; n++) {
+    struct simLink* link = &links[next];
+    uint8_t connection = next + 1;
+    uint8_t* p = pkt.data.evt_gatt_characteristic_value.value.data;
+
+    next = (next + 1) % SIM_MAX_LINKS;
+    if (!link->used || !link->notifying) {
+      continue;
+    }
+    pkt.data.evt_gatt_characteristic_value.connection = connection;
+    pkt.data.evt_gatt_characteristic_value.characteristic = SIM_NOTIFY_HANDLE;
+    pkt.data.evt_gatt_characteristic_value.att_opcode = SIM_ATT_NOTIFICATION;
+    pkt.data.evt_gatt_characteristic_value.offset = 0;
+    pkt.data.evt_gatt_characteristic_value.value.len = notifyPayload;
+    memset(p, connection, notifyPayload);
+    UINT32_TO_BITSTREAM(p, link->sequence);
+    link->sequence++;
+    simSend(gecko_evt_gatt_characteristic_value_id, sizeof(pkt.data.evt_gatt_characteristic_value) + notifyPayload);
+    stats.notifications++;
+    return;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Reboot, on a reset command or on its own: every link is lost without a closed event,
+ *          and the boot event follows after the boot time.
+ **************************************************************************************************/
+static void simReboot(void)
+{
+  memset(links, 0, sizeof(links));
+  memset(peerConnected, 0, sizeof(peerConnected));
+  memset(timers, 0, sizeof(timers));
+  pendingCount = 0;
+  scanning = false;
+  scanDuty = 1;
+  scanActive = false;
+  maxMtu = SIM_DEFAULT_MTU;
+  nextBaud = 0;
+  if (lineBaud != bootBaud) {
+    simSetBaud(bootBaud);
+  }
+  simSchedule(bootUs, SIM_BOOT, 0);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Lose a random link, as on a supervision timeout.
+ **************************************************************************************************/
+static void simDropLink(void)
+{
+  uint8_t start = rng() % SIM_MAX_LINKS;
+
+  for (uint8_t n = 0; n < SIM_MAX_LINKS; n++) {
+    struct simLink* link = &links[(start + n) % SIM_MAX_LINKS];
+
+    if (link->used) {
+      link->used = false;
+      peerConnected[link->peer] = false;
+      pkt.data.evt_le_connection_closed.reason = bg_err_bt_connection_timeout;
+      pkt.data.evt_le_connection_closed.connection = (start + n) % SIM_MAX_LINKS + 1;
+      simSend(gecko_evt_le_connection_closed_id, sizeof(pkt.data.evt_le_connection_closed));
+      stats.disconnects++;
+      return;
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Write as much of the host-bound data as the pseudo-terminal, and the line rate, take.
+ *  \param[in] elapsedNs Time since the previous call.
+ **************************************************************************************************/
+static void simFlush(uint64_t elapsedNs)
+{
+  uint32_t allowed = outTail - outHead;
+
+  if (lineRate > 0) {
+    lineCredit = MIN(lineCredit + elapsedNs / 1e9 * lineRate, lineRate * SIM_MAX_LINE_CREDIT_MS / 1000 + 1);
+    allowed = MIN(allowed, (uint32_t)lineCredit);
+  }
+  if (allowed > 0 && simLineGarbled()) {
+    /* The host cannot make sense of bytes at another rate. */
+    outHead += allowed;
+    lineCredit -= lineRate > 0 ? allowed : 0;
+    stats.garbled += allowed;
+    allowed = 0;
+  }
+  while (allowed > 0) {
+    ssize_t n = write(masterFd, out + outHead, allowed);
+
+    if (n <= 0) {
+      break;
+    }
+    outHead += n;
+    allowed -= n;
+    lineCredit -= lineRate > 0 ? n : 0;
+  }
+  if (outHead == outTail) {
+    outHead = outTail = 0;
+    /* The response to the baud rate command has left at the old rate. */
+    if (nextBaud != 0) {
+      revertBaud = lineBaud;
+      simSetBaud(nextBaud);
+      revertNs = timeNowNs() + UART_SPEED_REVERT_MS * NSEC_PER_MSEC;
+    }
+  } else if (outHead > sizeof(out) / 2) {
+    memmove(out, out + outHead, outTail - outHead);
+    outTail -= outHead;
+    outHead = 0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Switch the NCP's UART to another rate, and the pace of the line with -r.
+ *  \param[in] baudRate New rate.
+ **************************************************************************************************/
+static void simSetBaud(uint32_t baudRate)
+{
+  lineBaud = baudRate;
+  nextBaud = 0;
+  revertNs = 0;
+  if (lineRate > 0) {
+    lineRate = baudRate / 10.0;
+    lineCredit = 0;
+  }
+  stats.baudChanges++;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Tell whether the line garbles what it carries: with -H, when the host's terminal is
+ *          at another speed than the NCP's UART, or the UART is at the -X rate. The master side
+ *          of a pseudo-terminal reads the settings the host made on the slave side.
+ *  \return  true if bytes are lost.
+ **************************************************************************************************/
+static bool simLineGarbled(void)
+{
+  struct termios tio;
+
+  if (speedMax == 0) {
+    return false;
+  }
+  if (lineBaud == speedBroken) {
+    return true;
+  }
+  return tcgetattr(masterFd, &tio) == 0 && cfgetospeed(&tio) != simBaudSpeed(lineBaud);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Map a numeric baud rate to the termios speed constant, as the host's serial port does.
+ *  \param[in] baudRate Baud rate in bits per second.
+ *  \return  Matching speed_t value, B0 if the rate is not supported.
+ **************************************************************************************************/
+static speed_t simBaudSpeed(uint32_t baudRate)
+{
+  switch (baudRate) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    default:      return B0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Public address of a peer. The first byte is the peer number, the second the -i number.
+ *  \param[in] peer Peer number, 1 to SIM_MAX_PEERS.
+ *  \return  Address.
+ **************************************************************************************************/
+static bd_addr peerAddress(uint8_t peer)
+{
+  bd_addr address = { { peer, simNumber, 0, 0, 0xaa, 0xbb } };
+
+  return address;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Resolvable private address of a peer with -k: the two top bits 01, the first byte the
+ *          peer number, so that it stays recognizable here, then the -i number and the epoch.
+ *  \param[in] peer Peer number, 1 to SIM_MAX_PEERS.
+ *  \param[in] epoch Address lifetimes since the epoch of the clock.
+ *  \return  Address.
+ **************************************************************************************************/
+static bd_addr peerPrivateAddress(uint8_t peer, uint64_t epoch)
+{
+  bd_addr address = { { peer, simNumber, epoch & 0xff, (epoch >> 8) & 0xff, (epoch >> 16) & 0xff,
+                        0x40 | ((epoch >> 24) & 0x3f) } };
+
+  return address;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Bonding handle the NCP has for a peer.
+ *  \param[in] peer Peer number.
+ *  \return  Bonding handle, 0xff if none.
+ **************************************************************************************************/
+static uint8_t peerBonding(uint8_t peer)
+{
+  for (uint8_t i = 0; i < SIM_MAX_BONDS && peer != 0; i++) {
+    if (bondPeers[i] == peer) {
+      return i;
+    }
+  }
+  return 0xff;
+}
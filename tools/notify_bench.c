@@ -0,0 +1,177 @@
+/***********************************************************************************************//**
+ * \file   notify_bench.c
+ * \brief  Sustained throughput benchmark of the notification pipeline
+ ***************************************************************************************************
+ * Usage: notify_bench [-n notifications] [-s payload] [-w sink ns] [-o file]
+ *
+ * One producer pushes notifications for 8 links as fast as it can, like the BGAPI thread would
+ * under a flood, for every overflow policy and 1, 2 and 4 consumers. The callback sink folds
+ * every payload into a checksum and then spins for the given number of nanoseconds per
+ * notification to model a slower consumer. With -o, the file sink is registered as well.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "notify_pipe.h"
+#include "timeutil.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_LINKS                   8
+#define BENCH_CHARACTERISTIC          0x0015
+
+static uint32_t sinkWorkNs = 0;
+
+/** Per-consumer sink counters, one cache line each. */
+static struct {
+  uint64_t checksum;
+  uint64_t delivered;
+  uint8_t pad[48];
+} sinkCounters[NOTIFY_MAX_CONSUMERS];
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void benchSink(const struct notifySlot* slots, uint32_t count, void* ctx);
+static void benchRun(uint32_t notifications, uint8_t payload, uint8_t consumers,
+                     enum notifyOverflow policy, const char* filePath);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  static const enum notifyOverflow policies[] = { NOTIFY_DROP_NEWEST, NOTIFY_DROP_OLDEST, NOTIFY_BLOCK };
+  uint32_t notifications = 2000000;
+  uint32_t payload = 20;
+  const char* filePath = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:w:o:")) != -1) {
+    switch (opt) {
+      case 'n':
+        notifications = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        payload = strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        sinkWorkNs = strtoul(optarg, NULL, 0);
+        break;
+      case 'o':
+        filePath = optarg;
+        break;
+      default:
+        printf("Usage: %s [-n notifications] [-s payload] [-w sink ns] [-o file]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (payload > NOTIFY_SLOT_DATA) {
+    payload = NOTIFY_SLOT_DATA;
+  }
+
+  printf("%u notifications of %u bytes over %d links, sink work %u ns/notification%s\n",
+         notifications, payload, BENCH_LINKS, sinkWorkNs, filePath ? ", plus file sink" : "");
+  printf("%-12s %9s %12s %12s %10s %12s %12s %10s\n", "policy", "consumers", "pushed/s",
+         "delivered/s", "ns/push", "drop newest", "drop oldest", "waits");
+  for (uint8_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+    for (uint8_t consumers = 1; consumers <= NOTIFY_MAX_CONSUMERS; consumers *= 2) {
+      benchRun(notifications, payload, consumers, policies[p], filePath);
+    }
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Callback sink: checksum the payloads and burn the configured time.
+ *  \param[in] slots Notifications.
+ *  \param[in] count Number of notifications.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void benchSink(const struct notifySlot* slots, uint32_t count, void* ctx)
+{
+  uint64_t sum = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint8_t b = 0; b < slots[i].len; b++) {
+      sum += slots[i].data[b];
+    }
+  }
+  if (sinkWorkNs != 0) {
+    uint64_t until = timeNowNs() + (uint64_t)sinkWorkNs * count;
+
+    while (timeNowNs() < until) {
+    }
+  }
+  /* Consumers serve links by handle modulo their count, a divisor of NOTIFY_MAX_CONSUMERS, so
+   * this entry is only ever touched by the consumer running this call. */
+  sinkCounters[slots[0].connection % NOTIFY_MAX_CONSUMERS].checksum += sum;
+  sinkCounters[slots[0].connection % NOTIFY_MAX_CONSUMERS].delivered += count;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Push a flood through a fresh pipeline and print one result line.
+ *  \param[in] notifications Notifications to push.
+ *  \param[in] payload Bytes per notification.
+ *  \param[in] consumers Consumer threads.
+ *  \param[in] policy Overflow policy.
+ *  \param[in] filePath Also write to this file when not NULL.
+ **************************************************************************************************/
+static void benchRun(uint32_t notifications, uint8_t payload, uint8_t consumers,
+                     enum notifyOverflow policy, const char* filePath)
+{
+  static const char* names[] = { "drop-newest", "drop-oldest", "block" };
+  uint8_t data[NOTIFY_SLOT_DATA];
+  struct notifyPipeStats stats;
+  uint64_t startNs;
+  uint64_t pushNs;
+  uint64_t endNs;
+  uint64_t delivered = 0;
+
+  memset(data, 0xa5, sizeof(data));
+  memset(sinkCounters, 0, sizeof(sinkCounters));
+  if (notifyPipeAddSink(benchSink, NULL) < 0
+      || (filePath != NULL && notifyPipeAddFileSink(filePath) < 0)
+      || notifyPipeStart(consumers, policy) < 0) {
+    printf("Error!!! Could not start the notification pipeline\n");
+    exit(EXIT_FAILURE);
+  }
+
+  startNs = timeNowNs();
+  for (uint32_t i = 0; i < notifications; i++) {
+    memcpy(data, &i, sizeof(i));
+    notifyPipePush(i % BENCH_LINKS, BENCH_CHARACTERISTIC, startNs, data, payload);
+  }
+  pushNs = timeNowNs() - startNs;
+  notifyPipeGetStats(&stats);
+  notifyPipeStop();
+  endNs = timeNowNs() - startNs;
+  for (uint8_t c = 0; c < NOTIFY_MAX_CONSUMERS; c++) {
+    delivered += sinkCounters[c].delivered;
+  }
+
+  printf("%-12s %9u %12.0f %12.0f %10.1f %12llu %12llu %10llu\n", names[policy], consumers,
+         notifications / (pushNs / 1e9), delivered / (endNs / 1e9),
+         (double)pushNs / notifications, (unsigned long long)stats.droppedNewest,
+         (unsigned long long)stats.droppedOldest, (unsigned long long)stats.blockedWaits);
+}
@@ -0,0 +1,252 @@
+/***********************************************************************************************//**
+ * \file   shm_bench.c
+ * \brief  Latency and throughput benchmark of the shared memory ring
+ ***************************************************************************************************
+ * Usage: shm_bench [-n records] [-r rate] [-s payload]
+ *
+ * One writer publishes records into a fresh segment while 1, 2 and 4 reader threads follow it
+ * with the reader library, first as fast as it can, then paced at the given rate per second.
+ * Readers poll, yielding the CPU while the ring is empty, and take the time from the record's
+ * timestamp, set just before it was published, to their copy of it. Flat out, the writer laps
+ * readers that fall behind, which shows in the lost column; paced, no reader should lose any.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "infrastructure.h"
+#include "shm_ring.h"
+#include "timeutil.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_MAX_READERS             4
+
+/** Latency histogram: 50 ns buckets up to 1 ms, and one for everything slower. */
+#define BENCH_BUCKET_NS               50
+#define BENCH_BUCKETS                 20001
+
+/** One reader thread. */
+struct benchReader {
+  pthread_t thread;
+  const char* name;
+  uint64_t read;
+  uint64_t lost;
+  uint64_t checksum;
+  uint64_t latencySumNs;
+  uint64_t latencyMaxNs;
+  uint64_t startNs;
+  uint64_t endNs;
+  uint32_t buckets[BENCH_BUCKETS];
+};
+
+static struct benchReader readers[BENCH_MAX_READERS];
+
+/** Readers attached to the segment of the current run. */
+static uint32_t readersReady;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void* benchReaderThread(void* arg);
+static void benchRun(const char* name, uint32_t records, uint32_t rate, uint8_t payload, uint8_t count);
+static uint64_t benchPercentile(uint8_t count, uint64_t total, double fraction);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  uint32_t records = 1000000;
+  uint32_t rate = 20000;
+  uint32_t payload = 20;
+  char name[32];
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        records = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        rate = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        payload = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        printf("Usage: %s [-n records] [-r rate] [-s payload]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (payload > UINT8_MAX) {
+    payload = UINT8_MAX;
+  }
+  snprintf(name, sizeof(name), "shm_bench.%d", (int)getpid());
+
+  printf("%u records of %u bytes, ring of %d slots, %ld CPUs\n", records, payload, SHM_RING_SLOTS,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%7s %10s %12s %12s %10s %10s %10s %10s %10s\n", "readers", "rate", "written/s",
+         "read/s", "lost", "avg us", "p50 us", "p99 us", "max us");
+  for (uint8_t count = 1; count <= BENCH_MAX_READERS; count *= 2) {
+    benchRun(name, records, 0, payload, count);
+  }
+  for (uint8_t count = 1; count <= BENCH_MAX_READERS && rate > 0; count *= 2) {
+    benchRun(name, MIN(records, rate * 5), rate, payload, count);
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Reader thread: follow the segment until the writer closes it.
+ *  \param[in] arg The reader.
+ *  \return  NULL.
+ **************************************************************************************************/
+static void* benchReaderThread(void* arg)
+{
+  struct benchReader* reader = arg;
+  struct shmRingReader ring;
+  struct shmRecord record;
+  uint64_t latencyNs;
+  int ret;
+
+  if (shmRingOpen(&ring, reader->name) < 0) {
+    printf("Error!!! Could not open the segment %s\n", reader->name);
+    exit(EXIT_FAILURE);
+  }
+  __atomic_add_fetch(&readersReady, 1, __ATOMIC_RELEASE);
+  while ((ret = shmRingRead(&ring, &record)) >= 0) {
+    if (ret == 0) {
+      sched_yield();
+      continue;
+    }
+    latencyNs = timeNowNs() - record.tsNs;
+    if (reader->read++ == 0) {
+      reader->startNs = record.tsNs;
+    }
+    reader->checksum += record.data[0];
+    reader->latencySumNs += latencyNs;
+    reader->latencyMaxNs = MAX(reader->latencyMaxNs, latencyNs);
+    reader->buckets[MIN(latencyNs / BENCH_BUCKET_NS, BENCH_BUCKETS - 1)]++;
+  }
+  reader->endNs = timeNowNs();
+  reader->lost = ring.lost;
+  shmRingClose(&ring);
+  return NULL;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Publish records to a fresh segment followed by the given readers and print one
+ *          result line.
+ *  \param[in] name Segment name.
+ *  \param[in] records Records to publish.
+ *  \param[in] rate Records per second, 0 for as fast as possible.
+ *  \param[in] payload Bytes per record.
+ *  \param[in] count Reader threads.
+ **************************************************************************************************/
+static void benchRun(const char* name, uint32_t records, uint32_t rate, uint8_t payload, uint8_t count)
+{
+  struct shmRingWriter writer;
+  struct shmRecord* record;
+  uint64_t startNs;
+  uint64_t writeNs;
+  uint64_t readNs = 0;
+  uint64_t read = 0;
+  uint64_t lost = 0;
+  uint64_t latencySumNs = 0;
+  uint64_t latencyMaxNs = 0;
+
+  if (shmRingCreate(&writer, name, 0) < 0) {
+    printf("Error!!! Could not create the segment %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  memset(readers, 0, sizeof(readers));
+  readersReady = 0;
+  for (uint8_t r = 0; r < count; r++) {
+    readers[r].name = name;
+    if (pthread_create(&readers[r].thread, NULL, benchReaderThread, &readers[r]) != 0) {
+      printf("Error!!! Could not start the reader threads\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  while (__atomic_load_n(&readersReady, __ATOMIC_ACQUIRE) < count) {
+    sched_yield();
+  }
+
+  startNs = timeNowNs();
+  for (uint32_t i = 0; i < records; i++) {
+    if (rate > 0) {
+      uint64_t dueNs = startNs + (uint64_t)i * NSEC_PER_SEC / rate;
+
+      while (timeNowNs() < dueNs) {
+        sched_yield();
+      }
+    }
+    record = shmRingBegin(&writer);
+    record->type = SHM_RECORD_NOTIFY;
+    record->connection = i % 8;
+    record->characteristic = 0x0015;
+    record->len = payload;
+    memset(record->data, (uint8_t)i, payload);
+    record->tsNs = timeNowNs();
+    shmRingCommit(&writer);
+  }
+  writeNs = timeNowNs() - startNs;
+  shmRingDestroy(&writer);
+
+  for (uint8_t r = 0; r < count; r++) {
+    pthread_join(readers[r].thread, NULL);
+    read += readers[r].read;
+    lost += readers[r].lost;
+    latencySumNs += readers[r].latencySumNs;
+    latencyMaxNs = MAX(latencyMaxNs, readers[r].latencyMaxNs);
+    readNs = MAX(readNs, readers[r].endNs - readers[r].startNs);
+  }
+
+  printf("%7u %10u %12.0f %12.0f %10llu %10.2f %10.2f %10.2f %10.2f\n", count, rate,
+         records / (writeNs / 1e9), readNs ? read / (readNs / 1e9) : 0.0, (unsigned long long)lost,
+         read ? latencySumNs / 1e3 / read : 0.0, benchPercentile(count, read, 0.5) / 1e3,
+         benchPercentile(count, read, 0.99) / 1e3, latencyMaxNs / 1e3);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Latency below which the given fraction of the records read by all readers fell.
+ *  \param[in] count Reader threads of the run.
+ *  \param[in] total Records read by all of them.
+ *  \param[in] fraction Fraction, 0 to 1.
+ *  \return  The upper bound of the bucket, in nanoseconds.
+ **************************************************************************************************/
+static uint64_t benchPercentile(uint8_t count, uint64_t total, double fraction)
+{
+  uint64_t seen = 0;
+
+  for (uint32_t b = 0; b < BENCH_BUCKETS; b++) {
+    for (uint8_t r = 0; r < count; r++) {
+      seen += readers[r].buckets[b];
+    }
+    if (seen >= total * fraction) {
+      return (uint64_t)(b + 1) * BENCH_BUCKET_NS;
+    }
+  }
+  return (uint64_t)BENCH_BUCKETS * BENCH_BUCKET_NS;
+}
@@ -0,0 +1,450 @@
+/***********************************************************************************************//**
+ * \file   timer_bench.c
+ * \brief  Accuracy, jitter and CPU cost of the timer wheel against the job count
+ ***************************************************************************************************
+ * Usage: timer_bench [-t seconds] [-o one-shot percent]
+ *
+ * For growing numbers of jobs, runs the event loop for the given seconds with that many jobs of
+ * the kind the application schedules per link: periodic jobs of 10 ms to 1 s, half of them on the
+ * phase of timerWheelAlign() and half on a random one, and a share of one-shot jobs of up to 2 s
+ * that are added again when they run, like connect timeouts and reconnect backoffs. One periodic
+ * run in 16 also cancels a one-shot job and adds it again with a new delay.
+ *
+ * Each row is run twice: with the timer wheel, and with a single 1 ms event loop timer that checks
+ * every job in turn, the way one soft timer used to drive the writes of every link. Lateness is
+ * the time from the ideal due time to the handler, jitter the distance of the interval between
+ * two runs of a periodic job from its period; the wheel rounds due times to its 1 ms tick. The
+ * CPU time is the process's, per run and as a share of a core. Add and cancel are timed apart,
+ * on a wheel holding the row's jobs.
+ *
+ * Before the rows, a check holds the thread up for STALL_MS in a handler while a periodic job of
+ * STALL_PERIOD_MS is due, and fails the program if the job then runs more than once in a pass of
+ * the wheel, catching up with the runs it missed.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "infrastructure.h"
+#include "event_loop.h"
+#include "timer_wheel.h"
+#include "timeutil.h"
+#include "bench_util.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_MAX_JOBS                16000
+
+/** Histogram of lateness and jitter: 10 us buckets up to 50 ms, the last one for the rest. */
+#define BENCH_BUCKET_US               10
+#define BENCH_BUCKETS                 5001
+
+/** Longest delay of a one-shot job. */
+#define BENCH_ONESHOT_MAX_MS          2000
+
+/** Stall check: the periodic job, the stall, and how long the check runs. */
+#define STALL_PERIOD_MS               10
+#define STALL_MS                      105
+#define STALL_CHECK_MS                200
+
+/** One job of the benchmark. */
+struct benchJob {
+  int id;                       /**< timer wheel job, -1 if none */
+  uint32_t periodMs;            /**< 0 for a one-shot job */
+  uint64_t dueNs;               /**< ideal time of the next run, UINT64_MAX if none */
+  uint64_t lastNs;              /**< time of the previous run, 0 before the first */
+};
+
+/** Latency samples. */
+struct benchHistogram {
+  uint32_t buckets[BENCH_BUCKETS];
+  uint64_t count;
+  uint64_t sumNs;
+  uint64_t maxNs;
+};
+
+static struct benchJob jobs[BENCH_MAX_JOBS];
+static uint32_t jobCount;
+static uint32_t oneShotCount;
+static bool useWheel;
+static struct benchHistogram late;
+static struct benchHistogram jitter;
+static uint64_t runs;
+static uint64_t scanPasses;
+static uint64_t scanBatches;
+
+/** Stall check: runs of the periodic job, and those that shared a pass with the previous one. */
+static struct {
+  uint32_t runs;
+  uint32_t repeats;
+  uint64_t lastWakeup;
+} stall;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void benchSchedule(uint32_t index, uint32_t delayMs);
+static void benchCancel(uint32_t index);
+static void benchRecord(struct benchHistogram* histogram, uint64_t ns);
+static double benchPercentile(const struct benchHistogram* histogram, double fraction);
+static void benchRunJob(uint32_t index, uint64_t nowNs);
+static void onJob(int jobId, void* ctx);
+static void onScanTimer(int timerId, void* ctx);
+static void onStopTimer(int timerId, void* ctx);
+static void benchRow(uint32_t count, uint32_t seconds, uint32_t oneShotPercent, bool wheel);
+static double benchAddCancel(uint32_t count);
+static void onStallJob(int jobId, void* ctx);
+static void onStall(int jobId, void* ctx);
+static bool benchStallCheck(void);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  static const uint32_t jobCounts[] = { 16, 1000, 4000, BENCH_MAX_JOBS };
+  uint32_t seconds = 5;
+  uint32_t oneShotPercent = 25;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:o:")) != -1) {
+    switch (opt) {
+      case 't':
+        seconds = MAX(atoi(optarg), 1);
+        break;
+      case 'o':
+        oneShotPercent = MIN((uint32_t)atoi(optarg), 100);
+        break;
+      default:
+        printf("Usage: %s [-t seconds] [-o one-shot percent]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (!benchStallCheck()) {
+    return 1;
+  }
+  printf("%u s per row, %u%% one-shot jobs, %u ms tick\n", seconds, oneShotPercent, TIMER_WHEEL_TICK_MS);
+  printf(" jobs  mode   add+cancel ns  runs/s  runs/pass  wakeups/s  late avg/p99/max us   "
+         "jitter avg/p99 us  cpu ns/run  cpu %%\n");
+  for (uint32_t c = 0; c < sizeof(jobCounts) / sizeof(jobCounts[0]); c++) {
+    benchRow(jobCounts[c], seconds, oneShotPercent, true);
+    benchRow(jobCounts[c], seconds, oneShotPercent, false);
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Schedule a job for its first run.
+ *  \param[in] index Job index.
+ *  \param[in] delayMs Time until the run.
+ **************************************************************************************************/
+static void benchSchedule(uint32_t index, uint32_t delayMs)
+{
+  struct benchJob* job = &jobs[index];
+
+  job->dueNs = timeNowNs() + (uint64_t)delayMs * NSEC_PER_MSEC;
+  job->lastNs = 0;
+  if (useWheel) {
+    job->id = timerWheelAdd(delayMs, job->periodMs, onJob, (void*)(uintptr_t)index);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Cancel a job.
+ *  \param[in] index Job index.
+ **************************************************************************************************/
+static void benchCancel(uint32_t index)
+{
+  if (useWheel) {
+    timerWheelCancel(jobs[index].id);
+    jobs[index].id = -1;
+  }
+  jobs[index].dueNs = UINT64_MAX;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Add a sample to a histogram.
+ *  \param[in] histogram Histogram.
+ *  \param[in] ns Sample in nanoseconds.
+ **************************************************************************************************/
+static void benchRecord(struct benchHistogram* histogram, uint64_t ns)
+{
+  histogram->buckets[MIN(ns / NSEC_PER_USEC / BENCH_BUCKET_US, BENCH_BUCKETS - 1)]++;
+  histogram->count++;
+  histogram->sumNs += ns;
+  histogram->maxNs = MAX(histogram->maxNs, ns);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Percentile of a histogram, to the upper bound of its bucket.
+ *  \param[in] histogram Histogram.
+ *  \param[in] fraction 0 to 1.
+ *  \return  The percentile in microseconds.
+ **************************************************************************************************/
+static double benchPercentile(const struct benchHistogram* histogram, double fraction)
+{
+  uint64_t target = (uint64_t)(histogram->count * fraction);
+  uint64_t seen = 0;
+
+  for (uint32_t i = 0; i < BENCH_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen > target) {
+      return (i + 1) * BENCH_BUCKET_US;
+    }
+  }
+  return histogram->maxNs / 1e3;
+}
+
+/***********************************************************************************************//**
+ *  \brief  A job ran: record its lateness and jitter, and reschedule it.
+ *  \param[in] index Job index.
+ *  \param[in] nowNs Current time.
+ **************************************************************************************************/
+static void benchRunJob(uint32_t index, uint64_t nowNs)
+{
+  struct benchJob* job = &jobs[index];
+
+  runs++;
+  benchRecord(&late, nowNs - MIN(nowNs, job->dueNs));
+  if (job->periodMs == 0) {
+    /* Like a connect timeout of the next attempt. */
+    job->id = -1;
+    benchSchedule(index, 1 + rng() % BENCH_ONESHOT_MAX_MS);
+    return;
+  }
+  if (job->lastNs != 0) {
+    uint64_t intervalNs = nowNs - job->lastNs;
+    uint64_t periodNs = (uint64_t)job->periodMs * NSEC_PER_MSEC;
+
+    benchRecord(&jitter, intervalNs > periodNs ? intervalNs - periodNs : periodNs - intervalNs);
+  }
+  job->lastNs = nowNs;
+  job->dueNs += (uint64_t)job->periodMs * NSEC_PER_MSEC;
+  if (job->dueNs <= nowNs) {
+    job->dueNs = nowNs + (uint64_t)job->periodMs * NSEC_PER_MSEC;
+  }
+  if (oneShotCount > 0 && rng() % 16 == 0) {
+    /* Like a link opening before its timeout: cancel, and add the next. */
+    uint32_t other = jobCount - oneShotCount + rng() % oneShotCount;
+
+    benchCancel(other);
+    benchSchedule(other, 1 + rng() % BENCH_ONESHOT_MAX_MS);
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Timer wheel job.
+ *  \param[in] jobId Job that fell due.
+ *  \param[in] ctx Job index.
+ **************************************************************************************************/
+static void onJob(int jobId, void* ctx)
+{
+  benchRunJob((uintptr_t)ctx, timeNowNs());
+}
+
+/***********************************************************************************************//**
+ *  \brief  1 ms event loop timer of the scan mode: run every job that is due.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onScanTimer(int timerId, void* ctx)
+{
+  uint64_t nowNs = timeNowNs();
+  uint64_t before = runs;
+
+  scanPasses++;
+  for (uint32_t i = 0; i < jobCount; i++) {
+    if (jobs[i].dueNs <= nowNs) {
+      /* The clock is read for every run, as in the wheel mode. */
+      benchRunJob(i, timeNowNs());
+    }
+  }
+  if (runs != before) {
+    scanBatches++;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  End of a row.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStopTimer(int timerId, void* ctx)
+{
+  evloopStop();
+}
+
+/***********************************************************************************************//**
+ *  \brief  Run the jobs of a row and print it.
+ *  \param[in] count Number of jobs.
+ *  \param[in] seconds Run time.
+ *  \param[in] oneShotPercent Share of one-shot jobs.
+ *  \param[in] wheel true for the timer wheel, false for the 1 ms scan.
+ **************************************************************************************************/
+static void benchRow(uint32_t count, uint32_t seconds, uint32_t oneShotPercent, bool wheel)
+{
+  static const uint32_t periods[] = { 10, 20, 50, 100, 100, 200, 250, 500, 1000 };
+  double addCancelNs = wheel ? benchAddCancel(count) : 0.0;
+  uint64_t wakeups, cpuNs, wallNs;
+  double elapsed;
+
+  evloopInit();
+  if (wheel && timerWheelInit(count) < 0) {
+    printf("Timer wheel init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  useWheel = wheel;
+  jobCount = count;
+  oneShotCount = count * oneShotPercent / 100;
+  runs = 0;
+  scanPasses = 0;
+  scanBatches = 0;
+  memset(&late, 0, sizeof(late));
+  memset(&jitter, 0, sizeof(jitter));
+  /* The same jobs in both modes. */
+  rngState = BENCH_RNG_SEED ^ count;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t periodMs = i < count - oneShotCount ? periods[rng() % COUNTOF(periods)] : 0;
+
+    jobs[i].id = -1;
+    jobs[i].periodMs = periodMs;
+    if (periodMs == 0) {
+      benchSchedule(i, 1 + rng() % BENCH_ONESHOT_MAX_MS);
+    } else {
+      benchSchedule(i, i % 2 == 0 ? timerWheelAlign(periodMs) : 1 + rng() % periodMs);
+    }
+  }
+  if (!wheel) {
+    evloopAddTimer(TIMER_WHEEL_TICK_MS, true, onScanTimer, NULL);
+  }
+  evloopAddTimer(seconds * 1000, false, onStopTimer, NULL);
+
+  wakeups = evloopGetStats()->wakeups;
+  cpuNs = timeCpuNs();
+  wallNs = timeNowNs();
+  evloopRun();
+  cpuNs = timeCpuNs() - cpuNs;
+  wallNs = timeNowNs() - wallNs;
+  wakeups = evloopGetStats()->wakeups - wakeups;
+  elapsed = wallNs / 1e9;
+
+  if (wheel) {
+    const struct timerWheelStats* stats = timerWheelGetStats();
+
+    printf("%5u  wheel  %13.1f", count, addCancelNs);
+    printf("  %6.0f  %9.1f", runs / elapsed, stats->passes ? (double)stats->fired / stats->passes : 0.0);
+    timerWheelClose();
+  } else {
+    printf("%5u  scan   %13s", count, "-");
+    printf("  %6.0f  %9.1f", runs / elapsed, scanBatches ? (double)runs / scanBatches : 0.0);
+  }
+  printf("  %9.0f  %7.1f/%5.0f/%6.0f  %9.1f/%6.0f  %10.0f  %5.1f\n",
+         wakeups / elapsed,
+         late.count ? late.sumNs / 1e3 / late.count : 0.0, benchPercentile(&late, 0.99), late.maxNs / 1e3,
+         jitter.count ? jitter.sumNs / 1e3 / jitter.count : 0.0, benchPercentile(&jitter, 0.99),
+         runs ? (double)cpuNs / runs : 0.0, wallNs ? 100.0 * cpuNs / wallNs : 0.0);
+  fflush(stdout);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Time adding and cancelling jobs on a wheel that holds the given number of jobs.
+ *  \param[in] count Number of jobs.
+ *  \return  Nanoseconds per add and cancel pair.
+ **************************************************************************************************/
+static double benchAddCancel(uint32_t count)
+{
+  static int ids[BENCH_MAX_JOBS];
+  uint32_t rounds = MAX(1000000 / count, 1);
+  uint64_t startNs, elapsedNs;
+
+  evloopInit();
+  if (timerWheelInit(count) < 0) {
+    printf("Timer wheel init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  startNs = timeNowNs();
+  for (uint32_t r = 0; r < rounds; r++) {
+    for (uint32_t i = 0; i < count; i++) {
+      ids[i] = timerWheelAdd(1 + rng() % BENCH_ONESHOT_MAX_MS, 0, onJob, NULL);
+    }
+    /* In another order than added. */
+    for (uint32_t i = 0; i < count; i++) {
+      timerWheelCancel(ids[(i * 7919) % count]);
+    }
+  }
+  elapsedNs = timeNowNs() - startNs;
+  timerWheelClose();
+  return (double)elapsedNs / ((uint64_t)rounds * count);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Periodic job of the stall check: count the runs that share a pass with the previous.
+ *  \param[in] jobId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStallJob(int jobId, void* ctx)
+{
+  uint64_t wakeup = timerWheelGetStats()->wakeups;
+
+  if (stall.runs > 0 && wakeup == stall.lastWakeup) {
+    stall.repeats++;
+  }
+  stall.runs++;
+  stall.lastWakeup = wakeup;
+}
+
+/***********************************************************************************************//**
+ *  \brief  One-shot job of the stall check: hold the thread up.
+ *  \param[in] jobId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onStall(int jobId, void* ctx)
+{
+  usleep(STALL_MS * 1000);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Hold the wheel up past several periods of a periodic job, and check that the job
+ *          runs once when the wheel catches up, not once per period missed.
+ *  \return  true if it does.
+ **************************************************************************************************/
+static bool benchStallCheck(void)
+{
+  evloopInit();
+  if (timerWheelInit(2) < 0) {
+    printf("Timer wheel init failure\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(&stall, 0, sizeof(stall));
+  timerWheelAdd(STALL_PERIOD_MS, STALL_PERIOD_MS, onStallJob, NULL);
+  timerWheelAdd(STALL_PERIOD_MS * 2 + STALL_PERIOD_MS / 2, 0, onStall, NULL);
+  evloopAddTimer(STALL_CHECK_MS, false, onStopTimer, NULL);
+  evloopRun();
+  timerWheelClose();
+
+  /* Without the stall, one run per period; the runs missed while held up are dropped. */
+  printf("stall check: %u ms stall, %u runs of a %u ms job in %u ms, %u sharing a pass: %s\n",
+         STALL_MS, stall.runs, STALL_PERIOD_MS, STALL_CHECK_MS, stall.repeats,
+         stall.repeats == 0 && stall.runs < STALL_CHECK_MS / STALL_PERIOD_MS ? "ok" : "FAILED");
+  return stall.repeats == 0 && stall.runs < STALL_CHECK_MS / STALL_PERIOD_MS;
+}
@@ -0,0 +1,540 @@
+/***********************************************************************************************//**
+ * \file   uart_bench.c
+ * \brief  Saturate the UART link to the NCP at each baud rate it accepts
+ ***************************************************************************************************
+ * Usage: uart_bench [-r rates] [-t seconds] [-n hellos] <port> <baud> [flow control]
+ *
+ * Talks raw BGAPI to an NCP, or to ncpsim -H, that boots at the given rate. For each rate of the
+ * list (default 115200,230400,460800,921600), lowest first, it moves the line there with the
+ * baud rate user command of uart_speed.h and confirms it with a hello. It then times the given
+ * number of hellos on the idle line, starts discovery and, for the given seconds, counts the
+ * frames and bytes the NCP sends while one hello at a time keeps timing the round trip behind
+ * them. One line per rate gives the frames/s, bytes/s and the share of the line they use, and
+ * the round trips idle and loaded. Against ncpsim, -b and -B set how much there is to hear, and
+ * -r paces the line at the rate in use. The line is returned to the boot rate at the end.
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* BG stack headers */
+#include "gecko_bglib.h"
+
+#include "infrastructure.h"
+#include "timeutil.h"
+#include "uart_speed.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+#define BENCH_DEFAULT_RATES           "115200,230400,460800,921600"
+
+/** Round trips timed at most per rate, idle and loaded each. */
+#define BENCH_MAX_SAMPLES             100000
+
+/** Time allowed for a response outside the rate steps. */
+#define BENCH_RESPONSE_MS             1000
+
+/** Outcome of a rate change. */
+enum benchSwitch {
+  BENCH_SWITCHED,
+  BENCH_REFUSED,                /**< the NCP cannot run at the rate */
+  BENCH_NO_ANSWER,              /**< no hello at the new rate, back at the old one */
+  BENCH_FAILED                  /**< no baud rate command, or the line is lost */
+};
+
+/** Round trip samples in milliseconds. */
+struct benchSamples {
+  double ms[BENCH_MAX_SAMPLES];
+  uint32_t count;
+};
+
+static int fd = -1;
+static uint32_t lineBaud;
+static uint8_t rx[4096];
+static uint32_t rxLen = 0;
+static struct gecko_cmd_packet pkt;
+static struct benchSamples idle;
+static struct benchSamples loaded;
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static speed_t benchSpeed(uint32_t baudRate);
+static int benchOpen(const char* port, uint32_t baudRate, bool rtsCts);
+static int benchSetBaud(uint32_t baudRate);
+static void benchSend(uint32_t id, uint32_t len);
+static int benchReceive(uint32_t id, uint32_t timeoutMs, uint32_t* bytes, uint32_t* frames);
+static bool benchHello(uint32_t timeoutMs, double* ms);
+static enum benchSwitch benchSwitch(uint32_t baudRate);
+static void benchRun(uint32_t baudRate, uint32_t seconds, uint32_t hellos);
+static double benchPercentile(struct benchSamples* samples, double fraction);
+static double benchAverage(const struct benchSamples* samples);
+static int compareMs(const void* a, const void* b);
+static int compareRates(const void* a, const void* b);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  The main program.
+ *  \param[in] argc Argument count.
+ *  \param[in] argv Options, port, boot baud rate and flow control.
+ *  \return  0 on success, 1 on failure.
+ **************************************************************************************************/
+int main(int argc, char* argv[])
+{
+  struct uartSpeedRates rates;
+  const char* list = BENCH_DEFAULT_RATES;
+  uint32_t seconds = 5;
+  uint32_t hellos = 200;
+  uint32_t bootBaud;
+  double ms;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:t:n:")) != -1) {
+    switch (opt) {
+      case 'r':
+        list = optarg;
+        break;
+      case 't':
+        seconds = strtoul(optarg, NULL, 0);
+        break;
+      case 'n':
+        hellos = MIN(strtoul(optarg, NULL, 0), BENCH_MAX_SAMPLES);
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  /* The same list syntax as BLECentral -H, checked against the same speed table. */
+  rates.count = 0;
+  for (const char* p = list; *p != '\0' && rates.count < UART_SPEED_MAX_RATES; ) {
+    char* end;
+
+    rates.rates[rates.count] = strtoul(p, &end, 10);
+    if (end == p || benchSpeed(rates.rates[rates.count]) == B0) {
+      rates.count = 0;
+      break;
+    }
+    rates.count++;
+    p = *end == ',' ? end + 1 : end;
+  }
+  if (optind + 2 > argc || optind + 3 < argc || rates.count == 0) {
+    printf("Usage: %s [-r rates] [-t seconds] [-n hellos] <port> <baud> [flow control]\n", argv[0]);
+    return 1;
+  }
+  bootBaud = strtoul(argv[optind + 1], NULL, 0);
+  if (benchOpen(argv[optind], bootBaud, optind + 2 < argc && atoi(argv[optind + 2]) != 0) < 0) {
+    return 1;
+  }
+  if (!benchHello(BENCH_RESPONSE_MS, &ms)) {
+    printf("Error!!! No answer from the NCP on %s at %u baud\n", argv[optind], bootBaud);
+    return 1;
+  }
+
+  qsort(rates.rates, rates.count, sizeof(rates.rates[0]), compareRates);
+  for (uint8_t i = 1, kept = 1; i <= rates.count; i++) {
+    if (i == rates.count) {
+      rates.count = kept;
+    } else if (rates.rates[i] != rates.rates[kept - 1]) {
+      rates.rates[kept++] = rates.rates[i];
+    }
+  }
+
+  printf("%8s %10s %10s %12s %6s %10s %10s %10s %10s\n", "baud", "line B/s", "frames/s", "bytes/s",
+         "use %", "idle ms", "idle p99", "load ms", "load p99");
+  for (uint8_t i = 0; i < rates.count; i++) {
+    uint32_t rate = rates.rates[i];
+    enum benchSwitch result = BENCH_SWITCHED;
+
+    if (rate != lineBaud) {
+      result = benchSwitch(rate);
+    }
+    if (result == BENCH_FAILED) {
+      return 1;
+    }
+    if (result != BENCH_SWITCHED) {
+      printf("%8u %s\n", rate, result == BENCH_REFUSED ? "refused by the NCP" : "no answer at this rate");
+      continue;
+    }
+    benchRun(rate, seconds, hellos);
+  }
+  if (lineBaud != bootBaud && benchSwitch(bootBaud) != BENCH_SWITCHED) {
+    printf("Error!!! Could not return the NCP to %u baud\n", bootBaud);
+    return 1;
+  }
+  close(fd);
+  return 0;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Map a numeric baud rate to the termios speed constant, as the host's serial port does.
+ *  \param[in] baudRate Baud rate in bits per second.
+ *  \return  Matching speed_t value, B0 if the rate is not supported.
+ **************************************************************************************************/
+static speed_t benchSpeed(uint32_t baudRate)
+{
+  switch (baudRate) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+#ifdef B460800
+    case 460800:  return B460800;
+#endif
+#ifdef B921600
+    case 921600:  return B921600;
+#endif
+#ifdef B1000000
+    case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+    case 2000000: return B2000000;
+#endif
+    default:      return B0;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Open the port raw, 8N1.
+ *  \param[in] port Device path.
+ *  \param[in] baudRate Rate the NCP boots at.
+ *  \param[in] rtsCts Enable hardware flow control.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int benchOpen(const char* port, uint32_t baudRate, bool rtsCts)
+{
+  struct termios options;
+
+  fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || tcgetattr(fd, &options) < 0) {
+    printf("Error!!! Could not open %s - %s(%d)\n", port, strerror(errno), errno);
+    return -1;
+  }
+  cfmakeraw(&options);
+  options.c_cflag |= (CLOCAL | CREAD);
+  options.c_cflag &= ~CSTOPB;
+#ifdef CRTSCTS
+  if (rtsCts) {
+    options.c_cflag |= CRTSCTS;
+  } else {
+    options.c_cflag &= ~CRTSCTS;
+  }
+#endif
+  options.c_cc[VMIN] = 0;
+  options.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &options) < 0 || benchSetBaud(baudRate) < 0) {
+    printf("Error!!! Could not configure %s at %u baud\n", port, baudRate);
+    return -1;
+  }
+  tcflush(fd, TCIOFLUSH);
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move the host side of the line to another rate, dropping what arrived at the old one.
+ *  \param[in] baudRate New rate.
+ *  \return  0 on success, -1 on failure.
+ **************************************************************************************************/
+static int benchSetBaud(uint32_t baudRate)
+{
+  struct termios options;
+  speed_t speed = benchSpeed(baudRate);
+
+  if (speed == B0 || tcgetattr(fd, &options) < 0) {
+    return -1;
+  }
+  cfsetispeed(&options, speed);
+  cfsetospeed(&options, speed);
+  if (tcsetattr(fd, TCSADRAIN, &options) < 0) {
+    return -1;
+  }
+  tcflush(fd, TCIFLUSH);
+  rxLen = 0;
+  lineBaud = baudRate;
+  return 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Send the command built in pkt.
+ *  \param[in] id Message ID.
+ *  \param[in] len Payload length.
+ **************************************************************************************************/
+static void benchSend(uint32_t id, uint32_t len)
+{
+  uint32_t sent = 0;
+
+  pkt.header = id | ((len & 0xff) << 8) | ((len >> 8) & 0x7);
+  while (sent < BGLIB_MSG_HEADER_LEN + len) {
+    ssize_t n = write(fd, (uint8_t*)&pkt + sent, BGLIB_MSG_HEADER_LEN + len - sent);
+
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+      printf("Error!!! Write failed - %s(%d)\n", strerror(errno), errno);
+      exit(EXIT_FAILURE);
+    }
+    if (n < 0) {
+      struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+      poll(&pfd, 1, 10);
+      continue;
+    }
+    sent += n;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Read frames until the response to the given command, counting everything received.
+ *          Bytes that do not start a BGAPI frame are dropped one at a time.
+ *  \param[in] id Message ID of the command, 0 to only read until the time is up.
+ *  \param[in] timeoutMs Time to wait.
+ *  \param[in,out] bytes Bytes of the frames received, may be NULL.
+ *  \param[in,out] frames Frames received, may be NULL.
+ *  \return  1 when the response is in pkt, 0 on timeout.
+ **************************************************************************************************/
+static int benchReceive(uint32_t id, uint32_t timeoutMs, uint32_t* bytes, uint32_t* frames)
+{
+  uint64_t deadlineNs = timeNowNs() + timeoutMs * NSEC_PER_MSEC;
+
+  for (;;) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint32_t header;
+    uint32_t len;
+    uint64_t now;
+
+    while (rxLen >= BGLIB_MSG_HEADER_LEN) {
+      memcpy(&header, rx, sizeof(header));
+      len = BGLIB_MSG_LEN(header);
+      if ((rx[0] & 0x78) != gecko_dev_type_gecko || len > BGLIB_MSG_MAX_PAYLOAD) {
+        memmove(rx, rx + 1, --rxLen);
+        continue;
+      }
+      if (rxLen < BGLIB_MSG_HEADER_LEN + len) {
+        break;
+      }
+      memcpy(&pkt, rx, BGLIB_MSG_HEADER_LEN + len);
+      rxLen -= BGLIB_MSG_HEADER_LEN + len;
+      memmove(rx, rx + BGLIB_MSG_HEADER_LEN + len, rxLen);
+      if (bytes != NULL) {
+        *bytes += BGLIB_MSG_HEADER_LEN + len;
+      }
+      if (frames != NULL) {
+        (*frames)++;
+      }
+      if (id != 0 && BGLIB_MSG_ID(header) == id) {
+        return 1;
+      }
+    }
+
+    now = timeNowNs();
+    if (now >= deadlineNs) {
+      return 0;
+    }
+    if (poll(&pfd, 1, (deadlineNs - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC) > 0) {
+      ssize_t n = read(fd, rx + rxLen, sizeof(rx) - rxLen);
+
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        printf("Error!!! The line closed\n");
+        exit(EXIT_FAILURE);
+      }
+      rxLen += n > 0 ? n : 0;
+    }
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  Time one hello round trip.
+ *  \param[in] timeoutMs Time to wait for the response.
+ *  \param[out] ms Round trip in milliseconds.
+ *  \return  true if the NCP answered.
+ **************************************************************************************************/
+static bool benchHello(uint32_t timeoutMs, double* ms)
+{
+  uint64_t startNs = timeNowNs();
+
+  benchSend(gecko_cmd_system_hello_id, 0);
+  if (!benchReceive(gecko_rsp_system_hello_id, timeoutMs, NULL, NULL)) {
+    return false;
+  }
+  *ms = (timeNowNs() - startNs) / 1e6;
+  return true;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move both sides of the line to another rate, following the protocol of uart_speed.h.
+ *  \param[in] baudRate New rate.
+ *  \return  The outcome; on anything but BENCH_SWITCHED the line is at the old rate.
+ **************************************************************************************************/
+static enum benchSwitch benchSwitch(uint32_t baudRate)
+{
+  uint32_t previous = lineBaud;
+  uint16_t result;
+  double ms;
+
+  pkt.data.cmd_user_message_to_target.data.len = UART_SPEED_MSG_LEN;
+  pkt.data.cmd_user_message_to_target.data.data[0] = UART_SPEED_MSG_SET;
+  pkt.data.cmd_user_message_to_target.data.data[1] = baudRate;
+  pkt.data.cmd_user_message_to_target.data.data[2] = baudRate >> 8;
+  pkt.data.cmd_user_message_to_target.data.data[3] = baudRate >> 16;
+  pkt.data.cmd_user_message_to_target.data.data[4] = baudRate >> 24;
+  benchSend(gecko_cmd_user_message_to_target_id, sizeof(pkt.data.cmd_user_message_to_target) + UART_SPEED_MSG_LEN);
+  if (!benchReceive(gecko_rsp_user_message_to_target_id, BENCH_RESPONSE_MS, NULL, NULL)) {
+    printf("Error!!! No response to the baud rate command at %u baud\n", previous);
+    return BENCH_FAILED;
+  }
+  result = pkt.data.rsp_user_message_to_target.result;
+  if (result == bg_err_invalid_param) {
+    return BENCH_REFUSED;
+  }
+  if (result != 0 || pkt.data.rsp_user_message_to_target.data.len < UART_SPEED_MSG_LEN) {
+    printf("Error!!! The NCP has no baud rate command (error 0x%04x)\n", result);
+    return BENCH_FAILED;
+  }
+  usleep(UART_SPEED_SETTLE_MS * 1000);
+  if (benchSetBaud(baudRate) == 0 && benchHello(UART_SPEED_VERIFY_MS, &ms)) {
+    return BENCH_SWITCHED;
+  }
+  /* The NCP goes back by itself when nothing reaches it at the new rate. */
+  benchSetBaud(previous);
+  usleep(UART_SPEED_REVERT_MS * 1000);
+  tcflush(fd, TCIFLUSH);
+  if (!benchHello(BENCH_RESPONSE_MS, &ms)) {
+    printf("Error!!! The NCP does not answer at %u baud after a failed rate change\n", previous);
+    return BENCH_FAILED;
+  }
+  return BENCH_NO_ANSWER;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Measure the line at its current rate and print one result line.
+ *  \param[in] baudRate Rate of the line.
+ *  \param[in] seconds Time spent discovering.
+ *  \param[in] hellos Round trips timed on the idle line.
+ **************************************************************************************************/
+static void benchRun(uint32_t baudRate, uint32_t seconds, uint32_t hellos)
+{
+  uint32_t bytes = 0;
+  uint32_t frames = 0;
+  uint64_t startNs;
+  uint64_t endNs;
+  uint64_t helloNs;
+  double ms;
+
+  idle.count = 0;
+  loaded.count = 0;
+  for (uint32_t i = 0; i < hellos; i++) {
+    if (benchHello(BENCH_RESPONSE_MS, &ms)) {
+      idle.ms[idle.count++] = ms;
+    }
+  }
+
+  pkt.data.cmd_le_gap_discover.mode = le_gap_discover_observation;
+  benchSend(gecko_cmd_le_gap_discover_id, sizeof(pkt.data.cmd_le_gap_discover));
+  if (!benchReceive(gecko_rsp_le_gap_discover_id, BENCH_RESPONSE_MS, NULL, NULL)
+      || pkt.data.rsp_le_gap_discover.result != 0) {
+    printf("%8u discovery did not start\n", baudRate);
+    return;
+  }
+
+  /* One hello at a time, each queued behind whatever the NCP has to send. */
+  startNs = timeNowNs();
+  endNs = startNs + seconds * NSEC_PER_SEC;
+  while (timeNowNs() < endNs) {
+    helloNs = timeNowNs();
+    benchSend(gecko_cmd_system_hello_id, 0);
+    if (benchReceive(gecko_rsp_system_hello_id, (endNs - helloNs) / NSEC_PER_MSEC + 1, &bytes, &frames)) {
+      /* The response is not part of the load. */
+      bytes -= BGLIB_MSG_HEADER_LEN + sizeof(pkt.data.rsp_system_hello);
+      frames--;
+      if (loaded.count < BENCH_MAX_SAMPLES) {
+        loaded.ms[loaded.count++] = (timeNowNs() - helloNs) / 1e6;
+      }
+    }
+  }
+  endNs = timeNowNs();
+
+  benchSend(gecko_cmd_le_gap_end_procedure_id, 0);
+  benchReceive(gecko_rsp_le_gap_end_procedure_id, BENCH_RESPONSE_MS, NULL, NULL);
+
+  printf("%8u %10u %10.0f %12.0f %6.1f %10.3f %10.3f %10.3f %10.3f\n", baudRate, baudRate / 10,
+         frames / ((endNs - startNs) / 1e9), bytes / ((endNs - startNs) / 1e9),
+         bytes / ((endNs - startNs) / 1e9) * 1000 / baudRate, benchAverage(&idle),
+         benchPercentile(&idle, 0.99), benchAverage(&loaded), benchPercentile(&loaded, 0.99));
+}
+
+/***********************************************************************************************//**
+ *  \brief  Round trip below which the given fraction of the samples fell.
+ *  \param[in] samples Samples; sorted in place.
+ *  \param[in] fraction Fraction, 0 to 1.
+ *  \return  The round trip in milliseconds, 0 without samples.
+ **************************************************************************************************/
+static double benchPercentile(struct benchSamples* samples, double fraction)
+{
+  if (samples->count == 0) {
+    return 0;
+  }
+  qsort(samples->ms, samples->count, sizeof(samples->ms[0]), compareMs);
+  return samples->ms[MIN((uint32_t)(samples->count * fraction), samples->count - 1)];
+}
+
+/***********************************************************************************************//**
+ *  \brief  Mean round trip.
+ *  \param[in] samples Samples.
+ *  \return  The mean in milliseconds, 0 without samples.
+ **************************************************************************************************/
+static double benchAverage(const struct benchSamples* samples)
+{
+  double sum = 0;
+
+  for (uint32_t i = 0; i < samples->count; i++) {
+    sum += samples->ms[i];
+  }
+  return samples->count ? sum / samples->count : 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  qsort() comparison of round trips, shortest first.
+ *  \param[in] a Round trip.
+ *  \param[in] b Round trip.
+ *  \return  Order of a and b.
+ **************************************************************************************************/
+static int compareMs(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/***********************************************************************************************//**
+ *  \brief  qsort() comparison, lowest rate first.
+ *  \param[in] a Rate.
+ *  \param[in] b Rate.
+ *  \return  Order of a and b.
+ **************************************************************************************************/
+static int compareRates(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
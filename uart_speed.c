@@ -0,0 +1,331 @@
+/***********************************************************************************************//**
+ * \file   uart_speed.c
+ * \brief  UART baud rate negotiation with the NCP, from a list of candidate rates
+ **************************************************************************************************/
+
+/* standard library headers */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "infrastructure.h"
+
+#include "bg_types.h"
+#include "gecko_bglib.h"
+
+#include "adapter.h"
+#include "bgapi_cmd.h"
+#include "bgapi_rx.h"
+#include "event_loop.h"
+#include "serial.h"
+#include "timeutil.h"
+
+/* Own header */
+#include "uart_speed.h"
+
+/***************************************************************************************************
+ * Local Macros and Definitions
+ **************************************************************************************************/
+
+/** Steps of a negotiation. */
+enum uartSpeedStage {
+  UART_SPEED_IDLE,
+  UART_SPEED_ASK,               /**< rate requested, waiting for the response, if any */
+  UART_SPEED_SETTLE,            /**< switched, giving the NCP time to switch too */
+  UART_SPEED_VERIFY,            /**< hello sent at the new rate */
+  UART_SPEED_REVERT,            /**< back at the old rate, waiting for the NCP to revert */
+  UART_SPEED_CHECK              /**< hello sent at the old rate */
+};
+
+/** Line of one adapter. */
+static ADAPTER_LOCAL struct {
+  enum uartSpeedStage stage;
+  const struct uartSpeedRates* rates;
+  uartSpeedDoneFn done;
+  uint32_t bootRate;            /**< rate the NCP boots at */
+  uint32_t rate;                /**< rate of the line */
+  uint32_t trying;              /**< rate of the step in progress */
+  uint32_t previous;            /**< rate before it */
+  uint8_t next;                 /**< next candidate to request */
+  uint8_t probed;               /**< candidates tried by uartSpeedProbeNext() */
+  bool lost;                    /**< a step lost the line: no further attempts */
+  int timer;
+  uint64_t stepNs;              /**< hello sent */
+} speed = { .timer = -1 };
+
+/***************************************************************************************************
+ * Static Function Declarations
+ **************************************************************************************************/
+
+static void uartSpeedStep(void);
+static void uartSpeedFinish(bool ok);
+static void uartSpeedSwitch(uint32_t baudRate);
+static void onSetResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+static void onHelloResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx);
+static void onSpeedTimer(int timerId, void* ctx);
+static int compareRates(const void* a, const void* b);
+
+/***************************************************************************************************
+ * Public Function Definitions
+ **************************************************************************************************/
+
+int uartSpeedParse(const char* list, struct uartSpeedRates* rates)
+{
+  const char* p = list;
+  char* end;
+  uint8_t kept = 0;
+
+  memset(rates, 0, sizeof(*rates));
+  while (*p != '\0') {
+    unsigned long rate = strtoul(p, &end, 10);
+
+    if (end == p || (*end != ',' && *end != '\0') || !serialBaudRateSupported(rate)
+        || rates->count == UART_SPEED_MAX_RATES) {
+      return -1;
+    }
+    rates->rates[rates->count++] = rate;
+    p = *end == ',' ? end + 1 : end;
+  }
+  if (rates->count == 0) {
+    return -1;
+  }
+  qsort(rates->rates, rates->count, sizeof(rates->rates[0]), compareRates);
+  for (uint8_t i = 0; i < rates->count; i++) {
+    if (kept == 0 || rates->rates[i] != rates->rates[kept - 1]) {
+      rates->rates[kept++] = rates->rates[i];
+    }
+  }
+  rates->count = kept;
+  return 0;
+}
+
+void uartSpeedInit(uint32_t baudRate)
+{
+  evloopRemoveTimer(speed.timer);
+  memset(&speed, 0, sizeof(speed));
+  speed.timer = -1;
+  speed.bootRate = baudRate;
+  speed.rate = baudRate;
+}
+
+void uartSpeedRaise(const struct uartSpeedRates* rates, uartSpeedDoneFn done)
+{
+  evloopRemoveTimer(speed.timer);
+  speed.timer = -1;
+  speed.rates = rates;
+  speed.done = done;
+  speed.next = 0;
+  if (speed.lost) {
+    uartSpeedFinish(true);
+    return;
+  }
+  uartSpeedStep();
+}
+
+bool uartSpeedProbeNext(const struct uartSpeedRates* rates)
+{
+  while (speed.probed < rates->count) {
+    uint32_t rate = rates->rates[speed.probed++];
+
+    if (rate != speed.bootRate) {
+      uartSpeedSwitch(rate);
+      return true;
+    }
+  }
+  uartSpeedFallback();
+  return false;
+}
+
+void uartSpeedFallback(void)
+{
+  evloopRemoveTimer(speed.timer);
+  speed.timer = -1;
+  speed.stage = UART_SPEED_IDLE;
+  if (speed.rate != speed.bootRate) {
+    uartSpeedSwitch(speed.bootRate);
+  }
+}
+
+uint32_t uartSpeedCurrent(void)
+{
+  return speed.rate;
+}
+
+/***************************************************************************************************
+ * Static Function Definitions
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Request the next candidate above the current rate, or end the negotiation.
+ **************************************************************************************************/
+static void uartSpeedStep(void)
+{
+  uint8_t msg[UART_SPEED_MSG_LEN] = { UART_SPEED_MSG_SET };
+
+  while (speed.next < speed.rates->count) {
+    uint32_t rate = speed.rates->rates[speed.next++];
+
+    if (rate <= speed.rate) {
+      continue;
+    }
+    speed.trying = rate;
+    msg[1] = rate;
+    msg[2] = rate >> 8;
+    msg[3] = rate >> 16;
+    msg[4] = rate >> 24;
+    speed.stage = UART_SPEED_ASK;
+    bgapiCmdUserMessageToTarget(sizeof(msg), msg, onSetResponse, NULL);
+    /* An NCP without a handler for the message may not answer at all. */
+    speed.timer = evloopAddTimer(UART_SPEED_VERIFY_MS, false, onSpeedTimer, NULL);
+    return;
+  }
+  uartSpeedFinish(true);
+}
+
+/***********************************************************************************************//**
+ *  \brief  End the negotiation and call back.
+ *  \param[in] ok false if the line was lost.
+ **************************************************************************************************/
+static void uartSpeedFinish(bool ok)
+{
+  evloopRemoveTimer(speed.timer);
+  speed.timer = -1;
+  speed.stage = UART_SPEED_IDLE;
+  if (ok) {
+    printf("UART --- > %u baud on %s\r\n", speed.rate, adapterCurrent()->port);
+  }
+  speed.done(ok);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Move the host side of the line to another rate.
+ *  \param[in] baudRate New rate, supported by the serial port.
+ **************************************************************************************************/
+static void uartSpeedSwitch(uint32_t baudRate)
+{
+  if (serialSetBaudRate(baudRate) < 0) {
+    printf("Error!!! Could not set %u baud on %s\r\n", baudRate, adapterCurrent()->port);
+  }
+  /* Whatever is buffered arrived at the old rate; a command sent then will not be answered. */
+  bgapiRxDiscard();
+  bgapiCmdReset();
+  speed.rate = baudRate;
+}
+
+/***********************************************************************************************//**
+ *  \brief  Response to the rate request: switch, or move on to the next candidate.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp The response, echoing the request on success.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onSetResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx)
+{
+  const uint8array* echo = &rsp->data.rsp_user_message_to_target.data;
+
+  if (speed.stage != UART_SPEED_ASK) {
+    return;
+  }
+  evloopRemoveTimer(speed.timer);
+  speed.timer = -1;
+  if (result != 0 && result != bg_err_invalid_param) {
+    printf("UART --- > NCP has no baud rate command (error 0x%04x)\r\n", result);
+    uartSpeedFinish(true);
+    return;
+  }
+  if (result != 0 || echo->len < UART_SPEED_MSG_LEN || echo->data[0] != UART_SPEED_MSG_SET) {
+    printf("UART --- > NCP refused %u baud\r\n", speed.trying);
+    uartSpeedStep();
+    return;
+  }
+  speed.previous = speed.rate;
+  uartSpeedSwitch(speed.trying);
+  speed.stage = UART_SPEED_SETTLE;
+  speed.timer = evloopAddTimer(UART_SPEED_SETTLE_MS, false, onSpeedTimer, NULL);
+}
+
+/***********************************************************************************************//**
+ *  \brief  Hello answered: the new rate is confirmed, or the old one still works.
+ *  \param[in] result BGAPI result code.
+ *  \param[in] rsp Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onHelloResponse(uint16_t result, const struct gecko_cmd_packet* rsp, void* ctx)
+{
+  if (speed.stage == UART_SPEED_VERIFY) {
+    printf("UART --- > %u baud confirmed, hello round trip %.2f ms\r\n", speed.rate,
+           (timeNowNs() - speed.stepNs) / 1e6);
+    /* The candidates are tried from the highest: this is the best the NCP can do. */
+    uartSpeedFinish(true);
+  } else if (speed.stage == UART_SPEED_CHECK) {
+    evloopRemoveTimer(speed.timer);
+    speed.timer = -1;
+    uartSpeedStep();
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  A step ran out of time.
+ *  \param[in] timerId Unused.
+ *  \param[in] ctx Unused.
+ **************************************************************************************************/
+static void onSpeedTimer(int timerId, void* ctx)
+{
+  speed.timer = -1;
+  switch (speed.stage) {
+    case UART_SPEED_ASK:
+      printf("UART --- > NCP did not answer the baud rate request, staying at %u baud\r\n", speed.rate);
+      /* Drop the request, or the commands queued behind it would wait for it forever. */
+      bgapiCmdReset();
+      uartSpeedFinish(true);
+      break;
+    case UART_SPEED_SETTLE:
+      speed.stage = UART_SPEED_VERIFY;
+      speed.stepNs = timeNowNs();
+      bgapiCmdSystemHello(onHelloResponse, NULL);
+      speed.timer = evloopAddTimer(UART_SPEED_VERIFY_MS, false, onSpeedTimer, NULL);
+      break;
+    case UART_SPEED_VERIFY:
+      printf("UART --- > no answer at %u baud, back to the previous rate\r\n", speed.rate);
+      uartSpeedSwitch(speed.previous);
+      speed.stage = UART_SPEED_REVERT;
+      speed.timer = evloopAddTimer(UART_SPEED_REVERT_MS, false, onSpeedTimer, NULL);
+      break;
+    case UART_SPEED_REVERT:
+      speed.stage = UART_SPEED_CHECK;
+      bgapiCmdSystemHello(onHelloResponse, NULL);
+      speed.timer = evloopAddTimer(UART_SPEED_VERIFY_MS, false, onSpeedTimer, NULL);
+      break;
+    case UART_SPEED_CHECK:
+      printf("Error!!! NCP on %s does not answer at %u baud after a failed rate change, resetting it.\r\n",
+             adapterCurrent()->port, speed.rate);
+      /* The NCP may have taken the hello at the new rate and kept it: reset it at both rates,
+       * the old one first, so that a reset it understands is never followed by another one. */
+      adapterBglibLock();
+      gecko_cmd_system_reset(0);
+      serialSetBaudRate(speed.trying);
+      gecko_cmd_system_reset(0);
+      adapterBglibUnlock();
+      uartSpeedSwitch(speed.bootRate);
+      speed.lost = true;
+      uartSpeedFinish(false);
+      break;
+    default:
+      break;
+  }
+}
+
+/***********************************************************************************************//**
+ *  \brief  qsort() comparison, highest rate first.
+ *  \param[in] a Rate.
+ *  \param[in] b Rate.
+ *  \return  Order of a and b.
+ **************************************************************************************************/
+static int compareRates(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+
+  return x < y ? 1 : x > y ? -1 : 0;
+}
@@ -0,0 +1,122 @@
+/***********************************************************************************************//**
+ * \file   uart_speed.h
+ * \brief  UART baud rate negotiation with the NCP, from a list of candidate rates
+ ***************************************************************************************************
+ * BGAPI has no command to change the UART rate, so the NCP image has to handle one as a user
+ * message (user_message_to_target): UART_SPEED_MSG_SET followed by the rate, little-endian. An
+ * NCP that can run at the rate echoes the message in its response, sent at the old rate, and
+ * then switches. It goes back to the old rate by itself unless a command reaches it at the new
+ * one within UART_SPEED_REVERT_MS. An NCP that cannot run at the rate answers
+ * bg_err_invalid_param; any other error means it has no such command.
+ *
+ * After booting, or on reuse, the host tries the candidates from the highest down, skipping
+ * those not above the current rate. Each step is confirmed by a hello round trip at the new
+ * rate. If that fails, the host goes back to the old rate, waits for the NCP to revert, and
+ * checks that hello works there before it tries the next candidate. If it does not, the NCP may
+ * have kept the new rate with only its answers lost: the host resets it at both rates and gives
+ * up raising the rate. The NCP then boots at the rate given on the command line.
+ *
+ * The NCP keeps a raised rate when the host exits. A host that gets no answer at the boot rate
+ * tries hello at each candidate before resetting the NCP.
+ **************************************************************************************************/
+
+#ifndef UART_SPEED_H
+#define UART_SPEED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/***************************************************************************************************
+ * Type Definitions
+ **************************************************************************************************/
+
+/** User message setting the rate: this byte, then the rate as a little-endian uint32. */
+#define UART_SPEED_MSG_SET            0xb0
+#define UART_SPEED_MSG_LEN            5
+
+/** Time the NCP waits for a command at a new rate before it goes back to the old one. */
+#define UART_SPEED_REVERT_MS          500
+
+/** Time allowed, after the response, for the NCP to switch before the host talks at the new rate. */
+#define UART_SPEED_SETTLE_MS          5
+
+/** Time allowed for a hello round trip when checking a rate, and for the answer to a rate request. */
+#define UART_SPEED_VERIFY_MS          100
+
+/** Longest a candidate can take: request, settle, verify, revert and check. */
+#define UART_SPEED_STEP_MAX_MS \
+  (3 * UART_SPEED_VERIFY_MS + UART_SPEED_SETTLE_MS + UART_SPEED_REVERT_MS)
+
+/** Candidate rates at most. */
+#define UART_SPEED_MAX_RATES          8
+
+/** Candidate rates, highest first. */
+struct uartSpeedRates {
+  uint32_t rates[UART_SPEED_MAX_RATES];
+  uint8_t count;
+};
+
+/***********************************************************************************************//**
+ *  \brief  Called when a negotiation ends.
+ *  \param[in] ok false if the line was lost: the NCP was reset and boots at the boot rate.
+ **************************************************************************************************/
+typedef void (*uartSpeedDoneFn)(bool ok);
+
+/***************************************************************************************************
+ * Function Declarations
+ **************************************************************************************************/
+
+/***********************************************************************************************//**
+ *  \brief  Parse a comma-separated list of baud rates the serial port supports.
+ *  \param[in] list The list, e.g. "921600,460800,230400", in any order.
+ *  \param[out] rates Candidates, sorted highest first, without duplicates.
+ *  \return  0 on success, -1 on an empty or too long list or an unsupported rate.
+ **************************************************************************************************/
+int uartSpeedParse(const char* list, struct uartSpeedRates* rates);
+
+/***********************************************************************************************//**
+ *  \brief  Forget the state of the calling adapter: its line runs at the rate the port was
+ *          opened with, which is the rate the NCP boots at.
+ *  \param[in] baudRate Boot rate.
+ **************************************************************************************************/
+void uartSpeedInit(uint32_t baudRate);
+
+/***********************************************************************************************//**
+ *  \brief  Raise the rate of the calling adapter's line to the highest candidate the NCP
+ *          confirms. Nothing else may be queued to the NCP until the callback runs. Does
+ *          nothing, and calls back at once, after a step lost the line.
+ *  \param[in] rates Candidates; must stay valid until the callback.
+ *  \param[in] done Called when the negotiation ends.
+ **************************************************************************************************/
+void uartSpeedRaise(const struct uartSpeedRates* rates, uartSpeedDoneFn done);
+
+/***********************************************************************************************//**
+ *  \brief  Move the host side of the line to the next candidate not yet probed, to look for an
+ *          NCP that an earlier run left at a raised rate. Once all were tried, return to the
+ *          boot rate.
+ *  \param[in] rates Candidates.
+ *  \return  true if the line is now at another candidate, false when back at the boot rate.
+ **************************************************************************************************/
+bool uartSpeedProbeNext(const struct uartSpeedRates* rates);
+
+/***********************************************************************************************//**
+ *  \brief  Move the host side of the line back to the boot rate, when the NCP was reset. A
+ *          negotiation in progress ends without calling back.
+ **************************************************************************************************/
+void uartSpeedFallback(void);
+
+/***********************************************************************************************//**
+ *  \brief  Current rate of the calling adapter's line.
+ *  \return  Baud rate.
+ **************************************************************************************************/
+uint32_t uartSpeedCurrent(void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* UART_SPEED_H */